@@ -7,8 +7,7 @@
  */
 
 
-#include <Arduino.h>
-#include <Esp.h>
+#include <stdio.h>
 #include <string.h>
 #include "DebugHelper.h"
 
@@ -16,27 +15,34 @@
 void SerialPrint(OutputType type, const char * text)
 {
     if(type >= outputLevel)                                                                     // Only print if OutputType is more specific than OutputLevel
-        Serial.print(text);
+        DexcomPlatform::log(text);
 }
 void SerialPrint(OutputType type, uint8_t value, int mode)
 {
     if(type >= outputLevel)
-        Serial.print(value, mode);
+    {
+        char number[4];
+        snprintf(number, sizeof(number), mode == HEX ? "%X" : "%u", value);
+        DexcomPlatform::log(number);
+    }
 }
 
 void SerialPrintln(OutputType type)
 {
     if(type >= outputLevel)
-        Serial.println();
+        DexcomPlatform::log("\r\n");
     else
-        delay(10);
+        DexcomPlatform::delay(10);
 }
 void SerialPrintln(OutputType type, const char * text)
 {
     if(type >= outputLevel)
-        Serial.println(text);
+    {
+        DexcomPlatform::log(text);
+        DexcomPlatform::log("\r\n");
+    }
     else
-        delay(10);
+        DexcomPlatform::delay(10);
 }
 
 void printHexArray(uint8_t *data, size_t length)
@@ -49,6 +55,7 @@ void printHexArray(uint8_t *data, size_t length)
     SerialPrintln(DEBUG);
 }
 
+#ifdef ARDUINO
 void printHexString(String value)
 {
     for (int i = 0; i < value.length(); i++)
@@ -67,4 +74,5 @@ String uint8ToString(uint8_t *data, size_t length)
         value += (char)data[i];
     }
     return value;
-}
\ No newline at end of file
+}
+#endif
@@ -8,14 +8,25 @@
  */
 
 
-#include <Arduino.h>
-#include <Esp.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include "DexcomPlatform.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
 
 
 #ifndef DEBUGHELPER_H
 #define DEBUGHELPER_H
 
+#ifndef HEX                                                                                                             // Print modes of the Arduino core, also used off target.
+#define DEC 10
+#define HEX 16
+#endif
+
+#define SERIAL_PRINTF_MAX 256                                                                                           // Longer lines are truncated.
+
 typedef enum 
 { 
     DEBUG   = 0,                    // Tag for normal (debug) output (bytes send / recv, notify, callbacks).
@@ -41,9 +52,13 @@ template<typename... Args>
 void SerialPrintf(int type, const char * f, Args... args)                                    // Use C++11 variadic templates
 {
     if(type >= outputLevel)
-        Serial.printf(f, args...);
+    {
+        char line[SERIAL_PRINTF_MAX];
+        snprintf(line, sizeof(line), f, args...);
+        DexcomPlatform::log(line);
+    }
     else
-        delay(10);                                                                                                      // Use a delay as compensation for serial.print()
+        DexcomPlatform::delay(10);                                                                                      // Use a delay as compensation for serial.print()
 }
 
 /** 
@@ -55,21 +70,22 @@ void SerialPrint(OutputType type, uint8_t value, int mode);
 void SerialPrintln(OutputType type);
 void SerialPrintln(OutputType type, const char * text);
 
-/**
- * Prints a sting as hex values.
- */
-void printHexString(String value);
-
 /**
  * Prints an uint8_t array as hex values.
  */
 void printHexArray(uint8_t *data, size_t length);
 
+#ifdef ARDUINO
+/**
+ * Prints a sting as hex values.
+ */
+void printHexString(String value);
 
 /**
  * Converts an uint8_t array to string.
  */
 String uint8ToString(uint8_t *data, size_t length);
+#endif
 
 
 #endif /* DEBUGHELPER_H */
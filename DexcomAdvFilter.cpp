@@ -0,0 +1,48 @@
+/*
+ * DexcomAdvFilter
+ */
+
+
+#include <string.h>
+#include "DexcomAdvFilter.h"
+
+
+/**
+ * One pass over the length / type / value structures, a malformed length ends the walk.
+ * Most advertisers fail on the first UUID list or name, so the loop rarely runs to the end.
+ */
+bool DexcomAdvFilter::match(const uint8_t* data, size_t length, const DexcomTransmitterId &id)
+{
+    if (!id.isSet())
+        return false;
+    bool service = false, name = false;
+    size_t position = 0;
+    while (position + 1 < length)
+    {
+        uint8_t fieldLength = data[position];
+        if (fieldLength == 0 || position + 1 + fieldLength > length)
+            break;
+        uint8_t type = data[position + 1];
+        const uint8_t* value = &data[position + 2];
+        size_t valueLength = fieldLength - 1;
+
+        if (type == ADV_TYPE_UUID16_MORE || type == ADV_TYPE_UUID16_ALL)
+        {
+            for (size_t i = 0; i + 1 < valueLength && !service; i += 2)
+                service = (value[i] | (value[i + 1] << 8)) == ADV_SERVICE_UUID;
+            if (!service)
+                return false;                                                                                           // Only one list per advertisement.
+        }
+        else if (type == ADV_TYPE_NAME_SHORT || type == ADV_TYPE_NAME_FULL)
+        {
+            name = (valueLength == TRANSMITTER_ID_LENGTH && memcmp(value, id.id, TRANSMITTER_ID_LENGTH) == 0) ||
+                   (valueLength == id.advertisedNameLength && memcmp(value, id.advertisedName, valueLength) == 0);
+            if (!name)
+                return false;
+        }
+        if (service && name)
+            return true;
+        position += 1 + fieldLength;
+    }
+    return false;
+}
@@ -0,0 +1,29 @@
+/**
+ * Header File with the raw advertisement prefilter
+ * Checks the AD structures of one advertisement (and scan response) for the Dexcom 0xFEBC service UUID
+ * and one of the names of the configured transmitter, before any BLE objects are built for it.
+ * Portable, the GAP handler calls it on the board and the bench replays captured streams through it on the host.
+ */
+
+#ifndef DEXCOMADVFILTER_H
+#define DEXCOMADVFILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DexcomTransmitterId.h"
+
+#define ADV_SERVICE_UUID        0xfebc                                                                                  // Advertised by the transmitter, not the main service.
+
+// AD types, Bluetooth Core Supplement part A.
+#define ADV_TYPE_UUID16_MORE    0x02
+#define ADV_TYPE_UUID16_ALL     0x03
+#define ADV_TYPE_NAME_SHORT     0x08
+#define ADV_TYPE_NAME_FULL      0x09
+
+class DexcomAdvFilter
+{
+    public:
+        static bool match(const uint8_t* data, size_t length, const DexcomTransmitterId &id);                          // True when the service UUID and a transmitter name are both present.
+};
+
+#endif /* DEXCOMADVFILTER_H */
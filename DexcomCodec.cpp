@@ -0,0 +1,202 @@
+/*
+ * DexcomCodec
+ */
+
+
+#include <string.h>
+#include "DexcomCodec.h"
+
+
+/**
+ * Only clears bits, the ones are already there from the 0xff fill.
+ */
+bool DexcomBitWriter::put(uint32_t value, int bits)
+{
+    if (position + bits > capacity)
+        return false;
+    for (int i = bits - 1; i >= 0; i--, position++)
+    {
+        if (((value >> i) & 1) == 0)
+            data[position / 8] &= ~(0x80 >> (position % 8));
+    }
+    return true;
+}
+
+bool DexcomBitWriter::putVarint(uint32_t value)
+{
+    do
+    {
+        uint32_t group = value & 0x7;
+        value >>= 3;
+        if (!put((group << 1) | (value != 0 ? 1 : 0), 4))
+            return false;
+    } while (value != 0);
+    return true;
+}
+
+bool DexcomBitReader::get(uint32_t* value, int bits)
+{
+    if (position + bits > capacity)
+        return false;
+    uint32_t result = 0;
+    for (int i = 0; i < bits; i++, position++)
+        result = (result << 1) | ((data[position / 8] >> (7 - position % 8)) & 1);
+    *value = result;
+    return true;
+}
+
+bool DexcomBitReader::getVarint(uint32_t* value)
+{
+    uint32_t result = 0, group;
+    for (int shift = 0; shift < 33; shift += 3)
+    {
+        if (!get(&group, 4))
+            return false;
+        result |= (group >> 1) << shift;
+        if ((group & 1) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;                                                                                                       // All continue bits, an erased tail.
+}
+
+
+void DexcomCodec::begin(DexcomCodecState* state, const DexcomReading &first)
+{
+    state->dextime = first.dextime;
+    state->step = 5*60;                                                                                                 // The transmitter reads every 5 minutes.
+    state->glucose = first.glucose;
+    state->trend = first.trend;
+    state->status = first.status;
+}
+
+bool DexcomCodec::fits(const DexcomCodecState &state, const DexcomReading &reading)
+{
+    int64_t step = (int64_t)reading.dextime - state.dextime;
+    int64_t delta = step - state.step;
+    return step > 0 && delta > INT32_MIN && delta < INT32_MAX && zigzag((int32_t)delta) != CODEC_END_MARKER;
+}
+
+static size_t varintBits(uint32_t value)
+{
+    size_t bits = 4;
+    while (value >>= 3)
+        bits += 4;
+    return bits;
+}
+
+size_t DexcomCodec::entryBits(const DexcomCodecState &state, const DexcomReading &reading)
+{
+    uint32_t delta = zigzag((int32_t)(reading.dextime - state.dextime) - state.step);
+    size_t bits = delta == 0 ? 1 : delta < (1u << 7) ? 9 : delta < (1u << 12) ? 15 : 35;
+    bits += varintBits(zigzag((int32_t)reading.glucose - state.glucose));
+    bits += varintBits(zigzag((int32_t)reading.trend - state.trend));
+    return bits + (reading.status == state.status ? 1 : 9);
+}
+
+/**
+ * Nothing is written when the reading does not fit, so a full block never ends in a partial entry.
+ */
+bool DexcomCodec::encode(DexcomBitWriter &writer, DexcomCodecState* state, const DexcomReading &reading)
+{
+    if (!fits(*state, reading) || entryBits(*state, reading) > writer.remaining())
+        return false;
+    int32_t step = (int32_t)(reading.dextime - state->dextime);
+    uint32_t delta = zigzag(step - state->step);
+    bool written;
+    if (delta == 0) written = writer.put(0x0, 1);
+    else if (delta < (1u << 7)) written = writer.put(0x2, 2) && writer.put(delta, 7);
+    else if (delta < (1u << 12)) written = writer.put(0x6, 3) && writer.put(delta, 12);
+    else written = writer.put(0x7, 3) && writer.put(delta, 32);
+
+    written = written && writer.putVarint(zigzag((int32_t)reading.glucose - state->glucose));
+    written = written && writer.putVarint(zigzag((int32_t)reading.trend - state->trend));
+    if (reading.status == state->status) written = written && writer.put(0x1, 1);
+    else written = written && writer.put(0x0, 1) && writer.put(reading.status, 8);
+    if (!written)
+        return false;
+
+    state->dextime = reading.dextime;
+    state->step = step;
+    state->glucose = reading.glucose;
+    state->trend = reading.trend;
+    state->status = reading.status;
+    return true;
+}
+
+bool DexcomCodec::decode(DexcomBitReader &reader, DexcomCodecState* state, DexcomReading* reading)
+{
+    uint32_t bit, delta = 0, value;
+    if (!reader.get(&bit, 1))
+        return false;
+    if (bit == 1)
+    {
+        if (!reader.get(&bit, 1)) return false;
+        if (bit == 0) { if (!reader.get(&delta, 7)) return false; }
+        else
+        {
+            if (!reader.get(&bit, 1)) return false;
+            if (bit == 0) { if (!reader.get(&delta, 12)) return false; }
+            else if (!reader.get(&delta, 32) || delta == CODEC_END_MARKER) return false;
+        }
+    }
+    int32_t step = state->step + unzigzag(delta);
+
+    if (!reader.getVarint(&value)) return false;
+    uint16_t glucose = (uint16_t)(state->glucose + unzigzag(value));
+    if (!reader.getVarint(&value)) return false;
+    int8_t trend = (int8_t)(state->trend + unzigzag(value));
+    uint32_t status = state->status;
+    if (!reader.get(&bit, 1)) return false;
+    if (bit == 0 && !reader.get(&status, 8)) return false;
+
+    state->dextime += step;
+    state->step = step;
+    state->glucose = glucose;
+    state->trend = trend;
+    state->status = (uint8_t)status;
+    reading->dextime = state->dextime;
+    reading->glucose = glucose;
+    reading->trend = trend;
+    reading->status = (uint8_t)status;
+    return true;
+}
+
+/**
+ * Block layout: first reading raw, then the bit stream. Stops early when the next reading needs a new block,
+ * encoded is set to the readings that made it into the block.
+ */
+size_t DexcomCodec::encodeBlock(const DexcomReading* readings, size_t count, uint8_t* block, size_t size, size_t* encoded)
+{
+    *encoded = 0;
+    if (count == 0 || size < sizeof(DexcomReading))
+        return 0;
+    memset(block, 0xff, size);
+    memcpy(block, &readings[0], sizeof(DexcomReading));
+    DexcomCodecState state;
+    begin(&state, readings[0]);
+    DexcomBitWriter writer(block + sizeof(DexcomReading), size - sizeof(DexcomReading));
+    size_t i = 1;
+    while (i < count && encode(writer, &state, readings[i]))
+        i++;
+    *encoded = i;
+    return sizeof(DexcomReading) + (writer.position + 7) / 8;
+}
+
+size_t DexcomCodec::decodeBlock(const uint8_t* block, size_t size, DexcomReading* readings, size_t max)
+{
+    if (max == 0 || size < sizeof(DexcomReading))
+        return 0;
+    memcpy(&readings[0], block, sizeof(DexcomReading));
+    if (readings[0].dextime == CODEC_END_MARKER)
+        return 0;
+    DexcomCodecState state;
+    begin(&state, readings[0]);
+    DexcomBitReader reader(block + sizeof(DexcomReading), size - sizeof(DexcomReading));
+    size_t count = 1;
+    while (count < max && decode(reader, &state, &readings[count]))
+        count++;
+    return count;
+}
@@ -0,0 +1,83 @@
+/**
+ * Header File with the block codec for 5 minute CGM readings
+ * A block starts with one raw reading, every further reading is a bit stream entry:
+ *   time     delta of delta: '0' same step, '10' + 7 bit, '110' + 12 bit, '111' + 32 bit (zigzag)
+ *   glucose  zigzag delta as a varint of 3 bit groups, each followed by a continue bit
+ *   trend    zigzag delta as the same varint
+ *   status   '1' unchanged, '0' + 8 bit
+ * Bits are written MSB first into bytes that start as 0xff, so a stream can be appended in place on erased NOR flash.
+ * An erased tail reads as the '111' escape with all ones, which marks the end of the block.
+ */
+
+#ifndef DEXCOMCODEC_H
+#define DEXCOMCODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CODEC_MAX_ENTRY_BITS    80                                                                                      // Upper bound of one encoded reading.
+#define CODEC_END_MARKER        0xffffffff
+
+typedef struct
+{
+    uint32_t dextime;               // Transmitter time of the reading, seconds since activation.
+    uint16_t glucose;
+    int8_t trend;
+    uint8_t status;                 // Session state byte of the reading, 0x06 is ok.
+} DexcomReading;
+
+typedef struct
+{
+    uint32_t dextime;
+    int32_t step;                   // Last time delta.
+    uint16_t glucose;
+    int8_t trend;
+    uint8_t status;
+} DexcomCodecState;
+
+class DexcomBitWriter
+{
+    uint8_t* data;
+    size_t capacity;                // In bits.
+
+    public:
+        size_t position;            // In bits.
+
+        DexcomBitWriter(uint8_t* data, size_t bytes, size_t position = 0) : data(data), capacity(bytes * 8), position(position) {}
+        bool put(uint32_t value, int bits);
+        bool putVarint(uint32_t value);
+        size_t remaining() { return capacity - position; }
+};
+
+class DexcomBitReader
+{
+    const uint8_t* data;
+    size_t capacity;
+
+    public:
+        size_t position;
+
+        DexcomBitReader(const uint8_t* data, size_t bytes, size_t position = 0) : data(data), capacity(bytes * 8), position(position) {}
+        bool get(uint32_t* value, int bits);
+        bool getVarint(uint32_t* value);
+        size_t remaining() { return capacity - position; }
+};
+
+class DexcomCodec
+{
+    public:
+        static void begin(DexcomCodecState* state, const DexcomReading &first);
+        static bool fits(const DexcomCodecState &state, const DexcomReading &reading);                                  // False when the reading needs a new block (time going backwards).
+        static bool encode(DexcomBitWriter &writer, DexcomCodecState* state, const DexcomReading &reading);
+        static bool decode(DexcomBitReader &reader, DexcomCodecState* state, DexcomReading* reading);                   // False at the end of the block.
+
+        static size_t encodeBlock(const DexcomReading* readings, size_t count, uint8_t* block, size_t size, size_t* encoded);   // Whole block in memory, returns the bytes used.
+        static size_t decodeBlock(const uint8_t* block, size_t size, DexcomReading* readings, size_t max);               // Returns the readings decoded.
+
+        static size_t entryBits(const DexcomCodecState &state, const DexcomReading &reading);
+
+        static inline uint32_t zigzag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+        static inline int32_t unzigzag(uint32_t value) { return (int32_t)(value >> 1) ^ -(int32_t)(value & 1); }
+};
+
+#endif /* DEXCOMCODEC_H */
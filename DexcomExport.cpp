@@ -0,0 +1,139 @@
+/*
+ * DexcomExport
+ */
+
+
+#include <string.h>
+#include "DexcomExport.h"
+#include "DexcomPlatform.h"
+
+
+DexcomExportWriter DexcomExport::writer = NULL;
+bool DexcomExport::exporting = false;
+bool DexcomExport::live = false;
+uint32_t DexcomExport::sent = 0;
+DexcomHistoryCursor DexcomExport::cursor;
+DexcomReading DexcomExport::pending[EXPORT_BLOCK_READINGS];
+size_t DexcomExport::pendingCount = 0;
+
+void DexcomExport::setup(DexcomExportWriter output) { writer = output; }
+void DexcomExport::setLive(bool enabled) { live = enabled; }
+
+/**
+ * Begin streaming every reading newer than sinceDextime, 0 exports the whole history.
+ */
+void DexcomExport::start(uint32_t sinceDextime)
+{
+    uint8_t begin[8];
+    uint32_t stored = DexcomHistory::count();
+    memcpy(&begin[0], &sinceDextime, 4);
+    memcpy(&begin[4], &stored, 4);
+    send(EXPORT_FRAME_BEGIN, begin, sizeof(begin));
+    sent = 0;
+    pendingCount = 0;
+    exporting = DexcomHistory::seek(&cursor, sinceDextime);
+    if (!exporting)
+        send(EXPORT_FRAME_END, (const uint8_t*)&sent, 4);
+}
+
+/**
+ * The readings are encoded again into blocks that fit one frame, a frame decodes without the ones before it.
+ */
+bool DexcomExport::service()
+{
+    if (!exporting)
+        return false;
+    uint8_t block[EXPORT_MAX_PAYLOAD];
+    for (int frame = 0; frame < EXPORT_FRAMES_PER_CALL; frame++)
+    {
+        while (pendingCount < EXPORT_BLOCK_READINGS && DexcomHistory::next(&cursor, &pending[pendingCount]))
+            pendingCount++;
+        if (pendingCount == 0)
+        {
+            send(EXPORT_FRAME_END, (const uint8_t*)&sent, 4);
+            exporting = false;
+            return false;
+        }
+        size_t encoded;
+        size_t length = DexcomCodec::encodeBlock(pending, pendingCount, block, sizeof(block), &encoded);
+        send(EXPORT_FRAME_BLOCK, block, length);
+        sent += encoded;
+        pendingCount -= encoded;
+        memmove(pending, &pending[encoded], pendingCount * sizeof(DexcomReading));
+    }
+    return true;
+}
+
+void DexcomExport::pushLive(const DexcomReading &reading)
+{
+    if (live)
+        send(EXPORT_FRAME_LIVE, (const uint8_t*)&reading, sizeof(reading));
+}
+
+size_t DexcomExport::encode(uint8_t* frame, uint8_t type, const uint8_t* payload, uint16_t length)
+{
+    frame[0] = EXPORT_SYNC_1;
+    frame[1] = EXPORT_SYNC_2;
+    frame[2] = type;
+    memcpy(&frame[3], &length, 2);
+    memcpy(&frame[5], payload, length);
+    uint16_t crc = DexcomPlatform::crc16Xmodem(&frame[2], length + 3);
+    memcpy(&frame[5 + length], &crc, 2);
+    return length + 7;
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * One writer call per frame, so text from other tasks can only land between frames.
+ */
+void DexcomExport::send(uint8_t type, const uint8_t* payload, uint16_t length)
+{
+    uint8_t frame[EXPORT_MAX_FRAME];
+    if (writer == NULL || length > EXPORT_MAX_PAYLOAD)
+        return;
+    writer(frame, encode(frame, type, payload, length));
+}
+
+
+/**
+ * Collects bytes from the sync pattern on, a bad CRC drops the frame and the search restarts.
+ */
+bool DexcomFrameParser::push(uint8_t byte)
+{
+    if (fill == 0 && byte != EXPORT_SYNC_1) return false;
+    if (fill == 1 && byte != EXPORT_SYNC_2)
+    {
+        fill = byte == EXPORT_SYNC_1 ? 1 : 0;
+        return false;
+    }
+    frame[fill++] = byte;
+    if (fill < 5)
+        return false;
+
+    uint16_t frameLength;
+    memcpy(&frameLength, &frame[3], 2);
+    if (frameLength > EXPORT_MAX_PAYLOAD)
+    {
+        fill = 0;
+        return false;
+    }
+    if (fill < (size_t)frameLength + 7)
+        return false;
+
+    uint16_t crc;
+    memcpy(&crc, &frame[5 + frameLength], 2);
+    fill = 0;
+    if (crc != DexcomPlatform::crc16Xmodem(&frame[2], frameLength + 3))
+        return false;
+    type = frame[2];
+    length = frameLength;
+    payload = &frame[5];
+    return true;
+}
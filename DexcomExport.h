@@ -0,0 +1,67 @@
+/**
+ * Header File with the framed binary export of the glucose history
+ * Frames share the serial port with the debug text, the sync bytes and the CRC let the reader skip the text.
+ * Each frame is: 0xa5 0x5a, type (1 byte), payload length (2 bytes), payload, CRC-16/XMODEM of type, length and payload.
+ * All numbers are little endian, readings are DexcomReading (8 bytes), history blocks are DexcomCodec blocks.
+ */
+
+#ifndef DEXCOMEXPORT_H
+#define DEXCOMEXPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DexcomHistory.h"
+
+#define EXPORT_SYNC_1           0xa5
+#define EXPORT_SYNC_2           0x5a
+#define EXPORT_FRAME_BEGIN      1                                                                                       // Payload: since dextime (4), readings stored (4).
+#define EXPORT_FRAME_BLOCK      2                                                                                       // Payload: one DexcomCodec block, decodes on its own.
+#define EXPORT_FRAME_END        3                                                                                       // Payload: readings sent (4).
+#define EXPORT_FRAME_LIVE       4                                                                                       // Payload: one new reading.
+#define EXPORT_BLOCK_READINGS   128                                                                                     // Readings collected for one block, about the most 256 bytes hold.
+#define EXPORT_MAX_PAYLOAD      256
+#define EXPORT_MAX_FRAME        (EXPORT_MAX_PAYLOAD + 7)
+#define EXPORT_FRAMES_PER_CALL  16                                                                                      // Frames sent per service() call.
+
+typedef size_t (*DexcomExportWriter)(const uint8_t* data, size_t length);
+
+/**
+ * Incremental frame reader, feed it bytes as they arrive.
+ */
+class DexcomFrameParser
+{
+    uint8_t frame[EXPORT_MAX_FRAME];
+    size_t fill;
+
+    public:
+        uint8_t type;
+        uint16_t length;
+        const uint8_t* payload;
+
+        DexcomFrameParser() : fill(0), type(0), length(0), payload(NULL) {}
+        bool push(uint8_t byte);                                                                                        // True when a complete, valid frame is available.
+};
+
+class DexcomExport
+{
+    static DexcomExportWriter writer;
+    static bool exporting;
+    static bool live;
+    static uint32_t sent;
+    static DexcomHistoryCursor cursor;
+    static DexcomReading pending[EXPORT_BLOCK_READINGS];                                                               // Read from the history, not yet in a block.
+    static size_t pendingCount;
+
+    public:
+        static void setup(DexcomExportWriter output);
+        static void start(uint32_t sinceDextime);
+        static bool service();                                                                                          // Sends the next frames of a running export, true while it is not finished.
+        static void setLive(bool enabled);
+        static void pushLive(const DexcomReading &reading);
+        static size_t encode(uint8_t* frame, uint8_t type, const uint8_t* payload, uint16_t length);
+
+    private:
+        static void send(uint8_t type, const uint8_t* payload, uint16_t length);
+};
+
+#endif /* DEXCOMEXPORT_H */
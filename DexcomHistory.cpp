@@ -0,0 +1,317 @@
+/*
+ * DexcomHistory
+ */
+
+
+#include <string.h>
+#include "DexcomHistory.h"
+#include "DebugHelper.h"
+
+
+uint32_t DexcomHistory::sectors = 0;
+uint32_t DexcomHistory::headSector = 0;
+uint32_t DexcomHistory::headSequence = 0;
+uint32_t DexcomHistory::headEpoch = 0;
+uint32_t DexcomHistory::headCount = 0;
+size_t DexcomHistory::headBit = 0;
+DexcomCodecState DexcomHistory::headState;
+uint32_t DexcomHistory::records = 0;
+DexcomReading DexcomHistory::newest = { HISTORY_EMPTY, 0, 0, 0 };
+const uint8_t* DexcomHistory::map = NULL;
+uint32_t DexcomHistory::generation = 0;
+
+/**
+ * Find the head sector (highest sequence) and decode its block to the end to continue appending.
+ * Closed sectors carry their reading count in the header, only the head block is decoded.
+ */
+bool DexcomHistory::setup()
+{
+    sectors = DexcomPlatform::historySize() / HISTORY_SECTOR_SIZE;
+    records = 0;
+    headCount = 0;
+    newest.dextime = HISTORY_EMPTY;
+    if (sectors < 2)
+    {
+        sectors = 0;
+        SerialPrintln(ERROR, "No history partition, readings are not stored.");
+        return false;
+    }
+    map = DexcomPlatform::historyMap();
+    generation++;
+
+    bool found = false;
+    for (uint32_t sector = 0; sector < sectors; sector++)
+    {
+        DexcomHistorySector header;
+        if (!readHeader(sector, &header))
+            continue;
+        if (!found || header.sequence > headSequence)
+        {
+            headSector = sector;
+            headSequence = header.sequence;
+            headEpoch = header.epoch;
+        }
+        found = true;
+    }
+    if (!found)
+    {
+        headSequence = 0;                                                                                               // The first append starts sector 0 with sequence 1.
+        headSector = sectors - 1;
+        headEpoch = 0;
+        return true;
+    }
+
+    for (uint32_t sector = 0; sector < sectors; sector++)
+    {
+        DexcomHistorySector header;
+        if (sector != headSector && readHeader(sector, &header))
+            records += sectorCount(sector, header);
+    }
+
+    DexcomHistoryCursor cursor;
+    DexcomReading reading;
+    enter(&cursor, headSector, headSequence);
+    while (next(&cursor, &reading) && cursor.sequence == headSequence)
+        newest = reading;
+    headCount = cursor.index;
+    headBit = cursor.bit;
+    headState = cursor.state;
+    records += headCount;
+    SerialPrintf(DEBUG, "History: %d readings, head sector %d holds %d\n\r", records, headSector, headCount);
+    return true;
+}
+
+/**
+ * Store a reading, repeats of the newest reading are dropped.
+ * A dextime far below the newest one is a new transmitter and starts a new block.
+ */
+bool DexcomHistory::append(const DexcomReading &reading)
+{
+    if (sectors == 0 || reading.dextime == HISTORY_EMPTY)
+        return false;
+    if (newest.dextime != HISTORY_EMPTY && reading.dextime <= newest.dextime && newest.dextime - reading.dextime < 24*60*60)
+        return false;
+    bool restarted = newest.dextime == HISTORY_EMPTY || reading.dextime <= newest.dextime;                              // First reading, or a new transmitter.
+
+    if (headCount > 0 && DexcomCodec::fits(headState, reading) &&
+        headBit + DexcomCodec::entryBits(headState, reading) <= HISTORY_STREAM_BITS)
+    {
+        size_t byte = headBit / 8;                                                                                      // Rewrite the partly used byte, its written bits stay cleared.
+        size_t offset = sectorOffset(headSector) + HISTORY_BLOCK_OFFSET + sizeof(DexcomReading) + byte;
+        uint8_t scratch[(CODEC_MAX_ENTRY_BITS + 7) / 8 + 1];
+        memset(scratch, 0xff, sizeof(scratch));
+        DexcomPlatform::historyRead(offset, scratch, 1);
+        DexcomBitWriter writer(scratch, sizeof(scratch), headBit % 8);
+        if (!DexcomCodec::encode(writer, &headState, reading) ||
+            !DexcomPlatform::historyWrite(offset, scratch, (writer.position + 7) / 8))
+            return false;
+        headBit = byte * 8 + writer.position;
+        headCount++;
+        generation++;
+    }
+    else
+    {
+        if (headCount > 0)                                                                                              // Close the full block.
+        {
+            uint32_t count = headCount;
+            DexcomPlatform::historyWrite(sectorOffset(headSector) + offsetof(DexcomHistorySector, count), &count, sizeof(count));
+        }
+        uint32_t sector = (headSector + 1) % sectors;                                                                   // Drops the oldest sector once the ring is full.
+        DexcomHistorySector header;
+        if (readHeader(sector, &header))
+            records -= sectorCount(sector, header);
+        if (!startSector(sector, headSequence + 1, restarted ? headSequence + 1 : headEpoch, reading))
+            return false;
+    }
+    records++;
+    newest = reading;
+    return true;
+}
+
+uint32_t DexcomHistory::count() { return records; }
+
+bool DexcomHistory::latest(DexcomReading* reading)
+{
+    if (newest.dextime == HISTORY_EMPTY)
+        return false;
+    *reading = newest;
+    return true;
+}
+
+/**
+ * Position the cursor on the first reading newer than sinceDextime. Only the newest epoch is searched, the blocks
+ * of an earlier transmitter have a clock of their own. Whole blocks are skipped by the raw first reading of the following block.
+ */
+bool DexcomHistory::seek(DexcomHistoryCursor* cursor, uint32_t sinceDextime)
+{
+    if (sectors == 0 || records == 0)
+        return false;
+    uint32_t sector = headSector, sequence = headSequence;                                                              // Walk back to the oldest sector of the epoch still in the ring.
+    for (uint32_t i = 1; i < sectors; i++)
+    {
+        uint32_t previous = (sector + sectors - 1) % sectors;
+        DexcomHistorySector header;
+        if (!readHeader(previous, &header) || header.sequence != sequence - 1 || header.epoch != headEpoch)
+            break;
+        sector = previous;
+        sequence--;
+    }
+    while (sequence != headSequence)
+    {
+        uint32_t following = (sector + 1) % sectors;
+        DexcomReading first;
+        read(sectorOffset(following) + HISTORY_BLOCK_OFFSET, &first, sizeof(first));
+        if (first.dextime > sinceDextime)
+            break;
+        sector = following;
+        sequence++;
+    }
+
+    enter(cursor, sector, sequence);
+    DexcomHistoryCursor probe = *cursor;                                                                                // Skip the older readings inside the block.
+    DexcomReading reading;
+    while (next(&probe, &reading))
+    {
+        if (reading.dextime > sinceDextime)
+            return true;
+        *cursor = probe;
+    }
+    return false;
+}
+
+/**
+ * Decode the reading under the cursor and advance. False at the end of the history
+ * or when the sector under the cursor was erased and reused meanwhile.
+ * With a mapped region the bit stream is decoded where it lies in flash, otherwise through the cursor window.
+ */
+bool DexcomHistory::next(DexcomHistoryCursor* cursor, DexcomReading* reading)
+{
+    if (sectors == 0)
+        return false;
+    for (;;)
+    {
+        if (cursor->generation != generation)                                                                           // Written since the last call, the sector may be reused and the window stale.
+        {
+            DexcomHistorySector header;
+            if (!readHeader(cursor->sector, &header) || header.sequence != cursor->sequence)
+                return false;
+            cursor->generation = generation;
+            cursor->windowValid = false;
+        }
+        size_t block = sectorOffset(cursor->sector) + HISTORY_BLOCK_OFFSET;
+
+        if (cursor->index == 0)
+        {
+            if (!read(block, reading, sizeof(*reading)) || reading->dextime == HISTORY_EMPTY)
+                return false;
+            DexcomCodec::begin(&cursor->state, *reading);
+            cursor->index = 1;
+            return true;
+        }
+
+        const uint8_t* stream;
+        size_t streamStart, streamBytes;
+        if (map != NULL)
+        {
+            stream = map + block + sizeof(DexcomReading);
+            streamStart = 0;
+            streamBytes = HISTORY_BLOCK_SIZE - sizeof(DexcomReading);
+        }
+        else
+        {
+            size_t byte = cursor->bit / 8;
+            if (!cursor->windowValid || byte < cursor->windowStart || byte + (CODEC_MAX_ENTRY_BITS + 7) / 8 + 1 > cursor->windowStart + HISTORY_WINDOW)
+            {
+                size_t available = HISTORY_BLOCK_SIZE - sizeof(DexcomReading) - byte;
+                memset(cursor->window, 0xff, HISTORY_WINDOW);
+                DexcomPlatform::historyRead(block + sizeof(DexcomReading) + byte, cursor->window, available < HISTORY_WINDOW ? available : HISTORY_WINDOW);
+                cursor->windowStart = byte;
+                cursor->windowValid = true;
+            }
+            stream = cursor->window;
+            streamStart = cursor->windowStart;
+            streamBytes = HISTORY_BLOCK_SIZE - sizeof(DexcomReading) - streamStart;
+            if (streamBytes > HISTORY_WINDOW)
+                streamBytes = HISTORY_WINDOW;
+        }
+        DexcomBitReader reader(stream, streamBytes, cursor->bit - streamStart * 8);
+        DexcomCodecState state = cursor->state;
+        if (DexcomCodec::decode(reader, &state, reading))
+        {
+            cursor->state = state;
+            cursor->bit = streamStart * 8 + reader.position;
+            cursor->index++;
+            return true;
+        }
+
+        if (cursor->sequence == headSequence)                                                                           // Open block, more readings may come later.
+            return false;
+        enter(cursor, (cursor->sector + 1) % sectors, cursor->sequence + 1);
+    }
+}
+
+uint32_t DexcomHistory::get_generation() { return generation; }
+uint32_t DexcomHistory::get_epoch() { return headEpoch; }
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+bool DexcomHistory::read(size_t offset, void* buffer, size_t length)
+{
+    if (map == NULL)
+        return DexcomPlatform::historyRead(offset, buffer, length);
+    memcpy(buffer, map + offset, length);
+    return true;
+}
+
+bool DexcomHistory::readHeader(uint32_t sector, DexcomHistorySector* header)
+{
+    return read(sectorOffset(sector), header, sizeof(*header)) && header->magic == HISTORY_MAGIC;
+}
+
+bool DexcomHistory::startSector(uint32_t sector, uint32_t sequence, uint32_t epoch, const DexcomReading &first)
+{
+    DexcomHistorySector header = { HISTORY_MAGIC, sequence, HISTORY_EMPTY, epoch };
+    if (!DexcomPlatform::historyErase(sectorOffset(sector), HISTORY_SECTOR_SIZE) ||
+        !DexcomPlatform::historyWrite(sectorOffset(sector), &header, sizeof(header)) ||
+        !DexcomPlatform::historyWrite(sectorOffset(sector) + HISTORY_BLOCK_OFFSET, &first, sizeof(first)))
+        return false;
+    generation++;
+    headSector = sector;
+    headSequence = sequence;
+    headEpoch = epoch;
+    headCount = 1;
+    headBit = 0;
+    DexcomCodec::begin(&headState, first);
+    return true;
+}
+
+void DexcomHistory::enter(DexcomHistoryCursor* cursor, uint32_t sector, uint32_t sequence)
+{
+    cursor->sector = sector;
+    cursor->sequence = sequence;
+    cursor->index = 0;
+    cursor->bit = 0;
+    cursor->windowStart = 0;
+    cursor->windowValid = false;
+    cursor->generation = generation - 1;                                                                                // Check the header on the first step.
+}
+
+/**
+ * A sector that was never closed (power loss while it was the head) has to be decoded to count it.
+ */
+uint32_t DexcomHistory::sectorCount(uint32_t sector, const DexcomHistorySector &header)
+{
+    if (header.count != HISTORY_EMPTY)
+        return header.count;
+    DexcomHistoryCursor cursor;
+    DexcomReading reading;
+    enter(&cursor, sector, header.sequence);
+    while (next(&cursor, &reading) && cursor.sequence == header.sequence);
+    return cursor.index;
+}
@@ -0,0 +1,81 @@
+/**
+ * Header File with the glucose history kept in the raw history flash region
+ * An append only ring of sectors, each sector holds a header with a sequence number and one DexcomCodec block,
+ * readings are appended to the block in place. When the ring is full the oldest sector is erased.
+ * A new transmitter starts its clock over, its first reading starts a new block and a new epoch, the blocks of one
+ * transmitter carry the sequence of its first block. Seeks stay inside the newest epoch.
+ * Portable, the region is reached through DexcomPlatform. Readers decode straight from the mapped region when
+ * the platform can map it, every write bumps the generation so cursors check their sector again.
+ */
+
+#ifndef DEXCOMHISTORY_H
+#define DEXCOMHISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DexcomPlatform.h"
+#include "DexcomCodec.h"
+
+#define HISTORY_MAGIC           0x54534948                                                                              // "HIST"
+#define HISTORY_EMPTY           0xffffffff                                                                              // dextime of an erased reading, count of an open sector.
+#define HISTORY_WINDOW          24                                                                                      // Bytes of the block a cursor copies at a time without a mapped region.
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence;              // Increments with every sector that is started, never wraps in practice.
+    uint32_t count;                 // Readings in the block, written when the sector is closed.
+    uint32_t epoch;                 // Sequence of the first block of this transmitter, dextime rises within an epoch.
+} DexcomHistorySector;
+
+#define HISTORY_BLOCK_OFFSET    sizeof(DexcomHistorySector)
+#define HISTORY_BLOCK_SIZE      (HISTORY_SECTOR_SIZE - HISTORY_BLOCK_OFFSET)
+#define HISTORY_STREAM_BITS     ((HISTORY_BLOCK_SIZE - sizeof(DexcomReading)) * 8)
+
+typedef struct
+{
+    uint32_t sector;
+    uint32_t sequence;              // Sequence the sector had when the cursor entered it.
+    uint32_t index;                 // Readings already read from the sector.
+    size_t bit;                     // Position in the bit stream of the block.
+    DexcomCodecState state;
+    size_t windowStart;             // Byte of the bit stream held in window.
+    uint8_t window[HISTORY_WINDOW];
+    bool windowValid;
+    uint32_t generation;            // History generation the sector and window were checked at.
+} DexcomHistoryCursor;
+
+class DexcomHistory
+{
+    static uint32_t sectors;                                                                                            // 0 when there is no history region.
+    static uint32_t headSector;
+    static uint32_t headSequence;
+    static uint32_t headEpoch;
+    static uint32_t headCount;                                                                                          // Readings in the head block.
+    static size_t headBit;                                                                                              // Next free bit in the head block stream.
+    static DexcomCodecState headState;
+    static uint32_t records;
+    static DexcomReading newest;
+    static const uint8_t* map;                                                                                          // Read only view of the region, NULL when reads go through historyRead.
+    static uint32_t generation;                                                                                         // Bumped by every write and erase.
+
+    public:
+        static bool setup();
+        static bool append(const DexcomReading &reading);
+        static uint32_t count();
+        static bool latest(DexcomReading* reading);
+        static bool seek(DexcomHistoryCursor* cursor, uint32_t sinceDextime);                                           // First reading of the newest epoch newer than sinceDextime, false when there is none.
+        static bool next(DexcomHistoryCursor* cursor, DexcomReading* reading);                                         // False at the end, a later call continues with new readings.
+        static uint32_t get_generation();
+        static uint32_t get_epoch();                                                                                    // Epoch of the newest reading, changes with the transmitter.
+
+    private:
+        static bool read(size_t offset, void* buffer, size_t length);
+        static bool readHeader(uint32_t sector, DexcomHistorySector* header);
+        static bool startSector(uint32_t sector, uint32_t sequence, uint32_t epoch, const DexcomReading &first);
+        static void enter(DexcomHistoryCursor* cursor, uint32_t sector, uint32_t sequence);
+        static uint32_t sectorCount(uint32_t sector, const DexcomHistorySector &header);
+        static size_t sectorOffset(uint32_t sector) { return (size_t)sector * HISTORY_SECTOR_SIZE; }
+};
+
+#endif /* DEXCOMHISTORY_H */
@@ -0,0 +1,327 @@
+/*
+ * DexcomJpake
+ */
+
+
+#include <string.h>
+#include "mbedtls/sha256.h"
+#include "DexcomJpake.h"
+#include "DexcomPlatform.h"
+
+
+static const char* const JPAKE_ID_CLIENT = "client";                                                                   // Party identities hashed into the proofs.
+static const char* const JPAKE_ID_SERVER = "server";
+
+mbedtls_ecp_group DexcomJpake::group;
+bool DexcomJpake::groupLoaded = false;
+
+/**
+ * Randomizes the coordinates inside the scalar multiplications, it has no influence on the results.
+ */
+static int blinding(void*, unsigned char* output, size_t length)
+{
+    DexcomPlatform::randomBytes(output, length);
+    return 0;
+}
+
+DexcomJpake::DexcomJpake(uint8_t role) : role(role), prepared(false), peerChecked(false), keyReady(false)
+{
+    mbedtls_mpi_init(&x1);
+    mbedtls_mpi_init(&x2);
+    mbedtls_mpi_init(&password);
+    mbedtls_ecp_point_init(&X1);
+    mbedtls_ecp_point_init(&X2);
+    mbedtls_ecp_point_init(&X3);
+    mbedtls_ecp_point_init(&X4);
+    memset(roundOne, 0, sizeof(roundOne));
+    memset(key, 0, sizeof(key));
+}
+
+DexcomJpake::~DexcomJpake()
+{
+    mbedtls_mpi_free(&x1);
+    mbedtls_mpi_free(&x2);
+    mbedtls_mpi_free(&password);
+    mbedtls_ecp_point_free(&X1);
+    mbedtls_ecp_point_free(&X2);
+    mbedtls_ecp_point_free(&X3);
+    mbedtls_ecp_point_free(&X4);
+}
+
+/**
+ * The first multiplication by G builds the comb table, mbedtls stores it in the group (MBEDTLS_ECP_FIXED_POINT_OPTIM)
+ * and every later one by G only does the additions. Done here so no handshake pays for it.
+ */
+bool DexcomJpake::setup()
+{
+    if (groupLoaded)
+        return true;
+    mbedtls_ecp_group_init(&group);
+    if (mbedtls_ecp_group_load(&group, MBEDTLS_ECP_DP_SECP256R1) != 0)
+        return false;
+
+    mbedtls_mpi two;
+    mbedtls_ecp_point warm;
+    mbedtls_mpi_init(&two);
+    mbedtls_ecp_point_init(&warm);
+    bool ok = mbedtls_mpi_lset(&two, 2) == 0 && mbedtls_ecp_mul(&group, &warm, &two, &group.G, blinding, NULL) == 0;
+    mbedtls_ecp_point_free(&warm);
+    mbedtls_mpi_free(&two);
+    groupLoaded = ok;
+    return ok;
+}
+
+/**
+ * The password is read as a big endian number like mbedtls_ecjpake does, it must not be 0 mod n.
+ */
+bool DexcomJpake::setPassword(const uint8_t* secret, size_t length)
+{
+    if (!setup())
+        return false;
+    return mbedtls_mpi_read_binary(&password, secret, length) == 0 && mbedtls_mpi_mod_mpi(&password, &password, &group.N) == 0 &&
+           mbedtls_mpi_cmp_int(&password, 0) != 0;
+}
+
+/**
+ * Round one: X1 = G x1 and X2 = G x2, each with a proof of its secret. Nothing of the peer is needed.
+ */
+bool DexcomJpake::prepare(DexcomJpakeRandom random, void* context)
+{
+    reset();
+    if (!setup())
+        return false;
+    prepared = scalar(&x1, random, context) && mbedtls_ecp_mul(&group, &X1, &x1, &group.G, blinding, NULL) == 0 &&
+               prove(roundOne[0], group.G, x1, X1, random, context) &&
+               scalar(&x2, random, context) && mbedtls_ecp_mul(&group, &X2, &x2, &group.G, blinding, NULL) == 0 &&
+               prove(roundOne[1], group.G, x2, X2, random, context);
+    return prepared;
+}
+
+bool DexcomJpake::readRoundOne(const uint8_t* first, const uint8_t* second)
+{
+    peerChecked = prepared && check(&X3, first, group.G, identity(false)) && check(&X4, second, group.G, identity(false));
+    return peerChecked;
+}
+
+/**
+ * Round two: A = (X1 + X3 + X4) x2 s with a proof of x2 s on that base.
+ */
+bool DexcomJpake::writeRoundTwo(uint8_t* packet, DexcomJpakeRandom random, void* context)
+{
+    if (!peerChecked)
+        return false;
+    mbedtls_ecp_point base, A;
+    mbedtls_mpi xs;
+    mbedtls_ecp_point_init(&base);
+    mbedtls_ecp_point_init(&A);
+    mbedtls_mpi_init(&xs);
+    bool ok = sum(&base, X1, X3, X4) && passwordSecret(&xs) &&
+              mbedtls_ecp_mul(&group, &A, &xs, &base, blinding, NULL) == 0 && prove(packet, base, xs, A, random, context);
+    mbedtls_mpi_free(&xs);
+    mbedtls_ecp_point_free(&A);
+    mbedtls_ecp_point_free(&base);
+    return ok;
+}
+
+/**
+ * Checks B on the peer's base X1 + X2 + X3, then K = (B - X4 x2 s) x2 and the key is the start of SHA-256 of K.x.
+ * The subtraction is one multi-scalar multiplication with -x2 s mod n.
+ */
+bool DexcomJpake::readRoundTwo(const uint8_t* packet)
+{
+    keyReady = false;
+    if (!peerChecked)
+        return false;
+    mbedtls_ecp_point base, B, T, K;
+    mbedtls_mpi xs, one;
+    mbedtls_ecp_point_init(&base);
+    mbedtls_ecp_point_init(&B);
+    mbedtls_ecp_point_init(&T);
+    mbedtls_ecp_point_init(&K);
+    mbedtls_mpi_init(&xs);
+    mbedtls_mpi_init(&one);
+    uint8_t encoded[1 + JPAKE_POINT_SIZE];
+    size_t length = 0;
+    bool ok = sum(&base, X1, X2, X3) && check(&B, packet, base, identity(false)) &&
+              passwordSecret(&xs) && mbedtls_mpi_sub_mpi(&xs, &group.N, &xs) == 0 && mbedtls_mpi_lset(&one, 1) == 0 &&
+              mbedtls_ecp_muladd(&group, &T, &one, &B, &xs, &X4) == 0 && mbedtls_ecp_mul(&group, &K, &x2, &T, blinding, NULL) == 0 &&
+              mbedtls_ecp_point_write_binary(&group, &K, MBEDTLS_ECP_PF_UNCOMPRESSED, &length, encoded, sizeof(encoded)) == 0 &&
+              length == sizeof(encoded);
+    if (ok)
+    {
+        uint8_t digest[32];
+        mbedtls_sha256_context sha;
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        mbedtls_sha256_update(&sha, &encoded[1], JPAKE_SCALAR_SIZE);
+        mbedtls_sha256_finish(&sha, digest);
+        mbedtls_sha256_free(&sha);
+        memcpy(key, digest, JPAKE_KEY_SIZE);
+        keyReady = true;
+    }
+    memset(encoded, 0, sizeof(encoded));
+    mbedtls_mpi_free(&one);
+    mbedtls_mpi_free(&xs);
+    mbedtls_ecp_point_free(&K);
+    mbedtls_ecp_point_free(&T);
+    mbedtls_ecp_point_free(&B);
+    mbedtls_ecp_point_free(&base);
+    return keyReady;
+}
+
+/**
+ * lset() zeroes the limbs without giving them back, the next handshake reuses the allocations.
+ */
+void DexcomJpake::reset()
+{
+    mbedtls_mpi_lset(&x1, 0);
+    mbedtls_mpi_lset(&x2, 0);
+    memset(key, 0, sizeof(key));
+    prepared = false;
+    peerChecked = false;
+    keyReady = false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                          PRIVATE                                                              //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+const char* DexcomJpake::identity(bool own) const
+{
+    return (role == JPAKE_ROLE_CLIENT) == own ? JPAKE_ID_CLIENT : JPAKE_ID_SERVER;
+}
+
+/**
+ * A scalar in [1, n): 32 random bytes big endian mod n, redrawn in the unlikely case of 0.
+ */
+bool DexcomJpake::scalar(mbedtls_mpi* x, DexcomJpakeRandom random, void* context)
+{
+    uint8_t bytes[JPAKE_SCALAR_SIZE];
+    do
+    {
+        if (random(context, bytes, sizeof(bytes)) != 0 || mbedtls_mpi_read_binary(x, bytes, sizeof(bytes)) != 0 ||
+            mbedtls_mpi_mod_mpi(x, x, &group.N) != 0)
+            return false;
+    } while (mbedtls_mpi_cmp_int(x, 0) == 0);
+    memset(bytes, 0, sizeof(bytes));
+    return true;
+}
+
+/**
+ * h = SHA-256(base | V | X | id) mod n, every item uncompressed and prefixed with its 4 byte big endian length.
+ */
+bool DexcomJpake::hash(mbedtls_mpi* h, const mbedtls_ecp_point &base, const mbedtls_ecp_point &V, const mbedtls_ecp_point &X, const char* id)
+{
+    const mbedtls_ecp_point* points[3] = {&base, &V, &X};
+    uint8_t item[4 + 1 + JPAKE_POINT_SIZE];
+    uint8_t digest[32];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (int i = 0; i < 3; i++)
+    {
+        size_t length = 0;
+        if (mbedtls_ecp_point_write_binary(&group, points[i], MBEDTLS_ECP_PF_UNCOMPRESSED, &length, &item[4], sizeof(item) - 4) != 0)
+        {
+            mbedtls_sha256_free(&sha);
+            return false;
+        }
+        item[0] = 0; item[1] = 0; item[2] = 0; item[3] = (uint8_t)length;
+        mbedtls_sha256_update(&sha, item, 4 + length);
+    }
+    size_t idLength = strlen(id);
+    item[0] = 0; item[1] = 0; item[2] = 0; item[3] = (uint8_t)idLength;
+    mbedtls_sha256_update(&sha, item, 4);
+    mbedtls_sha256_update(&sha, (const unsigned char*)id, idLength);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    return mbedtls_mpi_read_binary(h, digest, sizeof(digest)) == 0 && mbedtls_mpi_mod_mpi(h, h, &group.N) == 0;
+}
+
+/**
+ * Schnorr proof of x for X = base x: V = base v, r = v - x h mod n. Writes X | V | r.
+ */
+bool DexcomJpake::prove(uint8_t* packet, const mbedtls_ecp_point &base, const mbedtls_mpi &x, const mbedtls_ecp_point &X, DexcomJpakeRandom random, void* context)
+{
+    mbedtls_mpi v, h, r;
+    mbedtls_ecp_point V;
+    mbedtls_mpi_init(&v);
+    mbedtls_mpi_init(&h);
+    mbedtls_mpi_init(&r);
+    mbedtls_ecp_point_init(&V);
+    bool ok = scalar(&v, random, context) && mbedtls_ecp_mul(&group, &V, &v, &base, blinding, NULL) == 0 &&
+              hash(&h, base, V, X, identity(true)) && mbedtls_mpi_mul_mpi(&r, &x, &h) == 0 && mbedtls_mpi_sub_mpi(&r, &v, &r) == 0 &&
+              mbedtls_mpi_mod_mpi(&r, &r, &group.N) == 0 && writePoint(packet, X) && writePoint(&packet[JPAKE_POINT_SIZE], V) &&
+              mbedtls_mpi_write_binary(&r, &packet[2 * JPAKE_POINT_SIZE], JPAKE_SCALAR_SIZE) == 0;
+    mbedtls_ecp_point_free(&V);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&h);
+    mbedtls_mpi_free(&v);
+    return ok;
+}
+
+/**
+ * Accepts the peer's X when V == base r + X h. Both products come from one multi-scalar multiplication,
+ * with base G it starts from the cached comb table.
+ */
+bool DexcomJpake::check(mbedtls_ecp_point* X, const uint8_t* packet, const mbedtls_ecp_point &base, const char* id)
+{
+    mbedtls_ecp_point V, R;
+    mbedtls_mpi r, h;
+    mbedtls_ecp_point_init(&V);
+    mbedtls_ecp_point_init(&R);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&h);
+    bool ok = readPoint(X, packet) && readPoint(&V, &packet[JPAKE_POINT_SIZE]) &&
+              mbedtls_mpi_read_binary(&r, &packet[2 * JPAKE_POINT_SIZE], JPAKE_SCALAR_SIZE) == 0 && mbedtls_mpi_cmp_mpi(&r, &group.N) < 0 &&
+              hash(&h, base, V, *X, id) && mbedtls_ecp_muladd(&group, &R, &r, &base, &h, X) == 0 && mbedtls_ecp_point_cmp(&R, &V) == 0;
+    mbedtls_mpi_free(&h);
+    mbedtls_mpi_free(&r);
+    mbedtls_ecp_point_free(&R);
+    mbedtls_ecp_point_free(&V);
+    return ok;
+}
+
+/**
+ * R = P + Q + S, the additions are multi-scalar multiplications with 1.
+ */
+bool DexcomJpake::sum(mbedtls_ecp_point* R, const mbedtls_ecp_point &P, const mbedtls_ecp_point &Q, const mbedtls_ecp_point &S)
+{
+    mbedtls_mpi one;
+    mbedtls_ecp_point T;
+    mbedtls_mpi_init(&one);
+    mbedtls_ecp_point_init(&T);
+    bool ok = mbedtls_mpi_lset(&one, 1) == 0 && mbedtls_ecp_muladd(&group, &T, &one, &P, &one, &Q) == 0 &&
+              mbedtls_ecp_muladd(&group, R, &one, &T, &one, &S) == 0;
+    mbedtls_ecp_point_free(&T);
+    mbedtls_mpi_free(&one);
+    return ok;
+}
+
+bool DexcomJpake::writePoint(uint8_t* buffer, const mbedtls_ecp_point &P)
+{
+    uint8_t encoded[1 + JPAKE_POINT_SIZE];
+    size_t length = 0;
+    if (mbedtls_ecp_point_write_binary(&group, &P, MBEDTLS_ECP_PF_UNCOMPRESSED, &length, encoded, sizeof(encoded)) != 0 || length != sizeof(encoded))
+        return false;
+    memcpy(buffer, &encoded[1], JPAKE_POINT_SIZE);
+    return true;
+}
+
+/**
+ * Only points on the curve and not at infinity get in, a crafted point would leak the secrets.
+ */
+bool DexcomJpake::readPoint(mbedtls_ecp_point* P, const uint8_t* buffer)
+{
+    uint8_t encoded[1 + JPAKE_POINT_SIZE];
+    encoded[0] = 0x04;
+    memcpy(&encoded[1], buffer, JPAKE_POINT_SIZE);
+    return mbedtls_ecp_point_read_binary(&group, P, encoded, sizeof(encoded)) == 0 && mbedtls_ecp_check_pubkey(&group, P) == 0;
+}
+
+bool DexcomJpake::passwordSecret(mbedtls_mpi* xs)
+{
+    return mbedtls_mpi_mul_mpi(xs, &x2, &password) == 0 && mbedtls_mpi_mod_mpi(xs, xs, &group.N) == 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * Header File with the EC J-PAKE key exchange of the G7 / ONE+ authentication
+ * Password authenticated key exchange by juggling on P-256 (RFC 8236) with Schnorr proofs (RFC 8235),
+ * built on the mbedtls ECP primitives, the password is the pairing code printed on the sensor.
+ * Round one only depends on our own random secrets, prepare() computes it before the connection so only the
+ * proof checks, round two and the key are left for the connection window. The P-256 group is loaded once and
+ * shared by all instances, mbedtls keeps the fixed-base comb table of the generator in it between sessions.
+ * Portable, DexcomAuth keeps the client instance, the emulator plays the server with a second one.
+ */
+
+#ifndef DEXCOMJPAKE_H
+#define DEXCOMJPAKE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mbedtls/ecp.h"
+
+#define JPAKE_SCALAR_SIZE       32
+#define JPAKE_POINT_SIZE        64                                                                                      // x and y big endian, the 0x04 of the uncompressed encoding is not sent.
+#define JPAKE_PACKET_SIZE       160                                                                                     // Point, proof commitment V and proof response r.
+#define JPAKE_KEY_SIZE          16                                                                                      // AES-128 key of the challenge that follows the exchange.
+
+#define JPAKE_ROLE_CLIENT       0
+#define JPAKE_ROLE_SERVER       1
+
+typedef int (*DexcomJpakeRandom)(void* context, unsigned char* output, size_t length);                                 // Same as the mbedtls f_rng, draws the secret scalars.
+
+class DexcomJpake
+{
+    static mbedtls_ecp_group group;                                                                                     // P-256, loaded by the first setup().
+    static bool groupLoaded;
+
+    uint8_t role;
+    bool prepared;                                                                                                      // Round one is ready to send.
+    bool peerChecked;                                                                                                   // Round one of the peer passed its proofs.
+    bool keyReady;
+    mbedtls_mpi x1, x2;                                                                                                 // Our secrets, RFC 8236 names from our side whatever the role.
+    mbedtls_mpi password;
+    mbedtls_ecp_point X1, X2;                                                                                           // Our round one points.
+    mbedtls_ecp_point X3, X4;                                                                                           // The peer's round one points.
+    uint8_t roundOne[2][JPAKE_PACKET_SIZE];
+    uint8_t key[JPAKE_KEY_SIZE];
+
+    public:
+        explicit DexcomJpake(uint8_t role);
+        ~DexcomJpake();
+
+        static bool setup();                                                                                            // Loads the group and builds the generator table, idempotent.
+
+        bool setPassword(const uint8_t* secret, size_t length);
+        bool prepare(DexcomJpakeRandom random, void* context);                                                          // Draws x1, x2 and writes both round one packets.
+        bool isPrepared() const { return prepared; }
+        const uint8_t* roundOnePacket(int index) const { return roundOne[index]; }
+        bool readRoundOne(const uint8_t* first, const uint8_t* second);                                                 // Checks the peer's proofs, keeps X3 and X4.
+        bool writeRoundTwo(uint8_t* packet, DexcomJpakeRandom random, void* context);
+        bool readRoundTwo(const uint8_t* packet);                                                                       // Checks the peer's proof and derives the key.
+        const uint8_t* sessionKey() const { return keyReady ? key : NULL; }
+        void reset();                                                                                                   // Clears the secrets for the next handshake, the allocated limbs are kept.
+
+    private:
+        const char* identity(bool own) const;
+        bool scalar(mbedtls_mpi* x, DexcomJpakeRandom random, void* context);
+        bool hash(mbedtls_mpi* h, const mbedtls_ecp_point &base, const mbedtls_ecp_point &V, const mbedtls_ecp_point &X, const char* id);
+        bool prove(uint8_t* packet, const mbedtls_ecp_point &base, const mbedtls_mpi &x, const mbedtls_ecp_point &X, DexcomJpakeRandom random, void* context);
+        bool check(mbedtls_ecp_point* X, const uint8_t* packet, const mbedtls_ecp_point &base, const char* id);
+        bool sum(mbedtls_ecp_point* R, const mbedtls_ecp_point &P, const mbedtls_ecp_point &Q, const mbedtls_ecp_point &S);
+        bool writePoint(uint8_t* buffer, const mbedtls_ecp_point &P);
+        bool readPoint(mbedtls_ecp_point* P, const uint8_t* buffer);
+        bool passwordSecret(mbedtls_mpi* xs);
+};
+
+#endif /* DEXCOMJPAKE_H */
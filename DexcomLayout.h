@@ -0,0 +1,97 @@
+/**
+ * Header File with the screen layout of the MFD
+ * Every widget of the main screen is one entry of a constexpr layout table: the glucose tape as a DexcomIndicator
+ * with its bounds, scale and value to pixel mapping, the text fields as DexcomField cells. The draw routines of
+ * DexcomMFD take all their coordinates from MFD_LAYOUT, so everything that does not depend on a reading or a limit
+ * folds into constants at build time, and a different panel or orientation is another table, checked by the
+ * static_asserts at the end. Portable, no display library needed.
+ */
+
+#ifndef DEXCOMLAYOUT_H
+#define DEXCOMLAYOUT_H
+
+#include <stdint.h>
+
+/** generic draw indicator data struct
+ *
+ * this contains basic position, size, and scale information for the indicator
+ *
+ * x, y  far left and top coordinates of graph
+ * height total height of the space INSIDE the bracket
+ * width total width of the top and bottom of the bracket
+ * tapeWidth width of the color tape inside the bracket
+ * max : maximum value of the graph
+ * min : minimum value of the graph
+ * labelShift : half the width of a digit of the value above the tape
+ *
+ **/
+struct DexcomIndicator {
+  int16_t x, y;
+  int16_t height, width, tapeWidth;
+  int16_t max, min;
+  int16_t labelShift;
+
+  constexpr int top() const { return y + 2; }                                                                           // First pixel inside the two line bracket.
+  constexpr int bottom() const { return top() + height; }
+  constexpr int tapeX() const { return x + width - tapeWidth; }
+  constexpr int pixelsPerPoint100() const { return (height * 100) / (max - min); }
+  constexpr int clampY(int py) const { return py < top() ? top() : py > bottom() ? bottom() : py; }
+  constexpr int toY(int value) const { return clampY(top() + (pixelsPerPoint100() * (max - value)) / 100); }
+  constexpr int labelX(int value) const { return tapeX() - (value > 99 ? 2 * labelShift : labelShift); }               // Centers two or three digits over the tape.
+};
+
+/**
+ * A line of text drawn one character per cell, erased as a whole before it is drawn again.
+ * y is the baseline, the cells reach digitHeight above it.
+ */
+struct DexcomField {
+  int16_t x, y;
+  int16_t digitWidth, digitHeight;
+  int16_t cells;
+
+  constexpr int cellX(int cell) const { return x + cell * digitWidth; }
+  constexpr int eraseX() const { return x - 2; }
+  constexpr int eraseY() const { return y - digitHeight; }
+  constexpr int eraseWidth() const { return cells * digitWidth + 4; }
+  constexpr int eraseHeight() const { return digitHeight + 4; }
+  constexpr int right() const { return eraseX() + eraseWidth(); }
+};
+
+struct DexcomLayout {
+  int16_t width, height;                                                                                                // Panel after the rotation.
+  uint8_t rotation;
+  DexcomIndicator glucose;
+  int16_t titleY;                                                                                                       // Baseline of "CGM" over the tape.
+  int16_t limitGap;                                                                                                     // From the bracket to the limit labels.
+  DexcomField time;                                                                                                     // Data age, framed in the age color.
+  DexcomField volts;
+  DexcomField percent;
+  DexcomField backfill;                                                                                                 // Progress, with the title one field height above and the bar below.
+};
+
+// The T-Display S3 upright, 170 x 320.
+constexpr DexcomLayout MFD_PORTRAIT = {
+  170, 320, 0,
+  { 70, 80, 178, 22, 14, 300, 40, 12 },
+  36, 8,
+  { 20, 300, 12, 20, 5 },
+  { 100, 300, 9, 20, 5 },
+  { 110, 280, 9, 20, 5 },
+  { 8, 150, 10, 20, 5 },
+};
+
+#ifndef MFD_LAYOUT
+#define MFD_LAYOUT MFD_PORTRAIT
+#endif
+
+static_assert(MFD_LAYOUT.glucose.max > MFD_LAYOUT.glucose.min, "glucose scale is empty");
+static_assert(MFD_LAYOUT.glucose.tapeWidth < MFD_LAYOUT.glucose.width, "glucose tape is wider than its bracket");
+static_assert(MFD_LAYOUT.glucose.bottom() + 2 <= MFD_LAYOUT.height, "glucose bracket is below the panel");
+static_assert(MFD_LAYOUT.glucose.pixelsPerPoint100() > 0, "glucose tape is too short for its scale");
+static_assert(MFD_LAYOUT.glucose.labelX(100) >= 0, "glucose value leaves the panel");
+static_assert(MFD_LAYOUT.time.right() + 2 <= MFD_LAYOUT.volts.eraseX() || MFD_LAYOUT.time.eraseY() >= MFD_LAYOUT.volts.y, "time and volts overlap");
+static_assert(MFD_LAYOUT.volts.right() <= MFD_LAYOUT.width && MFD_LAYOUT.percent.right() <= MFD_LAYOUT.width, "battery fields leave the panel");
+static_assert(MFD_LAYOUT.time.y + 6 <= MFD_LAYOUT.height, "time frame is below the panel");
+static_assert(MFD_LAYOUT.backfill.right() <= MFD_LAYOUT.glucose.x, "backfill progress covers the glucose tape");
+
+#endif /* DEXCOMLAYOUT_H */
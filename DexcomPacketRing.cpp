@@ -0,0 +1,66 @@
+/*
+ * DexcomPacketRing
+ */
+
+
+#include <string.h>
+#include "DexcomPacketRing.h"
+
+
+DexcomPacketRing::DexcomPacketRing() : head(0), tail(0), overflows(0), truncations(0)
+{
+}
+
+/**
+ * The slot is filled before head moves on, so the consumer never sees a half written packet.
+ * The acquire on tail pairs with the release in pop(), a freed slot is not reused while it is still copied out.
+ */
+bool DexcomPacketRing::push(const uint8_t* data, size_t length, uint32_t time)
+{
+    uint32_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) >= PACKET_RING_SLOTS)
+    {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    DexcomPacket &slot = slots[position & (PACKET_RING_SLOTS - 1)];
+    size_t stored = length > PACKET_RING_PAYLOAD ? PACKET_RING_PAYLOAD : length;
+    if (stored != length)
+        truncations.fetch_add(1, std::memory_order_relaxed);
+    slot.time = time;
+    slot.length = (uint16_t)stored;
+    slot.received = (uint16_t)(length > 0xffff ? 0xffff : length);
+    memcpy(slot.data, data, stored);
+    head.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool DexcomPacketRing::pop(DexcomPacket* packet)
+{
+    uint32_t position = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == position)
+        return false;
+    const DexcomPacket &slot = slots[position & (PACKET_RING_SLOTS - 1)];
+    packet->time = slot.time;
+    packet->length = slot.length;
+    packet->received = slot.received;
+    memcpy(packet->data, slot.data, slot.length);
+    tail.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+size_t DexcomPacketRing::available()
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+/**
+ * Only moves tail, so it is safe while the producer keeps pushing.
+ */
+size_t DexcomPacketRing::clear()
+{
+    uint32_t position = head.load(std::memory_order_acquire);
+    size_t dropped = position - tail.load(std::memory_order_relaxed);
+    tail.store(position, std::memory_order_release);
+    return dropped;
+}
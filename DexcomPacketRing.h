@@ -0,0 +1,47 @@
+/**
+ * Header File with the single producer / single consumer packet ring
+ * Carries the notifications and indications of one characteristic from the BT stack callback to the protocol task.
+ * push() only runs in the producer, pop() and clear() only in the consumer, neither blocks or allocates.
+ * A full ring drops the new packet and counts it, the packets already queued are never overwritten.
+ * Portable, G6DexcomBLE keeps one ring per characteristic and the bench floods one from a second thread on the host.
+ */
+
+#ifndef DEXCOMPACKETRING_H
+#define DEXCOMPACKETRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define PACKET_RING_SLOTS       16                                                                                      // Power of two, many connection events worth of packets.
+#define PACKET_RING_PAYLOAD     64                                                                                      // Bigger than any value the transmitter sends at the default MTU.
+
+typedef struct
+{
+    uint32_t time;                  // Platform millis when the callback ran.
+    uint16_t length;                // Bytes in data.
+    uint16_t received;              // Bytes the stack handed over, more than length when the packet was truncated.
+    uint8_t data[PACKET_RING_PAYLOAD];
+} DexcomPacket;
+
+class DexcomPacketRing
+{
+    DexcomPacket slots[PACKET_RING_SLOTS];
+    std::atomic<uint32_t> head;                                                                                         // Packets pushed, only the producer writes it.
+    std::atomic<uint32_t> tail;                                                                                         // Packets popped, only the consumer writes it.
+    std::atomic<uint32_t> overflows;                                                                                    // Packets dropped because the ring was full, producer side.
+    std::atomic<uint32_t> truncations;                                                                                  // Packets longer than PACKET_RING_PAYLOAD, producer side.
+
+    public:
+        DexcomPacketRing();
+
+        bool push(const uint8_t* data, size_t length, uint32_t time);                                                  // Producer, false when the packet was dropped.
+        bool pop(DexcomPacket* packet);                                                                                 // Consumer, oldest packet first, false when empty.
+        size_t available();
+        size_t clear();                                                                                                 // Consumer, drops what is queued and returns how many.
+
+        uint32_t get_overflows() { return overflows.load(std::memory_order_relaxed); }
+        uint32_t get_truncations() { return truncations.load(std::memory_order_relaxed); }
+};
+
+#endif /* DEXCOMPACKETRING_H */
@@ -0,0 +1,82 @@
+/*
+ * DexcomPerf
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include "DexcomPerf.h"
+#include "DexcomPlatform.h"
+
+
+static const char* const PERF_NAMES[PERF_COUNTERS] = {
+    "run", "run.connect", "run.auth", "run.bond", "run.devinfo", "run.register", "run.time", "run.battery",
+    "run.glucose", "run.backfill", "run.disconnect", "session.ok", "session.fail",
+    "draw.screen", "draw.time", "flash.write", "adc.read", "adv.seen",
+    "auth.prepare", "auth.round1", "auth.round2", "auth.key", "upload.radio", "upload.post",
+    "server.snapshot", "server.push"
+};
+
+DexcomPerfEntry DexcomPerf::entries[PERF_COUNTERS];
+DexcomHeapSample DexcomPerf::heapLast;
+
+DexcomPerfStamp DexcomPerf::start()
+{
+    DexcomPerfStamp stamp;
+    stamp.micros = DexcomPlatform::micros();
+    stamp.cycles = DexcomPlatform::cycleCount();
+    return stamp;
+}
+
+/**
+ * Cycles are read on the core the section started on, the BLE and UI tasks are both pinned.
+ */
+void DexcomPerf::stop(DexcomPerfCounter counter, const DexcomPerfStamp &stamp)
+{
+    uint32_t cycles = DexcomPlatform::cycleCount() - stamp.cycles;
+    uint64_t elapsed = DexcomPlatform::micros() - stamp.micros;
+    uint32_t micros = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    DexcomPerfEntry &entry = entries[counter];
+    entry.count++;
+    entry.totalMicros += micros;
+    entry.totalCycles += cycles;
+    entry.lastMicros = micros;
+    if (micros > entry.maxMicros) entry.maxMicros = micros;
+}
+
+void DexcomPerf::count(DexcomPerfCounter counter) { entries[counter].count++; }
+void DexcomPerf::reset() { memset(entries, 0, sizeof(entries)); }
+const DexcomPerfEntry* DexcomPerf::get(DexcomPerfCounter counter) { return &entries[counter]; }
+const char* DexcomPerf::name(DexcomPerfCounter counter) { return PERF_NAMES[counter]; }
+
+void DexcomPerf::heapSample()
+{
+    DexcomHeapInfo info;
+    DexcomPlatform::heapInfo(&info);
+    heapLast.change = heapLast.samples > 0 ? (int32_t)(info.freeBytes - heapLast.info.freeBytes) : 0;
+    if (heapLast.change < 0) heapLast.drops++;
+    heapLast.fragmentation = info.freeBytes > 0 ? 1000 - (uint32_t)((uint64_t)info.largestBlock * 1000 / info.freeBytes) : 0;
+    heapLast.info = info;
+    heapLast.samples++;
+}
+
+const DexcomHeapSample &DexcomPerf::heap() { return heapLast; }
+
+size_t DexcomPerf::formatHeap(char* buffer, size_t size)
+{
+    int length = snprintf(buffer, size, "heap free %u min %u largest %u frag %u.%u%% change %d drops %u/%u\n",
+                          heapLast.info.freeBytes, heapLast.info.minFreeBytes, heapLast.info.largestBlock,
+                          heapLast.fragmentation / 10, heapLast.fragmentation % 10, heapLast.change, heapLast.drops, heapLast.samples);
+    return length < 0 ? 0 : (size_t)length;
+}
+
+size_t DexcomPerf::format(DexcomPerfCounter counter, char* buffer, size_t size)
+{
+    const DexcomPerfEntry &entry = entries[counter];
+    uint32_t count = entry.count;
+    uint32_t average = count > 0 ? (uint32_t)(entry.totalMicros / count) : 0;
+    uint32_t averageCycles = count > 0 ? (uint32_t)(entry.totalCycles / count) : 0;
+    int length = snprintf(buffer, size, "%-16s %8u %10u %10u %10u %12u\n", PERF_NAMES[counter],
+                          count, average, entry.maxMicros, entry.lastMicros, averageCycles);
+    return length < 0 ? 0 : (size_t)length;
+}
@@ -0,0 +1,89 @@
+/**
+ * Header File with the fixed table of performance counters
+ * Sections are timed with start() / stop(), events only counted with count().
+ * heapSample() records the heap once per session cycle, the drop between samples shows allocations that stay.
+ * Portable like the session code, the console (G6DexcomConsole) dumps and resets the table on the board.
+ */
+
+#ifndef DEXCOMPERF_H
+#define DEXCOMPERF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DexcomPlatform.h"
+
+// Counter ids, keep in order with the names in DexcomPerf.cpp.
+enum DexcomPerfCounter
+{
+    PERF_RUN = 0,                   // Whole DexcomSession::run
+    PERF_RUN_CONNECT,
+    PERF_RUN_AUTH,
+    PERF_RUN_BOND,
+    PERF_RUN_DEVICE_INFO,
+    PERF_RUN_REGISTER,
+    PERF_RUN_TIME,
+    PERF_RUN_BATTERY,
+    PERF_RUN_GLUCOSE,
+    PERF_RUN_BACKFILL,
+    PERF_RUN_DISCONNECT,
+    PERF_SESSION_OK,                // Events, count only
+    PERF_SESSION_FAIL,
+    PERF_DRAW_SCREEN,
+    PERF_DRAW_TIME,
+    PERF_FLASH_WRITE,
+    PERF_ADC_READ,
+    PERF_ADV_SEEN,                  // Advertisements handed to the prefilter, count only
+    PERF_AUTH_PREPARE,              // G7 J-PAKE steps, round one is computed before the connection
+    PERF_AUTH_ROUND_ONE,
+    PERF_AUTH_ROUND_TWO,
+    PERF_AUTH_KEY,
+    PERF_UPLOAD_RADIO,              // Nightscout burst from radio on to off
+    PERF_UPLOAD_POST,               // One request to its response
+    PERF_SERVER_SNAPSHOT,           // Local server, serializing a reading into a slot
+    PERF_SERVER_PUSH,               // From publish to the frame taken by a live client's socket
+    PERF_COUNTERS
+};
+
+typedef struct
+{
+    uint32_t cycles;
+    uint64_t micros;
+} DexcomPerfStamp;
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t totalMicros;
+    uint32_t maxMicros;
+    uint32_t lastMicros;
+    uint64_t totalCycles;           // Only meaningful for sections shorter than one wrap of the 32 bit cycle counter (~17 s at 240 MHz).
+} DexcomPerfEntry;
+
+typedef struct
+{
+    DexcomHeapInfo info;
+    uint32_t samples;
+    uint32_t fragmentation;         // Per mille of the free heap not in the largest block.
+    int32_t change;                 // Free bytes against the previous sample, negative when the cycle kept memory.
+    uint32_t drops;                 // Samples with less free heap than the one before.
+} DexcomHeapSample;
+
+class DexcomPerf
+{
+    static DexcomPerfEntry entries[PERF_COUNTERS];
+    static DexcomHeapSample heapLast;                                                                      // Each counter is written by one task, a dump from another task may be one sample behind.
+
+    public:
+        static DexcomPerfStamp start();
+        static void stop(DexcomPerfCounter counter, const DexcomPerfStamp &stamp);
+        static void count(DexcomPerfCounter counter);
+        static void reset();
+        static const DexcomPerfEntry* get(DexcomPerfCounter counter);
+        static const char* name(DexcomPerfCounter counter);
+        static size_t format(DexcomPerfCounter counter, char* buffer, size_t size);                                    // One line: name count avg_us max_us last_us avg_cycles
+        static void heapSample();
+        static const DexcomHeapSample &heap();
+        static size_t formatHeap(char* buffer, size_t size);                                                            // One line: free min largest frag change drops
+};
+
+#endif /* DEXCOMPERF_H */
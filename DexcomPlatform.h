@@ -0,0 +1,50 @@
+/**
+ * Header File with the thin platform layer under the portable protocol code
+ * Clocks, logging, key / value storage, the raw history region, heap figures, random numbers and the CRC primitive.
+ * DexcomPlatformESP32.cpp implements it on the board, host/DexcomPlatformPOSIX.cpp on Linux.
+ */
+
+#ifndef DEXCOMPLATFORM_H
+#define DEXCOMPLATFORM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HISTORY_SECTOR_SIZE 4096                                                                                        // Erase unit of the history region.
+
+typedef struct
+{
+    uint32_t freeBytes;
+    uint32_t minFreeBytes;          // Low water mark since start.
+    uint32_t largestBlock;          // Largest single allocation that would succeed.
+} DexcomHeapInfo;
+
+class DexcomPlatform
+{
+    public:
+        static uint32_t millis();                                                                                       // Milliseconds since start.
+        static uint64_t micros();                                                                                       // Microseconds since start.
+        static void delay(uint32_t ms);                                                                                 // Blocks the calling task / thread.
+        static uint32_t cycleCount();                                                                                   // CPU cycle counter of the calling core, wraps.
+        static uint32_t epochSeconds();                                                                                 // Wall clock in Unix seconds, 0 while it was never set.
+
+        static void log(const char* text);                                                                              // Writes text as is, no newline is added.
+
+        static bool storageHasKey(const char* key);
+        static int storageGetInt(const char* key, int defaultValue);
+        static void storagePutInt(const char* key, int value);
+
+        static size_t historySize();                                                                                    // Bytes of the raw history region, 0 when there is none.
+        static bool historyRead(size_t offset, void* buffer, size_t length);
+        static bool historyWrite(size_t offset, const void* data, size_t length);                                       // Only clears bits, like NOR flash.
+        static bool historyErase(size_t offset, size_t length);                                                         // Whole HISTORY_SECTOR_SIZE sectors back to 0xff.
+        static const uint8_t* historyMap();                                                                             // Read only view of the whole region that follows the writes, NULL when it can not be mapped.
+
+        static void heapInfo(DexcomHeapInfo* info);
+
+        static void randomBytes(uint8_t* buffer, size_t length);
+
+        static uint16_t crc16Xmodem(const uint8_t* data, size_t length);                                                // CRC-16/XMODEM, poly 0x1021, init 0.
+};
+
+#endif /* DEXCOMPLATFORM_H */
@@ -0,0 +1,131 @@
+/*
+ * DexcomPlatformESP32
+ */
+
+
+#include <Arduino.h>
+#include <Esp.h>
+#include <Preferences.h>
+#include <time.h>
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "rom/crc.h"
+#include "DexcomPlatform.h"
+#include "DexcomPerf.h"
+
+
+#define STORAGE_NAMESPACE "Dexcom"
+#define RW_MODE false
+#define RO_MODE true
+#define EPOCH_VALID 1672531200                                                                                          // 2023-01-01, an unset clock counts from 1970.
+#define HISTORY_PARTITION_TYPE ((esp_partition_type_t)0x40)                                                            // Custom data type of the history partition in partitions.csv.
+
+static Preferences flashStorage;
+static const esp_partition_t* historyPartition = NULL;
+
+static const esp_partition_t* history()
+{
+    if (historyPartition == NULL)
+        historyPartition = esp_partition_find_first(HISTORY_PARTITION_TYPE, ESP_PARTITION_SUBTYPE_ANY, "history");
+    return historyPartition;
+}
+
+uint32_t DexcomPlatform::millis() { return ::millis(); }
+uint64_t DexcomPlatform::micros() { return (uint64_t)esp_timer_get_time(); }
+void DexcomPlatform::delay(uint32_t ms) { ::delay(ms); }
+uint32_t DexcomPlatform::cycleCount() { return (uint32_t)esp_cpu_get_cycle_count(); }
+
+/**
+ * Set by SNTP while the Wi-Fi is up, the RTC keeps it across esp_restart().
+ */
+uint32_t DexcomPlatform::epochSeconds()
+{
+    time_t now = time(NULL);
+    return now > EPOCH_VALID ? (uint32_t)now : 0;
+}
+
+void DexcomPlatform::log(const char* text)
+{
+    Serial.print(text);
+}
+
+bool DexcomPlatform::storageHasKey(const char* key)
+{
+    flashStorage.begin(STORAGE_NAMESPACE, RO_MODE);
+    bool found = flashStorage.isKey(key);
+    flashStorage.end();
+    return found;
+}
+
+int DexcomPlatform::storageGetInt(const char* key, int defaultValue)
+{
+    flashStorage.begin(STORAGE_NAMESPACE, RO_MODE);
+    int value = flashStorage.getInt(key, defaultValue);
+    flashStorage.end();
+    return value;
+}
+
+void DexcomPlatform::storagePutInt(const char* key, int value)
+{
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    flashStorage.begin(STORAGE_NAMESPACE, RW_MODE);
+    flashStorage.putInt(key, value);
+    flashStorage.end();
+    DexcomPerf::stop(PERF_FLASH_WRITE, stamp);
+}
+
+size_t DexcomPlatform::historySize() { return history() != NULL ? history()->size : 0; }
+
+bool DexcomPlatform::historyRead(size_t offset, void* buffer, size_t length)
+{
+    return history() != NULL && esp_partition_read(history(), offset, buffer, length) == ESP_OK;
+}
+
+bool DexcomPlatform::historyWrite(size_t offset, const void* data, size_t length)
+{
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    bool written = history() != NULL && esp_partition_write(history(), offset, data, length) == ESP_OK;
+    DexcomPerf::stop(PERF_FLASH_WRITE, stamp);
+    return written;
+}
+
+bool DexcomPlatform::historyErase(size_t offset, size_t length)
+{
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    bool erased = history() != NULL && esp_partition_erase_range(history(), offset, length) == ESP_OK;
+    DexcomPerf::stop(PERF_FLASH_WRITE, stamp);
+    return erased;
+}
+
+/**
+ * Maps the partition into the data cache once, the mapping is never released.
+ * The flash driver invalidates the cache over the range it writes or erases, so the view follows historyWrite.
+ */
+const uint8_t* DexcomPlatform::historyMap()
+{
+    static const void* mapped = NULL;
+    static esp_partition_mmap_handle_t handle;
+    if (mapped == NULL && history() != NULL &&
+        esp_partition_mmap(history(), 0, history()->size, ESP_PARTITION_MMAP_DATA, &mapped, &handle) != ESP_OK)
+        mapped = NULL;
+    return (const uint8_t*)mapped;
+}
+
+void DexcomPlatform::heapInfo(DexcomHeapInfo* info)
+{
+    info->freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    info->minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    info->largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+void DexcomPlatform::randomBytes(uint8_t* buffer, size_t length)
+{
+    esp_fill_random(buffer, length);                                                                                    // True random while the radio is on, pseudo random otherwise.
+}
+
+uint16_t DexcomPlatform::crc16Xmodem(const uint8_t* data, size_t length)
+{
+    return ~crc16_be((uint16_t)~0x0000, data, length);                                                                  // The ROM table implementation.
+}
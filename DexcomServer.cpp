@@ -0,0 +1,531 @@
+/*
+ * DexcomServer
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "mbedtls/sha1.h"
+#include "DexcomServer.h"
+#include "DexcomHistory.h"
+#include "DexcomPlatform.h"
+#include "DexcomUploader.h"
+#include "DebugHelper.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0                                                                                                  // lwIP raises no SIGPIPE.
+#endif
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static const char INDEX_PAGE[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n"
+    "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\"><title>Flying-CGM</title></head>"
+    "<body style=\"background:#000;color:#fff;font:64px sans-serif;text-align:center\">"
+    "<div id=\"g\">---</div><div id=\"d\" style=\"font-size:24px\"></div><script>"
+    "var r=null;function a(){if(r)d.textContent=r.direction+(r.date?' '+Math.round((Date.now()-r.date)/60000)+' min':'');}"
+    "function c(){var w=new WebSocket('ws://'+location.host+'/live');"
+    "w.onmessage=function(e){r=JSON.parse(e.data);g.textContent=r.sgv;a();};w.onclose=function(){setTimeout(c,2000);};}"
+    "c();setInterval(a,10000);</script></body></html>";
+static const char NO_READING[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 300\r\nConnection: close\r\n\r\n";
+static const char BAD_REQUEST[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char NOT_ALLOWED[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char JSON_HEADER[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\nCache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n";
+
+int DexcomServer::listenFd = -1;
+int DexcomServer::doorbellFd = -1;
+uint16_t DexcomServer::port = 0;
+DexcomServerSnapshot DexcomServer::slots[SERVER_SLOTS];
+std::atomic<int> DexcomServer::users[SERVER_SLOTS];
+std::atomic<int> DexcomServer::current(-1);
+DexcomServerClient DexcomServer::clients[SERVER_MAX_CLIENTS];
+DexcomServerStats DexcomServer::stats = {};
+
+static sockaddr_in doorbellAddress;
+
+static bool nonBlocking(int fd) { return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0; }
+
+/**
+ * Opens the listening socket and the doorbell, a UDP socket on the loopback that publish() writes to.
+ */
+bool DexcomServer::setup(uint16_t listenPort)
+{
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    sockaddr_in address = {};
+    socklen_t size = sizeof(address);
+    int reuse = 1;
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(listenPort);
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SERVER_MAX_CLIENTS) != 0 ||
+        getsockname(listenFd, (sockaddr*)&address, &size) != 0 || !nonBlocking(listenFd))
+    {
+        SerialPrintf(ERROR, "Server: could not listen on port %u\n\r", listenPort);
+        return false;
+    }
+    port = ntohs(address.sin_port);
+
+    doorbellAddress.sin_family = AF_INET;
+    doorbellAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    doorbellAddress.sin_port = 0;
+    size = sizeof(doorbellAddress);
+    doorbellFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (doorbellFd < 0 || bind(doorbellFd, (sockaddr*)&doorbellAddress, sizeof(doorbellAddress)) != 0 ||
+        getsockname(doorbellFd, (sockaddr*)&doorbellAddress, &size) != 0 || !nonBlocking(doorbellFd))
+    {
+        SerialPrintln(ERROR, "Server: could not open the doorbell.");
+        return false;
+    }
+    SerialPrintf(DEBUG, "Server: listening on port %u\n\r", port);
+    return true;
+}
+
+/**
+ * Serializes the reading, the last day and the push frame once into a free slot and makes it the current one.
+ * transmitterNow dates the readings, they go out without a date while the wall clock is not set.
+ */
+bool DexcomServer::publish(const DexcomReading &reading, uint32_t transmitterNow)
+{
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    int newest = current.load(std::memory_order_acquire);
+    int slot = -1;
+    for (int i = 0; i < SERVER_SLOTS && slot < 0; i++)
+    {
+        int idle = 0;
+        if (i != newest && users[i].compare_exchange_strong(idle, -1, std::memory_order_acquire))
+            slot = i;
+    }
+    if (slot < 0)
+    {
+        stats.skipped++;
+        return false;
+    }
+
+    uint32_t epoch = DexcomPlatform::epochSeconds();
+    uint32_t date = epoch != 0 && transmitterNow >= reading.dextime ? epoch - (transmitterNow - reading.dextime) : 0;
+    DexcomServerSnapshot &snapshot = slots[slot];
+    snapshot.generation = newest >= 0 ? slots[newest].generation + 1 : 1;
+    snapshot.published = stamp;
+
+    char json[SERVER_JSON_SIZE];
+    size_t jsonLength = formatJson(json, sizeof(json), reading, date);
+    snapshot.readingLength = snprintf(snapshot.reading, SERVER_READING_SIZE, JSON_HEADER, (unsigned)jsonLength);
+    memcpy(snapshot.reading + snapshot.readingLength, json, jsonLength);
+    snapshot.readingLength += jsonLength;
+
+    size_t header = 0;
+    snapshot.frame[header++] = 0x81;                                                                                    // Final text frame, never masked from the server.
+    if (jsonLength < 126)
+        snapshot.frame[header++] = (uint8_t)jsonLength;
+    else
+    {
+        snapshot.frame[header++] = 126;
+        snapshot.frame[header++] = (uint8_t)(jsonLength >> 8);
+        snapshot.frame[header++] = (uint8_t)jsonLength;
+    }
+    memcpy(snapshot.frame + header, json, jsonLength);
+    snapshot.frameLength = header + jsonLength;
+    snapshot.historyLength = formatHistory(snapshot.history, reading, date);
+
+    users[slot].store(0, std::memory_order_release);
+    current.store(slot, std::memory_order_release);
+    stats.snapshots++;
+    uint8_t ring = 1;
+    sendto(doorbellFd, &ring, 1, 0, (sockaddr*)&doorbellAddress, sizeof(doorbellAddress));
+    DexcomPerf::stop(PERF_SERVER_SNAPSHOT, stamp);
+    return true;
+}
+
+/**
+ * One round of the server task: waits for the sockets, takes new connections, reads requests,
+ * hands the newest frame to the live clients and sends what the sockets take.
+ */
+void DexcomServer::service(uint32_t timeoutMs)
+{
+    if (listenFd < 0)
+        return;
+    fd_set readSet, writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_SET(listenFd, &readSet);
+    FD_SET(doorbellFd, &readSet);
+    int maxFd = listenFd > doorbellFd ? listenFd : doorbellFd;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        DexcomServerClient &client = clients[i];
+        if (client.fd < 0)
+            continue;
+        if (client.state == SERVER_CLIENT_REQUEST || client.state == SERVER_CLIENT_LIVE)
+            FD_SET(client.fd, &readSet);
+        if (client.out != NULL)
+            FD_SET(client.fd, &writeSet);
+        if (client.fd > maxFd) maxFd = client.fd;
+    }
+    timeval timeout = { (time_t)(timeoutMs / 1000), (suseconds_t)((timeoutMs % 1000) * 1000) };
+    if (select(maxFd + 1, &readSet, &writeSet, NULL, &timeout) < 0)
+        return;
+
+    if (FD_ISSET(doorbellFd, &readSet))
+    {
+        uint8_t rings[16];
+        while (recv(doorbellFd, rings, sizeof(rings), 0) > 0);
+    }
+    if (FD_ISSET(listenFd, &readSet))
+        accept();
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        if (clients[i].fd >= 0 && FD_ISSET(clients[i].fd, &readSet))
+            receive(clients[i]);
+    }
+    pushLatest();
+    uint32_t now = DexcomPlatform::millis();
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        DexcomServerClient &client = clients[i];
+        if (client.fd >= 0 && client.out != NULL && FD_ISSET(client.fd, &writeSet))
+            flush(client);
+        if (client.fd >= 0 && client.out != NULL && now - client.sendStartMs > SERVER_SEND_TIMEOUT_MS)
+        {
+            stats.dropped++;
+            drop(client);
+        }
+    }
+}
+
+uint16_t DexcomServer::get_port() { return port; }
+const DexcomServerStats &DexcomServer::get_stats() { return stats; }
+
+int DexcomServer::clientCount()
+{
+    int count = 0;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+        if (clients[i].fd >= 0) count++;
+    return count;
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+void DexcomServer::accept()
+{
+    int fd;
+    while ((fd = ::accept(listenFd, NULL, NULL)) >= 0)
+    {
+        DexcomServerClient* client = NULL;
+        for (int i = 0; i < SERVER_MAX_CLIENTS && client == NULL; i++)
+            if (clients[i].fd < 0) client = &clients[i];
+        if (client == NULL || !nonBlocking(fd))
+        {
+            stats.rejected++;
+            close(fd);
+            continue;
+        }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));                                           // Every response and frame leaves in one send.
+        client->fd = fd;
+        client->state = SERVER_CLIENT_REQUEST;
+        client->requestLength = 0;
+        client->out = NULL;
+        client->slot = -1;
+        client->push = false;
+        client->upgrade = false;
+        client->pushed = 0;
+        client->sendStartMs = DexcomPlatform::millis();
+        stats.accepted++;
+    }
+}
+
+/**
+ * Collects the request until the end of its headers. A live client only ever sends control frames,
+ * a close frame ends it, anything else is read and ignored.
+ */
+void DexcomServer::receive(DexcomServerClient &client)
+{
+    if (client.state == SERVER_CLIENT_LIVE)
+    {
+        uint8_t frame[64];
+        ssize_t received = recv(client.fd, frame, sizeof(frame), 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || (received > 0 && (frame[0] & 0x0f) == 0x08))
+            drop(client);
+        return;
+    }
+    ssize_t received = recv(client.fd, client.request + client.requestLength, SERVER_REQUEST_SIZE - 1 - client.requestLength, 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        drop(client);
+        return;
+    }
+    if (received < 0)
+        return;
+    client.requestLength += received;
+    client.request[client.requestLength] = 0;
+    if (strstr(client.request, "\r\n\r\n") != NULL)
+        route(client);
+    else if (client.requestLength >= SERVER_REQUEST_SIZE - 1)
+        respond(client, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, -1);
+}
+
+static bool pathIs(const char* path, const char* name)
+{
+    size_t length = strlen(name);
+    return strncmp(path, name, length) == 0 && (path[length] == ' ' || path[length] == '?');
+}
+
+void DexcomServer::route(DexcomServerClient &client)
+{
+    const char* path = client.request + 4;
+    if (strncmp(client.request, "GET ", 4) != 0)
+        respond(client, NOT_ALLOWED, sizeof(NOT_ALLOWED) - 1, -1);
+    else if (pathIs(path, "/") || pathIs(path, "/index.html"))
+        respond(client, INDEX_PAGE, sizeof(INDEX_PAGE) - 1, -1);
+    else if (pathIs(path, "/reading") || pathIs(path, "/history"))
+    {
+        int slot = acquire();
+        if (slot < 0)
+            respond(client, NO_READING, sizeof(NO_READING) - 1, -1);
+        else if (path[1] == 'r')
+            respond(client, slots[slot].reading, slots[slot].readingLength, slot);
+        else
+            respond(client, slots[slot].history, slots[slot].historyLength, slot);
+    }
+    else if (pathIs(path, "/live"))
+    {
+        if (!handshake(client))
+            respond(client, BAD_REQUEST, sizeof(BAD_REQUEST) - 1, -1);
+        else
+        {
+            client.upgrade = true;
+            respond(client, client.handshake, strlen(client.handshake), -1);
+        }
+    }
+    else
+        respond(client, NOT_FOUND, sizeof(NOT_FOUND) - 1, -1);
+}
+
+void DexcomServer::respond(DexcomServerClient &client, const void* data, size_t length, int slot)
+{
+    if (client.state != SERVER_CLIENT_LIVE)
+        client.state = SERVER_CLIENT_RESPONSE;
+    client.out = (const uint8_t*)data;
+    client.outLength = length;
+    client.outSent = 0;
+    client.slot = slot;
+    client.sendStartMs = DexcomPlatform::millis();
+    flush(client);
+}
+
+/**
+ * Sends as much as the socket takes. A finished HTTP response closes the connection, a finished handshake
+ * turns the client live, a finished frame waits for the next reading.
+ */
+void DexcomServer::flush(DexcomServerClient &client)
+{
+    while (client.outSent < client.outLength)
+    {
+        ssize_t sent = send(client.fd, client.out + client.outSent, client.outLength - client.outSent, MSG_NOSIGNAL);
+        if (sent > 0)
+            client.outSent += sent;
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+        {
+            drop(client);
+            return;
+        }
+    }
+    if (client.push)
+    {
+        DexcomPerfStamp published = slots[client.slot].published;
+        published.cycles = DexcomPlatform::cycleCount();                                                                // Started on another task, its cycle count means nothing here.
+        DexcomPerf::stop(PERF_SERVER_PUSH, published);
+        stats.pushes++;
+        client.push = false;
+        release(client);
+        client.out = NULL;
+    }
+    else if (client.upgrade)
+    {
+        client.upgrade = false;
+        client.state = SERVER_CLIENT_LIVE;
+        client.out = NULL;
+    }
+    else
+    {
+        stats.responses++;
+        drop(client);
+    }
+}
+
+/**
+ * Live clients that are idle and behind get the frame of the newest snapshot, a client that missed a reading
+ * while it was still sending goes straight to the newest.
+ */
+void DexcomServer::pushLatest()
+{
+    int newest = current.load(std::memory_order_acquire);
+    if (newest < 0)
+        return;
+    uint32_t generation = slots[newest].generation;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        DexcomServerClient &client = clients[i];
+        if (client.fd < 0 || client.state != SERVER_CLIENT_LIVE || client.out != NULL || client.pushed == generation)
+            continue;
+        int slot = acquire();
+        if (slot < 0)
+            return;
+        client.pushed = slots[slot].generation;
+        client.push = true;
+        respond(client, slots[slot].frame, slots[slot].frameLength, slot);
+    }
+}
+
+/**
+ * Takes a use of the current slot, the publisher never writes the current one and waits for the count to reach 0.
+ */
+int DexcomServer::acquire()
+{
+    for (;;)
+    {
+        int slot = current.load(std::memory_order_acquire);
+        if (slot < 0)
+            return -1;
+        int count = users[slot].load(std::memory_order_acquire);
+        while (count >= 0)
+        {
+            if (users[slot].compare_exchange_weak(count, count + 1, std::memory_order_acquire))
+                return slot;
+        }
+    }
+}
+
+void DexcomServer::release(DexcomServerClient &client)
+{
+    if (client.slot >= 0)
+        users[client.slot].fetch_sub(1, std::memory_order_release);
+    client.slot = -1;
+}
+
+void DexcomServer::drop(DexcomServerClient &client)
+{
+    release(client);
+    close(client.fd);
+    client.fd = -1;
+    client.state = SERVER_CLIENT_FREE;
+    client.out = NULL;
+    client.push = false;
+    client.upgrade = false;
+}
+
+/**
+ * The upgrade answer of RFC 6455, Sec-WebSocket-Accept is the base64 SHA-1 of the key and the GUID.
+ */
+bool DexcomServer::handshake(DexcomServerClient &client)
+{
+    static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const char* key = NULL;
+    for (const char* line = strstr(client.request, "\r\n"); line != NULL && key == NULL; line = strstr(line + 2, "\r\n"))
+        if (strncasecmp(line + 2, "Sec-WebSocket-Key:", 18) == 0) key = line + 20;
+    if (key == NULL)
+        return false;
+    while (*key == ' ') key++;
+    size_t keyLength = strcspn(key, " \r");
+    if (keyLength == 0 || keyLength > 64)
+        return false;
+
+    uint8_t hash[21];
+    mbedtls_sha1_context context;
+    mbedtls_sha1_init(&context);
+    mbedtls_sha1_starts(&context);
+    mbedtls_sha1_update(&context, (const unsigned char*)key, keyLength);
+    mbedtls_sha1_update(&context, (const unsigned char*)WEBSOCKET_GUID, sizeof(WEBSOCKET_GUID) - 1);
+    mbedtls_sha1_finish(&context, hash);
+    mbedtls_sha1_free(&context);
+    hash[20] = 0;
+
+    char accept[29];
+    for (int i = 0, o = 0; i < 21; i += 3)                                                                              // 20 bytes, the last group is padded with one '='.
+    {
+        uint32_t group = (hash[i] << 16) | (hash[i + 1] << 8) | (i + 2 < 21 ? hash[i + 2] : 0);
+        accept[o++] = BASE64[(group >> 18) & 0x3f];
+        accept[o++] = BASE64[(group >> 12) & 0x3f];
+        accept[o++] = i + 1 < 20 ? BASE64[(group >> 6) & 0x3f] : '=';
+        accept[o++] = i + 2 < 20 ? BASE64[group & 0x3f] : '=';
+    }
+    accept[28] = 0;
+    snprintf(client.handshake, sizeof(client.handshake),
+             "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    return true;
+}
+
+size_t DexcomServer::formatJson(char* json, size_t size, const DexcomReading &reading, uint32_t date)
+{
+    char dateText[16] = "null";
+    if (date != 0)
+        snprintf(dateText, sizeof(dateText), "%lu000", (unsigned long)date);
+    int length = snprintf(json, size, "{\"dextime\":%lu,\"date\":%s,\"sgv\":%u,\"trend\":%d,\"direction\":\"%s\"}",
+                          (unsigned long)reading.dextime, dateText, reading.glucose, reading.trend, DexcomUploader::direction(reading.trend));
+    return length > 0 && (size_t)length < size ? length : 0;
+}
+
+/**
+ * The stored readings of the day before the newest as [dextime, sgv, trend], with the dextime and date of the newest
+ * so a client can date the others. The body is written behind room for the header and moved up to it.
+ */
+size_t DexcomServer::formatHistory(char* buffer, const DexcomReading &newest, uint32_t date)
+{
+    const size_t headerRoom = 192;
+    char* body = buffer + headerRoom;
+    size_t capacity = SERVER_HISTORY_SIZE - headerRoom;
+    char dateText[16] = "null";
+    if (date != 0)
+        snprintf(dateText, sizeof(dateText), "%lu000", (unsigned long)date);
+    size_t length = snprintf(body, capacity, "{\"dextime\":%lu,\"date\":%s,\"readings\":[", (unsigned long)newest.dextime, dateText);
+
+    DexcomHistoryCursor cursor;
+    DexcomReading reading;
+    int count = 0;
+    bool newestStored = false;
+    uint32_t since = newest.dextime > 24*60*60 ? newest.dextime - 24*60*60 : 0;
+    if (DexcomHistory::seek(&cursor, since))
+    {
+        while (count < SERVER_HISTORY_READINGS - 1 && DexcomHistory::next(&cursor, &reading) && reading.dextime <= newest.dextime)
+        {
+            length += snprintf(body + length, capacity - length, "%s[%lu,%u,%d]", count > 0 ? "," : "",
+                               (unsigned long)reading.dextime, reading.glucose, reading.trend);
+            newestStored = reading.dextime == newest.dextime;
+            count++;
+        }
+    }
+    if (!newestStored)                                                                                                  // Not in the history while a backfill is left.
+        length += snprintf(body + length, capacity - length, "%s[%lu,%u,%d]", count > 0 ? "," : "",
+                           (unsigned long)newest.dextime, newest.glucose, newest.trend);
+    length += snprintf(body + length, capacity - length, "]}");
+
+    char header[headerRoom];
+    size_t headerLength = snprintf(header, sizeof(header), JSON_HEADER, (unsigned)length);
+    memmove(buffer + headerLength, body, length);
+    memcpy(buffer, header, headerLength);
+    return headerLength + length;
+}
@@ -0,0 +1,110 @@
+/**
+ * Header File with the local HTTP / WebSocket server for the readings
+ * GET / is a small live page, GET /reading the newest reading, GET /history the last day and GET /live upgrades to a
+ * WebSocket that gets every new reading as a text frame. The responses are serialized once per reading into a snapshot
+ * slot and every client sends straight from the slot, nothing is copied per client. A slot is only written again once no
+ * client sends from it, the users count guards it (-1 while the publisher writes it).
+ * Written on BSD sockets, lwIP provides them on the board and the same code runs on Linux. One task runs service(),
+ * the history owner calls publish(), a loopback UDP socket wakes the server task for the push.
+ */
+
+#ifndef DEXCOMSERVER_H
+#define DEXCOMSERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "DexcomCodec.h"
+#include "DexcomPerf.h"
+
+#define SERVER_MAX_CLIENTS      8
+#define SERVER_SLOTS            3                                                                                       // Current, previous and the one being written.
+#define SERVER_HISTORY_READINGS 288                                                                                     // A day in /history.
+#define SERVER_READING_SIZE     384                                                                                     // Whole HTTP responses, headers included.
+#define SERVER_HISTORY_SIZE     (SERVER_HISTORY_READINGS * 24 + 256)
+#define SERVER_FRAME_SIZE       256                                                                                     // WebSocket text frame with the reading.
+#define SERVER_JSON_SIZE        192
+#define SERVER_REQUEST_SIZE     512                                                                                     // Request line and headers must fit.
+#define SERVER_HANDSHAKE_SIZE   160
+#define SERVER_SEND_TIMEOUT_MS  10000                                                                                   // A client that takes longer for one response or frame is dropped.
+
+#define SERVER_CLIENT_FREE      0
+#define SERVER_CLIENT_REQUEST   1                                                                                       // Reading the request.
+#define SERVER_CLIENT_RESPONSE  2                                                                                       // Sending a response, closed after it.
+#define SERVER_CLIENT_LIVE      3                                                                                       // WebSocket, gets the frame of every new snapshot.
+
+typedef struct
+{
+    uint32_t generation;            // Counts the published readings, 0 is none.
+    DexcomPerfStamp published;
+    size_t readingLength;
+    size_t historyLength;
+    size_t frameLength;
+    char reading[SERVER_READING_SIZE];
+    char history[SERVER_HISTORY_SIZE];
+    uint8_t frame[SERVER_FRAME_SIZE];
+} DexcomServerSnapshot;
+
+typedef struct
+{
+    int fd;
+    uint8_t state;
+    char request[SERVER_REQUEST_SIZE];
+    size_t requestLength;
+    const uint8_t* out;             // Response being sent, in a slot, in flash or in handshake.
+    size_t outLength;
+    size_t outSent;
+    int slot;                       // Slot out points into, -1 when it does not.
+    bool push;                      // out is the frame of a push.
+    bool upgrade;                   // Turns live once the handshake is out.
+    uint32_t pushed;                // Generation of the last frame sent to a live client.
+    uint32_t sendStartMs;
+    char handshake[SERVER_HANDSHAKE_SIZE];
+} DexcomServerClient;
+
+typedef struct
+{
+    uint32_t accepted;              // Connections taken.
+    uint32_t rejected;              // Connections closed at once, all clients busy.
+    uint32_t responses;             // HTTP responses sent.
+    uint32_t pushes;                // Frames sent to live clients.
+    uint32_t dropped;               // Clients closed for being too slow.
+    uint32_t snapshots;
+    uint32_t skipped;               // Readings not published, no free slot.
+} DexcomServerStats;
+
+class DexcomServer
+{
+    static int listenFd;
+    static int doorbellFd;
+    static uint16_t port;
+    static DexcomServerSnapshot slots[SERVER_SLOTS];
+    static std::atomic<int> users[SERVER_SLOTS];
+    static std::atomic<int> current;                                                                                    // Newest slot, -1 before the first reading.
+    static DexcomServerClient clients[SERVER_MAX_CLIENTS];
+    static DexcomServerStats stats;
+
+    public:
+        static bool setup(uint16_t listenPort);                                                                         // 0 takes a free port.
+        static bool publish(const DexcomReading &reading, uint32_t transmitterNow);                                     // History owner only, false when no slot was free.
+        static void service(uint32_t timeoutMs);                                                                        // Server task, waits up to timeoutMs for the sockets.
+        static uint16_t get_port();
+        static int clientCount();
+        static const DexcomServerStats &get_stats();
+
+    private:
+        static void accept();
+        static void receive(DexcomServerClient &client);
+        static void route(DexcomServerClient &client);
+        static void respond(DexcomServerClient &client, const void* data, size_t length, int slot);
+        static void flush(DexcomServerClient &client);
+        static void pushLatest();
+        static int acquire();
+        static void release(DexcomServerClient &client);
+        static void drop(DexcomServerClient &client);
+        static bool handshake(DexcomServerClient &client);
+        static size_t formatJson(char* json, size_t size, const DexcomReading &reading, uint32_t date);
+        static size_t formatHistory(char* buffer, const DexcomReading &newest, uint32_t date);
+};
+
+#endif /* DEXCOMSERVER_H */
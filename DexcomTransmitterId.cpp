@@ -0,0 +1,107 @@
+/*
+ * DexcomTransmitterId
+ */
+
+
+#include <string.h>
+#include "DexcomTransmitterId.h"
+
+
+static const uint8_t glucoseTxG5[3] = {0x30, 0x53, 0x36};                                                               // G5 = 0x30 the other 2 bytes are the CRC16 XMODEM value in twisted order
+static const uint8_t glucoseTxG6[3] = {0x4e, 0x0a, 0xa9};                                                               // G6 = 0x4e
+
+DexcomTransmitterId::DexcomTransmitterId()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+DexcomTransmitterId::DexcomTransmitterId(const char* text)
+{
+    memset(this, 0, sizeof(*this));
+    set(text);
+}
+
+bool DexcomTransmitterId::valid(const char* text)
+{
+    if (text == NULL || strlen(text) != TRANSMITTER_ID_LENGTH)
+        return false;
+    for (int i = 0; i < TRANSMITTER_ID_LENGTH; i++)
+    {
+        if (!((text[i] >= '0' && text[i] <= '9') || (text[i] >= 'A' && text[i] <= 'Z')))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Validates the ID and precomputes the derived fields, so the hot paths only read them.
+ */
+bool DexcomTransmitterId::set(const char* text)
+{
+    if (!valid(text))
+        return false;
+    memcpy(id, text, TRANSMITTER_ID_LENGTH + 1);
+    derive();
+    return true;
+}
+
+/**
+ * The code is kept as the ASCII digits, DexcomAuth hands them to the handshake as the password.
+ */
+bool DexcomTransmitterId::setPairingCode(const char* code)
+{
+    if (code == NULL || code[0] == 0)
+        pairingCode[0] = 0;
+    else
+    {
+        if (strlen(code) != PAIRING_CODE_LENGTH)
+            return false;
+        for (int i = 0; i < PAIRING_CODE_LENGTH; i++)
+        {
+            if (code[i] < '0' || code[i] > '9')
+                return false;
+        }
+        memcpy(pairingCode, code, PAIRING_CODE_LENGTH + 1);
+    }
+    if (isSet())
+        derive();
+    return true;
+}
+
+bool DexcomTransmitterId::matchesName(const char* name) const
+{
+    return name != NULL && isSet() && (strcmp(name, advertisedName) == 0 || strcmp(name, id) == 0);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                          PRIVATE                                                              //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+void DexcomTransmitterId::derive()
+{
+    bool g7 = pairingCode[0] != 0;
+    memcpy(advertisedName, g7 ? "DXCM" : "Dexcom", g7 ? 4 : 6);
+    advertisedNameLength = g7 ? 6 : 8;
+    memcpy(&advertisedName[advertisedNameLength - 2], &id[4], 2);
+    advertisedName[advertisedNameLength] = 0;
+
+    if (g7)
+        family = TRANSMITTER_FAMILY_G7;
+    else if (id[0] == '8' && id[1] == 'G')
+        family = TRANSMITTER_FAMILY_G6_PLUS;
+    else if (id[0] == '8')
+        family = TRANSMITTER_FAMILY_G6;
+    else
+        family = TRANSMITTER_FAMILY_G5;
+
+    key[0] = '0'; key[1] = '0';
+    memcpy(&key[2], id, TRANSMITTER_ID_LENGTH);
+    key[8] = '0'; key[9] = '0';
+    memcpy(&key[10], id, TRANSMITTER_ID_LENGTH);
+
+    memcpy(glucoseTx, isG6() ? glucoseTxG6 : glucoseTxG5, sizeof(glucoseTx));
+    glucoseRxOpcode = isG6() ? 0x4f : 0x31;
+    sensorScale = isG6() ? 34 : 1;
+}
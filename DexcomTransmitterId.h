@@ -0,0 +1,53 @@
+/**
+ * Header File with the transmitter ID value type
+ * Holds one validated 6 character ID and everything derived from it, computed once when the ID is set:
+ * the transmitter family, the names it advertises, the AES key of the auth handshake and the family opcodes.
+ * A G7 / ONE+ sensor is selected by also setting its 4 digit pairing code, the password of the EC J-PAKE handshake.
+ * Portable, used by the session, the scan callback and the host tools.
+ */
+
+#ifndef DEXCOMTRANSMITTERID_H
+#define DEXCOMTRANSMITTERID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRANSMITTER_ID_LENGTH   6
+#define PAIRING_CODE_LENGTH     4
+
+// Firmware family, selects the opcodes. See https://github.com/xdrip-js/xdrip-js/issues/87
+#define TRANSMITTER_FAMILY_G5       0
+#define TRANSMITTER_FAMILY_G6       1                                                                                   // ID starts with 8.
+#define TRANSMITTER_FAMILY_G6_PLUS  2                                                                                   // ID starts with 8G, same opcodes as the G6.
+#define TRANSMITTER_FAMILY_G7       3                                                                                   // A pairing code is set, the ID only names the sensor.
+
+class DexcomTransmitterId
+{
+    public:
+        char id[TRANSMITTER_ID_LENGTH + 1];
+        char advertisedName[9];                                                                                         // "Dexcom" and the last two characters, the full ID is the other name. "DXCM" on a G7.
+        uint8_t advertisedNameLength;
+        char pairingCode[PAIRING_CODE_LENGTH + 1];                                                                      // Empty unless G7.
+        uint8_t family;
+        uint8_t key[16];                                                                                                // AES-128 key "00" ID "00" ID.
+        uint8_t glucoseTx[3];                                                                                           // Glucose request with its CRC.
+        uint8_t glucoseRxOpcode;
+        uint8_t sensorScale;                                                                                            // Factor of the raw sensor values.
+
+        DexcomTransmitterId();
+        explicit DexcomTransmitterId(const char* text);
+
+        bool set(const char* text);                                                                                     // False and unchanged when text is not a valid ID.
+        bool setPairingCode(const char* code);                                                                          // 4 digits selects the G7 family, NULL or "" goes back to the ID's family.
+        bool isSet() const { return id[0] != 0; }
+        bool isG6() const { return family != TRANSMITTER_FAMILY_G5; }
+        bool isG7() const { return family == TRANSMITTER_FAMILY_G7; }
+        bool matchesName(const char* name) const;                                                                       // True for either name the transmitter advertises.
+
+        static bool valid(const char* text);                                                                            // Exactly 6 characters, digits and upper case letters.
+
+    private:
+        void derive();
+};
+
+#endif /* DEXCOMTRANSMITTERID_H */
@@ -0,0 +1,39 @@
+/**
+ * Header File with the transport interface between the protocol code and the radio
+ * One implementation per link: the ESP32 BLE client (DexcomBLETransport in G6DexcomBLE.h),
+ * or host side links that run the same session code on Linux.
+ */
+
+#ifndef DEXCOMTRANSPORT_H
+#define DEXCOMTRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class DexcomTransport
+{
+    public:
+        virtual ~DexcomTransport() {}
+
+        virtual bool connect() = 0;                                                                                     // Connect to the found transmitter and register on the auth characteristic.
+        virtual bool isConnected() = 0;
+        virtual bool disconnect() = 0;                                                                                  // Send the disconnect command and wait until the link is down.
+        virtual void fault(const char* message) = 0;                                                                    // Mark the session as failed and drop the link.
+        virtual bool lastConnectionWasError() = 0;
+
+        virtual bool readDeviceInformations() = 0;
+        virtual void prepareBond() = 0;                                                                                 // Called after authentication, before the bond request is sent.
+        virtual bool waitForBond() = 0;                                                                                 // Blocks until the link is bonded, false when the link dropped.
+
+        virtual bool authSend(uint8_t* pData, size_t length) = 0;
+        virtual size_t authReceive(uint8_t* pData, size_t max_length) = 0;                                             // Blocks until a value arrived, 0 when the link dropped.
+        virtual bool controlRegister() = 0;
+        virtual bool controlSend(uint8_t* pData, size_t length) = 0;
+        virtual size_t controlReceive(uint8_t* pData, size_t max_length) = 0;
+        virtual size_t controlPoll(uint8_t* pData, size_t max_length) = 0;                                             // Next control value that already arrived, 0 without waiting when there is none.
+        virtual bool backfillRegister() = 0;
+        virtual size_t backfillReceive(uint8_t* pData, size_t max_length) = 0;
+        virtual size_t backfillPoll(uint8_t* pData, size_t max_length) = 0;                                            // Next backfill value that already arrived, 0 without waiting when there is none.
+};
+
+#endif /* DEXCOMTRANSPORT_H */
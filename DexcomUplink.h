@@ -0,0 +1,28 @@
+/**
+ * Header File with the uplink interface between the uploader and the network
+ * One byte stream to the upload server plus the power of the radio under it, so the uploader decides
+ * how long the radio is on. G6DexcomWifi.h implements it on the Wi-Fi of the board,
+ * host/DexcomSocketUplink.h on a plain TCP socket.
+ */
+
+#ifndef DEXCOMUPLINK_H
+#define DEXCOMUPLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class DexcomUplink
+{
+    public:
+        virtual ~DexcomUplink() {}
+
+        virtual bool radioOn() = 0;                                                                                     // Powers the radio and joins the network, blocks until the server can be reached or it gave up.
+        virtual void radioOff() = 0;                                                                                    // Closes the connection and powers the radio down.
+        virtual bool open() = 0;                                                                                        // Connects to the server, true at once while the last connection is still open.
+        virtual bool isOpen() = 0;
+        virtual void close() = 0;
+        virtual bool write(const uint8_t* data, size_t length) = 0;                                                     // All or nothing, a failed write closes the connection.
+        virtual size_t read(uint8_t* buffer, size_t max_length, uint32_t timeoutMs) = 0;                               // Waits for at least one byte, 0 on timeout or when the server closed.
+};
+
+#endif /* DEXCOMUPLINK_H */
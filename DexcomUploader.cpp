@@ -0,0 +1,328 @@
+/*
+ * DexcomUploader
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include "mbedtls/sha1.h"
+#include "DexcomUploader.h"
+#include "DexcomHistory.h"
+#include "DexcomPlatform.h"
+#include "DexcomPerf.h"
+#include "DebugHelper.h"
+
+
+DexcomUplink* DexcomUploader::uplink = NULL;
+const char* DexcomUploader::host = "";
+char DexcomUploader::secret[UPLOAD_SECRET_SIZE];
+std::atomic<bool> DexcomUploader::busy(false);
+DexcomReading DexcomUploader::staged[UPLOAD_QUEUE_READINGS];
+size_t DexcomUploader::stagedCount = 0;
+uint32_t DexcomUploader::stagedDextime = 0;
+uint32_t DexcomUploader::stagedMs = 0;
+uint32_t DexcomUploader::stagedEpoch = 0;
+uint32_t DexcomUploader::sentDextime = 0;
+uint32_t DexcomUploader::sentEpoch = 0;
+int DexcomUploader::backoff = 0;
+int DexcomUploader::skip = 0;
+char DexcomUploader::request[UPLOAD_HEADER_SIZE + UPLOAD_BODY_SIZE];
+uint8_t DexcomUploader::response[UPLOAD_RESPONSE_SIZE];
+DexcomUploadStats DexcomUploader::stats = {};
+
+/**
+ * Nightscout checks the api-secret header against the SHA-1 of its API_SECRET, only the hash is kept.
+ * The queue position and the backoff come back from storage.
+ */
+void DexcomUploader::setup(DexcomUplink* link, const char* serverHost, const char* apiSecret)
+{
+    uplink = link;
+    host = serverHost;
+    uint8_t hash[20];
+    mbedtls_sha1_context context;
+    mbedtls_sha1_init(&context);
+    mbedtls_sha1_starts(&context);
+    mbedtls_sha1_update(&context, (const unsigned char*)apiSecret, strlen(apiSecret));
+    mbedtls_sha1_finish(&context, hash);
+    mbedtls_sha1_free(&context);
+    for (int i = 0; i < 20; i++)
+        snprintf(&secret[2 * i], 3, "%02x", hash[i]);
+
+    sentDextime = (uint32_t)DexcomPlatform::storageGetInt("NsSent", 0);
+    sentEpoch = (uint32_t)DexcomPlatform::storageGetInt("NsEpoch", 0);
+    backoff = DexcomPlatform::storageGetInt("NsBackoff", 0);
+    skip = DexcomPlatform::storageGetInt("NsSkip", 0);
+}
+
+/**
+ * Copies the readings after the last acknowledged one, called once per window by the history owner.
+ * transmitterNow is the transmitter clock at this moment, upload() dates the readings from it. After a transmitter swap
+ * the seek stays in the new epoch, the readings of the old transmitter can not be dated with the new clock.
+ */
+size_t DexcomUploader::stage(uint32_t transmitterNow)
+{
+    if (uplink == NULL || busy.load(std::memory_order_acquire))
+        return 0;
+    if (skip > 0)
+    {
+        skip--;
+        DexcomPlatform::storagePutInt("NsSkip", skip);
+        SerialPrintf(DEBUG, "Upload: backing off, %d windows left.\n\r", skip);
+        return 0;
+    }
+
+    DexcomReading newest;
+    if (!DexcomHistory::latest(&newest))
+        return 0;
+    uint32_t epoch = DexcomHistory::get_epoch();
+    if (sentDextime == 0 || sentEpoch != epoch || sentDextime > newest.dextime)                                         // First burst, or a new transmitter started over.
+        sentDextime = newest.dextime > UPLOAD_FIRST_SEC ? newest.dextime - UPLOAD_FIRST_SEC : 1;
+
+    DexcomHistoryCursor cursor;
+    DexcomReading reading;
+    stagedCount = 0;
+    if (DexcomHistory::seek(&cursor, sentDextime))
+    {
+        while (stagedCount < UPLOAD_QUEUE_READINGS && DexcomHistory::next(&cursor, &reading))
+        {
+            if (reading.dextime > transmitterNow)                                                                       // Can not be dated with this clock.
+                break;
+            staged[stagedCount++] = reading;
+        }
+    }
+    if (stagedCount == 0)
+        return 0;
+    stagedDextime = transmitterNow;
+    stagedEpoch = epoch;
+    stagedMs = DexcomPlatform::millis();
+    busy.store(true, std::memory_order_release);
+    return stagedCount;
+}
+
+/**
+ * Switches the radio on, posts the staged readings in batches and switches it off again.
+ * Each acknowledged batch moves the queue position, a failure keeps the rest for a later window.
+ */
+bool DexcomUploader::upload()
+{
+    if (!busy.load(std::memory_order_acquire))
+        return true;
+    DexcomPerfStamp radio = DexcomPerf::start();
+    uint32_t requests = stats.requests;
+    size_t done = 0;
+    bool ok = uplink->radioOn();
+    if (!ok)
+        SerialPrintln(ERROR, "Upload: no network.");
+    else if (DexcomPlatform::epochSeconds() == 0)
+    {
+        SerialPrintln(ERROR, "Upload: the wall clock is not set, readings can not be dated.");
+        ok = false;
+    }
+    while (ok && done < stagedCount)
+    {
+        size_t count = stagedCount - done < UPLOAD_BATCH_READINGS ? stagedCount - done : UPLOAD_BATCH_READINGS;
+        ok = post(&staged[done], count);
+        if (ok)
+        {
+            done += count;
+            stats.readings += count;
+            sentDextime = staged[done - 1].dextime;
+            DexcomPlatform::storagePutInt("NsSent", (int)sentDextime);
+            if (sentEpoch != stagedEpoch)
+            {
+                sentEpoch = stagedEpoch;
+                DexcomPlatform::storagePutInt("NsEpoch", (int)sentEpoch);
+            }
+        }
+    }
+    uplink->radioOff();
+    DexcomPerf::stop(PERF_UPLOAD_RADIO, radio);
+
+    uint32_t radioMs = (uint32_t)((DexcomPlatform::micros() - radio.micros) / 1000);
+    stats.bursts++;
+    stats.radioMs += radioMs;
+    SerialPrintf(DATA, "Upload: %d of %d readings in %d requests, radio on %d ms\n\r", (int)done, (int)stagedCount,
+                 (int)(stats.requests - requests), (int)radioMs);
+    finishBurst(ok);
+    return ok;
+}
+
+bool DexcomUploader::isBusy() { return busy.load(std::memory_order_acquire); }
+uint32_t DexcomUploader::get_sentDextime() { return sentDextime; }
+const DexcomUploadStats &DexcomUploader::get_stats() { return stats; }
+
+/**
+ * The Dexcom trend arrows, 127 is sent when the rate can not be computed.
+ */
+const char* DexcomUploader::direction(int8_t trend)
+{
+    if (trend == 127) return "NOT COMPUTABLE";
+    if (trend >= 30) return "DoubleUp";
+    if (trend >= 20) return "SingleUp";
+    if (trend >= 10) return "FortyFiveUp";
+    if (trend > -10) return "Flat";
+    if (trend > -20) return "FortyFiveDown";
+    if (trend > -30) return "SingleDown";
+    return "DoubleDown";
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * One request with the batch, the header goes right in front of the body so it leaves in one write.
+ * A kept alive connection the server already dropped is opened again once.
+ */
+bool DexcomUploader::post(const DexcomReading* readings, size_t count)
+{
+    char* body = request + UPLOAD_HEADER_SIZE;
+    size_t bodyLength = formatBody(body, readings, count);
+    if (bodyLength == 1)
+        return true;                                                                                                    // Nothing in the batch Nightscout would take.
+    if (bodyLength == 0)
+        return false;
+    char header[UPLOAD_HEADER_SIZE];
+    int headerLength = snprintf(header, sizeof(header),
+                                "POST /api/v1/entries HTTP/1.1\r\nHost: %s\r\napi-secret: %s\r\n"
+                                "Content-Type: application/json\r\nContent-Length: %u\r\nConnection: keep-alive\r\n\r\n",
+                                host, secret, (unsigned)bodyLength);
+    if (headerLength <= 0 || headerLength >= (int)sizeof(header))
+        return false;
+    char* start = body - headerLength;
+    memcpy(start, header, headerLength);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool reused = uplink->isOpen();
+        if (!uplink->open())
+            return false;
+        DexcomPerfStamp stamp = DexcomPerf::start();
+        stats.requests++;
+        stats.bytes += headerLength + bodyLength;
+        bool keepAlive = true;
+        int status = uplink->write((const uint8_t*)start, headerLength + bodyLength) ? receiveResponse(&keepAlive) : -1;
+        DexcomPerf::stop(PERF_UPLOAD_POST, stamp);
+        if (!keepAlive || status < 0)
+            uplink->close();
+        if (status < 0 && reused)
+            continue;
+        if (status >= 200 && status < 300)
+            return true;
+        SerialPrintf(ERROR, "Upload: request failed, status %d\n\r", status);
+        return false;
+    }
+    return false;
+}
+
+/**
+ * JSON array of sgv entries, dated through the transmitter clock of stage() and the wall clock now.
+ * Readings without a glucose value are left out, they still count as sent. Returns 1 when none is left, 0 on overflow.
+ */
+size_t DexcomUploader::formatBody(char* body, const DexcomReading* readings, size_t count)
+{
+    uint32_t transmitterNow = stagedDextime + (DexcomPlatform::millis() - stagedMs) / 1000;
+    uint32_t epoch = DexcomPlatform::epochSeconds();
+    size_t length = 0;
+    body[length++] = '[';
+    for (size_t i = 0; i < count; i++)
+    {
+        if (readings[i].glucose < 39 || readings[i].glucose > 401)
+            continue;
+        uint32_t date = epoch - (transmitterNow - readings[i].dextime);
+        int written = snprintf(body + length, UPLOAD_BODY_SIZE - length,
+                               "%s{\"type\":\"sgv\",\"device\":\"Flying-CGM\",\"date\":%lu000,\"sgv\":%u,\"direction\":\"%s\"}",
+                               length > 1 ? "," : "", (unsigned long)date, readings[i].glucose, direction(readings[i].trend));
+        if (written <= 0 || length + written >= UPLOAD_BODY_SIZE - 1)                                                   // Not with UPLOAD_ENTRY_SIZE, but never send a cut entry.
+            return 0;
+        length += written;
+    }
+    if (length == 1)
+        return 1;
+    body[length++] = ']';
+    return length;
+}
+
+/**
+ * Reads the status line and the headers, then drains a body of known length so the connection can be used again.
+ * Without a Content-Length the end of the body is unknown and the connection is not kept.
+ */
+int DexcomUploader::receiveResponse(bool* keepAlive)
+{
+    size_t filled = 0;
+    char* headersEnd = NULL;
+    while (headersEnd == NULL)
+    {
+        if (filled >= sizeof(response) - 1)
+            return -1;
+        size_t received = uplink->read(response + filled, sizeof(response) - 1 - filled, UPLOAD_RESPONSE_TIMEOUT_MS);
+        if (received == 0)
+            return -1;
+        filled += received;
+        response[filled] = 0;
+        headersEnd = strstr((char*)response, "\r\n\r\n");
+    }
+    int status = -1;
+    if (sscanf((const char*)response, "HTTP/1.%*d %d", &status) != 1)
+        return -1;
+
+    long contentLength = -1;
+    for (char* line = strstr((char*)response, "\r\n"); line != NULL && line < headersEnd; line = strstr(line + 2, "\r\n"))
+    {
+        char* name = line + 2;
+        if (strncasecmp(name, "content-length:", 15) == 0)
+            contentLength = strtol(name + 15, NULL, 10);
+        else if (strncasecmp(name, "connection:", 11) == 0)
+        {
+            char* value = name + 11;
+            while (*value == ' ') value++;
+            if (strncasecmp(value, "close", 5) == 0)
+                *keepAlive = false;
+        }
+    }
+    if (contentLength < 0)
+    {
+        *keepAlive = false;
+        return status;
+    }
+    long left = contentLength - (long)(filled - (headersEnd + 4 - (char*)response));
+    while (left > 0)
+    {
+        size_t received = uplink->read(response, left < (long)sizeof(response) ? left : sizeof(response), UPLOAD_RESPONSE_TIMEOUT_MS);
+        if (received == 0)
+        {
+            *keepAlive = false;
+            break;
+        }
+        left -= received;
+    }
+    return status;
+}
+
+/**
+ * A complete burst ends the backoff, a failed one skips 2^n - 1 windows.
+ */
+void DexcomUploader::finishBurst(bool complete)
+{
+    int lastBackoff = backoff;
+    if (complete)
+        backoff = 0;
+    else
+    {
+        stats.failures++;
+        if (backoff < UPLOAD_BACKOFF_STEPS) backoff++;
+    }
+    skip = complete ? 0 : (1 << backoff) - 1;
+    if (backoff != lastBackoff || !complete)
+    {
+        DexcomPlatform::storagePutInt("NsBackoff", backoff);
+        DexcomPlatform::storagePutInt("NsSkip", skip);
+    }
+    busy.store(false, std::memory_order_release);
+}
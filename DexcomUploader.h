@@ -0,0 +1,77 @@
+/**
+ * Header File with the Nightscout uploader
+ * Posts the stored readings to the REST API of a Nightscout site (POST /api/v1/entries), several entries per request
+ * over one kept alive connection. The history is the offline queue: only the dextime and the history epoch of the newest
+ * acknowledged reading are kept in storage, a burst sends everything newer, oldest first. A new transmitter starts over
+ * in its own epoch. A failed burst skips the next windows, twice as many
+ * after each failure. Nightscout stores an entry once per date and type, a batch that is sent again does no harm.
+ * The history owner calls stage() after a session, the uploader task then runs upload() with the radio on,
+ * the two only meet through the busy flag. Portable, the network is reached through DexcomUplink.
+ */
+
+#ifndef DEXCOMUPLOADER_H
+#define DEXCOMUPLOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "DexcomUplink.h"
+#include "DexcomCodec.h"
+
+#define UPLOAD_BATCH_READINGS   32                                                                                      // Entries per request.
+#define UPLOAD_QUEUE_READINGS   288                                                                                     // Readings staged per burst, a day, the rest waits for the next window.
+#define UPLOAD_FIRST_SEC        (24*60*60)                                                                              // How far back the first burst starts.
+#define UPLOAD_ENTRY_SIZE       112                                                                                     // Longest JSON entry with its separator.
+#define UPLOAD_HEADER_SIZE      320
+#define UPLOAD_BODY_SIZE        (UPLOAD_BATCH_READINGS * UPLOAD_ENTRY_SIZE + 2)
+#define UPLOAD_RESPONSE_SIZE    512                                                                                     // Status line and headers of a response must fit.
+#define UPLOAD_RESPONSE_TIMEOUT_MS 5000
+#define UPLOAD_BACKOFF_STEPS    4                                                                                       // Skips 1, 3, 7 and at most 15 windows.
+#define UPLOAD_SECRET_SIZE      41                                                                                      // SHA-1 of the API secret in hex.
+
+typedef struct
+{
+    uint32_t bursts;                // Times the radio was switched on.
+    uint32_t requests;              // Requests sent, resent ones included.
+    uint32_t failures;              // Bursts that ended with readings left.
+    uint32_t readings;              // Readings the server acknowledged.
+    uint32_t bytes;                 // Request bytes, headers included.
+    uint32_t radioMs;               // Radio on time of all bursts.
+} DexcomUploadStats;
+
+class DexcomUploader
+{
+    static DexcomUplink* uplink;
+    static const char* host;
+    static char secret[UPLOAD_SECRET_SIZE];
+    static std::atomic<bool> busy;                                                                                      // Staged readings are waiting for upload(), only it clears the flag.
+    static DexcomReading staged[UPLOAD_QUEUE_READINGS];
+    static size_t stagedCount;
+    static uint32_t stagedDextime;                                                                                      // Transmitter clock when staged, with stagedMs it maps dextime to the wall clock.
+    static uint32_t stagedMs;
+    static uint32_t stagedEpoch;
+    static uint32_t sentDextime;                                                                                        // Newest acknowledged reading, 0 before the first.
+    static uint32_t sentEpoch;                                                                                          // History epoch sentDextime belongs to.
+    static int backoff;
+    static int skip;                                                                                                    // Windows left to skip.
+    static char request[UPLOAD_HEADER_SIZE + UPLOAD_BODY_SIZE];
+    static uint8_t response[UPLOAD_RESPONSE_SIZE];
+    static DexcomUploadStats stats;
+
+    public:
+        static void setup(DexcomUplink* link, const char* serverHost, const char* apiSecret);
+        static size_t stage(uint32_t transmitterNow);                                                                   // History owner only, 0 while busy, backing off or when nothing is new.
+        static bool upload();                                                                                           // One radio burst for the staged readings, false when some are left.
+        static bool isBusy();
+        static uint32_t get_sentDextime();
+        static const DexcomUploadStats &get_stats();
+        static const char* direction(int8_t trend);                                                                     // Nightscout direction of a trend in 0.1 mg/dL per minute.
+
+    private:
+        static bool post(const DexcomReading* readings, size_t count);
+        static size_t formatBody(char* body, const DexcomReading* readings, size_t count);
+        static int receiveResponse(bool* keepAlive);                                                                    // HTTP status, -1 when no complete response came.
+        static void finishBurst(bool complete);
+};
+
+#endif /* DEXCOMUPLOADER_H */
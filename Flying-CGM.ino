@@ -40,14 +40,31 @@
 
 #include <Arduino.h>
 #include <Esp.h>
-#include <Preferences.h>
-#include <OneButton.h>
 #include "BLEDevice.h"
 #include "BLEScan.h"
 #include "DebugHelper.h"
+#include "DexcomPlatform.h"
+#include "DexcomPerf.h"
 #include "G6DexcomBLE.h"
 #include "G6DexcomClient.h"
+#include "G6DexcomSession.h"
 #include "G6DexcomMFD.h"
+#include "G6DexcomBacklight.h"
+#include "G6DexcomEvents.h"
+#include "G6DexcomBattery.h"
+#include "G6DexcomInput.h"
+#include "G6DexcomConsole.h"
+#include "G6DexcomScanTuner.h"
+#include "G6DexcomLinkStats.h"
+#include "G6DexcomEnergy.h"
+#include "DexcomHistory.h"
+#include "DexcomExport.h"
+#include "DexcomUploader.h"
+#include "G6DexcomWifi.h"
+#include "DexcomServer.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 #define STATE_START_SCAN 0                                                                                              // Set this state to start the scan.
 #define STATE_SCANNING   1                                                                                              // Indicates the esp is currently scanning for devices.
@@ -55,9 +72,24 @@
 #define STATE_WAIT       3
 static int Status      = 0;                                                                                             // Set to 0 to automatically start scanning when esp has started.
 
+#define WAIT_WINDOW_SEC  295                                                                                            // Restart for the next transmitter window this long after the last connect.
+#define CPU_REPORT_SEC   60                                                                                             // Interval of the UI task utilization report.
+#define BACKFILL_POST_MS 100                                                                                            // Longest the BLE task waits for room in the event queue for one backfilled reading.
+#define READING_POST_MS  1000                                                                                           // Longest the BLE task waits for room for the reading of the window.
+
 // This transmitter ID is used to identify our transmitter if multiple dexcom transmitters are found.
 // Updated 2023-10-15 to garbage. Create an include file and add to git-ignore.
 // #define DEXCOM_CONFIG_DEFAULT_ID "8nXXnn"
+// A G7 / ONE+ also needs the pairing code printed on the sensor, the ID then only supplies the end of the "DXCM" name.
+// #define DEXCOM_CONFIG_PAIRING_CODE "1234"
+// Readings are uploaded to a Nightscout site when its host is defined, over the Wi-Fi of pin_config.h.
+// The root certificate (PEM) is optional for port 443, without it the server is not verified.
+// #define DEXCOM_CONFIG_NIGHTSCOUT_HOST "example.herokuapp.com"
+// #define DEXCOM_CONFIG_NIGHTSCOUT_PORT 443
+// #define DEXCOM_CONFIG_NIGHTSCOUT_SECRET "API_SECRET of the site"
+// #define DEXCOM_CONFIG_NIGHTSCOUT_CA "-----BEGIN CERTIFICATE-----\n..."
+// The readings are served on the local network when a port is defined, the Wi-Fi then stays on.
+// #define DEXCOM_CONFIG_LOCAL_SERVER 80
 
 /* Enable when used concurrently with xDrip / Dexcom CGM */           // Tells the transmitter to use the alternative bt channel.
 #define DEXCOM_CONFIG_DEFAULT_ALT_CH false
@@ -71,8 +103,8 @@ static int Status      = 0;
 #define DEXCOM_CONFIG_DEFAULT_X_VALUES_TO_STORE 12
 
 /* Optimization or connecting problems:
- * - pBLEScan->setInterval(100);             10-500 and > setWindow(..)
- * - pBLEScan->setWindow(99);                10-500 and < setInterval(..)
+ * - Scan interval and window are chosen by DexcomScanTuner from the measured time to detect,
+ *   the candidate sets are in G6DexcomScanTuner.cpp and the statistics are on the console ("scan").
  * - pBLEScan->setActiveScan(false);         true, false
  * - BLEDevice::getScan()->start(0, true)    true, false */
 
@@ -81,15 +113,7 @@ static int Status      = 0;
 RTC_DATA_ATTR static boolean error_last_connection = false;
 RTC_DATA_ATTR static int glucoseCurrentValue;
 // Variables which do not survive reset.
-static boolean error_current_connection = false;                                                                        // To detect an error in the current session.
-static boolean read_complete = false;
-
-
-
-#define RW_MODE false
-#define RO_MODE true
-
-Preferences flashStorage;
+static volatile boolean read_complete = false;
 
 // static globals for timer and previous values
 // these will become static members of the DexomClient class
@@ -98,9 +122,12 @@ static uint32_t lastUpdateSec = 0; //sec counter when the last refresh of the TF
 static uint32_t lastConnectSec = 0; //sec counter when the last connection was made
 static uint32_t lastDataSec = 0; //sec counter when the last data update was made (retained on reset)
 static uint32_t screenState = 1; // status of if the backlight is on
-
-OneButton btn_ScreenOff(BUTTON_1);
-OneButton  btn_ScreenOn(BUTTON_2);
+static uint64_t uiBusyMicros = 0; //time the UI task spent working since the last utilization report
+static bool exportBusy = false; //a history export is streaming, the UI task does not wait for the tick
+static int backfillProgress = -1; //percent of the running backfill on the screen, -1 when none is shown
+static bool statsPage = false; //the link statistics page replaces the main screen
+static TaskHandle_t uploadTaskHandle = NULL; //NULL when no Nightscout site is configured
+static TaskHandle_t serverTaskHandle = NULL; //NULL when the local server is not enabled
 
 
 
@@ -134,40 +161,12 @@ void wakeUpRoutine()
         }
 
     }
-    flashStorage.begin("Dexcom", RO_MODE);
-    if( !flashStorage.isKey("CurVal"))
-    {
-        flashStorage.end();
-        flashStorage.begin("Dexcom", RW_MODE);
-        flashStorage.putInt("CurVal", 0);
-        flashStorage.end();
-    }
-    flashStorage.begin("Dexcom", RO_MODE);
-    if( !flashStorage.isKey("DataAge"))
-    {
-        flashStorage.end();
-        flashStorage.begin("Dexcom", RW_MODE);
-        flashStorage.putInt("DataAge", 600);
-        flashStorage.end();
-    }
-    flashStorage.begin("Dexcom", RO_MODE);
-    if( !flashStorage.isKey("ScreenOn"))
-    {
-        flashStorage.end();
-        flashStorage.begin("Dexcom", RW_MODE);
-        flashStorage.putInt("ScreenOn", 1);
-        flashStorage.end();
-    }
-
     // We set default values, so we always read data
-    flashStorage.begin("Dexcom", RO_MODE);
-    glucoseCurrentValue = flashStorage.getInt("CurVal");
-    lastDataSec = flashStorage.getInt("DataAge");
-    if (flashStorage.getInt("ScreenOn") > 0) screenOn();
+    glucoseCurrentValue = DexcomPlatform::storageGetInt("CurVal", 0);
+    lastDataSec = DexcomPlatform::storageGetInt("DataAge", 600);
+    if (DexcomPlatform::storageGetInt("ScreenOn", 1) > 0) screenOn();
     else screenOff();
 
-    flashStorage.end();
-
     DexcomMFD::set_glucoseValue(glucoseCurrentValue);
     DexcomMFD::set_dataAge(lastDataSec);
 }
@@ -177,298 +176,393 @@ void wakeUpRoutine()
  */
 void setup()
 {
-    // Set long press threshold to ten seconds so we can still turn the screen off when scanning.
-    btn_ScreenOff.attachClick([](){ screenOff(); });
-    btn_ScreenOn.attachClick([](){ screenOn(); });
-    btn_ScreenOff.attachLongPressStart([](){ screenOff(); });
-    btn_ScreenOn.attachLongPressStart([](){ screenOn(); });
-    String id = DexcomConnection::getTransmitterID();
+#ifdef DEXCOM_CONFIG_PAIRING_CODE
+    DexcomSession::setPairingCode(DEXCOM_CONFIG_PAIRING_CODE);
+#endif
+    const char* id = DexcomSession::getTransmitterID();
     DexcomMFD::setupTFT();
     Serial.begin(115200);
-    setupLipo();
+    DexcomBattery::setup();
+    DexcomScanTuner::setup();
+    DexcomLinkStats::setup();
+    DexcomEnergy::setup();
     Serial.println("Start...");
     Serial.print("Looking for transmitter: ");
     Serial.println(id);
     wakeUpRoutine();
-    DexcomMFD::drawScreen();
-    DexcomMFD::drawTime(lastDataSec);
-    DexcomMFD::drawVBat(readVBat(false));
-    DexcomMFD::drawPBat(getPctBat(readVBat(false)));
+    DexcomHistory::setup();
+    DexcomExport::setup(serialWrite);
+    drawMainScreen();
+
+    DexcomEvents::setup();
+    DexcomClient::setBackfillSink(postBackfill);
+    DexcomInput::setup();
+    setupPowerManagement();
+    TaskHandle_t bleTaskHandle = NULL;
+    xTaskCreatePinnedToCore(bleTask, "bleTask", BLE_TASK_STACK, NULL, BLE_TASK_PRIORITY, &bleTaskHandle, BLE_TASK_CORE);
+    DexcomConsole::watchTask(xTaskGetCurrentTaskHandle());                                                               // setup() runs on the loop task.
+    DexcomConsole::watchTask(bleTaskHandle);
+    setupUpload();
+    setupServer();
+    DexcomConsole::watchTask(xTimerGetTimerDaemonTaskHandle());
 }
 
 
 /**
- * This is the main loop function.
+ * This is the main loop function, it runs the UI on the loop task.
+ * Blocks on the event queue until an input or BLE event arrives or the next 1 Hz tick is due,
+ * so the CPU idles (or light sleeps) in between, also while the BLE task is inside a session.
  */
 void loop()
 {
+    DexcomEvent event;
+    uint32_t untilTick = exportBusy ? 0 : 1000 - (millis() % 1000);                                                    // Keep streaming while an export runs.
+    bool received = DexcomEvents::wait(&event, untilTick);
+    int64_t busyStart = esp_timer_get_time();
+    if (received)
+        handleEvent(event);
+    DexcomConsole::poll();
+    exportBusy = DexcomExport::service();
+
     int timeDelta = (millis() / 1000) - lastUpdateSec;
     if (timeDelta > 0) {
       lastUpdateSec += timeDelta;
       saveDataAge(lastDataSec + timeDelta);
-      DexcomMFD::drawTime(lastDataSec);
+      if (statsPage) {
+        DexcomMFD::set_dataAge(lastDataSec);
+        DexcomBacklight::update(lastDataSec, DexcomMFD::alertLevel());                                                 // drawTime does this on the main screen.
+      } else {
+        DexcomMFD::drawTime(lastDataSec);
+      }
+      DexcomBattery::update();
       if (lastUpdateSec / 10 > (lastUpdateSec - timeDelta) / 10) {
-        DexcomMFD::drawVBat(readVBat(true));
-        DexcomMFD::drawPBat(getPctBat(readVBat(false)));
+        SerialPrintf(DATA, "Battery: %d mV %d%%\n\r", DexcomBattery::get_millivolts(), DexcomBattery::get_percent());
+        if (!statsPage) {
+          DexcomMFD::drawVBat(DexcomBattery::get_millivolts());
+          DexcomMFD::drawPBat(DexcomBattery::get_percent());
+        }
+      }
+      if (lastUpdateSec / CPU_REPORT_SEC > (lastUpdateSec - timeDelta) / CPU_REPORT_SEC) {
+        uint32_t permille = (uint32_t)(uiBusyMicros / (CPU_REPORT_SEC * 1000));                                          // busy us / (window us / 1000)
+        SerialPrintf(DATA, "UI task CPU: %d.%d%%\n\r", permille / 10, permille % 10);
+        uiBusyMicros = 0;
+      }
+      DexcomPerf::heapSample();                                                                                          // Once per UI cycle, a drop is memory kept by this cycle or a session in between.
+      if (DexcomPerf::heap().change < 0 || lastUpdateSec / CPU_REPORT_SEC > (lastUpdateSec - timeDelta) / CPU_REPORT_SEC) {
+        char line[96];
+        DexcomPerf::formatHeap(line, sizeof(line));
+        SerialPrint(DexcomPerf::heap().change < 0 ? DEBUG : DATA, line);
       }
     }
-    btn_ScreenOff.tick();
-    btn_ScreenOn.tick();
+    uint32_t busy = (uint32_t)(esp_timer_get_time() - busyStart);
+    uiBusyMicros += busy;
+    DexcomEnergy::busy(busy);
+}
 
-    switch (Status)
+/**
+ * Handle an event posted by the BLE task. Only called from the UI task.
+ */
+void handleEvent(const DexcomEvent &event)
+{
+    switch (event.type)
     {
-      case STATE_START_SCAN:
-        //pBLEScan->start(0, true);                                                                         // false = maybe helps with connection problems.
-        DexcomConnection::find();
-        if (DexcomConnection::isFound()) Status = STATE_SCANNING;
-        //break;
-
-      case STATE_SCANNING:
-        if(DexcomConnection::isFound()) {
-            // A device (transmitter) was found by the scan (callback).
-            // Note the time offset when the device is found.
-            lastConnectSec = millis() / 1000;
-            run();                                                                                                      // This function is blocking until all tansmitter communication has finished.
-            // pBLEScan->clearResults();   // delete results fromBLEScan buffer to release memory
-            Status = STATE_WAIT;
-            glucoseCurrentValue = DexcomClient::get_glucose();
-            DexcomMFD::set_glucoseValue(glucoseCurrentValue);
-            lc709203f();
-            DexcomMFD::drawScreen();
-            DexcomMFD::drawVBat(readVBat(false));
-            DexcomMFD::drawPBat(getPctBat(readVBat(false)));
-            lastUpdateSec = millis() / 1000;
-            flashStorage.begin("Dexcom", RW_MODE);
-            flashStorage.putInt("CurVal", glucoseCurrentValue);
-            flashStorage.end();
+      case EVENT_READING:
+        if (event.fresh) saveDataAge(measurementAgeSec(event.reading));
+        glucoseCurrentValue = event.value;
+        DexcomMFD::set_glucoseValue(glucoseCurrentValue);
+        if (statsPage) {
+          DexcomMFD::set_dataAge(lastDataSec);
+          DexcomMFD::drawStats();                                                                                       // The session was just counted.
+        } else {
+          drawMainScreen();
+          uint32_t ageMs;
+          if (event.fresh && DexcomClient::measurementAgeMs(event.reading.dextime, &ageMs))
+            DexcomLinkStats::displayed(ageMs);                                                                          // The reading is on the glass now.
         }
+        lastUpdateSec = millis() / 1000;
+        DexcomPlatform::storagePutInt("CurVal", glucoseCurrentValue);
+        backfillProgress = -1;                                                                                          // drawScreen cleared the progress.
+        if (event.fresh && !DexcomClient::backfillPending() && DexcomHistory::append(event.reading))                   // Held back while older readings are still to come.
+            DexcomExport::pushLive(event.reading);
+        if (event.fresh) startUpload();
+        if (event.fresh) publishReading(event.reading);
         break;
 
-      case STATE_WAIT :
-        if ((millis() / 1000) - lastConnectSec > 295) {
-            esp_restart();
-        }
+      case EVENT_BACKFILL:
+        if (DexcomHistory::append(event.reading))
+            DexcomExport::pushLive(event.reading);
+        if (event.value != backfillProgress && !statsPage) DexcomMFD::drawBackfill(event.value);
+        backfillProgress = event.value;
+        break;
+
+      case EVENT_STATE:
+        SerialPrintf(DEBUG, "BLE task state: %d\n\r", event.value);
+        break;
+
+      case EVENT_INPUT:
+        if (event.value == INPUT_CLICK_1 || event.value == INPUT_LONG_1) screenOff();
+        if (event.value == INPUT_CLICK_2 || event.value == INPUT_LONG_2 || event.value == INPUT_TOUCH) screenOn();
+        if (event.value == INPUT_LONG_2) toggleStatsPage();
         break;
     }
 }
 
 /**
- * This function can be called in an error case.
+ * The BLE task, scans for the transmitter and runs the session on its own core.
+ * Results are handed to the UI task through the event queue.
  */
-void ExitState(String message)
+void bleTask(void *parameter)
 {
-    SerialPrintln(ERROR, message.c_str());
-    DexcomConnection::disconnect();                                                                                              // Disconnect to trigger onDisconnect event and go to sleep.
-}
+    for (;;)
+    {
+        switch (Status)
+        {
+          case STATE_START_SCAN:
+            //pBLEScan->start(0, true);                                                                         // false = maybe helps with connection problems.
+            DexcomSession::prepare();                                                                                   // The transmitter is not awake yet, the EC math of a G7 is done here.
+            DexcomLinkStats::scanStarted();
+            DexcomEnergy::set_scanDuty(DexcomScanTuner::current().windowMs * 1000 / DexcomScanTuner::current().intervalMs);
+            DexcomEnergy::set(POWER_RADIO, POWER_BLE_SCAN);
+            DexcomConnection::find();
+            DexcomEnergy::set(POWER_RADIO, DexcomConnection::isFound() ? POWER_BLE_CONNECTED : POWER_OFF);
+            if (DexcomConnection::isFound()) setStatus(STATE_SCANNING);
+            //break;
+
+          case STATE_SCANNING:
+            if(DexcomConnection::isFound()) {
+                // A device (transmitter) was found by the scan (callback).
+                // Note the time offset when the device is found.
+                lastConnectSec = millis() / 1000;
+                run();                                                                                                  // This function is blocking until all tansmitter communication has finished.
+                DexcomEnergy::set(POWER_RADIO, POWER_OFF);
+                // pBLEScan->clearResults();   // delete results fromBLEScan buffer to release memory
+                setStatus(STATE_WAIT);
+                if (!DexcomEvents::post(EVENT_READING, DexcomClient::get_glucose(), read_complete, &DexcomClient::get_lastReading(), READING_POST_MS))
+                    SerialPrintln(ERROR, "Reading not posted, event queue full.");
+            }
+            break;
 
+          case STATE_WAIT :
+            if ((millis() / 1000) - lastConnectSec > WAIT_WINDOW_SEC) {
+                DexcomEnergy::endCycle(DexcomBattery::get_millivolts());
+                esp_restart();
+            }
+            vTaskDelay(pdMS_TO_TICKS((WAIT_WINDOW_SEC + 1 - ((millis() / 1000) - lastConnectSec)) * 1000));          // Sleep until the next transmitter window.
+            break;
+        }
+    }
+}
 
 /**
- * This method will perform a full transmitter connect and read data.
+ * Let the idle task enter light sleep between events when the core was built with power management.
  */
- // CHANGE this function return type has been changed from bool to void. an unset return causes a reboot
-void run()
+void setupPowerManagement()
 {
-    error_current_connection = false;                                                                                    // Set to false to start.
-    read_complete = false;
-
-    if(!DexcomSecurity::forceRebondingEnabled())
-        DexcomSecurity::setupBonding();
-
-    Serial.print("Waited ");
-    Serial.print(lastConnectSec);
-    Serial.println(" seconds. ");
-
-    if (!error_current_connection) {
-        Serial.println("try connect");
-        error_current_connection = !DexcomConnection::connect();                                                    // Connect to the found transmitter.
-        if (error_current_connection) { ExitState("We have failed to connect to the transmitter!"); }
-        else { SerialPrintln(DEBUG, "We are now connected to the transmitter."); }
-    }
-
-    // Authenticate with the transmitter.
-    if (!error_current_connection) {
-
-        Serial.println("try to authenticate");
-        error_current_connection = !DexcomSecurity::authenticate();
-        if (error_current_connection) { ExitState("Error while trying to authenticate!"); }
-        else { SerialPrintln(DEBUG, "Successfully authenticated."); }
-    }
-
-    // Enable encryption and requesting bonding.
-    if (!error_current_connection) {
-
-        Serial.println("try to bond");
-        error_current_connection = !DexcomSecurity::requestBond();
-        if (error_current_connection) { ExitState("Error while trying to bond!"); }
-        else { SerialPrintln(DEBUG, "Successfully bonded."); }
-    }
-
-    // Read the general device informations like model no. and manufacturer.
-
-    if (!error_current_connection) {
-
-        Serial.println("try to read device information");
-        error_current_connection = !DexcomConnection::readDeviceInformations();
-        if (error_current_connection) { ExitState("Error while reading device informations!"); }    // If empty strings are read from the device information Characteristic, try reading device information after successfully authenticated.
-        else { SerialPrintln(DEBUG, "Successfully read device instructions."); }
-    }
-
-    // Register the control channel callback.
-    if (!error_current_connection) {
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pmConfig = {};
+    pmConfig.max_freq_mhz = getCpuFrequencyMhz();
+    pmConfig.min_freq_mhz = getXtalFrequencyMhz();
+    pmConfig.light_sleep_enable = true;
+    if (esp_pm_configure(&pmConfig) != ESP_OK)
+        SerialPrintln(ERROR, "Could not enable automatic light sleep.");
+#else
+    SerialPrintln(DEBUG, "Power management not enabled in this core, the CPU idles without light sleep.");
+#endif
+}
 
-        Serial.println("try to register control callback");
-        error_current_connection = !DexcomConnection::controlRegister();
-        if (error_current_connection) { ExitState("Error while trying to register!"); }
-        else { SerialPrintln(DEBUG, "Successfully registered."); }
-    }
+/**
+ * Creates the uploader task when a Nightscout site is configured.
+ */
+void setupUpload()
+{
+#ifdef DEXCOM_CONFIG_NIGHTSCOUT_HOST
+#ifndef DEXCOM_CONFIG_NIGHTSCOUT_PORT
+#define DEXCOM_CONFIG_NIGHTSCOUT_PORT 443
+#endif
+#ifndef DEXCOM_CONFIG_NIGHTSCOUT_CA
+#define DEXCOM_CONFIG_NIGHTSCOUT_CA NULL
+#endif
+    static DexcomWifiUplink uplink(WIFI_SSID, WIFI_PASSWORLD, DEXCOM_CONFIG_NIGHTSCOUT_HOST, DEXCOM_CONFIG_NIGHTSCOUT_PORT, DEXCOM_CONFIG_NIGHTSCOUT_CA);
+#ifdef DEXCOM_CONFIG_LOCAL_SERVER
+    uplink.setAlwaysOn(true);                                                                                           // The server needs the network between the bursts.
+#endif
+    DexcomUploader::setup(&uplink, DEXCOM_CONFIG_NIGHTSCOUT_HOST, DEXCOM_CONFIG_NIGHTSCOUT_SECRET);
+    xTaskCreatePinnedToCore(uploadTask, "uploadTask", UPLOAD_TASK_STACK, NULL, UPLOAD_TASK_PRIORITY, &uploadTaskHandle, UPLOAD_TASK_CORE);
+    DexcomConsole::watchTask(uploadTaskHandle);
+#endif
+}
 
-    // Reading current time from the transmitter (important for backfill).
-    if (!error_current_connection) {
+/**
+ * Stages the readings not yet on the site and wakes the uploader task. Runs on the UI task, which owns the history,
+ * right after the session, so the Wi-Fi burst falls in the quiet part of the transmitter window.
+ */
+void startUpload()
+{
+    uint32_t transmitterNow;
+    if (uploadTaskHandle != NULL && DexcomClient::transmitterNow(&transmitterNow) && DexcomUploader::stage(transmitterNow) > 0)
+        xTaskNotifyGive(uploadTaskHandle);
+}
 
-        Serial.println("try to read time message");
-        error_current_connection = !DexcomClient::readTimeMessage();
-        if (error_current_connection) { ExitState("Error reading Time Message!"); }
-        else { SerialPrintln(DEBUG, "Successfully read time message."); }
+/**
+ * The uploader task, one Wi-Fi burst per wake up. A burst still running at the restart for the next window is cut off,
+ * its unacknowledged readings stay queued.
+ */
+void uploadTask(void *parameter)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        DexcomUploader::upload();
     }
+}
 
-    // Reading current battery status
-    if (!error_current_connection) {
-
-        Serial.println("try to read battery status");
-        error_current_connection = !DexcomClient::readBatteryStatus();
-        if (error_current_connection) { ExitState("Error reading battery status!"); }
-        else { SerialPrintln(DEBUG, "Successfully read battery status."); }
-    }
+/**
+ * Creates the local server task when a port is configured.
+ */
+void setupServer()
+{
+#ifdef DEXCOM_CONFIG_LOCAL_SERVER
+    xTaskCreatePinnedToCore(serverTask, "serverTask", SERVER_TASK_STACK, NULL, SERVER_TASK_PRIORITY, &serverTaskHandle, SERVER_TASK_CORE);
+    DexcomConsole::watchTask(serverTaskHandle);
+#endif
+}
 
-    //Read current glucose level to save it.
-    if (!error_current_connection) {
+/**
+ * Hands a fresh reading to the local server, which serializes it once for every client. Runs on the UI task,
+ * the history it reads for /history is owned there.
+ */
+void publishReading(const DexcomReading &reading)
+{
+    if (serverTaskHandle == NULL)
+        return;
+    uint32_t transmitterNow;
+    if (!DexcomClient::transmitterNow(&transmitterNow))
+        transmitterNow = 0;                                                                                             // Served without a date.
+    DexcomServer::publish(reading, transmitterNow);
+}
 
-        Serial.println("try to read current glucose");
-        error_current_connection = !DexcomClient::readGlucose();
-        if (error_current_connection) { ExitState("Error reading current glucose!"); }
-        else 
-        { 
-            SerialPrintln(DEBUG, "Successfully read current glucose."); 
-            saveDataAge(0);
-        }
+/**
+ * The local server task. Joins the network, opens the sockets and serves until the restart for the next window,
+ * which closes every connection, the live page connects again on its own.
+ */
+void serverTask(void *parameter)
+{
+#ifdef DEXCOM_CONFIG_LOCAL_SERVER
+    static DexcomWifiUplink network(WIFI_SSID, WIFI_PASSWORLD, "", 0, NULL);
+    network.setAlwaysOn(true);
+    while (!network.radioOn())
+        vTaskDelay(pdMS_TO_TICKS(WIFI_JOIN_TIMEOUT_MS));
+    if (!DexcomServer::setup(DEXCOM_CONFIG_LOCAL_SERVER))
+        vTaskDelete(NULL);
+    for (;;)
+    {
+        DexcomServer::service(1000);
+        if (WiFi.status() != WL_CONNECTED)
+            network.radioOn();                                                                                          // The listening socket stays bound across a rejoin.
     }
+#endif
+}
 
-    if(!error_current_connection) read_complete = true;
+/**
+ * Hands a backfilled reading and the progress to the UI task, which owns the history and the screen.
+ * Waits for room in the queue, the UI task drains it while the session keeps running. When the queue stays full
+ * the stream is cut off, the history only grows at its newest end, so the next session asks again from there.
+ */
+bool postBackfill(const DexcomReading &reading, int progress)
+{
+    if (DexcomEvents::post(EVENT_BACKFILL, progress, false, &reading, BACKFILL_POST_MS))
+        return true;
+    SerialPrintln(ERROR, "Backfill reading not posted, event queue full.");
+    return false;
+}
 
-    // Optional: read sensor raw (unfiltered / filtered) data.
-    //if(!readSensor())
-        //SerialPrintln(ERROR, "Can't read raw Sensor values!");
+/**
+ * Change the state of the BLE task and tell the UI task about it.
+ */
+void setStatus(int newStatus)
+{
+    Status = newStatus;
+    DexcomEvents::post(EVENT_STATE, Status);
+}
 
-    // Optional: read time and glucose of last calibration.
-    //if(!readLastCalibration())
-        //SerialPrintln(ERROR, "Can't read last calibration data!");
+/**
+ * This method will perform a full transmitter connect and read data.
+ * The flow itself is portable and lives in DexcomSession, here it is bound to the BLE client.
+ */
+ // CHANGE this function return type has been changed from bool to void. an unset return causes a reboot
+void run()
+{
+    read_complete = false;
 
+    Serial.print("Waited ");
+    Serial.print(lastConnectSec);
+    Serial.println(" seconds. ");
 
-    if(DexcomClient::needBackfill())
-    {
-        DexcomConnection::backfillRegister();                         // Now register on the backfill characteristic.
-        // Read backfill of the last x values to also saves them.
-        if(!DexcomClient::readBackfill())
-            SerialPrintln(ERROR, "Can't read backfill data!");
-    }
-                                                                                  // When we reached this point no error occured.
-    //Let the Transmitter close the connection.
-    DexcomConnection::disconnect();
+    DexcomSession::setTransport(DexcomConnection::transport());
+    read_complete = DexcomSession::run();
+    DexcomLinkStats::record(read_complete, DexcomSession::get_failedStep(), DexcomSession::get_connectedMs(),
+                            DexcomSession::get_glucoseMs(), DexcomClient::get_lastReading().dextime);
 }
 
 
 
-// TODO: Update this to configure the analog port for the batery voltage sense rename setupAnalogLiPo
-void setupLipo()
+/**
+ * Binary export frames go to the same USB CDC port as the debug text, one write per frame.
+ */
+size_t serialWrite(const uint8_t* data, size_t length)
 {
-    Serial.println(F("Setting up analog read of battery voltage"));
-    //set the resolution to 12 bits (0-4095)
-    analogReadResolution(12);
+    return Serial.write(data, length);
 }
 
-int readVBat(bool print)
+/**
+ * Glucose screen with the data age and the battery, the page shown unless the statistics are.
+ */
+void drawMainScreen()
 {
-    uint32_t v1 = analogReadMilliVolts(PIN_BAT_VOLT);
-    if(print)
-    {
-        Serial.print("Batt_Voltage: ");
-        Serial.print(v1);
-        Serial.println(" mV ");
-    }
-    return (int)v1;
+    DexcomMFD::drawScreen();
+    DexcomMFD::drawTime(lastDataSec);
+    DexcomMFD::drawVBat(DexcomBattery::get_millivolts());
+    DexcomMFD::drawPBat(DexcomBattery::get_percent());
 }
 
-int getPctBat(int v1)
+/**
+ * A long press of the second button flips between the glucose screen and the link statistics.
+ */
+void toggleStatsPage()
 {
-    // defined points in percent and milivolts
-    int BAT_PCT[8] = { 0, 10, 25, 50, 75, 90, 100, 110};
-    //table for drain and charging (based on HTC powerpack charging)
-    int BAT_VOLT_D[7] = { 2500, 3330, 3450, 3660, 3800, 3900, 4000};
-    int BAT_VOLT_C[7] = { 4350, 4400, 4450, 4500, 4560, 4620, 4650};
-    int BAT_VOLT_CHARGING = 4190;
-    int pct = 100;
-
-    if (v1 >= BAT_VOLT_CHARGING)
-    {
-        if (v1 < BAT_VOLT_C[0]) pct = 0;
-        for(int i = 0; i < 6; i++)
-        {
-            if (v1 >= BAT_VOLT_C[i] && v1 < BAT_VOLT_C[i+1]) 
-            {
-                pct = BAT_PCT[i] + ((BAT_PCT[i+1] - BAT_PCT[i]) * (v1 - BAT_VOLT_C[i]) / (BAT_VOLT_C[i+1] - BAT_VOLT_C[i]));
-            }
-        }
-
-    }
-    else
-    {
-        if (v1 < BAT_VOLT_D[0]) pct = 0;
-        for(int i = 0; i < 6; i++)
-        {            
-            if (v1 >= BAT_VOLT_D[i] && v1 < BAT_VOLT_D[i+1]) 
-            {
-                pct = BAT_PCT[i] + ((BAT_PCT[i+1] - BAT_PCT[i]) * (v1 - BAT_VOLT_D[i]) / (BAT_VOLT_D[i+1] - BAT_VOLT_D[i]));
-            }
-        }
-    }
-    Serial.print("Battery_Charge: ");
-    Serial.print(pct);
-    Serial.println("%");
-    return pct; //return 100 if nothing above modified it
+    statsPage = !statsPage;
+    backfillProgress = -1;                                                                                              // Either page starts without the progress.
+    if (statsPage) DexcomMFD::drawStats();
+    else drawMainScreen();
 }
 
-// Replage this with analogLiPo
-void lc709203f() {
-  Serial.print("Batt_Voltage: unknown");
-  // Serial.print(lc.cellVoltage(), 3);
-  // DexcomMFD::set_battPct(lc.cellPercent());
+/**
+ * Age of a fresh reading from the transmitter's measurement, not from when it was read, 0 without a time message.
+ */
+int32_t measurementAgeSec(const DexcomReading &reading)
+{
+    uint32_t ageMs;
+    return DexcomClient::measurementAgeMs(reading.dextime, &ageMs) ? (int32_t)(ageMs / 1000) : 0;
 }
 
 void saveDataAge(int32_t newAge) {
     if (newAge < 7000)
     {        
-        flashStorage.begin("Dexcom", RW_MODE);
         lastDataSec = newAge;
-        flashStorage.putInt("DataAge", lastDataSec);
-        flashStorage.end();
+        DexcomPlatform::storagePutInt("DataAge", lastDataSec);
     }
 }
 
 void screenOn() {
-    DexcomMFD::set_brightness(255);
-    DexcomMFD::set_backlight(1); 
+    DexcomBacklight::set_userState(1);
     Serial.println("Backlight ON!");
     // save state
-    flashStorage.begin("Dexcom", RW_MODE);
-    flashStorage.putInt("ScreenOn", 1);
-    flashStorage.end();
+    DexcomPlatform::storagePutInt("ScreenOn", 1);
 }
 
 void screenOff() {
-    DexcomMFD::set_backlight(0); 
+    DexcomBacklight::set_userState(0);
     Serial.println("Backlight OFF!");
     // save state
-    flashStorage.begin("Dexcom", RW_MODE);
-    flashStorage.putInt("ScreenOn", 0);
-    flashStorage.end();
+    DexcomPlatform::storagePutInt("ScreenOn", 0);
 }
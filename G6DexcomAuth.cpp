@@ -0,0 +1,233 @@
+/*
+ * G6DexcomAuth
+ */
+
+
+#include <string.h>
+#include "mbedtls/aes.h"
+#include "G6DexcomAuth.h"
+#include "DexcomPerf.h"
+#include "DexcomPlatform.h"
+
+
+bool DexcomAuth::bonding = false;
+DexcomJpake DexcomAuth::jpake(JPAKE_ROLE_CLIENT);
+
+/**
+ * Round one of the next G7 handshake only needs our own secrets, computed here while nothing waits on the radio.
+ * Also loads the curve and its generator table the first time.
+ */
+bool DexcomAuth::prepare(const DexcomTransmitterId &id)
+{
+    if (!id.isG7() || jpake.isPrepared())
+        return true;
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    bool ok = jpake.prepare(random, NULL);
+    DexcomPerf::stop(PERF_AUTH_PREPARE, stamp);
+    if (!ok)
+        SerialPrintln(ERROR, "Can't prepare the J-PAKE round one!");
+    return ok;
+}
+
+bool DexcomAuth::authenticate(DexcomTransport* transport, const DexcomTransmitterId &id, bool alternateChannel)
+{
+    if (id.isG7())
+        return authenticateG7(transport, id, alternateChannel);
+    return challenge(transport, id.key, alternateChannel);
+}
+
+/**
+ * We have successfully authorized and now want to bond.
+ * First enable the BLE security bonding options and then indicate the transmitter that he can now initiate a bonding. 
+ * Return true if no error occurs.
+ */
+bool DexcomAuth::requestBond(DexcomTransport* transport)
+{
+    if(bonding)
+    {
+        SerialPrintln(DEBUG, "rqst_bd");
+        transport->prepareBond();
+
+        SerialPrintln(DEBUG, "Sending Bond Request.");
+        //Send KeepAliveTxMessage
+        uint8_t keepAliveTxMessage[2] = {0x06, 0x19};                                                                  // Opcode 2 byte = 0x06, 25 as hex (0x19)
+        transport->authSend(keepAliveTxMessage, 2);
+        SerialPrintln(DEBUG, "snd_kp_al");
+        //Send BondRequestTxMessage
+        uint8_t bondRequestTxMessage[1] = {0x07};                                                                      // Send bond command.
+        transport->authSend(bondRequestTxMessage, 1);
+        SerialPrintln(DEBUG, "snd_bd_rq");
+        //Wait for bonding to finish
+        SerialPrintln(DEBUG, "Waiting for bond.");
+        if (!transport->waitForBond())
+            return false;
+        SerialPrintln(DEBUG, "Bonding finished.");
+    }
+    else
+        SerialPrintln(DEBUG, "Transmitter does not want to (re)bond so DONT send bond request (already bonded).");
+    return true;
+}
+
+/**
+ * Calculates the 8 byte Hash for the given data.
+ */
+uint64_t DexcomAuth::calculateHash(uint64_t data, const uint8_t* key)
+{
+    uint64_t returnValue = 0;
+    //data = data + data;  //done as a string concat
+    uint8_t doubleData[16], hashBuffer[16];                                         // Use double the data to get 16 byte
+    memcpy(&doubleData[0], &data, 8);
+    memcpy(&doubleData[8], &data, 8);
+    encrypt(doubleData, key, hashBuffer);
+    memcpy(&returnValue, &hashBuffer[0], 8);                                         // Only use the first 8 byte of the hash (ciphertext)
+    return returnValue;                                                                                           
+
+}
+
+
+/**
+ * Encrypt using AES 182 ecb (Electronic Code Book Mode).
+ */
+void DexcomAuth::encrypt(uint8_t* buffer, const uint8_t* key, uint8_t* output)
+{
+    mbedtls_aes_context aes;
+
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);                                                                             // The key (that also used the transmitter) for the encryption.
+    mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, buffer, output);
+    mbedtls_aes_free(&aes);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                          PRIVATE                                                              //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+/**
+ * The AuthRequest / AuthChallenge / AuthStatus exchange, key is the ID derived AES key or the J-PAKE key of a G7.
+ */
+bool DexcomAuth::challenge(DexcomTransport* transport, const uint8_t* key, bool alternateChannel)
+{
+    //Send AuthRequestTxMessage
+    uint8_t authRequestTxBuffer[10] = {0x01, 0x19, 0xF3, 0x89, 0xF8, 0xB7, 0x58, 0x41, 0x33, 0 };  //0x02                 // 10byte, first byte = opcode (fix), [1] - [8] random bytes as challenge for the transmitter to encrypt,
+    authRequestTxBuffer[9] = alternateChannel ? 0x01 : 0x02;                                                            // last byte 0x02 = normal bt channel, 0x01 alternative bt channel
+    transport->authSend(authRequestTxBuffer, 10);
+
+    //Recv AuthChallengeRXMessage
+    uint8_t authChallengeBuffer[20];
+    size_t authChallengeSize = transport->authReceive(authChallengeBuffer, 20);                                         // Wait until we received data from the notify callback.
+    if ((authChallengeSize != 17) || (authChallengeBuffer[0] != 0x03))
+    {
+        SerialPrintln(ERROR, "Error wrong length or opcode!");
+        return false;
+    }
+    uint8_t tokenHash[8];
+    uint64_t challenge;
+    memcpy(tokenHash, &authChallengeBuffer[1], 8);               // Start with 1 to skip opcode.
+    memcpy(&challenge, &authChallengeBuffer[9], 8);             // store 8 bytes in a uint64_t
+    //Here we could check if the tokenHash is the encrypted 8 bytes from the authRequestTxMessage ([1] to [8]);
+    //To check if the Transmitter is a valid dexcom transmitter (because only the correct one should know the ID).
+
+    //Send AuthChallengeTXMessage
+    uint64_t hash = calculateHash(challenge, key);                                                                       // Calculate the hash from the random 8 bytes the transmitter send us as a challenge.
+    uint8_t authChallengeTXMessage[9] = {0x04, 0,0,0,0, 0,0,0,0};                                                                        // opcode
+    memcpy(&authChallengeTXMessage[1], &hash, 8);                                                                                     // in total 9 byte.
+    transport->authSend(authChallengeTXMessage, 9);
+
+    //Recv AuthStatusRXMessage
+    uint8_t authStatusBuffer[8];
+    size_t authStatusSize = transport->authReceive(authStatusBuffer, 8);                                               // Response { 0x05, 0x01 = authenticated / 0x02 = not authenticated, 0x01 = no bonding, 0x02 bonding
+    if(authStatusSize == 3 && authStatusBuffer[1] == 1)                                                // correct response is 0x05 0x01 0x02
+    {
+        SerialPrintln(DEBUG, "Authenticated!");
+        bonding = authStatusBuffer[2] != 0x01;
+        return true;
+    }
+    else
+        SerialPrintln(ERROR, "Authenticated FAILED!");
+    return false;
+}
+
+/**
+ * EC J-PAKE with the pairing code, then the usual challenge with the derived key.
+ * Phase 0 and 1 swap the round one packets, the peer's proofs are checked once both are in, phase 2 swaps round two.
+ */
+bool DexcomAuth::authenticateG7(DexcomTransport* transport, const DexcomTransmitterId &id, bool alternateChannel)
+{
+    uint8_t peer[2][JPAKE_PACKET_SIZE];
+    uint8_t packet[JPAKE_PACKET_SIZE];
+    if (!jpake.setPassword((const uint8_t*)id.pairingCode, PAIRING_CODE_LENGTH) || !prepare(id))
+        return false;
+
+    bool ok = true;
+    for (uint8_t phase = 0; phase < 2 && ok; phase++)
+        ok = sendExchange(transport, phase, jpake.roundOnePacket(phase)) && receiveExchange(transport, peer[phase]);
+    if (!ok)
+    {
+        SerialPrintln(ERROR, "J-PAKE round one not answered!");
+        jpake.reset();
+        return false;
+    }
+
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    ok = jpake.readRoundOne(peer[0], peer[1]);
+    DexcomPerf::stop(PERF_AUTH_ROUND_ONE, stamp);
+    if (ok)
+    {
+        stamp = DexcomPerf::start();
+        ok = jpake.writeRoundTwo(packet, random, NULL);
+        DexcomPerf::stop(PERF_AUTH_ROUND_TWO, stamp);
+    }
+    ok = ok && sendExchange(transport, 2, packet) && receiveExchange(transport, peer[0]);
+    if (ok)
+    {
+        stamp = DexcomPerf::start();
+        ok = jpake.readRoundTwo(peer[0]);
+        DexcomPerf::stop(PERF_AUTH_KEY, stamp);
+    }
+    if (!ok)
+    {
+        SerialPrintln(ERROR, "J-PAKE exchange FAILED!");
+        jpake.reset();
+        return false;
+    }
+    SerialPrintln(DEBUG, "J-PAKE key agreed.");
+    ok = challenge(transport, jpake.sessionKey(), alternateChannel);
+    jpake.reset();                                                                                                      // Every handshake uses fresh secrets.
+    return ok;
+}
+
+bool DexcomAuth::sendExchange(DexcomTransport* transport, uint8_t phase, const uint8_t* packet)
+{
+    uint8_t header[2] = {JPAKE_EXCHANGE_OPCODE, phase};
+    if (!transport->authSend(header, sizeof(header)))
+        return false;
+    uint8_t chunk[JPAKE_EXCHANGE_CHUNK];
+    for (size_t offset = 0; offset < JPAKE_PACKET_SIZE; offset += JPAKE_EXCHANGE_CHUNK)
+    {
+        memcpy(chunk, &packet[offset], JPAKE_EXCHANGE_CHUNK);
+        if (!transport->authSend(chunk, JPAKE_EXCHANGE_CHUNK))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Collects one packet from the chunk indications, a short or missing chunk fails the exchange.
+ */
+bool DexcomAuth::receiveExchange(DexcomTransport* transport, uint8_t* packet)
+{
+    for (size_t offset = 0; offset < JPAKE_PACKET_SIZE; offset += JPAKE_EXCHANGE_CHUNK)
+    {
+        if (transport->authReceive(&packet[offset], JPAKE_EXCHANGE_CHUNK) != JPAKE_EXCHANGE_CHUNK)
+            return false;
+    }
+    return true;
+}
+
+int DexcomAuth::random(void*, unsigned char* output, size_t length)
+{
+    DexcomPlatform::randomBytes(output, length);
+    return 0;
+}
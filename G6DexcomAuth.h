@@ -0,0 +1,44 @@
+/**
+ * Header File with the G6 authentication handshake and bond request
+ * A G7 / ONE+ first runs the EC J-PAKE exchange of DexcomJpake with its pairing code and then the same
+ * challenge / response with the derived key. Round one of that exchange is prepared between sessions.
+ * Portable protocol code, all radio access goes through the session transport.
+ */
+
+#ifndef G6DEXCOMAUTH_H
+#define G6DEXCOMAUTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DebugHelper.h"
+#include "DexcomTransport.h"
+#include "DexcomTransmitterId.h"
+#include "DexcomJpake.h"
+
+// G7 exchange on the auth characteristic: {opcode, phase}, then the packet in JPAKE_EXCHANGE_CHUNK byte writes,
+// the transmitter answers each phase with its own packet in chunks of the same size.
+#define JPAKE_EXCHANGE_OPCODE   0x0A
+#define JPAKE_EXCHANGE_CHUNK    20
+
+
+class DexcomAuth
+{
+    static bool bonding;                                                                                                // The transmitter asked for a (re)bond in the auth status.
+    static DexcomJpake jpake;                                                                                           // Client side, kept with its allocations from one session to the next.
+
+    public:
+        static bool prepare(const DexcomTransmitterId &id);                                                             // G7 round one ahead of the connection, nothing to do for a G6.
+        static bool authenticate(DexcomTransport* transport, const DexcomTransmitterId &id, bool alternateChannel);
+        static bool requestBond(DexcomTransport* transport);
+        static uint64_t calculateHash(uint64_t data, const uint8_t* key);
+        static void encrypt(uint8_t* buffer, const uint8_t* key, uint8_t* output);                                     // key is DexcomTransmitterId::key or the J-PAKE key.
+
+    private:
+        static bool challenge(DexcomTransport* transport, const uint8_t* key, bool alternateChannel);
+        static bool authenticateG7(DexcomTransport* transport, const DexcomTransmitterId &id, bool alternateChannel);
+        static bool sendExchange(DexcomTransport* transport, uint8_t phase, const uint8_t* packet);
+        static bool receiveExchange(DexcomTransport* transport, uint8_t* packet);
+        static int random(void* context, unsigned char* output, size_t length);
+};
+
+#endif /* G6DEXCOMAUTH_H */
@@ -9,17 +9,18 @@
 
 #include <Arduino.h>
 #include <Esp.h>
-#include "mbedtls\aes.h"
 #include "BLEDevice.h"
-#include "BLEScan.h"
 #include "BLEUUID.h"
 #include "G6DexcomBLE.h"
-#include "G6Transmitter.h"
+#include "G6DexcomSession.h"
+#include "G6DexcomScanTuner.h"
+#include "G6DexcomLinkStats.h"
+#include "DexcomAdvFilter.h"
+#include "DexcomPerf.h"
 
 
 // The remote service we wish to connect to.
 static BLEUUID    serviceUUID("f8083532-849e-531c-c594-30f1f86a4ea5");                                                  // This service holds all the important characteristics.
-static BLEUUID advServiceUUID("0000febc-0000-1000-8000-00805f9b34fb");                                                  // This service gets advertised by the transmitter.
 static BLEUUID deviceInformationServiceUUID("180A");                                                                    // The default service for the general device informations.
 // The characteristic of the remote serviceUUID service we are interested in.
 static BLEUUID  communicationUUID("F8083533-849E-531C-C594-30F1F86A4EA5"); // NOTIFY, READ
@@ -34,14 +35,36 @@ static BLEUUID        modelUUID("2A24"); // READ
 static BLEUUID     firmwareUUID("2A26"); // READ
 
 
+/**
+ * Debug prints of UUIDs and addresses without the String that toString() allocates.
+ */
+static void printUUID(OutputType type, BLEUUID uuid)
+{
+    esp_bt_uuid_t* native = uuid.getNative();
+    const uint8_t* b = native->uuid.uuid128;
+    if (native->len == ESP_UUID_LEN_16)
+        SerialPrintf(type, "%04x\n\r", native->uuid.uuid16);
+    else if (native->len == ESP_UUID_LEN_32)
+        SerialPrintf(type, "%08x\n\r", native->uuid.uuid32);
+    else
+        SerialPrintf(type, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x\n\r", b[15], b[14], b[13], b[12],
+                     b[11], b[10], b[9], b[8], b[7], b[6], b[5], b[4], b[3], b[2], b[1], b[0]);
+}
+
+static void printAddress(OutputType type, const esp_bd_addr_t address)
+{
+    SerialPrintf(type, "%02x:%02x:%02x:%02x:%02x:%02x\n\r", address[0], address[1], address[2], address[3], address[4], address[5]);
+}
+
+
 //Overall Flow:
 // 1) Initialize BLE hardware: BLEDevice::init("");  <<Static function>>
-// 2) Setup Scanner: pBLEScan = BLEDevice::getScan(); pBLEScan->set... ; pBLEScan->start
-// 3) CallBack from scan to MyAdvertisedDeviceCallbacks()::OnResult() matches dexcom
+// 2) Setup Scanner: custom GAP handler, esp_ble_gap_set_scan_params, start in the param set event
+// 3) GAP handler matches the raw advertisement with DexcomAdvFilter (0xFEBC and name)
 //   3.1) Stop Scan   <<Static function>>
-//   3.2) myDevice = new BLEAdvertisedDevice(advertisedDevice);
+//   3.2) foundAddress / foundAddressType = advertiser address
 // 4) setupBonding();  <<Static function>>
-// 5) connectToTransmitter() <<requries myDevice and UUID defines>>
+// 5) connectToTransmitter() <<requries foundAddress and UUID defines>>
 //    5.1) create client, register callbacks and connect
 //    5.2) get and save services based on UUIDs
 //    5.3) get and save characteristics based on service and UUID
@@ -77,84 +100,9 @@ static BLEUUID     firmwareUUID("2A26"); // READ
 /**
  * The Dexcom Reciever is connected (serivces have been found and pointers saved)
 */
-bool DexcomSecurity::bonding = false;
 volatile bool DexcomSecurity::bondingFinished = false;
 bool DexcomSecurity::forceRebonding = false;
 
-bool DexcomSecurity::authenticate()
-{
-    //Send AuthRequestTxMessage
-    uint8_t authRequestTxBuffer[10] = {0x01, 0x19, 0xF3, 0x89, 0xF8, 0xB7, 0x58, 0x41, 0x33, 0 };  //0x02                 // 10byte, first byte = opcode (fix), [1] - [8] random bytes as challenge for the transmitter to encrypt,
-    authRequestTxBuffer[9] = DexcomConnection::usingAlternateChannel() ? 0x01 : 0x02;                                                        // last byte 0x02 = normal bt channel, 0x01 alternative bt channel
-    DexcomConnection::AuthSendValue(authRequestTxBuffer, 10);
-
-    //Recv AuthChallengeRXMessage
-    uint8_t authChallengeBuffer[20];
-    size_t authChallengeSize = DexcomConnection::AuthWaitToReceiveValue(authChallengeBuffer, 20);                         // Wait until we received data from the notify callback.
-    if ((authChallengeSize != 17) || (authChallengeBuffer[0] != 0x03))
-    {
-        SerialPrintln(ERROR, "Error wrong length or opcode!");
-        return false;
-    }
-    uint8_t tokenHash[8];
-    uint64_t challenge;
-    memcpy(tokenHash, &authChallengeBuffer[1], 8);               // Start with 1 to skip opcode.
-    memcpy(&challenge, &authChallengeBuffer[9], 8);             // store 8 bytes in a uint64_t
-    //Here we could check if the tokenHash is the encrypted 8 bytes from the authRequestTxMessage ([1] to [8]);
-    //To check if the Transmitter is a valid dexcom transmitter (because only the correct one should know the ID).
-
-    //Send AuthChallengeTXMessage
-    uint64_t hash = calculateHash(challenge, DexcomConnection::getTransmitterID());                                                         // Calculate the hash from the random 8 bytes the transmitter send us as a challenge.
-    uint8_t authChallengeTXMessage[9] = {0x04, 0,0,0,0, 0,0,0,0};                                                                        // opcode
-    memcpy(&authChallengeTXMessage[1], &hash, 8);                                                                                     // in total 9 byte.
-    DexcomConnection::AuthSendValue(authChallengeTXMessage, 9);
-
-    //Recv AuthStatusRXMessage
-    uint8_t authStatusBuffer[8];
-    size_t authStatusSize = DexcomConnection::AuthWaitToReceiveValue(authStatusBuffer, 8);                              // Response { 0x05, 0x01 = authenticated / 0x02 = not authenticated, 0x01 = no bonding, 0x02 bonding
-    if(authStatusSize == 3 && authStatusBuffer[1] == 1)                                                // correct response is 0x05 0x01 0x02
-    {
-        SerialPrintln(DEBUG, "Authenticated!");
-        bonding = authStatusBuffer[2] != 0x01;
-        return true;
-    }
-    else
-        SerialPrintln(ERROR, "Authenticated FAILED!");
-    return false;
-}
-
-/**
- * Calculates the 8 byte Hash for the given data.
- */
-uint64_t DexcomSecurity::calculateHash(uint64_t data, String id)
-{
-    uint64_t returnValue = 0;
-    //data = data + data;  //done as a string concat
-    uint8_t doubleData[16], hashBuffer[16];                                         // Use double the data to get 16 byte
-    memcpy(&doubleData[0], &data, 8);
-    memcpy(&doubleData[8], &data, 8);
-    encrypt(doubleData, id, hashBuffer);
-    memcpy(&returnValue, &hashBuffer[0], 8);                                         // Only use the first 8 byte of the hash (ciphertext)
-    return returnValue;                                                                                           
-
-}
-
-
-/**
- * Encrypt using AES 182 ecb (Electronic Code Book Mode).
- */
-void DexcomSecurity::encrypt(uint8_t* buffer, String id, uint8_t* output)
-{
-    mbedtls_aes_context aes;
-
-    String key = "00" + id + "00" + id;                                                                            // The key (that also used the transmitter) for the encryption.
-
-    mbedtls_aes_init(&aes);
-    mbedtls_aes_setkey_enc(&aes, (const unsigned char *)key.c_str(), strlen(key.c_str()) * 8);
-    mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, buffer, output);
-    mbedtls_aes_free(&aes);
-}
-
 void DexcomSecurity::forceRebondingEnable() { forceRebonding = true; }
 void DexcomSecurity::forceRebondingDisable() { forceRebonding = false; }
 bool DexcomSecurity::forceRebondingEnabled() { return forceRebonding; }
@@ -183,8 +131,8 @@ int reasonCode = -1;
     }  // bonding completed successfully
     else {
         reasonCode = auth_cmpl.fail_reason;
-        Serial.println(auth_cmpl.fail_reason, HEX);
-        Serial.println(reasonCode);
+        SerialPrintf(ERROR, "Bonding failed, reason 0x%02x\n\r", reasonCode);
+        DexcomLinkStats::bondFailed(auth_cmpl.fail_reason);
     }   // bonding failed
 }
 
@@ -196,8 +144,10 @@ void DexcomSecurity::setupBonding()
     BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);                                                                 // Enable security encryption.
     //TODO: Classified implementation will use either pMyDexcomSecurity or &MyDexcomSecurity
     //This current method works because the old Security class was "static", but not really because it relied on globals
-    BLEDevice::setSecurityCallbacks(new DexcomSecurity());
-    BLESecurity *pSecurity = new BLESecurity();
+    static DexcomSecurity securityCallbacks;                                                                            // Static, setupBonding runs on every wake up.
+    static BLESecurity security;
+    BLEDevice::setSecurityCallbacks(&securityCallbacks);
+    BLESecurity *pSecurity = &security;
     pSecurity->setKeySize();
     pSecurity->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_ONLY);
     pSecurity->setCapability(ESP_IO_CAP_IO);
@@ -205,61 +155,20 @@ void DexcomSecurity::setupBonding()
     SerialPrintln(DEBUG, "Enabled bonding.");
 }
 
-/**
- * We have successfully authorized and now want to bond.
- * First enable the BLE security bonding options and then indicate the transmitter that he can now initiate a bonding. 
- * Return true if no error occurs.
- */
-bool DexcomSecurity::requestBond()
-{
-    if(bonding)
-    {
-
-        SerialPrintln(DEBUG, "rqst_bd");
-        
-        if(forceRebonding) {
-          // Enable bonding after successful auth and before sending bond request to transmitter.
-          SerialPrintln(DEBUG, "setup_bd_st");
-          setupBonding();
-          SerialPrintln(DEBUG, "setup_bd_ed");
-        }
-
-        SerialPrintln(DEBUG, "Sending Bond Request.");
-        //Send KeepAliveTxMessage
-        uint8_t keepAliveTxMessage[2] = {0x06, 0x19};                                                                  // Opcode 2 byte = 0x06, 25 as hex (0x19)
-        DexcomConnection::AuthSendValue(keepAliveTxMessage, 2);
-        SerialPrintln(DEBUG, "snd_kp_al");
-        //Send BondRequestTxMessage
-        uint8_t bondRequestTxMessage[1] = {0x07};                                                                      // Send bond command.
-        DexcomConnection::AuthSendValue(bondRequestTxMessage, 1);
-        SerialPrintln(DEBUG, "snd_bd_rq");
-        //Wait for bonding to finish
-        SerialPrintln(DEBUG, "Waiting for bond.");
-        while (bondingFinished == false);                                                                               // Barrier waits until bonding has finished, IMPORTANT to set the bondingFinished variable to sig_atomic_t OR volatile
-        //Wait
-        SerialPrintln(DEBUG, "Bonding finished.");
-    }
-    else
-        SerialPrintln(DEBUG, "Transmitter does not want to (re)bond so DONT send bond request (already bonded).");
-    return true;
-}
-
 /**
  * The Dexcom Receiver is connected (services have been found and pointers saved)
 */
 volatile bool DexcomConnection::connected = false;
 bool DexcomConnection::errorConnection = false;
 volatile bool DexcomConnection::errorLastConnection = false;
-bool DexcomConnection::alternateChannel = false;        // Option to use the alternate data channel (true if using with pump)
 
 unsigned long DexcomConnection::disconnectTime = 0;
-uint8_t DexcomConnection::AuthResponseBuffer[32];
-volatile size_t DexcomConnection::AuthResponseLength = 0;
-uint8_t DexcomConnection::BackfillResponseBuffer[32];
-volatile size_t DexcomConnection::BackfillResponseLength = 0;
-uint8_t DexcomConnection::ControlResponseBuffer[32];
-volatile size_t DexcomConnection::ControlResponseLength = 0;
-String DexcomConnection::transmitterID = DEXCOM_CONFIG_DEFAULT_ID;       // Static storage of one transmitter ID (only the last two characters matter)
+DexcomPacketRing DexcomConnection::authRing;
+DexcomPacketRing DexcomConnection::backfillRing;
+DexcomPacketRing DexcomConnection::controlRing;
+uint32_t DexcomConnection::authOverflows = 0;
+uint32_t DexcomConnection::backfillOverflows = 0;
+uint32_t DexcomConnection::controlOverflows = 0;
 
 
 BLERemoteCharacteristic* DexcomConnection::pRemoteCommunication = NULL;
@@ -270,8 +179,12 @@ BLERemoteCharacteristic* DexcomConnection::pRemoteManufacturer = NULL;
 BLERemoteCharacteristic* DexcomConnection::pRemoteModel = NULL;                   // Uses deviceInformationServiceUUID
 BLERemoteCharacteristic* DexcomConnection::pRemoteFirmware = NULL;                // Uses deviceInformationServiceUUID
 
-BLEScan* DexcomConnection::pBLEScan = NULL;                                                           // The scanner used to look for the device
-BLEAdvertisedDevice* DexcomConnection::myDevice = NULL;                           // The remote device (transmitter) found by the scan and set by scan callback function.
+volatile bool DexcomConnection::scanning = false;
+volatile bool DexcomConnection::found = false;                                    // The remote device (transmitter) found by the scan, also triggers a state change in main loop.
+esp_bd_addr_t DexcomConnection::foundAddress;
+esp_ble_addr_type_t DexcomConnection::foundAddressType = BLE_ADDR_TYPE_PUBLIC;
+uint32_t DexcomConnection::scanWindowMs = 0;
+uint32_t DexcomConnection::scanIntervalMs = 0;
 BLEClient* DexcomConnection::pClient = NULL;                                      // Is global so we can disconnect everywhere when an error occurred.
 
 /**
@@ -279,12 +192,11 @@ BLEClient* DexcomConnection::pClient = NULL;
 */
 
 bool DexcomConnection::isConnected() { return connected; }
-bool DexcomConnection::isFound() { return myDevice != NULL; }
+bool DexcomConnection::isFound() { return found; }
 bool DexcomConnection::lastConnectionWasError() { return errorLastConnection; }
 
-void DexcomConnection::useAlternateChannel() { alternateChannel = true; }
-void DexcomConnection::usePrimaryChannel() { alternateChannel = false; }
-bool DexcomConnection::usingAlternateChannel() { return alternateChannel; }
+static DexcomBLETransport bleTransport;
+DexcomTransport* DexcomConnection::transport() { return &bleTransport; }
 
 void DexcomConnection::onConnect(BLEClient* bleClient) 
 {
@@ -306,59 +218,23 @@ unsigned long DexcomConnection::sinceDisconnect() { return disconnectTime == 0 ?
 
 
 
-/**
- * Function to update the transmitter ID. 
- * Returns true if the update is successful.
- * Fails if the ID is not exactly 6 characters or if the 5th and 6th are not A-Z
-*/
-bool DexcomConnection::setTransmitterID(String updatedTransmitterID)
-{
-    if (updatedTransmitterID.length() == 6) {
-        if (updatedTransmitterID[4] >= 'A' && updatedTransmitterID[4] <= 'Z') {
-            if (updatedTransmitterID[5] >= 'A' && updatedTransmitterID[5] <= 'Z') {
-                transmitterID = updatedTransmitterID;
-            }
-        }
-    }
-    return transmitterID == updatedTransmitterID;
-}
-
-String DexcomConnection::getTransmitterID()
-{
-    return transmitterID;
-}
-
 /**
  * The different callbacks for notify and indicate if new data from the transmitter is available.
+ * They run in the BT stack task, so only stamp and queue the packet, the dump is printed by the consumer.
  */ 
 void DexcomConnection::indicateControlCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify) 
 {
-    SerialPrint(DEBUG, "indicateControlCallback - read ");
-    SerialPrint(DEBUG, length, DEC);
-    SerialPrintln(DEBUG, " byte data: ");
-    printHexArray(pData, length);
-    ControlResponseLength = length;
-    memcpy(&ControlResponseBuffer[0], pData, length > 32 ? 32 : length);
+    controlRing.push(pData, length, millis());
 }
 
 void DexcomConnection::indicateAuthCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify) 
 {
-    SerialPrint(DEBUG, "indicateAuthCallback - read ");
-    SerialPrint(DEBUG, length, DEC);
-    SerialPrintln(DEBUG, " byte data: ");
-    printHexArray(pData, length);
-    AuthResponseLength = length;
-    memcpy(&AuthResponseBuffer[0], pData, length > 32 ? 32 : length);
+    authRing.push(pData, length, millis());
 }
 
 void DexcomConnection::notifyBackfillCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify) 
 {
-    SerialPrint(DEBUG, "notifyBackfillCallback - read ");
-    SerialPrint(DEBUG, length, DEC);
-    SerialPrintln(DEBUG, " byte data: ");
-    printHexArray(pData, length);
-    BackfillResponseLength = length;
-    memcpy(&BackfillResponseBuffer[0], pData, length > 32 ? 32 : length);
+    backfillRing.push(pData, length, millis());
 }
 
 /**
@@ -390,48 +266,37 @@ bool DexcomConnection::readDeviceInformations()
  */
 bool DexcomConnection::AuthSendValue(uint8_t* pData, size_t length)
 {
-    AuthResponseLength = 0;                                                                                          // Reset to invalid because we will write to the characteristic and must wait until new data arrived from the notify callback.
+    discardStale("AuthSendValue", authRing);                                                                            // The answer to this request must be the next packet in the ring.
     return writeValue("AuthSendValue", pRemoteAuthentication, pData, length);
 }
 
 
 /**
- * Barrier to wait until new data arrived through the notify callback.
+ * Barrier to wait until new data arrived through the indicate callback.
  */
 size_t DexcomConnection::AuthWaitToReceiveValue(uint8_t* pData, size_t max_length)
 {
-    while(connected)                                                                                                    // Only loop until we lost connection.
-    {
-        if(AuthResponseLength != 0)
-        {
-            size_t returnSize = AuthResponseLength > max_length ? max_length : AuthResponseLength;
-            memcpy(pData, &AuthResponseBuffer[0], returnSize);                                                      // Save the new value.
-            AuthResponseLength = 0;                                                                                  // Reset because we handled the new data.
-            return returnSize;
-        }
-    }
-    commFault("Error timeout in AuthWaitToReceiveValue");                                                               // The transmitter disconnected so exit.
-    return 0;
+    return receive("AuthWaitToReceiveValue", authRing, authOverflows, pData, max_length);
 }
 
 
 /**
  * Barrier to wait until new data arrived through the notify callback.
+ * Backfill packets come in bursts, the ring keeps them in order until the session drains them.
  */
 size_t DexcomConnection::BackfillWaitToReceiveValue(uint8_t* pData, size_t max_length)
 {
-    while(connected)                                                                                                    // Only loop until we lost connection.
-    {
-        if(BackfillResponseLength != 0)
-        {
-            size_t returnSize = BackfillResponseLength > max_length ? max_length : BackfillResponseLength;
-            memcpy(pData, &BackfillResponseBuffer[0], returnSize);                                                      // Save the new value.
-            BackfillResponseLength = 0;                                                                                  // Reset because we handled the new data.
-            return returnSize;
-        }
-    }
-    commFault("Error timeout in BackfillWaitToReceiveValue");                                                               // The transmitter disconnected so exit.
-    return 0;
+    return receive("BackfillWaitToReceiveValue", backfillRing, backfillOverflows, pData, max_length);
+}
+
+/**
+ * Takes the next backfill packet that already arrived, 0 without waiting when the ring is empty.
+ */
+size_t DexcomConnection::BackfillPollValue(uint8_t* pData, size_t max_length)
+{
+    size_t length = 0;
+    take("BackfillPollValue", backfillRing, backfillOverflows, pData, max_length, &length);
+    return length;
 }
 
 /**
@@ -439,61 +304,103 @@ size_t DexcomConnection::BackfillWaitToReceiveValue(uint8_t* pData, size_t max_l
  */
 bool DexcomConnection::ControlSendValue(uint8_t* pData, size_t length)
 {
-    ControlResponseLength = 0;                                                                                          
+    discardStale("ControlSendValue", controlRing);
     return writeValue("ControlSendValue", pRemoteControl, pData, length);
 }
 
 
 /**
- * Barrier to wait until new data arrived through the notify callback.
+ * Barrier to wait until new data arrived through the indicate callback.
  */
 size_t DexcomConnection::ControlWaitToReceiveValue(uint8_t* pData, size_t max_length)
 {
-    while(connected)                                                                                                    // Only loop until we lost connection.
-    {
-        if(ControlResponseLength != 0)
-        {
-            size_t returnSize = ControlResponseLength > max_length ? max_length : ControlResponseLength;
-            memcpy(pData, &ControlResponseBuffer[0], returnSize);                                                      // Save the new value.
-            ControlResponseLength = 0;                                                                                  // Reset because we handled the new data.
-            return returnSize;
-        }
-    }
-    commFault("Error timeout in ControlWaitToReceiveValue");                                                            // The transmitter disconnected so exit.
-    return 0;
+    return receive("ControlWaitToReceiveValue", controlRing, controlOverflows, pData, max_length);
+}
+
+/**
+ * Takes the next control packet that already arrived, 0 without waiting when the ring is empty.
+ */
+size_t DexcomConnection::ControlPollValue(uint8_t* pData, size_t max_length)
+{
+    size_t length = 0;
+    take("ControlPollValue", controlRing, controlOverflows, pData, max_length, &length);
+    return length;
 }
 
 /**
- * Create a BLE scanner and block while looking for a dexcom transmitter with the correct ID
+ * Scan through the GAP API and block while looking for a dexcom transmitter with the correct ID.
+ * BLEScan is never created, so no BLEAdvertisedDevice is built or kept for the other advertisers around us.
 */
 void DexcomConnection::find() 
 {
 
     BLEDevice::init("");                                                                                    // Possible source of error if we cant connect to the transmitter.
-
-    pBLEScan = BLEDevice::getScan();                                                                        // Retrieve a Scanner.
-    pBLEScan->setAdvertisedDeviceCallbacks(new nestedAdvertisedDeviceCallbacks());                              // Set the callback to informed when a new device was detected.
-    pBLEScan->setInterval(100); //100 works                                                                 // The time in ms how long each search intrevall last. Important for fast scanning so we dont miss the transmitter waking up.
-    pBLEScan->setWindow(99); //60-99 works                                                                  // The actual time that will be searched. Interval - Window = time the esp is doing nothing (used for energy efficiency).
-    pBLEScan->setActiveScan(false); 
-    pBLEScan->start(3, true);                                                                               // false = maybe helps with connection problems.
+    BLEDevice::setCustomGapHandler(gapEventHandler);                                                        // Raw scan results come to gapEventHandler.
+
+    const DexcomScanParams &params = DexcomScanTuner::current();                                            // Interval and window are picked by the tuner from the measured time to detect.
+    scanIntervalMs = params.intervalMs;                                                                     // The time in ms how long each search intrevall last. Important for fast scanning so we dont miss the transmitter waking up.
+    scanWindowMs = params.windowMs;                                                                         // The actual time that will be searched. Interval - Window = time the esp is doing nothing (used for energy efficiency).
+    esp_ble_scan_params_t scanParams = {
+        .scan_type = BLE_SCAN_TYPE_PASSIVE,
+        .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+        .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+        .scan_interval = (uint16_t)(scanIntervalMs * 1000 / 625),                                           // Units of 0.625 ms.
+        .scan_window = (uint16_t)(scanWindowMs * 1000 / 625),
+        .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE                                                         // The controller reports each advertiser once per scan.
+    };
+    DexcomScanTuner::scanStarted();
+    scanning = true;
+    if (esp_ble_gap_set_scan_params(&scanParams) != ESP_OK)                                                 // The scan starts in the param set event.
+    {
+        scanning = false;
+        return;
+    }
+    unsigned long start = millis();
+    while (scanning && !found && millis() - start < (SCAN_DURATION_SEC + 1) * 1000UL)
+        delay(10);
+    if (scanning)
+        esp_ble_gap_stop_scanning();
+    scanning = false;
+    if (isFound())
+        DexcomScanTuner::finishWindow();
 }
 
-void DexcomConnection::advertisedDeviceCallback(BLEAdvertisedDevice advertisedDevice)
+/**
+ * Runs on the Bluedroid task for every GAP event. Scan results are matched on their raw bytes,
+ * only the transmitter gets logged and its address stored.
+ */
+void DexcomConnection::gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param)
 {
-    SerialPrint(DEBUG, "BLE Advertised Device found: ");
-    SerialPrintln(DEBUG, advertisedDevice.toString().c_str());
-
-    // We have found a device, let us now see if it contains the service we are looking for.
-    if (advertisedDevice.haveServiceUUID() && advertisedDevice.isAdvertisingService(advServiceUUID) &&              // If the advertised service is the dexcom advertise service (not the main service that contains the characteristics).
-        advertisedDevice.haveName() && 
-         (advertisedDevice.getName() == ("Dexcom" + transmitterID.substring(4,6)) ||
-          advertisedDevice.getName() == transmitterID)
-        )
+    switch (event)
     {
-        pBLEScan->stop();                                                                               // We found our transmitter so stop scanning for now.
-        SerialPrintln(DEBUG, "Found Dexcom");
-        myDevice = new BLEAdvertisedDevice(advertisedDevice);                                                       // Save device as new copy, myDevice also triggers a state change in main loop.
+        case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+            if (scanning && esp_ble_gap_start_scanning(SCAN_DURATION_SEC) != ESP_OK)
+                scanning = false;
+            break;
+        case ESP_GAP_BLE_SCAN_RESULT_EVT:
+            if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_CMPL_EVT)                                  // Scan duration is over.
+            {
+                scanning = false;
+                break;
+            }
+            if (param->scan_rst.search_evt != ESP_GAP_SEARCH_INQ_RES_EVT || found)
+                break;
+            DexcomPerf::count(PERF_ADV_SEEN);
+            if (!DexcomAdvFilter::match(param->scan_rst.ble_adv, param->scan_rst.adv_data_len + param->scan_rst.scan_rsp_len, DexcomSession::transmitter()))
+                break;
+            DexcomScanTuner::markDetected();
+            esp_ble_gap_stop_scanning();                                                                    // We found our transmitter so stop scanning for now.
+            memcpy(foundAddress, param->scan_rst.bda, sizeof(esp_bd_addr_t));
+            foundAddressType = param->scan_rst.ble_addr_type;
+            found = true;                                                                                   // Triggers a state change in main loop.
+            SerialPrint(DEBUG, "Found Dexcom ");
+            printAddress(DEBUG, foundAddress);
+            break;
+        case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+            scanning = false;
+            break;
+        default:
+            break;
     }
 }
 
@@ -503,18 +410,25 @@ void DexcomConnection::advertisedDeviceCallback(BLEAdvertisedDevice advertisedDe
 bool DexcomConnection::connect()
 {
     errorConnection = false;
+    authRing.clear();                                                                                                   // Nothing of the last connection belongs to this one.
+    backfillRing.clear();
+    controlRing.clear();
 
     SerialPrint(DEBUG, "Forming a connection to ");
-    SerialPrintln(DEBUG, myDevice->getAddress().toString().c_str());
+    printAddress(DEBUG, foundAddress);
 
-    pClient = BLEDevice::createClient();                                                                                // We specify the security settings later after we have successful authorized with the transmitter.
-    SerialPrintln(DEBUG, " - Created client");
+    static DexcomConnection clientCallbacks;
+    if (pClient == NULL)                                                                                                // One client for all connections, the BLE library keeps every client it created.
+    {
+        pClient = BLEDevice::createClient();                                                                            // We specify the security settings later after we have successful authorized with the transmitter.
+        SerialPrintln(DEBUG, " - Created client");
+    }
 
-    pClient->setClientCallbacks(new DexcomConnection());                                                                // Callbacks for onConnect() onDisconnect()
-    SerialPrintln(DEBUG, " - Callbacks assigned attempting connection to myDevice");
+    pClient->setClientCallbacks(&clientCallbacks);                                                                      // Callbacks for onConnect() onDisconnect()
+    SerialPrintln(DEBUG, " - Callbacks assigned attempting connection to the transmitter");
 
     // Connect to the remote BLE Server.
-    if(!pClient->connect(myDevice))                                                                                     // Notice from the example: if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
+    if(!pClient->connect(BLEAddress(foundAddress), foundAddressType))                                                   // The address type from the advertisement (public or private).
         return false;
     
     SerialPrintln(DEBUG, " - Connected to server");
@@ -524,7 +438,7 @@ bool DexcomConnection::connect()
     if (pRemoteService == nullptr) 
     {
         SerialPrint(ERROR, "Failed to find our service UUID: ");
-        SerialPrintln(ERROR, serviceUUID.toString().c_str());
+        printUUID(ERROR, serviceUUID);
         pClient->disconnect();
         return false;
     }
@@ -532,7 +446,7 @@ bool DexcomConnection::connect()
     if (pRemoteServiceInfos == nullptr)
     {
         SerialPrint(ERROR, "Failed to find our service UUID: ");
-        SerialPrintln(ERROR, deviceInformationServiceUUID.toString().c_str());
+        printUUID(ERROR, deviceInformationServiceUUID);
         pClient->disconnect();
         return false;
     }
@@ -567,7 +481,7 @@ bool DexcomConnection::disconnect()
     SerialPrintln(DEBUG, "Initiating a disconnect.");
     uint8_t disconnectTxMessage[1] = {0x09}; 
     ControlSendValue(disconnectTxMessage, 1);
-    while(connected);                                                                                                   // Wait until onDisconnect callback was called and connected status flipped.
+    while(connected) delay(1);                                                                                          // Wait until onDisconnect callback was called and connected status flipped.
     return true;
 }
 
@@ -582,7 +496,7 @@ bool DexcomConnection::getCharacteristic(BLERemoteCharacteristic** pRemoteCharac
     if (*pRemoteCharacteristic == nullptr) 
     {
         SerialPrint(DEBUG, "Failed to find our characteristic for UUID: ");
-        SerialPrintln(DEBUG, uuid.toString().c_str());
+        printUUID(DEBUG, uuid);
         return false;
     }
     return true;
@@ -618,9 +532,9 @@ bool DexcomConnection::controlRegister()
 /**
  * Write a string to the given characteristic.
  */
-bool DexcomConnection::writeValue(String caller, BLERemoteCharacteristic *pRemoteCharacteristic, uint8_t* pData, size_t length)
+bool DexcomConnection::writeValue(const char* caller, BLERemoteCharacteristic *pRemoteCharacteristic, uint8_t* pData, size_t length)
 {
-    SerialPrint(DEBUG, caller.c_str());
+    SerialPrint(DEBUG, caller);
     SerialPrint(DEBUG, " - Writing Data = ");
     printHexArray(pData, length);
     //BLERemoteCharacteristic: writeValue(std::string newValue, bool response = false);                                 //Not possible to send 0x00 within a string because this method converts std::string to c string using c_str()
@@ -632,6 +546,57 @@ bool DexcomConnection::writeValue(String caller, BLERemoteCharacteristic *pRemot
 }
 
 
+/**
+ * Blocks until the ring has a packet.
+ */
+size_t DexcomConnection::receive(const char* caller, DexcomPacketRing &ring, uint32_t &overflowsSeen, uint8_t* pData, size_t max_length)
+{
+    size_t length = 0;
+    while(connected)                                                                                                    // Only loop until we lost connection.
+    {
+        if (take(caller, ring, overflowsSeen, pData, max_length, &length))
+            return length;
+        delay(1);                                                                                                       // Yield so the other tasks on the BLE core keep running.
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "Error timeout in %s", caller);
+    commFault(message);                                                                                                 // The transmitter disconnected so exit.
+    return 0;
+}
+
+/**
+ * Pops the oldest packet, dumps it and copies it out, false when the ring is empty.
+ * Packets the callback had to drop since the last call are reported here, outside of the BT stack task.
+ */
+bool DexcomConnection::take(const char* caller, DexcomPacketRing &ring, uint32_t &overflowsSeen, uint8_t* pData, size_t max_length, size_t* length)
+{
+    static DexcomPacket packet;                                                                                         // Only the protocol task consumes, keeps 72 bytes off its stack.
+    uint32_t overflows = ring.get_overflows();
+    if (overflows != overflowsSeen)
+    {
+        SerialPrintf(ERROR, "%s - ring full, %u packets dropped\n\r", caller, (unsigned)(overflows - overflowsSeen));
+        overflowsSeen = overflows;
+    }
+    if (!ring.pop(&packet))
+        return false;
+    SerialPrintf(DEBUG, "%s - read %u byte data %u ms ago: ", caller, (unsigned)packet.received, (unsigned)(millis() - packet.time));
+    printHexArray(packet.data, packet.length);
+    *length = packet.length > max_length ? max_length : packet.length;
+    memcpy(pData, packet.data, *length);
+    return true;
+}
+
+/**
+ * Drops packets nobody waited for before a new request is written, the request / response pairing stays intact.
+ */
+void DexcomConnection::discardStale(const char* caller, DexcomPacketRing &ring)
+{
+    size_t dropped = ring.clear();
+    if (dropped > 0)
+        SerialPrintf(ERROR, "%s - discarded %u unread packets\n\r", caller, (unsigned)dropped);
+}
+
+
 /**
  * Register for notification, also check if notification is available.
  */
@@ -641,13 +606,13 @@ bool DexcomConnection::registerForNotification(notify_callback _callback, BLERem
     {
         pBLERemoteCharacteristic->registerForNotify(_callback);
         SerialPrint(DEBUG, " - Registered for notify on UUID: ");
-        SerialPrintln(DEBUG, pBLERemoteCharacteristic->getUUID().toString().c_str());
+        printUUID(DEBUG, pBLERemoteCharacteristic->getUUID());
         return true;
     }
     else
     {
         SerialPrint(ERROR, " - Notify NOT available for UUID: ");
-        SerialPrintln(ERROR, pBLERemoteCharacteristic->getUUID().toString().c_str());
+        printUUID(ERROR, pBLERemoteCharacteristic->getUUID());
     }
     return false;
 }
@@ -661,7 +626,7 @@ bool DexcomConnection::forceRegisterNotificationAndIndication(notify_callback _c
     pBLERemoteCharacteristic->registerForNotify(_callback, isNotify);                                                   // Register first for indication(/notification) (because this is the correct one)
     pBLERemoteCharacteristic->getDescriptor(BLEUUID((uint16_t)0x2902))->writeValue((uint8_t *)bothOn, 2, true);         // True to wait for acknowledge, set to both, manually set the bytes because there is no such function to set both.
     SerialPrint(DEBUG, " - FORCE registered for indicate and notify on UUID: ");
-    SerialPrintln(DEBUG, pBLERemoteCharacteristic->getUUID().toString().c_str());
+    printUUID(DEBUG, pBLERemoteCharacteristic->getUUID());
     return true;
 }
 
@@ -675,21 +640,52 @@ bool DexcomConnection::registerForIndication(notify_callback _callback, BLERemot
     {
         pBLERemoteCharacteristic->registerForNotify(_callback, false);  // false = indication, true = notification
         SerialPrint(DEBUG, " - Registered for indicate on UUID: ");
-        SerialPrintln(DEBUG, pBLERemoteCharacteristic->getUUID().toString().c_str());
+        printUUID(DEBUG, pBLERemoteCharacteristic->getUUID());
         return true;
     }
     else
     {
         SerialPrint(ERROR, " - Indicate NOT available for UUID: ");
-        SerialPrintln(ERROR, pBLERemoteCharacteristic->getUUID().toString().c_str());
+        printUUID(ERROR, pBLERemoteCharacteristic->getUUID());
     }
     return false;
 }
 
 
-void DexcomConnection::commFault(String faultMessage)
+void DexcomConnection::commFault(const char* faultMessage)
 {
     errorConnection = true;                         // Set to true to indicate that an error has occurred.
-    SerialPrintln(ERROR, faultMessage.c_str());
+    SerialPrintln(ERROR, faultMessage);
     pClient->disconnect();   
+}
+
+
+//
+// DexcomBLETransport
+//
+
+/**
+ * Bonding is enabled before connecting unless it is forced to happen after authentication.
+ */
+bool DexcomBLETransport::connect()
+{
+    if(!DexcomSecurity::forceRebondingEnabled())
+        DexcomSecurity::setupBonding();
+    return DexcomConnection::connect();
+}
+
+void DexcomBLETransport::prepareBond()
+{
+    if(DexcomSecurity::forceRebondingEnabled()) {
+      // Enable bonding after successful auth and before sending bond request to transmitter.
+      SerialPrintln(DEBUG, "setup_bd_st");
+      DexcomSecurity::setupBonding();
+      SerialPrintln(DEBUG, "setup_bd_ed");
+    }
+}
+
+bool DexcomBLETransport::waitForBond()
+{
+    while (!DexcomSecurity::isBonded() && DexcomConnection::isConnected()) delay(1);                                  // Barrier waits until bonding has finished or the transmitter dropped the link.
+    return DexcomSecurity::isBonded();
 }
\ No newline at end of file
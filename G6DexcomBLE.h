@@ -13,11 +13,11 @@
 
 #include <Arduino.h>
 #include <Esp.h>
-#include "mbedtls/aes.h"
 #include "BLEDevice.h"
-#include "BLEScan.h"
 #include "BLEUUID.h"
 #include "DebugHelper.h"
+#include "DexcomTransport.h"
+#include "DexcomPacketRing.h"
 
 
 // Byte values for the notification / indication.
@@ -33,12 +33,10 @@ const uint8_t bothOn[]         = {0x3, 0x0};
  */
 class DexcomSecurity : public BLESecurityCallbacks 
 {
-    static bool bonding;
     static volatile bool bondingFinished;
     static bool forceRebonding;
 
     public:
-        static bool authenticate();
         static void forceRebondingEnable();
         static void forceRebondingDisable();
         static bool forceRebondingEnabled();
@@ -48,26 +46,18 @@ class DexcomSecurity : public BLESecurityCallbacks
         bool onConfirmPIN(uint32_t pass_key);
         bool onSecurityRequest();
         void onAuthenticationComplete(esp_ble_auth_cmpl_t auth_cmpl);
-        static bool requestBond();
         static void setupBonding();
-    private:
-        static uint64_t calculateHash(uint64_t data, String id);
-        static void encrypt(uint8_t* buffer, String id, uint8_t* output);
 };
 
 class DexcomConnection : public BLEClientCallbacks
 {
     static volatile bool connected;                  // Indicates if the ble client is connected to the transmitter. Used to detect a transmitter timeout.
-    static uint8_t AuthSendBuffer[16];
-    static uint8_t AuthResponseBuffer[32];
-    static volatile size_t AuthResponseLength;
-    static uint8_t BackfillResponseBuffer[32];
-    static volatile size_t BackfillResponseLength;
-    static uint8_t ControlSendBuffer[32];
-    static uint8_t ControlResponseBuffer[32];
-    static volatile size_t ControlResponseLength;
-    static String transmitterID;       // Static storage of one transmitter ID (only the last two characters matter)
-    static bool alternateChannel;        // Option to use the alternate data channel (true if using with pump)
+    static DexcomPacketRing authRing;                                // Filled by the callbacks in the BT stack task, drained by the protocol task.
+    static DexcomPacketRing backfillRing;
+    static DexcomPacketRing controlRing;
+    static uint32_t authOverflows;                                   // Ring overflows already reported by the consumer.
+    static uint32_t backfillOverflows;
+    static uint32_t controlOverflows;
     static bool errorConnection;            // Used to hold error status until the connection is disconnected.
     static volatile bool errorLastConnection;
     static unsigned long disconnectTime;
@@ -79,19 +69,19 @@ class DexcomConnection : public BLEClientCallbacks
     static BLERemoteCharacteristic* pRemoteModel;                   // Uses deviceInformationServiceUUID
     static BLERemoteCharacteristic* pRemoteFirmware;                // Uses deviceInformationServiceUUID
     
-    static BLEScan* pBLEScan;                                       // The scanner used to look for the device
-    static BLEAdvertisedDevice* myDevice;                           // The remote device (transmitter) found by the scan and set by scan callback function.
+    static volatile bool scanning;                                  // A GAP scan started by find() is running.
+    static volatile bool found;                                     // Set by the GAP handler when the transmitter advertised.
+    static esp_bd_addr_t foundAddress;                              // Address and address type of the transmitter found by the scan.
+    static esp_ble_addr_type_t foundAddressType;
+    static uint32_t scanWindowMs;                                   // Scan parameters handed to the controller by the GAP handler.
+    static uint32_t scanIntervalMs;
     static BLEClient* pClient;                                      // Is global so we can disconnect everywhere when an error occurred.
 
     public:  
-        static bool setTransmitterID(String updatedTransmitterID);    //returns true if the new transmitter ID is valid, and the value is updated.
-        static String getTransmitterID();
-        static void useAlternateChannel();
-        static void usePrimaryChannel();
-        static bool usingAlternateChannel();
+        static DexcomTransport* transport();
 
         static void find();
-        static void advertisedDeviceCallback(BLEAdvertisedDevice advertisedDevice);
+        static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);                     // Raw scan results, everything but our transmitter is dropped here.
         static bool isFound();
         static bool connect();
         void onConnect(BLEClient *bleClient);
@@ -103,34 +93,59 @@ class DexcomConnection : public BLEClientCallbacks
         static bool backfillRegister();
         static bool backfillRegister(notify_callback callbackFunction);
         static size_t BackfillWaitToReceiveValue(uint8_t* pData, size_t max_length);
+        static size_t BackfillPollValue(uint8_t* pData, size_t max_length);
         static bool controlRegister();
         static bool ControlSendValue(uint8_t* pData, size_t length);
         static size_t ControlWaitToReceiveValue(uint8_t* pData, size_t max_length);
+        static size_t ControlPollValue(uint8_t* pData, size_t max_length);
 
         static bool disconnect();
         void onDisconnect(BLEClient *bleClient);
         static unsigned long sinceDisconnect();
         static bool lastConnectionWasError();
         static bool resetConnection();
-        static void commFault(String faultMessage);
+        static void commFault(const char* faultMessage);
 
     private:
         static void indicateControlCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
         static void indicateAuthCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify);
         static void notifyBackfillCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify);
-        static bool writeValue(String caller, BLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length);
+        static size_t receive(const char* caller, DexcomPacketRing &ring, uint32_t &overflowsSeen, uint8_t* pData, size_t max_length);
+        static bool take(const char* caller, DexcomPacketRing &ring, uint32_t &overflowsSeen, uint8_t* pData, size_t max_length, size_t* length);
+        static void discardStale(const char* caller, DexcomPacketRing &ring);
+        static bool writeValue(const char* caller, BLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length);
         static bool getCharacteristic(BLERemoteCharacteristic** pRemoteCharacteristic, BLERemoteService* pRemoteService, BLEUUID uuid) ;
         static bool registerForNotification(notify_callback _callback, BLERemoteCharacteristic *pBLERemoteCharacteristic);
         static bool forceRegisterNotificationAndIndication(notify_callback _callback, BLERemoteCharacteristic *pBLERemoteCharacteristic, bool isNotify);
         static bool registerForIndication(notify_callback _callback, BLERemoteCharacteristic *pBLERemoteCharacteristic);
+};
 
-        class nestedAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
-        {
-            void onResult(BLEAdvertisedDevice advertisedDevice)                                                                 // Called for each advertising BLE server.
-            {
-                DexcomConnection::advertisedDeviceCallback(advertisedDevice);
-            }
-        };
+
+/**
+ * The BLE client as seen by the portable session code.
+ */
+class DexcomBLETransport : public DexcomTransport
+{
+    public:
+        bool connect();
+        bool isConnected() { return DexcomConnection::isConnected(); }
+        bool disconnect() { return DexcomConnection::disconnect(); }
+        void fault(const char* message) { DexcomConnection::commFault(message); }
+        bool lastConnectionWasError() { return DexcomConnection::lastConnectionWasError(); }
+
+        bool readDeviceInformations() { return DexcomConnection::readDeviceInformations(); }
+        void prepareBond();
+        bool waitForBond();
+
+        bool authSend(uint8_t* pData, size_t length) { return DexcomConnection::AuthSendValue(pData, length); }
+        size_t authReceive(uint8_t* pData, size_t max_length) { return DexcomConnection::AuthWaitToReceiveValue(pData, max_length); }
+        bool controlRegister() { return DexcomConnection::controlRegister(); }
+        bool controlSend(uint8_t* pData, size_t length) { return DexcomConnection::ControlSendValue(pData, length); }
+        size_t controlReceive(uint8_t* pData, size_t max_length) { return DexcomConnection::ControlWaitToReceiveValue(pData, max_length); }
+        size_t controlPoll(uint8_t* pData, size_t max_length) { return DexcomConnection::ControlPollValue(pData, max_length); }
+        bool backfillRegister() { return DexcomConnection::backfillRegister(); }
+        size_t backfillReceive(uint8_t* pData, size_t max_length) { return DexcomConnection::BackfillWaitToReceiveValue(pData, max_length); }
+        size_t backfillPoll(uint8_t* pData, size_t max_length) { return DexcomConnection::BackfillPollValue(pData, max_length); }
 };
 
 
@@ -0,0 +1,55 @@
+/*
+ * G6DexcomBacklight
+ */
+
+
+#include <Arduino.h>
+#include "pin_config.h"
+#include "G6DexcomBacklight.h"
+#include "G6DexcomEnergy.h"
+
+
+int DexcomBacklight::userState = 1;
+int DexcomBacklight::targetDuty = -1;
+int DexcomBacklight::dataAge = 0;
+int DexcomBacklight::alertLevel = BACKLIGHT_ALERT_NONE;
+
+/**
+ * Attach the backlight pin to the LEDC and start at half brightness until the first update.
+ */
+void DexcomBacklight::setup()
+{
+    ledcAttach(PIN_LCD_BL, LCD_BL_LED_FREQ, LCD_BL_LED_RES);
+    ledcWrite(PIN_LCD_BL, BACKLIGHT_DUTY_CAUTION);
+    targetDuty = BACKLIGHT_DUTY_CAUTION;
+    DexcomEnergy::set(POWER_DISPLAY, DexcomEnergy::backlightState(targetDuty));
+}
+
+/**
+ * Evaluate the policy and hand a new target to the LEDC fade unit.
+ * Nothing is written when the target did not change, so this is cheap to call every tick.
+ */
+void DexcomBacklight::update(int newDataAge, int newAlertLevel)
+{
+    dataAge = newDataAge;
+    alertLevel = newAlertLevel;
+
+    int duty = policy(dataAge, alertLevel, userState);
+    if (duty == targetDuty)
+        return;
+
+    uint32_t startDuty = targetDuty < 0 ? ledcRead(PIN_LCD_BL) : (uint32_t)targetDuty;                                  // Ramp from where the last fade was headed.
+    targetDuty = duty;
+    DexcomEnergy::set(POWER_DISPLAY, DexcomEnergy::backlightState(duty));
+    if (!ledcFade(PIN_LCD_BL, startDuty, duty, BACKLIGHT_FADE_MS))                                                      // The fade runs in hardware, no CPU time is spent ramping.
+        ledcWrite(PIN_LCD_BL, duty);
+}
+
+void DexcomBacklight::set_userState(int state)
+{
+    userState = state;
+    update(dataAge, alertLevel);
+}
+
+int DexcomBacklight::get_userState() { return userState; }
+int DexcomBacklight::get_targetDuty() { return targetDuty; }
@@ -0,0 +1,56 @@
+/**
+ * Header File with the backlight brightness policy and the LEDC fade controller
+ * The policy is plain integer logic so it can be checked off target,
+ * only the controller touches the LEDC hardware.
+ */
+
+#ifndef G6DEXCOMBACKLIGHT_H
+#define G6DEXCOMBACKLIGHT_H
+
+#include <stdint.h>
+
+// Alert level of the displayed glucose value, the caller compares the value against its limits.
+#define BACKLIGHT_ALERT_NONE    0
+#define BACKLIGHT_ALERT_CAUTION 1                                                                                       // Outside the high / low limits.
+#define BACKLIGHT_ALERT_WARNING 2                                                                                       // Outside the hi-high / lo-low limits.
+
+// Duty levels for the 8 bit backlight channel.
+#define BACKLIGHT_DUTY_OFF      0
+#define BACKLIGHT_DUTY_DIM      64
+#define BACKLIGHT_DUTY_CAUTION  128
+#define BACKLIGHT_DUTY_WARNING  192
+#define BACKLIGHT_DUTY_FULL     255
+
+// Time for the LEDC fade unit to ramp between two levels.
+#define BACKLIGHT_FADE_MS       400
+
+class DexcomBacklight
+{
+    static int userState;                                                                                               // Screen on / off selected with the buttons.
+    static int targetDuty;                                                                                              // Last duty handed to the fade unit, -1 before setup.
+    static int dataAge;                                                                                                 // Inputs of the last update, kept to re-evaluate on a user state change.
+    static int alertLevel;
+
+    public:
+        static void setup();
+        static void update(int dataAge, int alertLevel);
+        static void set_userState(int state);
+        static int get_userState();
+        static int get_targetDuty();
+
+        /**
+         * The single brightness policy.
+         * New data is shown at full brightness, old data or a warning level glucose stays bright,
+         * a caution level gets some extra time before dimming, everything else is dimmed.
+         */
+        static inline uint8_t policy(int dataAge, int alertLevel, int userState)
+        {
+            if (userState <= 0) return BACKLIGHT_DUTY_OFF;
+            if (dataAge < 15) return BACKLIGHT_DUTY_FULL;                                                              // Data is new make sure we see it
+            if (dataAge > 600 || alertLevel >= BACKLIGHT_ALERT_WARNING) return BACKLIGHT_DUTY_WARNING;                 // Data is old, or Alarm level
+            if (dataAge < 60 && alertLevel == BACKLIGHT_ALERT_CAUTION) return BACKLIGHT_DUTY_CAUTION;                  // Give more time to see warning conditions
+            return BACKLIGHT_DUTY_DIM;
+        }
+};
+
+#endif /* G6DEXCOMBACKLIGHT_H */
@@ -0,0 +1,95 @@
+/*
+ * G6DexcomBattery
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomBattery.h"
+#include "DebugHelper.h"
+#include "DexcomPerf.h"
+
+
+bool DexcomBattery::continuous = false;
+int32_t DexcomBattery::emaScaled = 0;
+int DexcomBattery::millivolts = 0;
+int DexcomBattery::percent = 0;
+bool DexcomBattery::charging = false;
+uint8_t DexcomBattery::pctDischarge[BATT_TABLE_SIZE];
+uint8_t DexcomBattery::pctCharge[BATT_TABLE_SIZE];
+
+/**
+ * Build the lookup tables and configure the ADC continuous mode on the battery pin, it is started per burst.
+ */
+void DexcomBattery::setup()
+{
+    buildTable(pctDischarge, BAT_VOLT_D);
+    buildTable(pctCharge, BAT_VOLT_C);
+
+    const uint8_t pins[1] = { PIN_BAT_VOLT };
+    analogContinuousSetWidth(12);
+    continuous = analogContinuous(pins, 1, BATT_OVERSAMPLE, BATT_SAMPLE_FREQ_HZ, NULL);
+    if (!continuous)
+    {
+        SerialPrintln(ERROR, "ADC continuous mode failed, reading the battery one shot.");
+        analogReadResolution(12);
+    }
+
+    // Seed the filter with a full burst so the first value on screen is not a ramp from zero.
+    emaScaled = 0;
+    update();
+}
+
+/**
+ * Take one burst, fold it into the filter and refresh the cached values.
+ * Called once a second by the UI task, blocks for the burst of about BATT_BURST_TIMEOUT_MS / 2.
+ */
+void DexcomBattery::update()
+{
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    int mv = sample();
+    DexcomPerf::stop(PERF_ADC_READ, stamp);
+    if (mv <= 0)
+        return;
+
+    if (emaScaled == 0)
+        emaScaled = (int32_t)mv << BATT_EMA_SHIFT;
+    else
+        emaScaled += mv - (emaScaled >> BATT_EMA_SHIFT);
+    millivolts = emaScaled >> BATT_EMA_SHIFT;
+
+    if (!charging && millivolts >= BATT_CHARGING_MV + BATT_HYSTERESIS_MV) charging = true;
+    else if (charging && millivolts < BATT_CHARGING_MV - BATT_HYSTERESIS_MV) charging = false;
+
+    percent = lookup(charging ? pctCharge : pctDischarge, millivolts);
+}
+
+int DexcomBattery::get_millivolts() { return millivolts; }
+int DexcomBattery::get_percent() { return percent; }
+bool DexcomBattery::isCharging() { return charging; }
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * Runs one DMA burst and returns its averaged millivolts, or 0 when it did not complete.
+ * The conversions stop right after, a running continuous driver would hold a power management lock and keep
+ * the chip out of light sleep.
+ */
+int DexcomBattery::sample()
+{
+    if (!continuous)
+        return analogReadMilliVolts(PIN_BAT_VOLT);
+
+    if (!analogContinuousStart())
+        return 0;
+    adc_continuous_data_t *result = NULL;
+    bool read = analogContinuousRead(&result, BATT_BURST_TIMEOUT_MS) && result != NULL;                                 // A missed burst is picked up on the next tick.
+    int mv = read ? result[0].avg_read_mvolts : 0;
+    analogContinuousStop();
+    return mv;
+}
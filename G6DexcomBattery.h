@@ -0,0 +1,86 @@
+/**
+ * Header File with the battery voltage sampler
+ * Each tick the ADC runs one oversampled burst in continuous mode through DMA and is stopped again, so it is idle
+ * and holds no power management lock between ticks. The UI task folds each burst into an EMA and looks the charge
+ * up in a precomputed table.
+ */
+
+#ifndef G6DEXCOMBATTERY_H
+#define G6DEXCOMBATTERY_H
+
+#include <stdint.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "pin_config.h"
+#endif
+
+#define BATT_SAMPLE_FREQ_HZ     20000                                                                                   // ADC conversion rate of the continuous mode.
+#define BATT_OVERSAMPLE         64                                                                                      // Conversions averaged into one burst result.
+#define BATT_BURST_TIMEOUT_MS   (2 * (1000 * BATT_OVERSAMPLE) / BATT_SAMPLE_FREQ_HZ + 2)                                // Wait for one burst, about 3 ms.
+#define BATT_EMA_SHIFT          3                                                                                       // EMA weight of a new burst is 1 / 2^shift.
+
+// Range and resolution of the state of charge table.
+#define BATT_TABLE_MIN_MV       2500
+#define BATT_TABLE_MAX_MV       4650
+#define BATT_TABLE_STEP_MV      10
+#define BATT_TABLE_SIZE         ((BATT_TABLE_MAX_MV - BATT_TABLE_MIN_MV) / BATT_TABLE_STEP_MV + 1)
+
+// Above this voltage the charging curve is used, the hysteresis keeps the curve from toggling.
+#define BATT_CHARGING_MV        4190
+#define BATT_HYSTERESIS_MV      40
+
+// Defined points in percent and millivolts, table for drain and charging (based on HTC powerpack charging).
+static const int BAT_PCT[7]    = {    0,   10,   25,   50,   75,   90,  100};
+static const int BAT_VOLT_D[7] = { 2500, 3330, 3450, 3660, 3800, 3900, 4000};
+static const int BAT_VOLT_C[7] = { 4350, 4400, 4450, 4500, 4560, 4620, 4650};
+
+class DexcomBattery
+{
+    static bool continuous;                                                                                             // False when the continuous driver could not be started.
+    static int32_t emaScaled;                                                                                           // Filtered millivolts << BATT_EMA_SHIFT, 0 until the first sample.
+    static int millivolts;
+    static int percent;
+    static bool charging;
+    static uint8_t pctDischarge[BATT_TABLE_SIZE];
+    static uint8_t pctCharge[BATT_TABLE_SIZE];
+
+    public:
+        static void setup();
+        static void update();
+        static int get_millivolts();
+        static int get_percent();
+        static bool isCharging();
+
+        /**
+         * Fill a table with the linear interpolation of the given curve, one entry per BATT_TABLE_STEP_MV.
+         * Plain integer logic like the backlight policy, so the charge lookup can be measured off target.
+         */
+        static inline void buildTable(uint8_t* table, const int* volts)
+        {
+            for (int i = 0; i < BATT_TABLE_SIZE; i++)
+            {
+                int mv = BATT_TABLE_MIN_MV + i * BATT_TABLE_STEP_MV;
+                int pct = 100;                                                                                          // Above the last point.
+                if (mv < volts[0]) pct = 0;
+                for (int j = 0; j < 6; j++)
+                {
+                    if (mv >= volts[j] && mv < volts[j+1])
+                        pct = BAT_PCT[j] + ((BAT_PCT[j+1] - BAT_PCT[j]) * (mv - volts[j]) / (volts[j+1] - volts[j]));
+                }
+                table[i] = (uint8_t)pct;
+            }
+        }
+
+        static inline int lookup(const uint8_t* table, int millivolts)
+        {
+            int index = (millivolts - BATT_TABLE_MIN_MV) / BATT_TABLE_STEP_MV;
+            if (index < 0) index = 0;
+            if (index >= BATT_TABLE_SIZE) index = BATT_TABLE_SIZE - 1;
+            return table[index];
+        }
+
+    private:
+        static int sample();
+};
+
+#endif /* G6DEXCOMBATTERY_H */
@@ -1,8 +1,10 @@
 
 
+#include <string.h>
 #include "G6DexcomClient.h"
+#include "G6DexcomSession.h"
 #include "DebugHelper.h"
-#include "rom/crc.h"
+#include "DexcomPlatform.h"
 
 
 uint16_t DexcomClient::currentBG = 0;
@@ -10,15 +12,29 @@ int DexcomClient::saveLastXValues = 12;
 uint16_t DexcomClient::glucoseValues[72] = {   0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0
                                 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0
                                 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0 ,0,0,0,0};
-std::string DexcomClient::backfillStream = "";
+uint8_t DexcomClient::backfillStream[8];
+size_t DexcomClient::backfillStreamLength = 0;
 int DexcomClient::backfillExpectedSequence = 0;
+uint32_t DexcomClient::backfillStart = 0;
+uint32_t DexcomClient::backfillEnd = 0;
+uint32_t DexcomClient::backfillLast = HISTORY_EMPTY;
+bool DexcomClient::backfillColdStart = false;
+bool DexcomClient::backfillComplete = true;
+uint32_t DexcomClient::backfillResponseMs = 0;
+DexcomBackfillSink DexcomClient::backfillSink = NULL;
+DexcomBackfillStats DexcomClient::backfillSession = {};
+DexcomBackfillStats DexcomClient::backfillTotal = {};
+uint32_t DexcomClient::backfillLegacyBytes = 0;
+DexcomReading DexcomClient::lastReading = { HISTORY_EMPTY, 0, 0, 0 };
+uint32_t DexcomClient::transmitterTime = 0;
+uint32_t DexcomClient::transmitterTimeMs = 0;
 
 /**
  * Calculate crc16 check sum for the given string.
  */
 uint16_t DexcomClient::CRC_16_XMODEM(uint8_t* pData, size_t length)
 {
-    uint16_t crc = ~crc16_be((uint16_t)~0x0000, pData, length);       // calculate crc 16 xmodem
+    uint16_t crc = DexcomPlatform::crc16Xmodem(pData, length);        // calculate crc 16 xmodem
     uint8_t crcArray[2] = { (uint8_t)crc, (uint8_t)(crc >> 8) };                                                        // proper way of converting our bytes to string
     uint16_t crcSwapped =  0x100*crcArray[1] + crcArray[0];
 
@@ -33,19 +49,63 @@ uint16_t DexcomClient::CRC_16_XMODEM(uint8_t* pData, size_t length)
     return crcSwapped;
 }
 
+void DexcomClient::setBackfillSink(DexcomBackfillSink sink) { backfillSink = sink; }
+
+/**
+ * The RAM slots are not kept in RTC memory, the board starts every window with them empty and the legacy rule
+ * sees them so. The host runs keep the process between windows and clear them here to compare against the same rule.
+ */
+void DexcomClient::restart()
+{
+    memset(glucoseValues, 0, sizeof(glucoseValues));
+}
+
 /**
- * Returns true if invalid data was found / missing values or not x values are available.
+ * Returns true when the history is missing readings before the one just read, the range is kept for readBackfill.
+ * Must run after readGlucose.
  */
 bool DexcomClient::needBackfill()
 {
-    if (DexcomConnection::lastConnectionWasError()) return true;                                                                            // Also request backfill if last time was an error (maybe error while backfilling so missed some data).
+    memset(&backfillSession, 0, sizeof(backfillSession));
+    backfillSession.sessions = 1;
+    backfillLegacyBytes = legacyNeedBackfill() ? BACKFILL_EXCHANGE_BYTES + streamBytes(saveLastXValues) : 0;
+    if (planBackfill(lastReading, &backfillStart, &backfillEnd))
+    {
+        DexcomReading newest;
+        backfillColdStart = !DexcomHistory::latest(&newest) || newest.dextime + 1 != backfillStart                      // The range does not follow on from the history,
+                            || backfillEnd - backfillStart > (uint32_t)saveLastXValues * BACKFILL_INTERVAL_SEC;         // or goes further back than the fixed window, the rest of a cut off one.
+        backfillComplete = false;
+        return true;
+    }
+    SerialPrintln(DEBUG, "Backfill - history is complete, nothing to request.");
+    backfillComplete = true;
+    accountBackfill(false, 0);
+    return false;
+}
 
-    for(int i = 0; i < saveLastXValues; i++)
+/**
+ * The history only grows at its newest end, so the one range that can still be stored is the one
+ * between its newest reading and current. Holes further back stay holes and are not asked for.
+ * The range is capped to what the transmitter keeps, an empty or stale history asks for all of it.
+ */
+bool DexcomClient::planBackfill(const DexcomReading &current, uint32_t* start, uint32_t* end)
+{
+    if (current.dextime == HISTORY_EMPTY)
+        return false;
+    uint32_t from = current.dextime > BACKFILL_WINDOW_SEC ? current.dextime - BACKFILL_WINDOW_SEC : 0;
+    DexcomReading newest;
+    if (DexcomHistory::latest(&newest))
     {
-        if(glucoseValues[i] < 10 || glucoseValues[i] > 600)                                                             // This includes 0 values from initialisation.
-            return true;
+        if (newest.dextime >= current.dextime && newest.dextime - current.dextime < 24*60*60)
+            return false;                                                                                               // Already stored, a bigger step back is a new transmitter.
+        if (newest.dextime < current.dextime && newest.dextime + 1 > from)
+            from = newest.dextime + 1;
     }
-    return false; // no reason to backfill
+    if (current.dextime - from < 2*BACKFILL_INTERVAL_SEC - BACKFILL_SLACK_SEC)                                          // Not even one reading fits in between.
+        return false;
+    *start = from;
+    *end = current.dextime - BACKFILL_SLACK_SEC;
+    return true;
 }
 
 
@@ -57,9 +117,9 @@ uint32_t sensorElapsedTime = 0;
 bool DexcomClient::readTimeMessage()
 {
     uint8_t timeTxMessage[3] = {0x24, 0xE6, 0x64};
-    DexcomConnection::ControlSendValue(timeTxMessage, 3);
+    DexcomSession::transport()->controlSend(timeTxMessage, 3);
     uint8_t timeRxBuffer[20];
-    size_t timeRxLength = DexcomConnection::ControlWaitToReceiveValue(timeRxBuffer, 20);
+    size_t timeRxLength = DexcomSession::transport()->controlReceive(timeRxBuffer, 20);
     if ((timeRxLength != 16) || timeRxBuffer[0] != 0x25)
         return false;
 
@@ -68,6 +128,8 @@ bool DexcomClient::readTimeMessage()
     uint32_t sessionStartTime = 0;          // currentTime when sensor was started
     memcpy(&currentTime, &(timeRxBuffer[2]), 4);
     memcpy(&sessionStartTime, &(timeRxBuffer[6]), 4);
+    transmitterTime = currentTime;
+    transmitterTimeMs = DexcomPlatform::millis() | 1;
     uint32_t sessionElapsedTime = currentTime - sessionStartTime;
     uint32_t sessionRemainingTime = (10*24*60*60) -  sessionElapsedTime;
     SerialPrintf(DATA, "Time - Status:              %d\n\r", status);
@@ -98,9 +160,9 @@ bool DexcomClient::readBatteryStatus()
 {
     SerialPrintln(DEBUG, "Reading Battery Status.");
     uint8_t batteryStatusTxMessage[3] ={0x22, 0x20, 0x04};
-    DexcomConnection::ControlSendValue(batteryStatusTxMessage, 3);
+    DexcomSession::transport()->controlSend(batteryStatusTxMessage, 3);
     uint8_t batteryStatusRxBuffer[16];
-    size_t batteryStatusRxLength = DexcomConnection::ControlWaitToReceiveValue(batteryStatusRxBuffer, 16);
+    size_t batteryStatusRxLength = DexcomSession::transport()->controlReceive(batteryStatusRxBuffer, 16);
     if(!(batteryStatusRxLength == 10 || batteryStatusRxLength == 12) ||
          batteryStatusRxBuffer[0] != 0x23)
         return false;
@@ -127,17 +189,14 @@ bool DexcomClient::readBatteryStatus()
  */
 bool DexcomClient::readGlucose()
 {
-    uint8_t glucoseTxMessageG5[3] = {0x30, 0x53, 0x36};                                                                // G5 = 0x30 the other 2 bytes are the CRC16 XMODEM value in twisted order
-    uint8_t glucoseTxMessageG6[3] = {0x4e, 0x0a, 0xa9};                                                                // G6 = 0x4e
-    String transmitterID = DexcomConnection::getTransmitterID();
-    if(transmitterID[0] == 8 || (transmitterID[0] == 2 && transmitterID[1] == 2 && transmitterID[2] == 2))              // Check if G6 or one of the newest G6 plus (>2.18.2.88) see https://github.com/xdrip-js/xdrip-js/issues/87
-        DexcomConnection::ControlSendValue(glucoseTxMessageG6, 3);
-    else
-        DexcomConnection::ControlSendValue(glucoseTxMessageG5, 3);
+    const DexcomTransmitterId &transmitter = DexcomSession::transmitter();
+    uint8_t glucoseTxMessage[3];                                                                                        // Opcode depends on G5 / G6, picked when the ID was set.
+    memcpy(glucoseTxMessage, transmitter.glucoseTx, 3);
+    DexcomSession::transport()->controlSend(glucoseTxMessage, 3);
 
     uint8_t glucoseRxBuffer[20];
-    size_t glucoseRxLength = DexcomConnection::ControlWaitToReceiveValue(glucoseRxBuffer, 20);
-    if (glucoseRxLength < 16 || glucoseRxBuffer[0] != (transmitterID[0] != 8 ? 0x31 : 0x4f))                 // Opcode depends on G5 / G6
+    size_t glucoseRxLength = DexcomSession::transport()->controlReceive(glucoseRxBuffer, 20);
+    if (glucoseRxLength < 16 || glucoseRxBuffer[0] != transmitter.glucoseRxOpcode)
         return false;
 
     uint8_t status = glucoseRxBuffer[1];
@@ -152,14 +211,14 @@ bool DexcomClient::readGlucose()
 
     uint16_t glucoseBytes = (uint16_t)(glucoseRxBuffer[10] +
                                        glucoseRxBuffer[11]*0x100);
-    boolean glucoseIsDisplayOnly = (glucoseBytes & 0xf000) > 0;
+    bool glucoseIsDisplayOnly = (glucoseBytes & 0xf000) > 0;
     uint16_t glucose = glucoseBytes & 0xfff;
     uint8_t state = glucoseRxBuffer[12];
     int trend = glucoseRxBuffer[13];
     if(state != 0x06)                                                                                                   // Not the ok state -> exit
     {
         SerialPrintf(ERROR, "\nERROR - Session Status / State NOT OK (%d)!\n\r", state);
-        DexcomConnection::commFault("ERROR - We will not continue due to safety reasons (warmup, stopped, waiting for calibration(s), failed or expired.\n\r");
+        DexcomSession::transport()->fault("ERROR - We will not continue due to safety reasons (warmup, stopped, waiting for calibration(s), failed or expired.\n\r");
     }
 
     SerialPrintf(DATA, "Glucose - Status:      %d\n\r", status);
@@ -176,6 +235,10 @@ bool DexcomClient::readGlucose()
             glucoseValues[i] = glucoseValues[i-1];
         glucoseValues[0] = glucose;
     }
+    lastReading.dextime = timestamp;
+    lastReading.glucose = glucose;
+    lastReading.trend = (int8_t)trend;
+    lastReading.status = state;
     return true;
 }
 
@@ -185,9 +248,9 @@ bool DexcomClient::readGlucose()
 bool DexcomClient::readSensor()
 {
     uint8_t sensorTxMessage[3] = {0x2e, 0xac, 0xc5};
-    DexcomConnection::ControlSendValue(sensorTxMessage, 3);
+    DexcomSession::transport()->controlSend(sensorTxMessage, 3);
     uint8_t sensorRxBuffer[18];
-    size_t sensorRxLength = DexcomConnection::ControlWaitToReceiveValue(sensorRxBuffer, 18);
+    size_t sensorRxLength = DexcomSession::transport()->controlReceive(sensorRxBuffer, 18);
     if((sensorRxLength != 16 && sensorRxLength != 8) || sensorRxBuffer[0] != 0x2f)
         return false;
 
@@ -208,12 +271,8 @@ bool DexcomClient::readSensor()
                                          sensorRxBuffer[11]*0x100  +
                                          sensorRxBuffer[12]*0x10000 +
                                          sensorRxBuffer[13]*0x1000000);
-        if (DexcomConnection::getTransmitterID()[0] == 8)                                                                                      // G6 Transmitter
-        {
-                int g6Scale = 34;
-                unfiltered *= g6Scale;
-                filtered *= g6Scale;
-        }
+        unfiltered *= DexcomSession::transmitter().sensorScale;                                                        // G6 values are scaled down by the transmitter.
+        filtered *= DexcomSession::transmitter().sensorScale;
         SerialPrintf(DATA, "Sensor - Unfiltered: %d\n\r", unfiltered);
         SerialPrintf(DATA, "Sensor - Filtered:   %d\n\r", filtered);
     }
@@ -227,9 +286,9 @@ bool DexcomClient::readSensor()
 bool DexcomClient::readLastCalibration()
 {
     uint8_t calibrationDataTxMessage[3] = {0x32, 0x11, 0x16};
-    DexcomConnection::ControlSendValue(calibrationDataTxMessage, 3);
+    DexcomSession::transport()->controlSend(calibrationDataTxMessage, 3);
     uint8_t calibrationDataRxBuffer[22];
-    size_t calibrationDataRxLength = DexcomConnection::ControlWaitToReceiveValue(calibrationDataRxBuffer, 22);
+    size_t calibrationDataRxLength = DexcomSession::transport()->controlReceive(calibrationDataRxBuffer, 22);
     if ((calibrationDataRxLength != 19 && calibrationDataRxLength != 20) ||
         (calibrationDataRxBuffer[0] != 0x33))
     return false;
@@ -246,22 +305,27 @@ bool DexcomClient::readLastCalibration()
 }
 
 /**
- * Reads the last glucose values from the transmitter when the esp was not connected.
+ * Requests the planned range and processes the backfill stream while it arrives, record by record into the sink.
+ * The control response can come before the last data packets, so the stream is over when a record
+ * reached the end of the range, or when it went quiet after the response. Without a response it was cut off
+ * and backfillPending() holds the current reading back, the next session continues after the last stored record.
  */
 bool DexcomClient::readBackfill()
 {
     if(transmitterElapsedTime == 0)                                                                                       // The read time command must be send first to get the current time.
         return false;
 
-    backfillStream = "";                                                                                                // Empty the backfill stream.
+    backfillStreamLength = 0;                                                                                           // Empty the backfill stream.
     backfillExpectedSequence = 1;                                                                                       // Set to the first message.
+    backfillLast = HISTORY_EMPTY;
+    backfillSession.requests++;
+    backfillSession.bytes += BACKFILL_EXCHANGE_BYTES;
 
     uint8_t backfillTxBuffer[20] = { 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0};
     //uint8_t backfill_opcode[4] = {0x50, 0x05, 0x02, 0x00};                                   // 12 + 6 byte fill + 2 byte crc = 20 byte
     uint32_t backfill_opcode = 0x00020550;
-    // Set backfill_start to 0 to get all values of the last ~150 measurements (~12,5h)
-    uint32_t backfill_start = transmitterElapsedTime - (saveLastXValues * 5) * 60;                                        // Get the last x values. Only need x-1 because we already have the current value but request one more to be sure that we get x-1.
-    uint32_t backfill_end   = transmitterElapsedTime - 60;                                                                // Do not request the current value. (But is not anyway available by backfill)
+    uint32_t backfill_start = backfillStart;                                                                            // Planned by needBackfill from the history.
+    uint32_t backfill_end   = backfillEnd;
 
 
     memcpy(&backfillTxBuffer[0], &backfill_opcode, 4);
@@ -272,37 +336,76 @@ bool DexcomClient::readBackfill()
     uint16_t backfill_crc = CRC_16_XMODEM(backfillTxBuffer, 18);                                            // Add crc 16.
     memcpy(&backfillTxBuffer[18], &backfill_crc, 2);
 
-	SerialPrintf(DEBUG,  "Request backfill from %d to %d (current %d).\n\r", backfill_start, backfill_end, transmitterElapsedTime);
-    DexcomConnection::ControlSendValue(backfillTxBuffer, 20);
+	SerialPrintf(DEBUG,  "Request %sbackfill from %d to %d (current %d).\n\r", backfillColdStart ? "cold start " : "", backfill_start, backfill_end, transmitterElapsedTime);
+    uint32_t requestMs = DexcomPlatform::millis();
+    DexcomSession::transport()->controlSend(backfillTxBuffer, 20);
 
     SerialPrintln(DATA, "Waiting for backfill data...");
     uint8_t backfillRxBuffer[22];
-    size_t backfillRxLength = DexcomConnection::ControlWaitToReceiveValue(backfillRxBuffer, 22);        // We will receive this normally after all backfill data has been send by the transmitter.
-    if (backfillRxLength != 20 || backfillRxBuffer[0] != 0x51)
-        return false;
-
-    uint8_t status          = backfillRxBuffer[1];
-    uint8_t backFillStatus  = backfillRxBuffer[2];
-    uint8_t identifier      = backfillRxBuffer[3];
-    uint32_t timestampStart = (uint32_t)(backfillRxBuffer[4] +
-                                         backfillRxBuffer[5]*0x100  +
-                                         backfillRxBuffer[6]*0x10000 +
-                                         backfillRxBuffer[7]*0x1000000);
-    uint32_t timestampEnd   = (uint32_t)(backfillRxBuffer[8] +
-                                         backfillRxBuffer[9]*0x100  +
-                                         backfillRxBuffer[10]*0x10000 +
-                                         backfillRxBuffer[11]*0x1000000);
-    SerialPrintf(DATA, "Backfill - Status:          %d\n\r", status);
-    SerialPrintf(DATA, "Backfill - Backfill Status: %d\n\r", backFillStatus);
-    SerialPrintf(DATA, "Backfill - Identifier:      %d\n\r", identifier);
-    SerialPrintf(DATA, "Backfill - Timestamp Start: %d\n\r", timestampStart);
-    SerialPrintf(DATA, "Backfill - Timestamp End:   %d\n\r", timestampEnd);
+    uint8_t backfillPacket[20];
+    size_t length;
+    bool response = false;
+    uint32_t timestampEnd = backfill_end;
+    uint32_t lastActivityMs = requestMs;
+    while (DexcomSession::transport()->isConnected())
+    {
+        bool active = false;
+        while ((length = DexcomSession::transport()->backfillPoll(backfillPacket, sizeof(backfillPacket))) > 0)
+        {
+            saveBackfill(backfillPacket, length);                                                                       // Records go to the sink as soon as their last byte is in.
+            active = true;
+        }
+        if (!response && (length = DexcomSession::transport()->controlPoll(backfillRxBuffer, sizeof(backfillRxBuffer))) > 0)
+        {
+            if (length != 20 || backfillRxBuffer[0] != 0x51)
+                break;
+            response = true;
+            active = true;
+            backfillResponseMs = DexcomPlatform::millis() - requestMs;
+            uint8_t status          = backfillRxBuffer[1];
+            uint8_t backFillStatus  = backfillRxBuffer[2];
+            uint8_t identifier      = backfillRxBuffer[3];
+            uint32_t timestampStart = (uint32_t)(backfillRxBuffer[4] +
+                                                 backfillRxBuffer[5]*0x100  +
+                                                 backfillRxBuffer[6]*0x10000 +
+                                                 backfillRxBuffer[7]*0x1000000);
+            timestampEnd            = (uint32_t)(backfillRxBuffer[8] +
+                                                 backfillRxBuffer[9]*0x100  +
+                                                 backfillRxBuffer[10]*0x10000 +
+                                                 backfillRxBuffer[11]*0x1000000);
+            SerialPrintf(DATA, "Backfill - Status:          %d\n\r", status);
+            SerialPrintf(DATA, "Backfill - Backfill Status: %d\n\r", backFillStatus);
+            SerialPrintf(DATA, "Backfill - Identifier:      %d\n\r", identifier);
+            SerialPrintf(DATA, "Backfill - Timestamp Start: %d\n\r", timestampStart);
+            SerialPrintf(DATA, "Backfill - Timestamp End:   %d\n\r", timestampEnd);
+        }
+        if (backfillExpectedSequence == 0)                                                                              // Out of order or refused by the sink, nothing after it can be used.
+            break;
+        if (response && backfillLast != HISTORY_EMPTY && backfillLast + BACKFILL_INTERVAL_SEC > timestampEnd)
+        {
+            backfillComplete = true;                                                                                    // No reading can follow the last one inside the range.
+            break;
+        }
+        uint32_t now = DexcomPlatform::millis();
+        if (active)
+            lastActivityMs = now;
+        else if (now - lastActivityMs > BACKFILL_IDLE_MS)
+        {
+            backfillComplete = response;                                                                                // The transmitter had nothing more for the range.
+            break;
+        }
+        else
+            DexcomPlatform::delay(1);
+    }
+    SerialPrintf(DATA, "Backfill - %s after %u records, last %u.\n\r", backfillComplete ? "complete" : "cut off",
+                 backfillSession.records, backfillLast);
     printSavedGlucose();
-
-    delay(2*1000);                                                                                                      // Wait 2 seconds to be sure that all backfill data has arrived.
-    return true;
+    accountBackfill(true, DexcomPlatform::millis() - requestMs);
+    return response;
 }
 
+bool DexcomClient::backfillPending() { return !backfillComplete; }
+
 /**
  * Prints out the last x glucose levels.
  */
@@ -321,13 +424,13 @@ void DexcomClient::printSavedGlucose()
 /**
  * This method saves the backfill data received from the backfill characteristic callback.
  */
-bool DexcomClient::saveBackfill(std::string backfillParseMessage)
+bool DexcomClient::saveBackfill(const uint8_t* backfillParseMessage, size_t length)
 {
-    if (backfillParseMessage.length() < 2)                                                                              // Minimum is sequence + identifier.
+    backfillSession.bytes += length;
+    if (length < 2)                                                                                                     // Minimum is sequence + identifier.
         return false;
 
-    uint8_t sequence   = (uint8_t)backfillParseMessage[0];
-    uint8_t identifier = (uint8_t)backfillParseMessage[1];
+    uint8_t sequence = (uint8_t)backfillParseMessage[0];                                                                // [1] is the identifier, not checked.
 
     if(sequence != backfillExpectedSequence)
     {
@@ -337,28 +440,30 @@ bool DexcomClient::saveBackfill(std::string backfillParseMessage)
     }
     backfillExpectedSequence += 1;
 
+    size_t payload = 2;
     if(sequence == 1)
     {
+        if (length < 6)
+            return false;
         uint16_t backfillRequestCounter = (uint16_t)(backfillParseMessage[2] + backfillParseMessage[3]*0x100);
         uint16_t unknown                = (uint16_t)(backfillParseMessage[4] + backfillParseMessage[5]*0x100);
         SerialPrintf(DATA,  "Backfill Data - Request Counter: %d\n\r", backfillRequestCounter);
         SerialPrintf(DATA,  "Backfill Data - Unknown:         %d\n\r", unknown);
-        backfillStream = backfillParseMessage.substr(6);                                                                // Empty string and set payload.
+        backfillStreamLength = 0;                                                                                       // Empty stream, payload starts after the header.
+        payload = 6;
     }
-    else
-        backfillStream += backfillParseMessage.substr(2);                                                               // Add data.
 
-    //SerialPrintf(DATA, "Backfill Data - Sequence: %d   Identifier: %d   Data: ", sequence, identifier);
+    //SerialPrintf(DATA, "Backfill Data - Sequence: %d   Identifier: %d   Data: ", sequence, backfillParseMessage[1]);
     //printHexString(backfillParseMessage);
 
-    while(backfillStream.length() >= 8)
+    for (size_t i = payload; i < length; i++)                                                                           // Records run across packet borders.
     {
-        std::string data = backfillStream.substr(0,8);                                                                  // Get the first 8 byte.
-        if(backfillStream.length() > 8)                                                                                 // More than 8 byte?
-            backfillStream = backfillStream.substr(8);                                                                  // Trim of the first 8 byte.
-        else                                                                                                            // Exactly 8 byte:
-            backfillStream = "";                                                                                        // Empty string.
-        parseBackfill(data);
+        backfillStream[backfillStreamLength++] = backfillParseMessage[i];
+        if (backfillStreamLength == 8)
+        {
+            parseBackfill(backfillStream);
+            backfillStreamLength = 0;
+        }
     }
     return true;
 }
@@ -366,15 +471,15 @@ bool DexcomClient::saveBackfill(std::string backfillParseMessage)
 /**
  * This method parsed 8 bytes representing the timestamp and glucose values.
  */
-void DexcomClient::parseBackfill(std::string data)
+void DexcomClient::parseBackfill(const uint8_t* data)
 {
     uint32_t dextime = (uint32_t)(data[0] +
                                   data[1]*0x100  +
                                   data[2]*0x10000 +
                                   data[3]*0x1000000);
     uint16_t glucose = (uint16_t)(data[4] + data[5]*0x100);
-    uint8_t type     = (uint8_t)data[6];
-    uint8_t trend    = (uint8_t)data[7];
+    uint8_t type     = data[6];
+    uint8_t trend    = data[7];
 
     if(saveLastXValues > 1)                                                                                             // Array is big enough for min 1 backfill value (and the current value).
     {
@@ -384,9 +489,123 @@ void DexcomClient::parseBackfill(std::string data)
     }
 
     SerialPrintf(GLUCOSE,  "Backfill -> Dextime: %d   Glucose: %d   Type: %d\n\r", dextime, glucose, type);
+
+    if (backfillExpectedSequence == 0)                                                                                  // Cut off earlier in this packet.
+        return;
+    if (dextime < backfillStart || dextime > backfillEnd || (backfillLast != HISTORY_EMPTY && dextime <= backfillLast))
+        return;                                                                                                         // Outside the planned range, or repeated.
+    if (backfillSink != NULL)
+    {
+        DexcomReading reading = { dextime, glucose, (int8_t)trend, type };
+        uint32_t range = backfillEnd - backfillStart;
+        if (!backfillSink(reading, range > 0 ? (int)((uint64_t)(dextime - backfillStart) * 100 / range) : 100))
+        {
+            SerialPrintf(ERROR, "Backfill - sink refused %d, stream cut off.\n\r", dextime);
+            backfillExpectedSequence = 0;                                                                               // A hole in the history could never be filled, stop before it.
+            return;
+        }
+    }
+    backfillLast = dextime;
+    backfillSession.records++;
+}
+
+const DexcomBackfillStats &DexcomClient::get_backfillSession() { return backfillSession; }
+const DexcomBackfillStats &DexcomClient::get_backfillTotal() { return backfillTotal; }
+
+const DexcomReading &DexcomClient::get_lastReading() { return lastReading; }
+
+bool DexcomClient::transmitterNow(uint32_t* dextime)
+{
+    if (transmitterTimeMs == 0)
+        return false;
+    *dextime = transmitterTime + (DexcomPlatform::millis() - transmitterTimeMs) / 1000;
+    return true;
+}
+
+/**
+ * Maps the measurement time onto the local clock through the last time message, good to the second the
+ * transmitter clock counts in. A dextime ahead of the time message counts as measured then.
+ */
+bool DexcomClient::measurementAgeMs(uint32_t dextime, uint32_t* ageMs)
+{
+    if (transmitterTimeMs == 0)
+        return false;
+    uint32_t behind = dextime < transmitterTime ? transmitterTime - dextime : 0;
+    *ageMs = behind * 1000 + (DexcomPlatform::millis() - transmitterTimeMs);
+    return true;
 }
 
 int DexcomClient::get_glucose()
 {
     return glucoseValues[0] > 0 ? glucoseValues[0] : -1;
 }
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * The old rule: backfill the fixed window when one of the last values is missing or the last connection failed.
+ * Only kept to tell how much the planned requests save.
+ */
+bool DexcomClient::legacyNeedBackfill()
+{
+    if (DexcomSession::transport()->lastConnectionWasError()) return true;
+
+    for(int i = 0; i < saveLastXValues; i++)
+    {
+        if(glucoseValues[i] < 10 || glucoseValues[i] > 600)                                                             // This includes 0 values from initialisation.
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Bytes of a backfill stream: a 4 byte header, 8 bytes per record and 2 bytes of sequence / identifier per 20 byte packet.
+ */
+uint32_t DexcomClient::streamBytes(uint32_t records)
+{
+    uint32_t payload = 4 + records * 8;
+    uint32_t packets = (payload + 17) / 18;
+    return payload + packets * 2;
+}
+
+/**
+ * Closes the figures of this session against the fixed window.
+ * The old exchange took the response time plus its fixed wait, the last measured response time stands in when nothing was sent.
+ * A cold start fetches readings the fixed window never asked for, it is counted on its own and not netted into the savings.
+ * The legacy figure needs the slots as the board has them, empty after the restart before each window, see restart().
+ */
+void DexcomClient::accountBackfill(bool requested, uint32_t exchangeMs)
+{
+    if (requested && backfillColdStart)
+    {
+        backfillSession.coldStarts = 1;
+        backfillSession.coldStartBytes = backfillSession.bytes;
+    }
+    else
+    {
+        uint32_t legacyMs = backfillLegacyBytes > 0 ? backfillResponseMs + BACKFILL_LEGACY_WAIT_MS : 0;
+        backfillSession.bytesSaved = (int32_t)backfillLegacyBytes - (int32_t)backfillSession.bytes;
+        backfillSession.msSaved = (int32_t)legacyMs - (int32_t)(requested ? exchangeMs : 0);
+    }
+    backfillTotal.sessions += backfillSession.sessions;
+    backfillTotal.requests += backfillSession.requests;
+    backfillTotal.records += backfillSession.records;
+    backfillTotal.bytes += backfillSession.bytes;
+    backfillTotal.bytesSaved += backfillSession.bytesSaved;
+    backfillTotal.msSaved += backfillSession.msSaved;
+    backfillTotal.coldStarts += backfillSession.coldStarts;
+    backfillTotal.coldStartBytes += backfillSession.coldStartBytes;
+    if (backfillSession.coldStarts > 0)
+        SerialPrintf(DATA, "Backfill - %u records, %u bytes, cold start (total %u requests in %u sessions, %u cold starts)\n\r",
+                     backfillSession.records, backfillSession.bytes, backfillTotal.requests, backfillTotal.sessions, backfillTotal.coldStarts);
+    else
+        SerialPrintf(DATA, "Backfill - %u records, %u bytes, saved %d bytes and %d ms (total %u requests in %u sessions, saved %d bytes and %d ms)\n\r",
+                     backfillSession.records, backfillSession.bytes, backfillSession.bytesSaved, backfillSession.msSaved,
+                     backfillTotal.requests, backfillTotal.sessions, backfillTotal.bytesSaved, backfillTotal.msSaved);
+}
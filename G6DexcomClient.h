@@ -12,36 +12,85 @@
 #define G6DEXCOMCLIENT_H
 
 
-#include <Arduino.h>
-#include <Esp.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "DebugHelper.h"
-#include "G6DexcomBLE.h"
+#include "DexcomTransport.h"
+#include "DexcomHistory.h"
 
 
+#define BACKFILL_INTERVAL_SEC   300                                                                                     // The transmitter stores one reading every 5 minutes.
+#define BACKFILL_SLACK_SEC      60                                                                                      // Jitter of the reading times, also kept clear of the current reading.
+#define BACKFILL_WINDOW_SEC     (24*60*60)                                                                              // The transmitter keeps a day of readings, a cold start asks for all of it.
+#define BACKFILL_IDLE_MS        1000                                                                                    // A stream silent this long is over, cut off when the response never came.
+#define BACKFILL_LEGACY_WAIT_MS 2000                                                                                    // The fixed wait the old flow added to every backfill.
+#define BACKFILL_EXCHANGE_BYTES 40                                                                                      // Request and response on the control characteristic.
+
+typedef bool (*DexcomBackfillSink)(const DexcomReading &reading, int progress);                                         // Gets the backfilled readings oldest first with the percent of the range done, in the protocol task.
+                                                                                                                        // False when it could not take the reading, the stream is cut off there.
+
+typedef struct
+{
+    uint32_t sessions;              // Sessions that reached the backfill decision.
+    uint32_t requests;              // Backfill requests sent.
+    uint32_t records;               // Records handed to the sink.
+    uint32_t bytes;                 // Backfill bytes over the air, control exchange included.
+    int32_t bytesSaved;             // Against the fixed window of saveLastXValues readings asked for before, cold starts left out.
+    int32_t msSaved;                // Connection time against the fixed window and its fixed wait, cold starts left out.
+    uint32_t coldStarts;            // Requests reaching further back than the fixed window, which never asked for those readings.
+    uint32_t coldStartBytes;
+} DexcomBackfillStats;
+
 
 class DexcomClient
 {
         static uint16_t currentBG;
         static int saveLastXValues;
         static uint16_t glucoseValues[72];
-        static std::string backfillStream;
+        static uint8_t backfillStream[8];                                                                              // Start of a record split over two packets.
+        static size_t backfillStreamLength;
         static int backfillExpectedSequence;
+        static uint32_t backfillStart;                                                                                 // dextime range of the running request.
+        static uint32_t backfillEnd;
+        static uint32_t backfillLast;                                                                                  // Newest record handed to the sink.
+        static bool backfillColdStart;                                                                                 // The history had nothing inside the transmitter window or the range is longer than the fixed one.
+        static bool backfillComplete;                                                                                  // The last stream ran to its end, false while a range is left over.
+        static uint32_t backfillResponseMs;                                                                            // Request to control response of the last exchange, for the skipped exchange estimate.
+        static DexcomBackfillSink backfillSink;
+        static DexcomBackfillStats backfillSession;
+        static DexcomBackfillStats backfillTotal;
+        static uint32_t backfillLegacyBytes;                                                                           // What the fixed window would have cost this session, 0 when it would not have run.
+        static DexcomReading lastReading;
+        static uint32_t transmitterTime;                                                                               // Transmitter clock of the last time message.
+        static uint32_t transmitterTimeMs;                                                                             // Platform millis it arrived at, 0 before the first.
     public:
         static bool findAndConnect();
+        static void setBackfillSink(DexcomBackfillSink sink);
+        static void restart();                                                                                          // Host runs, clears what the board's esp_restart() before each window clears.
         static bool needBackfill();
+        static bool planBackfill(const DexcomReading &current, uint32_t* start, uint32_t* end);                        // The dextime range the history is missing before current, false when none is.
         static bool readTimeMessage();
         static bool readBatteryStatus();
         static bool readGlucose();
         static bool readSensor();
         static bool readLastCalibration();
         static bool readBackfill();
-        static bool saveBackfill(std::string backfillParseMessage);
-        static void parseBackfill(std::string data);
+        static bool backfillPending();                                                                                  // The last backfill was cut off, storing the current reading now would strand the rest.
+        static bool saveBackfill(const uint8_t* backfillParseMessage, size_t length);
+        static void parseBackfill(const uint8_t* data);                                                                 // One 8 byte record.
         static int get_glucose();
+        static const DexcomReading &get_lastReading();                                                                  // The reading of the last readGlucose, dextime is HISTORY_EMPTY before.
+        static bool transmitterNow(uint32_t* dextime);                                                                  // The transmitter clock now, from the last time message, false before the first.
+        static bool measurementAgeMs(uint32_t dextime, uint32_t* ageMs);                                               // Local time since the transmitter measured at dextime, false before the first time message.
         static int get_rate(); //returns to the rate of change in points per hour
-    private:
+        static const DexcomBackfillStats &get_backfillSession();
+        static const DexcomBackfillStats &get_backfillTotal();
         static uint16_t CRC_16_XMODEM(uint8_t* pData, size_t length);
+    private:
         static void printSavedGlucose();
+        static bool legacyNeedBackfill();
+        static uint32_t streamBytes(uint32_t records);
+        static void accountBackfill(bool requested, uint32_t exchangeMs);
 };
 
 #endif /* G6DEXCOMCLIENT_H */
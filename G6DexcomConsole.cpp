@@ -0,0 +1,190 @@
+/*
+ * G6DexcomConsole
+ */
+
+
+#include <Arduino.h>
+#include <Esp.h>
+#include "G6DexcomConsole.h"
+#include "DexcomPerf.h"
+#include "G6DexcomScanTuner.h"
+#include "G6DexcomLinkStats.h"
+#include "DexcomExport.h"
+#include "DexcomServer.h"
+#include "G6DexcomEnergy.h"
+#include "G6DexcomBattery.h"
+
+
+char DexcomConsole::line[CONSOLE_LINE_MAX];
+size_t DexcomConsole::lineLength = 0;
+TaskHandle_t DexcomConsole::tasks[CONSOLE_MAX_TASKS];
+int DexcomConsole::taskCount = 0;
+
+void DexcomConsole::watchTask(TaskHandle_t task)
+{
+    if (task != NULL && taskCount < CONSOLE_MAX_TASKS)
+        tasks[taskCount++] = task;
+}
+
+/**
+ * Collect the characters that arrived since the last call, run the command at the end of a line.
+ * Overlong lines are dropped as a whole.
+ */
+void DexcomConsole::poll()
+{
+    while (Serial.available() > 0)
+    {
+        char c = (char)Serial.read();
+        if (c == '\r' || c == '\n')
+        {
+            if (lineLength > 0 && lineLength < CONSOLE_LINE_MAX)
+            {
+                line[lineLength] = 0;
+                execute(line);
+            }
+            lineLength = 0;
+        }
+        else if (lineLength < CONSOLE_LINE_MAX)
+            line[lineLength++] = c;
+    }
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * Every answer line starts with the command word, so a host script can pick them out of the debug output.
+ */
+void DexcomConsole::execute(const char* command)
+{
+    if (strcmp(command, "perf") == 0) printCounters();
+    else if (strcmp(command, "heap") == 0) printHeap();
+    else if (strcmp(command, "tasks") == 0) printTasks();
+    else if (strcmp(command, "scan") == 0) printScan();
+    else if (strcmp(command, "link") == 0) printLink();
+    else if (strcmp(command, "server") == 0) printServer();
+    else if (strcmp(command, "energy") == 0) printEnergy();
+    else if (strcmp(command, "dump") == 0)
+    {
+        printCounters();
+        printHeap();
+        printTasks();
+        printScan();
+        printLink();
+        printServer();
+        printEnergy();
+    }
+    else if (strncmp(command, "export", 6) == 0)
+        DexcomExport::start((uint32_t)strtoul(command + 6, NULL, 10));                                                 // "export <since dextime>", binary frames follow.
+    else if (strcmp(command, "live on") == 0) DexcomExport::setLive(true);
+    else if (strcmp(command, "live off") == 0) DexcomExport::setLive(false);
+    else if (strcmp(command, "reset") == 0)
+    {
+        DexcomPerf::reset();
+        Serial.println("reset ok");
+    }
+    else
+        Serial.println("help perf | heap | tasks | scan | link | server | energy | dump | reset | export <since> | live on | live off");
+}
+
+void DexcomConsole::printCounters()
+{
+    char buffer[96];
+    Serial.printf("perf %-16s %8s %10s %10s %10s %12s\n", "name", "count", "avg_us", "max_us", "last_us", "avg_cycles");
+    for (int i = 0; i < PERF_COUNTERS; i++)
+    {
+        DexcomPerf::format((DexcomPerfCounter)i, buffer, sizeof(buffer));
+        Serial.print("perf ");
+        Serial.print(buffer);
+    }
+}
+
+void DexcomConsole::printHeap()
+{
+    char buffer[96];
+    DexcomPerf::heapSample();
+    DexcomPerf::formatHeap(buffer, sizeof(buffer));
+    Serial.print(buffer);
+}
+
+void DexcomConsole::printTasks()
+{
+    for (int i = 0; i < taskCount; i++)
+        Serial.printf("tasks %-12s stack_free_min %u\n", pcTaskGetName(tasks[i]), (unsigned)uxTaskGetStackHighWaterMark(tasks[i]));
+}
+
+/**
+ * Detection latency per scan parameter set, the current set is marked with a star.
+ */
+void DexcomConsole::printScan()
+{
+    Serial.printf("scan %-3s %8s %6s %7s %7s %6s %8s %8s\n", "set", "interval", "window", "scans", "windows", "misses", "avg_ms", "max_ms");
+    for (int i = 0; i < SCAN_SETS; i++)
+    {
+        const DexcomScanParams &params = DexcomScanTuner::get_params(i);
+        const DexcomScanStats &stats = DexcomScanTuner::get_stats(i);
+        Serial.printf("scan %d%c  %8u %6u %7u %7u %6u %8u %8u\n", i, i == DexcomScanTuner::get_currentSet() ? '*' : ' ',
+                      params.intervalMs, params.windowMs, stats.scans, stats.windows, stats.misses,
+                      stats.windows > 0 ? stats.totalMs / stats.windows : 0, stats.maxMs);
+    }
+}
+
+/**
+ * Session outcomes, failures per step and both latency histograms of the link statistics.
+ */
+void DexcomConsole::printLink()
+{
+    const DexcomLinkCounters &stats = DexcomLinkStats::get();
+    Serial.printf("link attempts %u successes %u missed_windows %u bond_failures %u last_bond_reason 0x%02x\n",
+                  (unsigned)stats.attempts, (unsigned)stats.successes, (unsigned)stats.missedWindows,
+                  (unsigned)stats.bondFailures, stats.lastBondReason);
+    for (int step = SESSION_STEP_CONNECT; step < SESSION_STEPS; step++)
+        Serial.printf("link failed %-4s %u\n", DexcomLinkStats::stepName(step), (unsigned)stats.failures[step]);
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+        Serial.printf("link scan_to_connect %-5s %u\n", DexcomLinkStats::scanToConnectLabel(i), (unsigned)stats.scanToConnect[i]);
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+        Serial.printf("link connect_to_glucose %-5s %u\n", DexcomLinkStats::connectToGlucoseLabel(i), (unsigned)stats.connectToGlucose[i]);
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+        Serial.printf("link measurement_to_pixel %-5s %u\n", DexcomLinkStats::measurementToPixelLabel(i), (unsigned)stats.measurementToPixel[i]);
+    Serial.printf("link measurement_to_pixel_last_ms %u\n", (unsigned)stats.lastMeasurementToPixelMs);
+}
+
+/**
+ * Connections and snapshots of the local server, all 0 when it is not enabled.
+ */
+void DexcomConsole::printServer()
+{
+    const DexcomServerStats &stats = DexcomServer::get_stats();
+    Serial.printf("server port %u clients %d accepted %u rejected %u responses %u pushes %u dropped %u snapshots %u skipped %u\n",
+                  DexcomServer::get_port(), DexcomServer::clientCount(), (unsigned)stats.accepted, (unsigned)stats.rejected,
+                  (unsigned)stats.responses, (unsigned)stats.pushes, (unsigned)stats.dropped, (unsigned)stats.snapshots,
+                  (unsigned)stats.skipped);
+}
+
+/**
+ * Time and charge per power state over the totals, the averages and the hours left on the battery at that rate.
+ */
+void DexcomConsole::printEnergy()
+{
+    const DexcomEnergyTotals &totals = DexcomEnergy::get();
+    for (int i = 0; i < POWER_STATES; i++)
+    {
+        uint64_t us = i == POWER_BLE_SCAN ? totals.scanRxUs : totals.stateUs[i];
+        Serial.printf("energy %-13s %8u s %6u uA %8u uAh\n", DexcomEnergy::stateName(i), (unsigned)(totals.stateUs[i] / 1000000),
+                      (unsigned)DexcomEnergy::stateMicroamps(i), (unsigned)(us * DexcomEnergy::stateMicroamps(i) / 3600000000ULL));
+    }
+    uint32_t perHour = DexcomEnergy::microampHoursPerHour();
+    int trend = 0;
+    bool trendValid = DexcomEnergy::batteryTrend(&trend);
+    Serial.printf("energy cycles %u wall_s %u charge_uah %u uah_per_hour %u uah_per_cycle %u last_cycle_uah %u last_cycle_ms %u\n",
+                  (unsigned)totals.cycles, (unsigned)(totals.wallUs / 1000000), (unsigned)(totals.chargeNah / 1000), (unsigned)perHour,
+                  totals.cycles > 0 ? (unsigned)(totals.chargeNah / 1000 / totals.cycles) : 0u,
+                  (unsigned)(totals.lastCycleNah / 1000), (unsigned)totals.lastCycleMs);
+    Serial.printf("energy battery_mv %d trend_mv_per_hour %d%s hours_left %u\n", DexcomBattery::get_millivolts(), trend,
+                  trendValid ? "" : "?", perHour > 0 ? (unsigned)(ENERGY_BATTERY_MAH * 1000ULL * DexcomBattery::get_percent() / 100 / perHour) : 0u);
+}
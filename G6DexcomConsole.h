@@ -0,0 +1,38 @@
+/**
+ * Header File with the line based query console on the USB CDC serial port
+ * Dumps and resets the DexcomPerf counters, heap figures, the stack high water marks, the scan tuner and the link statistics,
+ * shows the server and the energy accounting, and starts the binary history export (DexcomExport).
+ * Commands are read when the UI task wakes, that is at least once a second.
+ */
+
+#ifndef G6DEXCOMCONSOLE_H
+#define G6DEXCOMCONSOLE_H
+
+#include <Arduino.h>
+
+#define CONSOLE_LINE_MAX    32
+#define CONSOLE_MAX_TASKS   6
+
+class DexcomConsole
+{
+    static char line[CONSOLE_LINE_MAX];
+    static size_t lineLength;
+    static TaskHandle_t tasks[CONSOLE_MAX_TASKS];
+    static int taskCount;
+
+    public:
+        static void watchTask(TaskHandle_t task);                                                                       // Report the stack high water mark of this task.
+        static void poll();                                                                                             // Non blocking, only called from the UI task.
+
+    private:
+        static void execute(const char* command);
+        static void printCounters();
+        static void printHeap();
+        static void printTasks();
+        static void printScan();
+        static void printLink();
+        static void printServer();
+        static void printEnergy();
+};
+
+#endif /* G6DEXCOMCONSOLE_H */
@@ -0,0 +1,251 @@
+/*
+ * G6DexcomEnergy
+ */
+
+
+#include <Arduino.h>
+#include "esp_pm.h"
+#include "esp_bt.h"
+#include "G6DexcomEnergy.h"
+#include "G6DexcomBacklight.h"
+#include "G6DexcomRetained.h"
+#include "DebugHelper.h"
+
+
+static const char* const STATE_NAMES[POWER_STATES] = {"cpu_active", "cpu_idle", "cpu_sleep", "ble_scan", "ble_connected",
+                                                      "wifi", "bl_dim", "bl_caution", "bl_warning", "bl_full"};
+static const uint32_t STATE_MICROAMPS[POWER_STATES] = {ENERGY_UA_CPU_ACTIVE, ENERGY_UA_CPU_IDLE, ENERGY_UA_CPU_SLEEP,
+                                                       ENERGY_UA_BLE_RX, ENERGY_UA_BLE_CONNECTED, ENERGY_UA_WIFI,
+                                                       ENERGY_UA_BACKLIGHT_DIM, ENERGY_UA_BACKLIGHT_CAUTION,
+                                                       ENERGY_UA_BACKLIGHT_WARNING, ENERGY_UA_BACKLIGHT_FULL};
+
+#define ENERGY_MAGIC 0x454e5231                                                                                         // "ENR1"
+
+// Not initialised by the startup code, setup() checks the seal and endCycle() renews it.
+RTC_NOINIT_ATTR static DexcomEnergyTotals totals;
+RTC_NOINIT_ATTR static DexcomRetainedSeal totalsSeal;
+
+uint8_t DexcomEnergy::current[POWER_COMPONENTS] = {POWER_OFF, POWER_OFF, POWER_OFF};
+uint64_t DexcomEnergy::sinceUs[POWER_COMPONENTS];
+uint64_t DexcomEnergy::cycleUs[POWER_STATES];
+uint64_t DexcomEnergy::cycleScanRxUs = 0;
+uint16_t DexcomEnergy::scanDutyPermille = 1000;
+std::atomic<int> DexcomEnergy::awakeHolders(0);
+uint64_t DexcomEnergy::awakeSinceUs = 0;
+uint64_t DexcomEnergy::cycleAwakeUs = 0;
+uint64_t DexcomEnergy::cycleBusyUs = 0;
+bool DexcomEnergy::sleepable = false;
+uint64_t DexcomEnergy::sampledUs = 0;
+uint64_t DexcomEnergy::cycleSleepableUs = 0;
+
+/**
+ * After a power on the totals start from zero.
+ */
+void DexcomEnergy::setup()
+{
+    if (DexcomRetained::valid(totalsSeal, ENERGY_MAGIC, &totals, sizeof(totals)))
+        return;
+    memset(&totals, 0, sizeof(totals));
+    DexcomRetained::seal(&totalsSeal, ENERGY_MAGIC, &totals, sizeof(totals));
+}
+
+/**
+ * Closes the time of the previous state and starts the new one. The radio and the Wi-Fi keep the CPU awake.
+ */
+void DexcomEnergy::set(uint8_t component, uint8_t state)
+{
+    if (component >= POWER_COMPONENTS || state == current[component])
+        return;
+    uint8_t previous = current[component];
+    uint64_t now = esp_timer_get_time();
+    if (previous != POWER_OFF)
+    {
+        uint64_t spent = now - sinceUs[component];
+        cycleUs[previous] += spent;
+        if (previous == POWER_BLE_SCAN)
+            cycleScanRxUs += spent * scanDutyPermille / 1000;
+    }
+    current[component] = state;
+    sinceUs[component] = now;
+    if (component == POWER_RADIO)
+        sample(now);
+
+    if (component == POWER_DISPLAY || (previous != POWER_OFF) == (state != POWER_OFF))
+        return;
+    if (state != POWER_OFF)
+    {
+        if (awakeHolders.fetch_add(1) == 0)
+            awakeSinceUs = now;
+    }
+    else if (awakeHolders.fetch_sub(1) == 1)
+        cycleAwakeUs += now - awakeSinceUs;
+}
+
+void DexcomEnergy::set_scanDuty(uint16_t permille) { scanDutyPermille = permille > 1000 ? 1000 : permille; }
+
+void DexcomEnergy::busy(uint32_t micros)
+{
+    if (awakeHolders.load() == 0)                                                                                       // Otherwise already booked as awake.
+        cycleBusyUs += micros;
+}
+
+/**
+ * Books the open states up to now, folds the cycle into the totals and logs its charge with the battery trend.
+ * The cycle started at boot, so the time to boot is part of it.
+ */
+void DexcomEnergy::endCycle(int batteryMv)
+{
+    uint64_t now = esp_timer_get_time();
+    uint64_t stateUs[POWER_STATES];
+    memcpy(stateUs, cycleUs, sizeof(stateUs));
+    uint64_t scanRxUs = cycleScanRxUs;
+    for (int i = 0; i < POWER_COMPONENTS; i++)
+    {
+        if (current[i] == POWER_OFF)
+            continue;
+        stateUs[current[i]] += now - sinceUs[i];
+        if (current[i] == POWER_BLE_SCAN)
+            scanRxUs += (now - sinceUs[i]) * scanDutyPermille / 1000;
+    }
+    uint64_t activeUs = cycleAwakeUs + cycleBusyUs + (awakeHolders.load() > 0 ? now - awakeSinceUs : 0);
+    if (activeUs > now) activeUs = now;
+    sample(now);
+    uint64_t idleUs = now - activeUs;
+    stateUs[POWER_CPU_ACTIVE] = activeUs;
+    stateUs[POWER_CPU_SLEEP] = now > 0 ? idleUs * cycleSleepableUs / now : 0;                                           // Idle time spread evenly over the time that could sleep.
+    stateUs[POWER_CPU_IDLE] = idleUs - stateUs[POWER_CPU_SLEEP];
+    uint64_t chargeNah = charge(stateUs, scanRxUs, now);
+
+    if (totals.cycles >= ENERGY_WINDOW)
+        halve();
+    totals.cycles++;
+    totals.wallUs += now;
+    for (int i = 0; i < POWER_STATES; i++)
+        totals.stateUs[i] += stateUs[i];
+    totals.scanRxUs += scanRxUs;
+    totals.chargeNah += chargeNah;
+    totals.lastCycleNah = (uint32_t)chargeNah;
+    totals.lastCycleMs = (uint32_t)(now / 1000);
+    if (batteryMv > 0)
+    {
+        totals.batteryMv[totals.batteryNext] = (uint16_t)batteryMv;
+        totals.batteryMs[totals.batteryNext] = totals.lastCycleMs;
+        totals.batteryNext = (totals.batteryNext + 1) % ENERGY_TREND_CYCLES;
+        if (totals.batteryCount < ENERGY_TREND_CYCLES) totals.batteryCount++;
+    }
+    DexcomRetained::seal(&totalsSeal, ENERGY_MAGIC, &totals, sizeof(totals));
+
+    int trend = 0;
+    batteryTrend(&trend);
+    SerialPrintf(DATA, "Energy: cycle %d uAh in %d s (awake %d ms, scan %d ms, connected %d ms, wifi %d ms), %d uAh per hour, battery %d mV %+d mV/h\n\r",
+                 (int)(chargeNah / 1000), (int)(now / 1000000), (int)(activeUs / 1000), (int)(stateUs[POWER_BLE_SCAN] / 1000),
+                 (int)(stateUs[POWER_BLE_CONNECTED] / 1000), (int)(stateUs[POWER_WIFI] / 1000), (int)microampHoursPerHour(),
+                 batteryMv, trend);
+}
+
+const DexcomEnergyTotals &DexcomEnergy::get() { return totals; }
+const char* DexcomEnergy::stateName(uint8_t state) { return state < POWER_STATES ? STATE_NAMES[state] : "?"; }
+uint32_t DexcomEnergy::stateMicroamps(uint8_t state) { return state < POWER_STATES ? STATE_MICROAMPS[state] : 0; }
+
+uint32_t DexcomEnergy::microampHoursPerHour()
+{
+    return totals.wallUs > 0 ? (uint32_t)(totals.chargeNah * 3600000ULL / totals.wallUs) : 0;                           // nAh * 1e-3 / (us / 3.6e9)
+}
+
+/**
+ * Change from the oldest to the newest voltage in the ring, over the cycles in between.
+ */
+bool DexcomEnergy::batteryTrend(int* mvPerHour)
+{
+    if (totals.batteryCount < 2)
+        return false;
+    int newest = (totals.batteryNext + ENERGY_TREND_CYCLES - 1) % ENERGY_TREND_CYCLES;
+    int oldest = (totals.batteryNext + ENERGY_TREND_CYCLES - totals.batteryCount) % ENERGY_TREND_CYCLES;
+    uint64_t elapsedMs = 0;
+    for (int i = (oldest + 1) % ENERGY_TREND_CYCLES; ; i = (i + 1) % ENERGY_TREND_CYCLES)
+    {
+        elapsedMs += totals.batteryMs[i];
+        if (i == newest)
+            break;
+    }
+    if (elapsedMs == 0)
+        return false;
+    *mvPerHour = (int)(((int64_t)totals.batteryMv[newest] - totals.batteryMv[oldest]) * 3600000LL / (int64_t)elapsedMs);
+    return true;
+}
+
+/**
+ * The backlight state of a duty, the fades in between are booked at their target.
+ */
+uint8_t DexcomEnergy::backlightState(int duty)
+{
+    if (duty <= BACKLIGHT_DUTY_OFF) return POWER_OFF;
+    if (duty <= BACKLIGHT_DUTY_DIM) return POWER_BACKLIGHT_DIM;
+    if (duty <= BACKLIGHT_DUTY_CAUTION) return POWER_BACKLIGHT_CAUTION;
+    if (duty <= BACKLIGHT_DUTY_WARNING) return POWER_BACKLIGHT_WARNING;
+    return POWER_BACKLIGHT_FULL;
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * uA * us / 3.6e6 is nAh, the scan draws its receive current only for the window share of the interval.
+ */
+uint64_t DexcomEnergy::charge(const uint64_t* stateUs, uint64_t scanRxUs, uint64_t wallUs)
+{
+    uint64_t total = wallUs * ENERGY_UA_BASE;
+    for (int i = 0; i < POWER_STATES; i++)
+        total += (i == POWER_BLE_SCAN ? scanRxUs : stateUs[i]) * STATE_MICROAMPS[i];
+    return total / 3600000ULL;
+}
+
+/**
+ * Automatic light sleep has to be configured, and an enabled BLE controller without modem sleep holds a lock
+ * that keeps the chip out of it. Locks held for a moment, like the ADC burst of the battery tick, are not seen here.
+ */
+bool DexcomEnergy::lightSleepPossible()
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t config;
+    if (esp_pm_get_configuration(&config) != ESP_OK || !config.light_sleep_enable)
+        return false;
+#if CONFIG_BT_ENABLED && !CONFIG_BT_CTRL_MODEM_SLEEP
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED)
+        return false;
+#endif
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Books the span since the last sample by what was possible at its start, then samples again.
+ * Runs on the radio changes and at the end of the cycle, both on the BLE task that also enables the controller.
+ */
+void DexcomEnergy::sample(uint64_t now)
+{
+    if (sleepable)
+        cycleSleepableUs += now - sampledUs;
+    sampledUs = now;
+    sleepable = lightSleepPossible();
+}
+
+/**
+ * Keeps the ratios, the totals stay in a one day order of magnitude.
+ */
+void DexcomEnergy::halve()
+{
+    totals.cycles /= 2;
+    totals.wallUs /= 2;
+    for (int i = 0; i < POWER_STATES; i++)
+        totals.stateUs[i] /= 2;
+    totals.scanRxUs /= 2;
+    totals.chargeNah /= 2;
+}
@@ -0,0 +1,129 @@
+/**
+ * Header File with the energy accounting
+ * Books the time of every power state per cycle, one transmitter window from boot to the restart for the next one:
+ * the BLE radio scanning and connected, the Wi-Fi, the backlight at each brightness level and the CPU awake, idle or
+ * in light sleep. Each state is owned by the task that changes it, the BLE task the radio, the network tasks the Wi-Fi,
+ * the UI task the backlight and its own work. The CPU is awake while a radio holds it, otherwise idle but for the work
+ * the UI task reports. Idle time counts as light sleep only while light sleep can really happen: automatic light sleep
+ * is configured and no enabled BLE controller holds its power management lock. The times are multiplied by the
+ * current model below, override any figure before this header is included, and give the charge of the cycle.
+ * The totals are kept in checksummed RTC memory and halved like the link statistics, so mAh per hour, mAh per cycle
+ * and the battery voltage trend follow the last day.
+ */
+
+#ifndef G6DEXCOMENERGY_H
+#define G6DEXCOMENERGY_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Current model in uA, each on top of ENERGY_UA_BASE. Rough figures for the T-Display S3, measure and override.
+#ifndef ENERGY_UA_BASE
+#define ENERGY_UA_BASE          3000                                                                                    // Regulator, panel controller and the rest of the board, always drawn.
+#endif
+#ifndef ENERGY_UA_CPU_ACTIVE
+#define ENERGY_UA_CPU_ACTIVE    40000                                                                                   // Awake at full clock.
+#endif
+#ifndef ENERGY_UA_CPU_IDLE
+#define ENERGY_UA_CPU_IDLE      20000                                                                                   // Idle task without light sleep.
+#endif
+#ifndef ENERGY_UA_CPU_SLEEP
+#define ENERGY_UA_CPU_SLEEP     300                                                                                     // Automatic light sleep.
+#endif
+#ifndef ENERGY_UA_BLE_RX
+#define ENERGY_UA_BLE_RX        55000                                                                                   // Receiving, scaled by the scan duty.
+#endif
+#ifndef ENERGY_UA_BLE_CONNECTED
+#define ENERGY_UA_BLE_CONNECTED 20000                                                                                   // Average over the connection events of a session.
+#endif
+#ifndef ENERGY_UA_WIFI
+#define ENERGY_UA_WIFI          40000                                                                                   // Joined, average of traffic and modem sleep.
+#endif
+#ifndef ENERGY_UA_BACKLIGHT_DIM
+#define ENERGY_UA_BACKLIGHT_DIM     6000
+#define ENERGY_UA_BACKLIGHT_CAUTION 12000
+#define ENERGY_UA_BACKLIGHT_WARNING 18000
+#define ENERGY_UA_BACKLIGHT_FULL    24000
+#endif
+#ifndef ENERGY_BATTERY_MAH
+#define ENERGY_BATTERY_MAH      1000                                                                                    // Capacity for the hours left.
+#endif
+
+#define ENERGY_WINDOW           288                                                                                     // About a day of cycles before the totals are halved.
+#define ENERGY_TREND_CYCLES     12                                                                                      // Battery voltage samples, about an hour.
+#define POWER_OFF               0xff                                                                                    // A component in none of its states.
+
+typedef enum
+{
+    POWER_CPU_ACTIVE = 0,
+    POWER_CPU_IDLE,
+    POWER_CPU_SLEEP,
+    POWER_BLE_SCAN,
+    POWER_BLE_CONNECTED,
+    POWER_WIFI,
+    POWER_BACKLIGHT_DIM,
+    POWER_BACKLIGHT_CAUTION,
+    POWER_BACKLIGHT_WARNING,
+    POWER_BACKLIGHT_FULL,
+    POWER_STATES
+} DexcomPowerState;
+
+typedef enum
+{
+    POWER_RADIO = 0,                // BLE task.
+    POWER_NETWORK,                  // Wi-Fi, the uploader and server tasks.
+    POWER_DISPLAY,                  // Backlight, UI task.
+    POWER_COMPONENTS
+} DexcomPowerComponent;
+
+typedef struct
+{
+    uint32_t cycles;
+    uint64_t wallUs;
+    uint64_t stateUs[POWER_STATES];
+    uint64_t scanRxUs;              // Scan time times the scan duty.
+    uint64_t chargeNah;
+    uint32_t lastCycleNah;
+    uint32_t lastCycleMs;
+    uint16_t batteryMv[ENERGY_TREND_CYCLES];                                                                            // Ring of the voltage at each cycle end.
+    uint32_t batteryMs[ENERGY_TREND_CYCLES];                                                                            // Length of the cycle that ended with it.
+    uint8_t batteryNext;
+    uint8_t batteryCount;
+} DexcomEnergyTotals;
+
+class DexcomEnergy
+{
+    static uint8_t current[POWER_COMPONENTS];
+    static uint64_t sinceUs[POWER_COMPONENTS];
+    static uint64_t cycleUs[POWER_STATES];
+    static uint64_t cycleScanRxUs;
+    static uint16_t scanDutyPermille;
+    static std::atomic<int> awakeHolders;                                                                               // Components keeping the CPU awake.
+    static uint64_t awakeSinceUs;
+    static uint64_t cycleAwakeUs;
+    static uint64_t cycleBusyUs;                                                                                        // UI task work while no radio held the CPU.
+    static bool sleepable;                                                                                              // Light sleep possible at the last sample.
+    static uint64_t sampledUs;
+    static uint64_t cycleSleepableUs;
+
+    public:
+        static void setup();
+        static void set(uint8_t component, uint8_t state);                                                              // Owner task of the component only, POWER_OFF when it is off.
+        static void set_scanDuty(uint16_t permille);                                                                    // BLE task, before the scan state.
+        static void busy(uint32_t micros);                                                                              // UI task, time it just worked.
+        static void endCycle(int batteryMv);                                                                            // Right before the restart for the next window.
+        static const DexcomEnergyTotals &get();
+        static const char* stateName(uint8_t state);
+        static uint32_t stateMicroamps(uint8_t state);
+        static uint32_t microampHoursPerHour();                                                                         // Average of the totals, 0 before the first cycle.
+        static bool batteryTrend(int* mvPerHour);                                                                       // Voltage change over the ring, false with less than two samples.
+        static uint8_t backlightState(int duty);
+
+    private:
+        static uint64_t charge(const uint64_t* stateUs, uint64_t scanRxUs, uint64_t wallUs);                            // nAh
+        static bool lightSleepPossible();
+        static void sample(uint64_t now);
+        static void halve();
+};
+
+#endif /* G6DEXCOMENERGY_H */
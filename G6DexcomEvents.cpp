@@ -0,0 +1,59 @@
+/*
+ * G6DexcomEvents
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomEvents.h"
+
+
+QueueHandle_t DexcomEvents::queue = NULL;
+QueueHandle_t DexcomEvents::inputQueue = NULL;
+QueueSetHandle_t DexcomEvents::set = NULL;
+
+void DexcomEvents::setup()
+{
+    if (queue != NULL)
+        return;
+    queue = xQueueCreate(EVENT_QUEUE_DEPTH, sizeof(DexcomEvent));
+    inputQueue = xQueueCreate(INPUT_QUEUE_DEPTH, sizeof(uint8_t));
+    set = xQueueCreateSet(EVENT_QUEUE_DEPTH + INPUT_QUEUE_DEPTH);
+    xQueueAddToSet(queue, set);
+    xQueueAddToSet(inputQueue, set);
+}
+
+/**
+ * Post an event, waits up to timeoutMs for room (default not at all), returns false when the queue stayed full.
+ * An EVENT_INPUT goes to the input queue, only the input sources fill it.
+ */
+bool DexcomEvents::post(uint8_t type, int32_t value, bool fresh, const DexcomReading* reading, uint32_t timeoutMs)
+{
+    if (type == EVENT_INPUT)
+    {
+        uint8_t code = (uint8_t)value;
+        return xQueueSend(inputQueue, &code, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+    }
+    DexcomEvent event = { type, fresh, value, { HISTORY_EMPTY, 0, 0, 0 } };
+    if (reading != NULL)
+        event.reading = *reading;
+    return xQueueSend(queue, &event, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+}
+
+/**
+ * Block until an event arrives on either queue or the timeout expires, returns false on timeout.
+ * The set hands out the queues in posting order, the queue it names is read right away.
+ */
+bool DexcomEvents::wait(DexcomEvent* event, uint32_t timeoutMs)
+{
+    QueueSetMemberHandle_t member = xQueueSelectFromSet(set, pdMS_TO_TICKS(timeoutMs));
+    if (member == NULL)
+        return false;
+    if (member != inputQueue)
+        return xQueueReceive(queue, event, 0) == pdTRUE;
+
+    uint8_t code;
+    if (xQueueReceive(inputQueue, &code, 0) != pdTRUE)
+        return false;
+    *event = { EVENT_INPUT, false, code, { HISTORY_EMPTY, 0, 0, 0 } };
+    return true;
+}
@@ -0,0 +1,55 @@
+/**
+ * Header File with the message queue between the BLE task and the UI task
+ * The BLE task blocks for a whole transmitter session, so it only posts
+ * events and never touches the display or the flash storage.
+ * Inputs have a queue of their own in the same queue set, a backfill that keeps the session queue full
+ * can not push a button press out.
+ */
+
+#ifndef G6DEXCOMEVENTS_H
+#define G6DEXCOMEVENTS_H
+
+#include <Arduino.h>
+#include "DexcomHistory.h"
+
+#define BLE_TASK_CORE     0                                                                                             // Same core as the bluedroid host and controller tasks.
+#define BLE_TASK_STACK    8192
+#define BLE_TASK_PRIORITY 1
+#define UPLOAD_TASK_CORE     0                                                                                          // With the Wi-Fi tasks, the UI core stays free.
+#define UPLOAD_TASK_STACK    12288                                                                                      // The TLS handshake runs on it.
+#define UPLOAD_TASK_PRIORITY 1
+#define SERVER_TASK_CORE     0
+#define SERVER_TASK_STACK    4096
+#define SERVER_TASK_PRIORITY 1
+#define EVENT_QUEUE_DEPTH 8
+#define INPUT_QUEUE_DEPTH 8
+
+typedef enum
+{
+    EVENT_READING = 0,              // A session finished, value holds the glucose (or -1) and fresh tells if it was read now, reading holds it for the history.
+    EVENT_STATE   = 1,              // The BLE task changed its state, value holds the new state.
+    EVENT_INPUT   = 2,              // A debounced button or touch input, value holds the DexcomInputCode.
+    EVENT_BACKFILL = 3              // A reading recovered by backfill during the session, oldest first and before the EVENT_READING, value holds the percent done.
+} DexcomEventType;
+
+typedef struct
+{
+    uint8_t type;
+    bool fresh;
+    int32_t value;
+    DexcomReading reading;
+} DexcomEvent;
+
+class DexcomEvents
+{
+    static QueueHandle_t queue;
+    static QueueHandle_t inputQueue;                                                                                    // EVENT_INPUT only, just the DexcomInputCode.
+    static QueueSetHandle_t set;
+
+    public:
+        static void setup();
+        static bool post(uint8_t type, int32_t value, bool fresh = false, const DexcomReading* reading = NULL, uint32_t timeoutMs = 0);
+        static bool wait(DexcomEvent* event, uint32_t timeoutMs);
+};
+
+#endif /* G6DEXCOMEVENTS_H */
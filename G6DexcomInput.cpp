@@ -0,0 +1,96 @@
+/*
+ * G6DexcomInput
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomInput.h"
+#include "G6DexcomEvents.h"
+
+
+// Buttons and the touch interrupt are all active low.
+DexcomInput::Source DexcomInput::sources[3] = {
+    { PIN_BUTTON_1,  INPUT_CLICK_1, INPUT_LONG_1, false, false, NULL, NULL },
+    { PIN_BUTTON_2,  INPUT_CLICK_2, INPUT_LONG_2, false, false, NULL, NULL },
+    { PIN_TOUCH_INT, INPUT_TOUCH,   INPUT_TOUCH,  false, false, NULL, NULL }
+};
+
+/**
+ * Create the timers and attach the edge interrupts.
+ * Also arms the pins as light sleep wakeup sources when automatic light sleep is available.
+ */
+void DexcomInput::setup()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        Source &source = sources[i];
+        pinMode(source.pin, INPUT_PULLUP);
+        source.debounceTimer = xTimerCreate("debounce", pdMS_TO_TICKS(INPUT_DEBOUNCE_MS), pdFALSE, &source, onDebounced);
+        source.longTimer = xTimerCreate("longPress", pdMS_TO_TICKS(INPUT_LONG_PRESS_MS), pdFALSE, &source, onLongPress);
+        attachInterruptArg(source.pin, onEdge, &source, CHANGE);
+#if CONFIG_PM_ENABLE
+        gpio_wakeup_enable((gpio_num_t)source.pin, GPIO_INTR_LOW_LEVEL);
+#endif
+    }
+#if CONFIG_PM_ENABLE
+    esp_sleep_enable_gpio_wakeup();
+#endif
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+/**
+ * Any edge (re)starts the debounce timer, the level is only read once it is stable.
+ */
+void ARDUINO_ISR_ATTR DexcomInput::onEdge(void* arg)
+{
+    Source *source = (Source *)arg;
+    BaseType_t woken = pdFALSE;
+    xTimerResetFromISR(source->debounceTimer, &woken);
+    if (woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+/**
+ * Runs in the timer task after the pin was stable for INPUT_DEBOUNCE_MS.
+ */
+void DexcomInput::onDebounced(TimerHandle_t timer)
+{
+    Source *source = (Source *)pvTimerGetTimerID(timer);
+    bool down = digitalRead(source->pin) == LOW;
+    if (down && !source->pressed)
+    {
+        source->pressed = true;
+        source->longFired = false;
+        if (source->longCode != source->clickCode)
+            xTimerReset(source->longTimer, 0);
+        else
+            DexcomEvents::post(EVENT_INPUT, source->clickCode);                                                          // No long press, report on the press edge.
+    }
+    else if (!down && source->pressed)
+    {
+        source->pressed = false;
+        xTimerStop(source->longTimer, 0);
+        if (!source->longFired && source->longCode != source->clickCode)
+            DexcomEvents::post(EVENT_INPUT, source->clickCode);
+    }
+}
+
+/**
+ * Runs in the timer task when a button is still held after INPUT_LONG_PRESS_MS.
+ */
+void DexcomInput::onLongPress(TimerHandle_t timer)
+{
+    Source *source = (Source *)pvTimerGetTimerID(timer);
+    if (source->pressed)
+    {
+        source->longFired = true;
+        DexcomEvents::post(EVENT_INPUT, source->longCode);
+    }
+}
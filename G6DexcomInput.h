@@ -0,0 +1,49 @@
+/**
+ * Header File with the interrupt driven input handling
+ * GPIO edges only restart a debounce timer, the FreeRTOS timers decide on
+ * click and long press and post the result to the UI event queue.
+ */
+
+#ifndef G6DEXCOMINPUT_H
+#define G6DEXCOMINPUT_H
+
+#include <Arduino.h>
+#include "pin_config.h"
+
+#define INPUT_DEBOUNCE_MS   30
+#define INPUT_LONG_PRESS_MS 800
+
+// Input codes posted as the value of an EVENT_INPUT.
+typedef enum
+{
+    INPUT_CLICK_1 = 0,              // Short press on button 1 (screen off).
+    INPUT_LONG_1  = 1,
+    INPUT_CLICK_2 = 2,              // Short press on button 2 (screen on).
+    INPUT_LONG_2  = 3,
+    INPUT_TOUCH   = 4               // The touch controller signaled a touch.
+} DexcomInputCode;
+
+class DexcomInput
+{
+    struct Source
+    {
+        uint8_t pin;
+        uint8_t clickCode;
+        uint8_t longCode;                                                                                               // Same as clickCode when the source has no long press.
+        volatile bool pressed;
+        volatile bool longFired;
+        TimerHandle_t debounceTimer;
+        TimerHandle_t longTimer;
+    };
+    static Source sources[3];
+
+    public:
+        static void setup();
+
+    private:
+        static void ARDUINO_ISR_ATTR onEdge(void* arg);
+        static void onDebounced(TimerHandle_t timer);
+        static void onLongPress(TimerHandle_t timer);
+};
+
+#endif /* G6DEXCOMINPUT_H */
@@ -0,0 +1,159 @@
+/*
+ * G6DexcomLinkStats
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomLinkStats.h"
+#include "DebugHelper.h"
+#include "G6DexcomRetained.h"
+
+
+const uint32_t DexcomLinkStats::scanToConnectEdges[LINK_LATENCY_BINS - 1] = {2000, 5000, 10000, 30000, 60000};
+const uint32_t DexcomLinkStats::connectToGlucoseEdges[LINK_LATENCY_BINS - 1] = {500, 1000, 2000, 4000, 8000};
+const uint32_t DexcomLinkStats::measurementToPixelEdges[LINK_LATENCY_BINS - 1] = {15000, 30000, 60000, 120000, 240000};
+
+static const char* const STEP_NAMES[SESSION_STEPS] = {"OK", "CON", "AUT", "BND", "INF", "REG", "TIM", "BAT", "GLU"};
+static const char* const SCAN_LABELS[LINK_LATENCY_BINS] = {"<2s", "<5s", "<10s", "<30s", "<60s", "60s+"};
+static const char* const GLUCOSE_LABELS[LINK_LATENCY_BINS] = {"<.5s", "<1s", "<2s", "<4s", "<8s", "8s+"};
+static const char* const PIXEL_LABELS[LINK_LATENCY_BINS] = {"<15s", "<30s", "<1m", "<2m", "<4m", "4m+"};
+
+#define LINK_MAGIC 0x4c4e4b31                                                                                           // "LNK1"
+
+typedef struct
+{
+    DexcomLinkCounters counters;
+    uint32_t lastDextime;                                                                                               // Reading of the last successful session.
+} DexcomLinkState;
+
+// One block under one seal, a power on fails the check and starts the counters from zero.
+RTC_NOINIT_ATTR static DexcomLinkState link;
+RTC_NOINIT_ATTR static DexcomRetainedSeal linkSeal;
+static DexcomLinkCounters &counters = link.counters;
+static uint32_t &lastDextime = link.lastDextime;
+
+uint32_t DexcomLinkStats::scanStartMs = 0;
+
+/**
+ * After a power on the statistics start from zero.
+ */
+void DexcomLinkStats::setup()
+{
+    if (DexcomRetained::valid(linkSeal, LINK_MAGIC, &link, sizeof(link)))
+        return;
+    memset(&link, 0, sizeof(link));
+    seal();
+}
+
+void DexcomLinkStats::scanStarted()
+{
+    if (scanStartMs == 0)
+        scanStartMs = millis() | 1;
+}
+
+/**
+ * Books one session, connectedMs and glucoseMs are the DexcomSession figures of the run (0 when not reached).
+ * Windows are missed when the reading is more than one transmitter interval after the last one,
+ * a big step or a step back is a new transmitter or a restarted session and only resets the reference.
+ */
+void DexcomLinkStats::record(bool complete, uint8_t failedStep, uint32_t connectedMs, uint32_t glucoseMs, uint32_t dextime)
+{
+    if (counters.attempts >= LINK_STATS_WINDOW)
+        halve();
+    counters.attempts++;
+    if (complete)
+        counters.successes++;
+    else if (failedStep < SESSION_STEPS)
+        counters.failures[failedStep]++;
+
+    if (scanStartMs != 0 && connectedMs != 0)
+        counters.scanToConnect[bin(scanToConnectEdges, connectedMs - scanStartMs)]++;
+    scanStartMs = 0;
+    if (complete && glucoseMs != 0)
+        counters.connectToGlucose[bin(connectToGlucoseEdges, glucoseMs)]++;
+
+    if (complete && dextime != 0)
+    {
+        uint32_t intervals = dextime > lastDextime ? (dextime - lastDextime + 150) / 300 : 0;
+        if (lastDextime != 0 && intervals > 1 && intervals <= LINK_STATS_WINDOW)
+            counters.missedWindows += intervals - 1;
+        lastDextime = dextime;
+    }
+    SerialPrintf(DATA, "Link: %d/%d sessions ok, last %s, missed windows %d\n\r", counters.successes, counters.attempts,
+                 stepName(complete ? (uint8_t)SESSION_STEP_NONE : failedStep), counters.missedWindows);
+    seal();
+}
+
+/**
+ * Called during the session, the record() that ends it seals the count.
+ */
+void DexcomLinkStats::bondFailed(uint8_t reason)
+{
+    counters.bondFailures++;
+    counters.lastBondReason = reason;
+}
+
+/**
+ * Books the latency of a fresh reading from its measurement to the end of the draw, the transmitter clock
+ * only counts seconds, so the figure is good to about one.
+ */
+void DexcomLinkStats::displayed(uint32_t measurementAgeMs)
+{
+    if (counters.displayed >= LINK_STATS_WINDOW)
+    {
+        counters.displayed /= 2;
+        for (int i = 0; i < LINK_LATENCY_BINS; i++)
+            counters.measurementToPixel[i] /= 2;
+    }
+    counters.displayed++;
+    counters.measurementToPixel[bin(measurementToPixelEdges, measurementAgeMs)]++;
+    counters.lastMeasurementToPixelMs = measurementAgeMs;
+    SerialPrintf(DATA, "Link: measurement to pixel %d ms\n\r", measurementAgeMs);
+    seal();
+}
+
+const DexcomLinkCounters &DexcomLinkStats::get() { return counters; }
+const char* DexcomLinkStats::stepName(uint8_t step) { return step < SESSION_STEPS ? STEP_NAMES[step] : "?"; }
+const char* DexcomLinkStats::scanToConnectLabel(int bin) { return SCAN_LABELS[bin]; }
+const char* DexcomLinkStats::connectToGlucoseLabel(int bin) { return GLUCOSE_LABELS[bin]; }
+const char* DexcomLinkStats::measurementToPixelLabel(int bin) { return PIXEL_LABELS[bin]; }
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+int DexcomLinkStats::bin(const uint32_t* edges, uint32_t ms)
+{
+    int i = 0;
+    while (i < LINK_LATENCY_BINS - 1 && ms >= edges[i])
+        i++;
+    return i;
+}
+
+/**
+ * Keeps the ratios, the figures stay in a one day order of magnitude.
+ */
+void DexcomLinkStats::halve()
+{
+    counters.attempts /= 2;
+    counters.successes /= 2;
+    counters.missedWindows /= 2;
+    counters.bondFailures /= 2;
+    for (int i = 0; i < SESSION_STEPS; i++)
+        counters.failures[i] /= 2;
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+    {
+        counters.scanToConnect[i] /= 2;
+        counters.connectToGlucose[i] /= 2;
+    }
+}
+
+/**
+ * The writers take turns: record() at the end of a session, displayed() on the UI task once the reading was posted.
+ * Each seals after its change, the bond callback runs before the record() of its session.
+ */
+void DexcomLinkStats::seal() { DexcomRetained::seal(&linkSeal, LINK_MAGIC, &link, sizeof(link)); }
@@ -0,0 +1,60 @@
+/**
+ * Header File with the rolling connection reliability statistics
+ * Counts sessions, the step each failed session ended in, the scan to connect and connect to glucose latencies
+ * and the 5 minute windows without a reading. Kept in checksummed RTC memory so they survive the restart between
+ * windows, once LINK_STATS_WINDOW sessions are counted every figure is halved, so old sessions fade out.
+ * Written by the BLE task, read by the UI task for the statistics page and by the console, a reader may be one session behind.
+ * The measurement to pixel latency, from the transmitter's measurement to the reading on the screen, is written by the
+ * UI task and halved on its own count.
+ */
+
+#ifndef G6DEXCOMLINKSTATS_H
+#define G6DEXCOMLINKSTATS_H
+
+#include <Arduino.h>
+#include "G6DexcomSession.h"
+
+#define LINK_STATS_WINDOW       288                                                                                     // About a day of sessions before the figures are halved.
+#define LINK_LATENCY_BINS       6
+
+typedef struct
+{
+    uint32_t attempts;              // Sessions started after the transmitter was found.
+    uint32_t successes;             // Sessions that read the glucose.
+    uint32_t failures[SESSION_STEPS];                                                                                   // Per DexcomSessionStep, SESSION_STEP_NONE stays 0.
+    uint32_t missedWindows;         // Readings skipped between two successful sessions.
+    uint32_t bondFailures;
+    uint8_t lastBondReason;         // fail_reason of the last failed bonding, esp_ble_auth_cmpl_t.
+    uint32_t scanToConnect[LINK_LATENCY_BINS];
+    uint32_t connectToGlucose[LINK_LATENCY_BINS];
+    uint32_t displayed;             // Fresh readings drawn, UI task.
+    uint32_t measurementToPixel[LINK_LATENCY_BINS];
+    uint32_t lastMeasurementToPixelMs;
+} DexcomLinkCounters;
+
+class DexcomLinkStats
+{
+    static const uint32_t scanToConnectEdges[LINK_LATENCY_BINS - 1];                                                    // Upper bin limits in ms, the last bin is open.
+    static const uint32_t connectToGlucoseEdges[LINK_LATENCY_BINS - 1];
+    static const uint32_t measurementToPixelEdges[LINK_LATENCY_BINS - 1];
+    static uint32_t scanStartMs;                                                                                        // First scan of this window, 0 when not timing.
+
+    public:
+        static void setup();
+        static void scanStarted();
+        static void record(bool complete, uint8_t failedStep, uint32_t connectedMs, uint32_t glucoseMs, uint32_t dextime);
+        static void bondFailed(uint8_t reason);                                                                         // Called from the BT stack task.
+        static void displayed(uint32_t measurementAgeMs);                                                               // UI task, a fresh reading is on the screen.
+        static const DexcomLinkCounters &get();
+        static const char* stepName(uint8_t step);                                                                      // Three letters for the page and the console.
+        static const char* scanToConnectLabel(int bin);
+        static const char* connectToGlucoseLabel(int bin);
+        static const char* measurementToPixelLabel(int bin);
+
+    private:
+        static int bin(const uint32_t* edges, uint32_t ms);
+        static void halve();
+        static void seal();
+};
+
+#endif /* G6DEXCOMLINKSTATS_H */
@@ -1,4 +1,7 @@
 #include "G6DexcomMFD.h"
+#include "G6DexcomBacklight.h"
+#include "G6DexcomLinkStats.h"
+#include "DexcomPerf.h"
 // TODO: figure out the correct fonts to include
 
 // TODO: replace this with the correct library and class for the T-Display
@@ -22,8 +25,7 @@ int DexcomMFD::glucoseDisplay = 0;
 int DexcomMFD::rateDisplay = +7;
 int DexcomMFD::battDisplay = 72;
 int DexcomMFD::dataAge = 1200;
-int DexcomMFD::backlightState = 1;
-int DexcomMFD::backlightBrightness = 255;
+int DexcomMFD::runtime = 0;
 
 
 // TODO: rework this for the T-Display
@@ -31,8 +33,7 @@ int DexcomMFD::backlightBrightness = 255;
 void DexcomMFD::setupTFT()
 {
     // turn on backlight
-    ledcAttach( PIN_LCD_BL, LCD_BL_LED_FREQ, LCD_BL_LED_RES);
-    ledcWrite( PIN_LCD_BL, 128);
+    DexcomBacklight::setup();
 
     // turn on the TFT / I2C power supply
     pinMode(PIN_POWER_ON, OUTPUT);
@@ -41,7 +42,7 @@ void DexcomMFD::setupTFT()
 
     // initialize TFT
     tft->begin();
-    tft->setRotation(0);
+    tft->setRotation(MFD_LAYOUT.rotation);
     tft->fillScreen(BLACK);
 
     Serial.println(F("Initialized"));
@@ -52,95 +53,58 @@ void DexcomMFD::setupTFT()
     set_loLowBG(75);
 }
 
+/**
+ * Main screen, the glucose tape and value of MFD_LAYOUT.glucose. The limit positions follow the limits set at run time.
+ */
 void DexcomMFD::drawScreen()
 {
-    const static int gluX = 70;
-    const static int gluY = 80;
-    const static int gluWd = 22;
-    const static int gluTpWd = 14;
-    const static int gluTpOfSt = gluWd - gluTpWd;
-    const static int gluHt = 178;
-    const static int gluMax = 300;
-    const static int gluMin = 40;
-    const static int gluPPP_100 = ( gluHt * 100 ) / (gluMax - gluMin); //glucose Pixels per Point x100
-    const static int gluYMx = gluY + 2;
-    const static int gluYHH = gluYMx + ((gluPPP_100 * (gluMax - hiHighLimit)) / 100);
-    const static int gluYH = gluYMx + ((gluPPP_100 * (gluMax - highLimit)) / 100);
-    const static int gluYL = gluYMx + ((gluPPP_100 * (gluMax - lowLimit)) / 100);
-    const static int gluYLL = gluYMx + ((gluPPP_100 * (gluMax - loLowLimit)) / 100);
-    const static int gluYMn = gluYMx + gluHt;
-    int glucoseY = gluYMx + ((gluPPP_100 * (gluMax - glucoseDisplay)) / 100);
-    int textOffset = glucoseDisplay > 99 ? 24 : 12;
-    if (glucoseY > gluYMn) glucoseY = gluYMn;
-    if (glucoseY < gluYMx) glucoseY = gluYMx;
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    constexpr DexcomIndicator glu = MFD_LAYOUT.glucose;
+    const int gluYHH = glu.toY(hiHighLimit);
+    const int gluYH = glu.toY(highLimit);
+    const int gluYL = glu.toY(lowLimit);
+    const int gluYLL = glu.toY(loLowLimit);
+    const int glucoseY = glu.toY(glucoseDisplay);
     tft->fillScreen(BLACK);
-    tft->drawFastHLine(gluX, gluY, gluWd, WHITE);
-    tft->drawFastHLine(gluX, gluY + 1, gluWd, WHITE);
-    tft->drawFastHLine(gluX, gluY + gluHt + 2, gluWd, WHITE);
-    tft->drawFastHLine(gluX, gluY + gluHt + 3, gluWd, WHITE);
-    tft->drawFastHLine(gluX + gluWd, gluYH, 5, WHITE);
-    tft->drawFastHLine(gluX + gluWd, gluYH + 1, 5, WHITE);
-    tft->drawFastHLine(gluX + gluWd, gluYL, 5, WHITE);
-    tft->drawFastHLine(gluX + gluWd, gluYL + 1, 5, WHITE);
-    tft->drawFastVLine(gluX + gluWd, gluY, gluHt + 4, WHITE);
-    tft->drawFastVLine(gluX + gluWd + 1, gluY, gluHt + 4, WHITE);
-    // tft->fillRect(gluX + gluTpOfSt, gluYMx, gluTpWd, gluYHH - gluYMx, RED); //High-High warning bar
-    // tft->fillRect(gluX + gluTpOfSt, gluYLL, gluTpWd, gluYMn - gluYLL, RED); //Low-Low Warning bar
-    // tft->fillRect(gluX + gluTpOfSt, gluYHH, gluTpWd, gluYH - gluYHH, YELLOW); //high caution bar
-    // tft->fillRect(gluX + gluTpOfSt, gluYL, gluTpWd, gluYLL - gluYL, YELLOW); //low caution bar
-    // tft->fillRect(gluX + gluTpOfSt, gluYH, gluTpWd, gluYL - gluYH, GREEN); //green control band
-    pfdColorVTape(gluX + gluTpOfSt, gluYH, gluYL, gluTpWd, GREEN);
-    pfdColorVTape(gluX + gluTpOfSt, gluYHH, gluYH, gluTpWd, YELLOW);
-    pfdColorVTape(gluX + gluTpOfSt, gluYL, gluYLL, gluTpWd, YELLOW);
-    pfdColorVTape(gluX + gluTpOfSt, gluYMx, gluYHH, gluTpWd, RED);
-    pfdColorVTape(gluX + gluTpOfSt, gluYLL, gluYMn, gluTpWd, RED);
+    tft->drawFastHLine(glu.x, glu.y, glu.width, WHITE);
+    tft->drawFastHLine(glu.x, glu.y + 1, glu.width, WHITE);
+    tft->drawFastHLine(glu.x, glu.bottom(), glu.width, WHITE);
+    tft->drawFastHLine(glu.x, glu.bottom() + 1, glu.width, WHITE);
+    tft->drawFastHLine(glu.x + glu.width, gluYH, 5, WHITE);
+    tft->drawFastHLine(glu.x + glu.width, gluYH + 1, 5, WHITE);
+    tft->drawFastHLine(glu.x + glu.width, gluYL, 5, WHITE);
+    tft->drawFastHLine(glu.x + glu.width, gluYL + 1, 5, WHITE);
+    tft->drawFastVLine(glu.x + glu.width, glu.y, glu.height + 4, WHITE);
+    tft->drawFastVLine(glu.x + glu.width + 1, glu.y, glu.height + 4, WHITE);
+    pfdColorVTape(glu.tapeX(), gluYH, gluYL, glu.tapeWidth, GREEN);
+    pfdColorVTape(glu.tapeX(), gluYHH, gluYH, glu.tapeWidth, YELLOW);
+    pfdColorVTape(glu.tapeX(), gluYL, gluYLL, glu.tapeWidth, YELLOW);
+    pfdColorVTape(glu.tapeX(), glu.top(), gluYHH, glu.tapeWidth, RED);
+    pfdColorVTape(glu.tapeX(), gluYLL, glu.bottom(), glu.tapeWidth, RED);
     tft->setTextColor(WHITE);
     tft->setFont(u8g2_font_helvB14_te);
-    // tft->setCursor(gluX - 15, 12);
-    tft->setCursor(gluX + gluTpOfSt - 20, 36);
+    tft->setCursor(glu.tapeX() - 20, MFD_LAYOUT.titleY);
     tft->println("CGM");
-    tft->setCursor(gluX + gluWd + 8, gluYH + 5);
+    tft->setCursor(glu.x + glu.width + MFD_LAYOUT.limitGap, gluYH + 5);
     tft->println(highLimit);
-    tft->setCursor(gluX + gluWd + 8, gluYL + 5);
+    tft->setCursor(glu.x + glu.width + MFD_LAYOUT.limitGap, gluYL + 5);
     tft->println(lowLimit);
     tft->setFont(u8g2_font_inb21_mr);
-    // tft->setCursor(gluX - 20, gluY - 8);
     if (glucoseDisplay > 10)
     {
-        // Serial.print("Value: ");
-        // Serial.print(String(glucoseDisplay));
-        // Serial.print(" Text offset: ");
-        // Serial.println(txtCenter(String(glucoseDisplay)));
-
-        tft->setCursor(gluX + gluTpOfSt - textOffset, gluY - 8);
+        tft->setCursor(glu.labelX(glucoseDisplay), glu.y - 8);
         tft->println(glucoseDisplay);
-        tft->fillTriangle(gluX, glucoseY - (gluTpWd / 2), gluX + gluWd, glucoseY, gluX, glucoseY + (gluWd / 2), WHITE);
-        tft->drawTriangle(gluX, glucoseY - (gluTpWd / 2), gluX + gluWd, glucoseY, gluX, glucoseY + (gluWd / 2), BLACK);
+        tft->fillTriangle(glu.x, glucoseY - (glu.tapeWidth / 2), glu.x + glu.width, glucoseY, glu.x, glucoseY + (glu.width / 2), WHITE);
+        tft->drawTriangle(glu.x, glucoseY - (glu.tapeWidth / 2), glu.x + glu.width, glucoseY, glu.x, glucoseY + (glu.width / 2), BLACK);
     }
     else
     {
-        tft->setCursor(gluX + gluTpOfSt - txtCenter("---"), gluY - 8);
+        tft->setCursor(glu.tapeX() - txtCenter("---"), glu.y - 8);
         tft->println("---");
     }
 
-    if (dataAge < 15) // Data is new make sure we see it
-    {
-        set_brightness(255);
-    }
-    else if ((dataAge > 600) || (glucoseDisplay > hiHighLimit) || (glucoseDisplay < loLowLimit))  // Data is old, or Alarm level
-    {
-        set_brightness(192);
-    }
-    else if ((dataAge < 60) && ((glucoseDisplay > highLimit) || (glucoseDisplay < lowLimit))) // Give more time to see warning conditions
-    {
-        set_brightness(128);
-    }
-    else
-    {
-        set_brightness(64);
-    }
-
-
+    DexcomBacklight::update(dataAge, alertLevel());
+    DexcomPerf::stop(PERF_DRAW_SCREEN, stamp);
 }
 
 void DexcomMFD::pfdColorVTape( uint16_t x, uint16_t y1, uint16_t y2, uint16_t w, uint16_t color) {
@@ -174,128 +138,132 @@ void DexcomMFD::pfdColorVTape( uint16_t x, uint16_t y1, uint16_t y2, uint16_t w,
 
 void DexcomMFD::drawGrid()
 {
-    int w = 170;
-    int h = 320;
-    for (int x = 9; x < w; x+=10) tft->drawFastVLine(x, 0, h, DARKGREY);
-    for (int y = 9; y < h; y+=10) tft->drawFastHLine(0, y, w, DARKGREY);
+    for (int x = 9; x < MFD_LAYOUT.width; x+=10) tft->drawFastVLine(x, 0, MFD_LAYOUT.height, DARKGREY);
+    for (int y = 9; y < MFD_LAYOUT.height; y+=10) tft->drawFastHLine(0, y, MFD_LAYOUT.width, DARKGREY);
 }
 
+/**
+ * Data age as mm:ss in MFD_LAYOUT.time, framed green, yellow after 5 and red after 10 minutes.
+ */
 void DexcomMFD::drawTime(uint32_t time)
 {
+    DexcomPerfStamp stamp = DexcomPerf::start();
+    constexpr DexcomField field = MFD_LAYOUT.time;
     int timeMins = time / 60;
     int timeSecs = time - (60 * timeMins);
-    int minTens = timeMins / 10;
-    int minOnes = timeMins - (10 * minTens);
-    int secTens = timeSecs / 10;
-    int secOnes = timeSecs - (10 * secTens);
-    int y = 300;
-    int x = 20;
-    int wDig = 12;
-    int hDig = 20;
-
-
-    if (minTens > 9) 
-    {
-        minTens = minOnes = secTens = secOnes = 9;
-    }
+    char cells[8];
+    if (timeMins > 99)
+        snprintf(cells, sizeof(cells), "99:99");
+    else
+        snprintf(cells, sizeof(cells), "%c%d:%02d", timeMins >= 10 ? '0' + timeMins / 10 : ' ', timeMins % 10, timeSecs);
 
     // drawGrid();
     uint16_t color = DARKGREEN;
     if (time > 300) color = YELLOW;
     if (time > 600) color = RED;
 
-    tft->drawRoundRect(x-4, y-hDig-2, 5*wDig + 8, hDig + 8, 3, color); //age status
-    tft->drawRoundRect(x-3, y-hDig-1, 5*wDig + 6, hDig + 6, 3, color); //age status
-
-    tft->fillRoundRect(x-2, y-hDig, 5*wDig + 4, hDig + 4, 3, BLACK); //Erase old time
-    tft->setTextColor(WHITE);
-    tft->setFont(u8g2_font_helvB14_te);
-    tft->setCursor(x, y);
-    if (minTens > 0) tft->println(minTens);
-    tft->setCursor(x + wDig, y);
-    tft->println(minOnes);
-    tft->setCursor(x + 2*wDig, y);
-    tft->println(":");
-    tft->setCursor(x + 3*wDig, y);
-    tft->println(secTens);
-    tft->setCursor(x + 4*wDig, y);
-    tft->println(secOnes);
-
-    
-
-    if (time < 15) // Data is new make sure we see it
-    {
-        set_brightness(255);
-    }
-    else if ((time > 600) || (glucoseDisplay > hiHighLimit) || (glucoseDisplay < loLowLimit))  // Data is old, or Alarm level
-    {
-        set_brightness(192);
-    }
-    else if ((time < 60) && ((glucoseDisplay > highLimit) || (glucoseDisplay < lowLimit))) // Give more time to see warning conditions
-    {
-        set_brightness(128);
-    }
-    else
-    {
-        set_brightness(64);
-    }
+    tft->drawRoundRect(field.eraseX() - 2, field.eraseY() - 2, field.eraseWidth() + 4, field.eraseHeight() + 4, 3, color); //age status
+    tft->drawRoundRect(field.eraseX() - 1, field.eraseY() - 1, field.eraseWidth() + 2, field.eraseHeight() + 2, 3, color); //age status
+    drawField(field, u8g2_font_helvB14_te, cells);
 
+    dataAge = time;
+    DexcomBacklight::update(dataAge, alertLevel());
+    DexcomPerf::stop(PERF_DRAW_TIME, stamp);
 }
 
 void DexcomMFD::drawVBat(int mVolts)
 {
-    int y = 300;
-    int x = 100;
-    int wDig = 9;
-    int hDig = 20;
-    int volts = mVolts / 1000;
-    int tenths = (mVolts - 1000*volts) / 100;
-    int hundreths = (mVolts - 1000*volts - 100*tenths) / 10;
-
-    tft->fillRoundRect(x-2, y-hDig, 5*wDig + 4, hDig + 4, 3, BLACK); //Erase old time
+    char cells[8];
+    snprintf(cells, sizeof(cells), "%d.%d%dv", (mVolts / 1000) % 10, (mVolts / 100) % 10, (mVolts / 10) % 10);
+    drawField(MFD_LAYOUT.volts, u8g2_font_helvB10_te, cells);
+}
+
+void DexcomMFD::drawPBat(int pct)
+{
+    char cells[8];
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+    snprintf(cells, sizeof(cells), "%3d%%", pct);
+    drawField(MFD_LAYOUT.percent, u8g2_font_helvB10_te, cells);
+}
+
+/**
+ * Progress of a running backfill left of the glucose tape, drawScreen clears it with the next reading.
+ */
+void DexcomMFD::drawBackfill(int pct)
+{
+    constexpr DexcomField field = MFD_LAYOUT.backfill;
+    constexpr int barWidth = field.cells * field.digitWidth;
+    char text[8];
+    if (pct < 0) pct = 0;
+    if (pct > 100) pct = 100;
+    snprintf(text, sizeof(text), "%d%%", pct);
+
+    tft->fillRoundRect(field.eraseX(), field.eraseY() - field.eraseHeight(), field.eraseWidth(), 2 * field.eraseHeight(), 3, BLACK); //Erase old progress
     tft->setTextColor(WHITE);
     tft->setFont(u8g2_font_helvB10_te);
-    tft->setCursor(x, y);
-    tft->println(volts);
-    tft->setCursor(x + wDig, y);
-    tft->println(".");
-    tft->setCursor(x + 2*wDig, y);
-    tft->println(tenths);
-    tft->setCursor(x + 3*wDig, y);
-    tft->println(hundreths);
-    tft->setCursor(x + 4*wDig, y);
-    tft->println("v");
-
+    tft->setCursor(field.x, field.y - field.eraseHeight());
+    tft->println("FILL");
+    tft->setCursor(field.x, field.y);
+    tft->println(text);
+    tft->drawRect(field.x, field.y + 2, barWidth, 4, DARKGREEN);
+    tft->fillRect(field.x, field.y + 2, (barWidth * pct) / 100, 4, DARKGREEN);
 }
 
-void DexcomMFD::drawPBat(int pct)
+/**
+ * Connection statistics page, success rate, missed windows, bonding, the failed steps and both latency histograms.
+ */
+void DexcomMFD::drawStats()
 {
-    int y = 280;
-    int x = 110;
-    int wDig = 9;
-    int hDig = 20;
-    int hundreds = pct / 100;
-    int tens = (pct - 100*hundreds) / 10;
-    int ones = pct - 100*hundreds - 10*tens;
-
-    tft->fillRoundRect(x-2, y-hDig, 5*wDig + 4, hDig + 4, 3, BLACK); //Erase old time
+    const DexcomLinkCounters &stats = DexcomLinkStats::get();
+    int x = 8;
+    int y = 24;
+    char text[24];
+
+    tft->fillScreen(BLACK);
     tft->setTextColor(WHITE);
+    tft->setFont(u8g2_font_helvB14_te);
+    tft->setCursor(x, y);
+    tft->println("LINK");
+
     tft->setFont(u8g2_font_helvB10_te);
-    if(pct >= 100)
-    {        
-        tft->setCursor(x, y);
-        tft->println(hundreds);
+    y += 22;
+    snprintf(text, sizeof(text), "OK %lu/%lu", (unsigned long) stats.successes, (unsigned long) stats.attempts);
+    tft->setCursor(x, y);
+    tft->println(text);
+    if (stats.attempts > 0)
+    {
+        int pct = (int) ((100 * stats.successes) / stats.attempts);
+        snprintf(text, sizeof(text), "%d%%", pct);
+        tft->setTextColor(pct >= 90 ? GREEN : pct >= 70 ? YELLOW : RED);
+        tft->setCursor(120, y);
+        tft->println(text);
+        tft->setTextColor(WHITE);
     }
-    if(pct >= 10)
-    {        
-        tft->setCursor(x + wDig, y);
-        tft->println(tens);
+    y += 18;
+    snprintf(text, sizeof(text), "MISSED %lu", (unsigned long) stats.missedWindows);
+    tft->setCursor(x, y);
+    tft->println(text);
+    y += 18;
+    snprintf(text, sizeof(text), "BOND %lu  R%u", (unsigned long) stats.bondFailures, stats.lastBondReason);
+    tft->setCursor(x, y);
+    tft->println(stats.bondFailures > 0 ? text : "BOND OK");
+
+    y += 8;
+    tft->drawFastHLine(x, y, 154, DARKGREY);
+    for (int step = SESSION_STEP_CONNECT; step < SESSION_STEPS; step++)
+    {
+        int column = (step - SESSION_STEP_CONNECT) % 2;
+        if (column == 0) y += 16;
+        snprintf(text, sizeof(text), "%s %lu", DexcomLinkStats::stepName(step), (unsigned long) stats.failures[step]);
+        tft->setTextColor(stats.failures[step] > 0 ? YELLOW : DARKGREY);
+        tft->setCursor(x + column * 80, y);
+        tft->println(text);
     }
-    tft->setCursor(x + 2*wDig, y);
-    tft->println(ones);
-    tft->setCursor(x + 3*wDig, y);
-    tft->println("%");
+    tft->setTextColor(WHITE);
 
+    y = drawHistogram(y + 20, "SCAN>CON", stats.scanToConnect, DexcomLinkStats::scanToConnectLabel);
+    drawHistogram(y + 16, "CON>GLU", stats.connectToGlucose, DexcomLinkStats::connectToGlucoseLabel);
 }
 
 void DexcomMFD::set_glucoseValue(int bg_value)
@@ -359,37 +327,63 @@ void DexcomMFD::set_loLowBatt(int limit)
 {
 }
 
-void DexcomMFD::set_backlight(int state)
+/**
+ * Compares the displayed glucose against the limits for the backlight policy.
+ */
+int DexcomMFD::alertLevel()
 {
-    backlightState = state;
-    setBacklightLED();
+    if ((glucoseDisplay > hiHighLimit) || (glucoseDisplay < loLowLimit)) return BACKLIGHT_ALERT_WARNING;
+    if ((glucoseDisplay > highLimit) || (glucoseDisplay < lowLimit)) return BACKLIGHT_ALERT_CAUTION;
+    return BACKLIGHT_ALERT_NONE;
 }
 
-int DexcomMFD::get_backlight()
+/**
+ * One bar per bin scaled to the fullest bin, returns the y below the last bar.
+ */
+int DexcomMFD::drawHistogram(int y, const char* title, const uint32_t* bins, const char* (*label)(int))
 {
-    return backlightState;
-}
+    const static int barX = 48;
+    const static int barWd = 114;
+    uint32_t most = 1;
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+        if (bins[i] > most) most = bins[i];
 
-void DexcomMFD::set_brightness(int brightness)
-{
-    backlightBrightness = brightness;
-    setBacklightLED();
+    tft->setFont(u8g2_font_helvB10_te);
+    tft->setTextColor(WHITE);
+    tft->setCursor(8, y);
+    tft->println(title);
+    for (int i = 0; i < LINK_LATENCY_BINS; i++)
+    {
+        y += 10;
+        tft->setTextColor(DARKGREY);
+        tft->setFont(u8g2_font_helvR08_tr);
+        tft->setCursor(8, y);
+        tft->println(label(i));
+        tft->fillRect(barX, y - 7, (int) ((barWd * bins[i]) / most), 7, DARKGREEN);
+    }
+    tft->setTextColor(WHITE);
+    return y;
 }
 
-void DexcomMFD::setBacklightLED()
+/**
+ * Erases the field and draws one character per cell, blanks are left empty.
+ */
+void DexcomMFD::drawField(const DexcomField &field, const uint8_t* font, const char* cells)
 {
-    if (backlightState > 0)
-    {
-        ledcWrite( PIN_LCD_BL, backlightBrightness);
-    }
-    else
+    tft->fillRoundRect(field.eraseX(), field.eraseY(), field.eraseWidth(), field.eraseHeight(), 3, BLACK);
+    tft->setTextColor(WHITE);
+    tft->setFont(font);
+    for (int i = 0; i < field.cells && cells[i] != 0; i++)
     {
-        ledcWrite( PIN_LCD_BL, 0);
+        if (cells[i] == ' ')
+            continue;
+        tft->setCursor(field.cellX(i), field.y);
+        tft->print(cells[i]);
     }
 }
 
 //returns the center offset for the given string
-int DexcomMFD::txtCenter(const String &str)
+int DexcomMFD::txtCenter(const char* str)
 {
     int16_t  x1, y1;
     uint16_t w, h;
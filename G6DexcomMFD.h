@@ -15,6 +15,7 @@
 #include "U8g2lib.h"
 #include "Arduino_GFX_Library.h"    // Core graphics library
 #include "pin_config.h"
+#include "DexcomLayout.h"
 
 #define GARMIN_GREEN_16 (15 << 11) + (49 << 5) + 11
 #define GARMIN_YELLOW_16 (31 << 11) + (55 << 5) + 6
@@ -49,8 +50,6 @@ class DexcomMFD {
     static int lowRateLimit;
     static int lowBattLimit;
     static int loLowBattLimit;
-    static int backlightState;
-    static int backlightBrightness;
 
     public:
         static void setupTFT();
@@ -59,6 +58,8 @@ class DexcomMFD {
         static void drawTime(uint32_t time);
         static void drawVBat(int mVolts);
         static void drawPBat(int pct);
+        static void drawBackfill(int pct);
+        static void drawStats();                                                                                        // Second page, replaces the whole screen.
         static void set_glucoseValue(int bg_value);
         static void set_glucoseRate(int bg_rate);
         static void set_battPct(int batt_pct);
@@ -72,35 +73,13 @@ class DexcomMFD {
         static void set_loLowBG(int limit);
         static void set_lowBatt(int limit);
         static void set_loLowBatt(int limit);
-        static void set_backlight(int state);
-        static int get_backlight();
-        static void set_brightness(int brightness);
+        static int alertLevel();
 
     private:
-        static int txtCenter(const String &str);
+        static int txtCenter(const char* str);
         static void pfdColorVTape( uint16_t x, uint16_t y1, uint16_t y2, uint16_t w, uint16_t color);
-        static void setBacklightLED();
+        static void drawField(const DexcomField &field, const uint8_t* font, const char* cells);
+        static int drawHistogram(int y, const char* title, const uint32_t* bins, const char* (*label)(int));
 };
 
-/** generic draw indicator data struct
- *
- * this contains basic position, size, and scale information for the indicator
- *
- * x, y  far left and top coordinates of graph
- * ht total height of the space INSIDE the bracket
- * wd total width of the top and bottom of the bracket
- * tpWd width of the color tape inside the bracket
- * max : maximum value of the graph
- * min : minimum value of the graph
- *
- **/
-typedef struct {
-  unsigned int x, y;
-  unsigned int height, width, tapeWidth;
-  int max, min;
-} DexcomIndicator;
-
-
-
-
 #endif //G6DEXCOMMFD_H
@@ -0,0 +1,40 @@
+/**
+ * Header File with the check for state kept in RTC memory across the restart between windows
+ * esp_restart() is not a deep sleep wake, the bootloader loads RTC_DATA_ATTR variables from the image again and
+ * the startup code zeroes RTC bss, so state that has to outlive it is declared RTC_NOINIT_ATTR and never initialised.
+ * After a power on such a block holds noise, the seal next to it, a magic word per block, the length and a
+ * CRC-16 over the data, tells a block this firmware wrote from that. The owner seals after each change.
+ */
+
+#ifndef G6DEXCOMRETAINED_H
+#define G6DEXCOMRETAINED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DexcomPlatform.h"
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t length;                // A changed layout in a new firmware does not pass either.
+    uint16_t crc;
+} DexcomRetainedSeal;
+
+class DexcomRetained
+{
+    public:
+        static inline bool valid(const DexcomRetainedSeal &seal, uint32_t magic, const void* data, size_t length)
+        {
+            return seal.magic == magic && seal.length == (uint16_t)length &&
+                   seal.crc == DexcomPlatform::crc16Xmodem((const uint8_t*)data, length);
+        }
+
+        static inline void seal(DexcomRetainedSeal* seal, uint32_t magic, const void* data, size_t length)
+        {
+            seal->magic = magic;
+            seal->length = (uint16_t)length;
+            seal->crc = DexcomPlatform::crc16Xmodem((const uint8_t*)data, length);
+        }
+};
+
+#endif /* G6DEXCOMRETAINED_H */
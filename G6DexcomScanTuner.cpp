@@ -0,0 +1,122 @@
+/*
+ * G6DexcomScanTuner
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomScanTuner.h"
+#include "DebugHelper.h"
+#include "DexcomPlatform.h"
+#include "G6DexcomRetained.h"
+
+
+const DexcomScanParams DexcomScanTuner::sets[SCAN_SETS] = {
+    { 100, 99 },                    // The hand tuned default, 99 % duty.
+    { 100, 80 },
+    { 100, 60 },
+    { 200, 80 },
+    { 200, 60 },
+    { 300, 60 }                     // 20 % duty.
+};
+
+#define TUNER_MAGIC 0x53434e31                                                                                          // "SCN1"
+
+typedef struct
+{
+    int currentSet;
+    int lowestAllowed;                                                                                                  // A set that missed too often blocks the ones below it.
+    DexcomScanStats stats[SCAN_SETS];
+} DexcomTunerState;
+
+// RTC_NOINIT so the statistics outlive the window restart, the seal tells them from power on noise.
+RTC_NOINIT_ATTR static DexcomTunerState tuner;
+RTC_NOINIT_ATTR static DexcomRetainedSeal tunerSeal;
+
+uint32_t DexcomScanTuner::startMs = 0;
+volatile uint32_t DexcomScanTuner::detectedMs = 0;
+
+/**
+ * After a power on the statistics are gone, start again from the set that was chosen last.
+ */
+void DexcomScanTuner::setup()
+{
+    if (DexcomRetained::valid(tunerSeal, TUNER_MAGIC, &tuner, sizeof(tuner)))
+        return;
+    memset(&tuner, 0, sizeof(tuner));
+    tuner.lowestAllowed = SCAN_SETS - 1;
+    tuner.currentSet = DexcomPlatform::storageGetInt("ScanSet", 0);
+    if (tuner.currentSet < 0 || tuner.currentSet >= SCAN_SETS) tuner.currentSet = 0;
+    seal();
+}
+
+const DexcomScanParams &DexcomScanTuner::current() { return sets[tuner.currentSet]; }
+int DexcomScanTuner::get_currentSet() { return tuner.currentSet; }
+const DexcomScanParams &DexcomScanTuner::get_params(int set) { return sets[set]; }
+const DexcomScanStats &DexcomScanTuner::get_stats(int set) { return tuner.stats[set]; }
+
+void DexcomScanTuner::scanStarted()
+{
+    if (startMs == 0)
+    {
+        startMs = millis() | 1;
+        detectedMs = 0;
+    }
+    tuner.stats[tuner.currentSet].scans++;
+    seal();
+}
+
+void DexcomScanTuner::markDetected()
+{
+    if (detectedMs == 0)
+        detectedMs = millis();
+}
+
+/**
+ * Book the time to detect on the current set and decide on the set for the next window.
+ */
+void DexcomScanTuner::finishWindow()
+{
+    if (startMs == 0 || detectedMs == 0)
+        return;
+    uint32_t elapsed = detectedMs - startMs;
+    startMs = 0;
+
+    DexcomScanStats &stat = tuner.stats[tuner.currentSet];
+    bool missed = elapsed > SCAN_MISS_MS;
+    stat.windows++;
+    stat.totalMs += elapsed;
+    if (elapsed > stat.maxMs) stat.maxMs = elapsed;
+    if (missed) stat.misses++;
+    SerialPrintf(DATA, "Scan set %d (%d/%d ms) detected after %d ms%s\n\r", tuner.currentSet, sets[tuner.currentSet].windowMs,
+                 sets[tuner.currentSet].intervalMs, elapsed, missed ? ", missed" : "");
+
+    bool tooManyMisses = stat.misses * 8 > stat.windows * SCAN_MAX_MISS_EIGHTHS;
+    if (missed && tooManyMisses && tuner.currentSet > 0)
+    {
+        tuner.lowestAllowed = tuner.currentSet - 1;                                                                     // Do not probe this set again until a power cycle.
+        select(tuner.currentSet - 1);
+    }
+    else if (!tooManyMisses && stat.windows >= SCAN_MIN_WINDOWS && tuner.currentSet < tuner.lowestAllowed)
+        select(tuner.currentSet + 1);
+    seal();
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+void DexcomScanTuner::select(int set)
+{
+    SerialPrintf(DEBUG, "Scan tuner: set %d -> %d\n\r", tuner.currentSet, set);
+    tuner.currentSet = set;
+    DexcomPlatform::storagePutInt("ScanSet", set);
+}
+
+/**
+ * Only the BLE task changes the tuner state, it seals after each change.
+ */
+void DexcomScanTuner::seal() { DexcomRetained::seal(&tunerSeal, TUNER_MAGIC, &tuner, sizeof(tuner)); }
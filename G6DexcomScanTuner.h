@@ -0,0 +1,56 @@
+/**
+ * Header File with the self tuning BLE scan parameters
+ * Measures the time from the first scan of a transmitter window to the advertisement hit for each parameter set,
+ * steps down to lower scan duty while the advertisement is still caught reliably and steps back up on misses.
+ * The statistics and the blocked sets are kept in checksummed RTC memory across the restart between windows,
+ * the chosen set also in flash, so a power on starts from it with fresh statistics.
+ */
+
+#ifndef G6DEXCOMSCANTUNER_H
+#define G6DEXCOMSCANTUNER_H
+
+#include <Arduino.h>
+
+#define SCAN_SETS               6
+#define SCAN_DURATION_SEC       3                                                                                       // Length of one blocking scan in find().
+#define SCAN_MISS_MS            30000                                                                                   // Detected later than this, the first advertisement burst was missed.
+#define SCAN_MIN_WINDOWS        8                                                                                       // Windows on a set before it may step down.
+#define SCAN_MAX_MISS_EIGHTHS   1                                                                                       // Tolerated misses per 8 windows.
+
+typedef struct
+{
+    uint16_t intervalMs;
+    uint16_t windowMs;
+} DexcomScanParams;
+
+typedef struct
+{
+    uint32_t windows;               // Transmitter windows detected with this set.
+    uint32_t misses;
+    uint32_t totalMs;               // Sum of the time to detect.
+    uint32_t maxMs;
+    uint32_t scans;                 // Blocking scans started, includes the ones that found nothing.
+} DexcomScanStats;
+
+class DexcomScanTuner
+{
+    static const DexcomScanParams sets[SCAN_SETS];                                                                      // Ordered by falling duty.
+    static uint32_t startMs;                                                                                            // Start of the first scan in this window, 0 when not timing.
+    static volatile uint32_t detectedMs;
+
+    public:
+        static void setup();
+        static const DexcomScanParams &current();
+        static void scanStarted();
+        static void markDetected();                                                                                     // Called from the advertisement callback, only stores the time.
+        static void finishWindow();                                                                                     // Called by the BLE task once the transmitter was found.
+        static int get_currentSet();
+        static const DexcomScanParams &get_params(int set);
+        static const DexcomScanStats &get_stats(int set);
+
+    private:
+        static void select(int set);
+        static void seal();
+};
+
+#endif /* G6DEXCOMSCANTUNER_H */
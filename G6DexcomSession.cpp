@@ -0,0 +1,214 @@
+/*
+ * G6DexcomSession
+ */
+
+
+#include <string.h>
+#include "G6DexcomSession.h"
+#include "G6DexcomAuth.h"
+#include "G6DexcomClient.h"
+#include "DexcomPerf.h"
+#include "DexcomPlatform.h"
+#include "G6Transmitter.h"
+
+
+DexcomTransport* DexcomSession::link = NULL;
+DexcomTransmitterId DexcomSession::transmitterID(DEXCOM_CONFIG_DEFAULT_ID);
+bool DexcomSession::alternateChannel = false;
+bool DexcomSession::errorCurrentConnection = false;
+uint8_t DexcomSession::failedStep = SESSION_STEP_NONE;
+uint32_t DexcomSession::connectedMs = 0;
+uint32_t DexcomSession::glucoseMs = 0;
+
+void DexcomSession::setTransport(DexcomTransport* transport) { link = transport; }
+DexcomTransport* DexcomSession::transport() { return link; }
+
+void DexcomSession::useAlternateChannel() { alternateChannel = true; }
+void DexcomSession::usePrimaryChannel() { alternateChannel = false; }
+bool DexcomSession::usingAlternateChannel() { return alternateChannel; }
+
+/**
+ * Function to update the transmitter ID. 
+ * Returns true if the update is successful.
+ * Fails if the ID is not exactly 6 digits or upper case letters, the old ID is kept then.
+*/
+bool DexcomSession::setTransmitterID(const char* updatedTransmitterID)
+{
+    return transmitterID.set(updatedTransmitterID);
+}
+
+bool DexcomSession::setPairingCode(const char* code)
+{
+    return transmitterID.setPairingCode(code);
+}
+
+const char* DexcomSession::getTransmitterID()
+{
+    return transmitterID.id;
+}
+
+const DexcomTransmitterId &DexcomSession::transmitter()
+{
+    return transmitterID;
+}
+
+uint8_t DexcomSession::get_failedStep() { return failedStep; }
+uint32_t DexcomSession::get_connectedMs() { return connectedMs; }
+uint32_t DexcomSession::get_glucoseMs() { return glucoseMs; }
+
+/**
+ * This function can be called in an error case, step is the DexcomSessionStep that failed.
+ */
+void DexcomSession::exitState(uint8_t step, const char* message)
+{
+    failedStep = step;
+    SerialPrintln(ERROR, message);
+    link->disconnect();                                                                                                 // Disconnect to trigger onDisconnect event and go to sleep.
+}
+
+/**
+ * Computes the parts of the auth handshake that do not depend on the transmitter (G7 round one),
+ * so they are not paid for inside the connection window.
+ */
+bool DexcomSession::prepare()
+{
+    return DexcomAuth::prepare(transmitterID);
+}
+
+/**
+ * This method will perform a full transmitter connect and read data.
+ * Blocks until all transmitter communication has finished, returns true when the current glucose was read.
+ */
+bool DexcomSession::run()
+{
+    bool readComplete = false;
+    errorCurrentConnection = false;                                                                                    // Set to false to start.
+    failedStep = SESSION_STEP_NONE;
+    connectedMs = 0;
+    glucoseMs = 0;
+    DexcomPerfStamp runStamp = DexcomPerf::start();
+    DexcomPerfStamp stamp;
+
+    if (!errorCurrentConnection) {
+        SerialPrintln(DEBUG, "try connect");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !link->connect();                                                                      // Connect to the found transmitter.
+        DexcomPerf::stop(PERF_RUN_CONNECT, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_CONNECT, "We have failed to connect to the transmitter!"); }
+        else { SerialPrintln(DEBUG, "We are now connected to the transmitter."); connectedMs = DexcomPlatform::millis() | 1; }
+    }
+
+    // Authenticate with the transmitter.
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to authenticate");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !DexcomAuth::authenticate(link, transmitterID, alternateChannel);
+        DexcomPerf::stop(PERF_RUN_AUTH, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_AUTH, "Error while trying to authenticate!"); }
+        else { SerialPrintln(DEBUG, "Successfully authenticated."); }
+    }
+
+    // Enable encryption and requesting bonding.
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to bond");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !DexcomAuth::requestBond(link);
+        DexcomPerf::stop(PERF_RUN_BOND, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_BOND, "Error while trying to bond!"); }
+        else { SerialPrintln(DEBUG, "Successfully bonded."); }
+    }
+
+    // Read the general device informations like model no. and manufacturer.
+
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to read device information");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !link->readDeviceInformations();
+        DexcomPerf::stop(PERF_RUN_DEVICE_INFO, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_DEVICE_INFO, "Error while reading device informations!"); }    // If empty strings are read from the device information Characteristic, try reading device information after successfully authenticated.
+        else { SerialPrintln(DEBUG, "Successfully read device instructions."); }
+    }
+
+    // Register the control channel callback.
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to register control callback");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !link->controlRegister();
+        DexcomPerf::stop(PERF_RUN_REGISTER, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_REGISTER, "Error while trying to register!"); }
+        else { SerialPrintln(DEBUG, "Successfully registered."); }
+    }
+
+    // Reading current time from the transmitter (important for backfill).
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to read time message");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !DexcomClient::readTimeMessage();
+        DexcomPerf::stop(PERF_RUN_TIME, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_TIME, "Error reading Time Message!"); }
+        else { SerialPrintln(DEBUG, "Successfully read time message."); }
+    }
+
+    // Reading current battery status
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to read battery status");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !DexcomClient::readBatteryStatus();
+        DexcomPerf::stop(PERF_RUN_BATTERY, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_BATTERY, "Error reading battery status!"); }
+        else { SerialPrintln(DEBUG, "Successfully read battery status."); }
+    }
+
+    //Read current glucose level to save it.
+    if (!errorCurrentConnection) {
+
+        SerialPrintln(DEBUG, "try to read current glucose");
+        stamp = DexcomPerf::start();
+        errorCurrentConnection = !DexcomClient::readGlucose();
+        DexcomPerf::stop(PERF_RUN_GLUCOSE, stamp);
+        if (errorCurrentConnection) { exitState(SESSION_STEP_GLUCOSE, "Error reading current glucose!"); }
+        else { SerialPrintln(DEBUG, "Successfully read current glucose."); }                                           // The UI task resets the data age when it gets the reading.
+    }
+
+    if(!errorCurrentConnection)
+    {
+        readComplete = true;
+        glucoseMs = DexcomPlatform::millis() - connectedMs;
+    }
+
+    // Optional: read sensor raw (unfiltered / filtered) data.
+    //if(!readSensor())
+        //SerialPrintln(ERROR, "Can't read raw Sensor values!");
+
+    // Optional: read time and glucose of last calibration.
+    //if(!readLastCalibration())
+        //SerialPrintln(ERROR, "Can't read last calibration data!");
+
+
+    if(readComplete && DexcomClient::needBackfill())
+    {
+        stamp = DexcomPerf::start();
+        link->backfillRegister();                                                                                       // Now register on the backfill characteristic.
+        // Read backfill of the last x values to also saves them.
+        if(!DexcomClient::readBackfill())
+            SerialPrintln(ERROR, "Can't read backfill data!");
+        DexcomPerf::stop(PERF_RUN_BACKFILL, stamp);
+    }
+                                                                                  // When we reached this point no error occured.
+    //Let the Transmitter close the connection.
+    if (link->isConnected())
+    {
+        stamp = DexcomPerf::start();
+        link->disconnect();
+        DexcomPerf::stop(PERF_RUN_DISCONNECT, stamp);
+    }
+    DexcomPerf::stop(PERF_RUN, runStamp);
+    DexcomPerf::count(readComplete ? PERF_SESSION_OK : PERF_SESSION_FAIL);
+    return readComplete;
+}
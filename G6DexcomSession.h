@@ -0,0 +1,62 @@
+/**
+ * Header File with the session flow: connect, authenticate, bond, read and disconnect
+ * Portable protocol code shared by the firmware and the host build,
+ * the radio is reached through the DexcomTransport given to setTransport().
+ */
+
+#ifndef G6DEXCOMSESSION_H
+#define G6DEXCOMSESSION_H
+
+#include <stdint.h>
+#include "DebugHelper.h"
+#include "DexcomTransport.h"
+#include "DexcomTransmitterId.h"
+
+// Step of DexcomSession::run that ended the session, SESSION_STEP_NONE when the glucose was read.
+typedef enum
+{
+    SESSION_STEP_NONE = 0,
+    SESSION_STEP_CONNECT,
+    SESSION_STEP_AUTH,
+    SESSION_STEP_BOND,
+    SESSION_STEP_DEVICE_INFO,
+    SESSION_STEP_REGISTER,
+    SESSION_STEP_TIME,
+    SESSION_STEP_BATTERY,
+    SESSION_STEP_GLUCOSE,
+    SESSION_STEPS
+} DexcomSessionStep;
+
+
+class DexcomSession
+{
+    static DexcomTransport* link;
+    static DexcomTransmitterId transmitterID;                                                                           // The one transmitter ID with its derived fields.
+    static bool alternateChannel;                                                                                       // Option to use the alternate data channel (true if using with pump)
+    static bool errorCurrentConnection;                                                                                 // To detect an error in the current session.
+    static uint8_t failedStep;                                                                                          // DexcomSessionStep of the last run.
+    static uint32_t connectedMs;                                                                                        // Platform millis when the last run was connected, 0 if it was not.
+    static uint32_t glucoseMs;                                                                                          // From connected to the glucose read, 0 if it was not read.
+
+    public:
+        static void setTransport(DexcomTransport* transport);
+        static DexcomTransport* transport();
+        static bool setTransmitterID(const char* updatedTransmitterID);                                                 //returns true if the new transmitter ID is valid, and the value is updated.
+        static bool setPairingCode(const char* code);                                                                   // G7 / ONE+ only, the 4 digits printed on the sensor.
+        static const char* getTransmitterID();
+        static const DexcomTransmitterId &transmitter();
+        static void useAlternateChannel();
+        static void usePrimaryChannel();
+        static bool usingAlternateChannel();
+
+        static bool prepare();                                                                                          // Work that does not need the transmitter, call before scanning.
+        static bool run();
+        static uint8_t get_failedStep();
+        static uint32_t get_connectedMs();
+        static uint32_t get_glucoseMs();
+
+    private:
+        static void exitState(uint8_t step, const char* message);
+};
+
+#endif /* G6DEXCOMSESSION_H */
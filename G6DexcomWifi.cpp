@@ -0,0 +1,141 @@
+/*
+ * G6DexcomWifi
+ */
+
+
+#include <Arduino.h>
+#include "G6DexcomWifi.h"
+#include "DebugHelper.h"
+#include "DexcomPlatform.h"
+#include "G6DexcomEnergy.h"
+#include "G6DexcomRetained.h"
+
+
+#define JOIN_MAGIC 0x574a4e31                                                                                           // "WJN1"
+
+typedef struct
+{
+    int32_t channel;
+    uint8_t bssid[6];
+} DexcomJoinPoint;
+
+// The access point of the last join, noise after a power on until the seal matches.
+RTC_NOINIT_ATTR static DexcomJoinPoint joinPoint;
+RTC_NOINIT_ATTR static DexcomRetainedSeal joinSeal;
+
+DexcomWifiUplink::DexcomWifiUplink(const char* ssid, const char* password, const char* host, uint16_t port, const char* rootCa)
+    : ssid(ssid), password(password), host(host), port(port), client(&plainClient), alwaysOn(false)
+{
+    if (port == 443)
+    {
+        if (rootCa != NULL)
+            secureClient.setCACert(rootCa);
+        else
+        {
+            SerialPrintln(DEBUG, "Wi-Fi uplink: no root certificate, the server is not verified.");
+            secureClient.setInsecure();
+        }
+        client = &secureClient;
+    }
+}
+
+void DexcomWifiUplink::setAlwaysOn(bool on) { alwaysOn = on; }
+
+/**
+ * Joins straight on the known channel first, a full scan only when that fails.
+ */
+bool DexcomWifiUplink::radioOn()
+{
+    if (alwaysOn && WiFi.status() == WL_CONNECTED)
+        return true;
+    WiFi.mode(WIFI_STA);
+    DexcomEnergy::set(POWER_NETWORK, POWER_WIFI);
+    bool known = DexcomRetained::valid(joinSeal, JOIN_MAGIC, &joinPoint, sizeof(joinPoint));                            // False after a power on.
+    if (!(known && join(true)) && !join(false))
+    {
+        SerialPrintf(ERROR, "Wi-Fi uplink: could not join %s\n\r", ssid);
+        radioOff();
+        return false;
+    }
+    memset(&joinPoint, 0, sizeof(joinPoint));                                                                           // No stale padding under the CRC.
+    joinPoint.channel = WiFi.channel();
+    memcpy(joinPoint.bssid, WiFi.BSSID(), sizeof(joinPoint.bssid));
+    DexcomRetained::seal(&joinSeal, JOIN_MAGIC, &joinPoint, sizeof(joinPoint));
+
+    configTime(0, 0, WIFI_NTP_SERVER);
+    uint32_t start = millis();
+    while (DexcomPlatform::epochSeconds() == 0 && millis() - start < WIFI_NTP_TIMEOUT_MS)
+        delay(50);
+    return true;
+}
+
+void DexcomWifiUplink::radioOff()
+{
+    close();
+    if (alwaysOn)
+        return;
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+    DexcomEnergy::set(POWER_NETWORK, POWER_OFF);
+}
+
+bool DexcomWifiUplink::open()
+{
+    if (client->connected())
+        return true;
+    if (!client->connect(host, port))
+        return false;
+    client->setNoDelay(true);                                                                                           // A request leaves in one write, nothing to wait for.
+    return true;
+}
+
+bool DexcomWifiUplink::isOpen() { return client->connected(); }
+void DexcomWifiUplink::close() { client->stop(); }
+
+bool DexcomWifiUplink::write(const uint8_t* data, size_t length)
+{
+    if (client->write(data, length) == length)
+        return true;
+    close();
+    return false;
+}
+
+size_t DexcomWifiUplink::read(uint8_t* buffer, size_t max_length, uint32_t timeoutMs)
+{
+    uint32_t start = millis();
+    while (client->available() <= 0)
+    {
+        if (!client->connected() || millis() - start >= timeoutMs)
+            return 0;
+        delay(5);
+    }
+    int received = client->read(buffer, max_length);
+    return received > 0 ? (size_t)received : 0;
+}
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+bool DexcomWifiUplink::join(bool fast)
+{
+    if (fast)
+        WiFi.begin(ssid, password, joinPoint.channel, joinPoint.bssid);
+    else
+        WiFi.begin(ssid, password);
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        if (millis() - start >= (fast ? WIFI_FAST_JOIN_TIMEOUT_MS : WIFI_JOIN_TIMEOUT_MS))
+        {
+            WiFi.disconnect();
+            return false;
+        }
+        delay(20);
+    }
+    return true;
+}
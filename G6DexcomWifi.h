@@ -0,0 +1,50 @@
+/**
+ * Header File with the Wi-Fi uplink of the uploader
+ * The radio is only on for a burst: radioOn() joins the network, with the channel and access point of the last join
+ * from RTC memory it skips the scan, and starts SNTP, radioOff() switches the Wi-Fi off again.
+ * Port 443 goes through TLS, checked against the root certificate when one is given.
+ * Kept on, for the local server, radioOn() only joins when the station is not connected and radioOff() only closes
+ * the connection.
+ */
+
+#ifndef G6DEXCOMWIFI_H
+#define G6DEXCOMWIFI_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include "DexcomUplink.h"
+
+#define WIFI_JOIN_TIMEOUT_MS    8000
+#define WIFI_FAST_JOIN_TIMEOUT_MS 2000                                                                                  // Known channel and access point, gives up early when it moved.
+#define WIFI_NTP_TIMEOUT_MS     4000                                                                                    // Only waited for while the clock was never set.
+#define WIFI_NTP_SERVER         "pool.ntp.org"
+
+class DexcomWifiUplink : public DexcomUplink
+{
+    const char* ssid;
+    const char* password;
+    const char* host;
+    uint16_t port;
+    WiFiClient plainClient;
+    WiFiClientSecure secureClient;
+    WiFiClient* client;
+    bool alwaysOn;
+
+    public:
+        DexcomWifiUplink(const char* ssid, const char* password, const char* host, uint16_t port, const char* rootCa);
+        void setAlwaysOn(bool on);
+
+        bool radioOn();
+        void radioOff();
+        bool open();
+        bool isOpen();
+        void close();
+        bool write(const uint8_t* data, size_t length);
+        size_t read(uint8_t* buffer, size_t max_length, uint32_t timeoutMs);
+
+    private:
+        bool join(bool fast);
+};
+
+#endif /* G6DEXCOMWIFI_H */
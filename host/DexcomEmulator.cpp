@@ -0,0 +1,445 @@
+/*
+ * DexcomEmulator
+ */
+
+
+#include <string.h>
+#include "DexcomEmulator.h"
+#include "../DebugHelper.h"
+#include "../DexcomPlatform.h"
+#include "../G6DexcomAuth.h"
+
+
+DexcomEmulator::DexcomEmulator(const char* transmitterID, const DexcomEmulatorConfig &config)
+    : config(config), random(config.seed ? config.seed : 1), connected(false), bonded(false),
+      errorConnection(false), errorLastConnection(false), challenge(0),
+      activationTime(3*24*60*60), sequence(0), backfillRequests(0), historyCount(0),
+      jpake(JPAKE_ROLE_SERVER), exchangePhase(-1), exchangeReceived(0), key(NULL), sessions(0), dropped(0), disconnects(0)
+{
+    id.set(transmitterID);
+    if (config.pairingCode != NULL && id.setPairingCode(config.pairingCode) && id.isG7())
+        jpake.setPassword((const uint8_t*)id.pairingCode, PAIRING_CODE_LENGTH);
+    memset(&auth, 0, sizeof(auth));
+    memset(&control, 0, sizeof(control));
+    memset(&backfill, 0, sizeof(backfill));
+    for (int i = 0; i < EMULATOR_HISTORY; i++)                                                                          // A full day of history for the cold start backfill.
+        advance();
+}
+
+/**
+ * Next 5 minute reading, the glucose does a bounded random walk.
+ */
+void DexcomEmulator::advance()
+{
+    Reading reading;
+    uint16_t last = historyCount > 0 ? history[(historyCount - 1) % EMULATOR_HISTORY].glucose : 120;
+    int glucose = last + (int)(next() % 21) - 10;
+    if (glucose < 40) glucose = 40;
+    if (glucose > 400) glucose = 400;
+    activationTime += 5*60;
+    sequence++;
+    reading.dextime = activationTime;
+    reading.glucose = (uint16_t)glucose;
+    reading.trend = (int8_t)((glucose - last) / 5);                                                                     // mg/dl per minute * 10
+    history[historyCount % EMULATOR_HISTORY] = reading;
+    historyCount++;
+}
+
+bool DexcomEmulator::connect()
+{
+    errorConnection = false;
+    bonded = false;
+    memset(&auth, 0, sizeof(auth));
+    memset(&control, 0, sizeof(control));
+    memset(&backfill, 0, sizeof(backfill));
+    exchangePhase = -1;
+    key = id.isG7() ? NULL : id.key;
+    if (id.isG7())
+        jpake.prepare(jpakeRandom, this);
+    DexcomPlatform::delay(config.latencyMs);
+    connected = true;
+    sessions++;
+    return true;
+}
+
+bool DexcomEmulator::isConnected() { return connected; }
+bool DexcomEmulator::lastConnectionWasError() { return errorLastConnection; }
+
+bool DexcomEmulator::disconnect()
+{
+    SerialPrintln(DEBUG, "Initiating a disconnect.");
+    uint8_t disconnectTxMessage[1] = {0x09};
+    controlSend(disconnectTxMessage, 1);
+    if (connected)
+    {
+        DexcomPlatform::delay(config.latencyMs);                                                                        // The transmitter closes the link.
+        connected = false;
+        errorLastConnection = errorConnection;
+    }
+    return true;
+}
+
+void DexcomEmulator::fault(const char* message)
+{
+    errorConnection = true;
+    SerialPrintln(ERROR, message);
+    connected = false;
+    errorLastConnection = errorConnection;
+}
+
+bool DexcomEmulator::readDeviceInformations() { return connected; }
+void DexcomEmulator::prepareBond() {}
+
+/**
+ * Bonding finishes one response time after the bond request, a lost request stalls until the supervision timeout.
+ */
+bool DexcomEmulator::waitForBond()
+{
+    if (!connected)
+        return false;
+    DexcomPlatform::delay(config.latencyMs);
+    if (!bonded)
+    {
+        DexcomPlatform::delay(config.supervisionMs);
+        drop();
+    }
+    return connected && bonded;
+}
+
+bool DexcomEmulator::authSend(uint8_t* pData, size_t length)
+{
+    if (!connected)
+        return false;
+    if (chance(config.disconnectPermille))
+    {
+        drop();
+        return false;
+    }
+    handleAuth(pData, length);
+    return true;
+}
+
+size_t DexcomEmulator::authReceive(uint8_t* pData, size_t max_length) { return receive(auth, pData, max_length); }
+bool DexcomEmulator::controlRegister() { return connected; }
+
+bool DexcomEmulator::controlSend(uint8_t* pData, size_t length)
+{
+    if (!connected)
+        return false;
+    if (length > 0 && pData[0] != 0x09 && chance(config.disconnectPermille))
+    {
+        drop();
+        return false;
+    }
+    handleControl(pData, length);
+    return true;
+}
+
+size_t DexcomEmulator::controlReceive(uint8_t* pData, size_t max_length) { return receive(control, pData, max_length); }
+size_t DexcomEmulator::controlPoll(uint8_t* pData, size_t max_length) { return poll(control, pData, max_length); }
+bool DexcomEmulator::backfillRegister() { return connected; }
+size_t DexcomEmulator::backfillReceive(uint8_t* pData, size_t max_length) { return receive(backfill, pData, max_length); }
+
+size_t DexcomEmulator::backfillPoll(uint8_t* pData, size_t max_length) { return poll(backfill, pData, max_length); }
+
+
+
+/**
+ * ----------------------------------------------------------------------------------------------------------------
+ * PRIVATE
+ * ----------------------------------------------------------------------------------------------------------------
+ */
+
+/**
+ * xorshift32, a fixed seed makes a soak run repeatable.
+ */
+uint32_t DexcomEmulator::next()
+{
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return random;
+}
+
+bool DexcomEmulator::chance(uint16_t permille) { return permille > 0 && next() % 1000 < permille; }
+
+/**
+ * The transmitter dropped the link, same bookkeeping as DexcomConnection::onDisconnect.
+ */
+void DexcomEmulator::drop()
+{
+    if (connected)
+        disconnects++;
+    connected = false;
+    errorLastConnection = errorConnection;
+}
+
+/**
+ * Queue a packet for delivery after the configured latency and jitter, or lose it.
+ * Packets of one characteristic never overtake each other.
+ */
+void DexcomEmulator::reply(Queue &queue, const uint8_t* pData, size_t length)
+{
+    if (chance(config.lossPermille))
+    {
+        dropped++;
+        return;
+    }
+    if (queue.count == EMULATOR_QUEUE || length > EMULATOR_PACKET)
+        return;
+    uint32_t due = DexcomPlatform::millis() + config.latencyMs + (config.jitterMs ? next() % (config.jitterMs + 1) : 0);
+    if (queue.count > 0)
+    {
+        uint32_t last = queue.packets[(queue.head + queue.count - 1) % EMULATOR_QUEUE].due;
+        if ((int32_t)(due - last) < 0) due = last;
+    }
+    Packet &packet = queue.packets[(queue.head + queue.count) % EMULATOR_QUEUE];
+    packet.due = due;
+    packet.length = (uint8_t)length;
+    memcpy(packet.data, pData, length);
+    queue.count++;
+}
+
+/**
+ * Blocks like the BLE wait functions: until the packet is due, or until the transmitter gives up on a silent link.
+ */
+size_t DexcomEmulator::receive(Queue &queue, uint8_t* pData, size_t max_length)
+{
+    if (!connected)
+        return 0;
+    if (queue.count == 0)
+    {
+        DexcomPlatform::delay(config.supervisionMs);
+        drop();
+        return 0;
+    }
+    Packet &packet = queue.packets[queue.head];
+    int32_t wait = (int32_t)(packet.due - DexcomPlatform::millis());
+    if (wait > 0)
+        DexcomPlatform::delay(wait);
+    size_t length = packet.length < max_length ? packet.length : max_length;
+    memcpy(pData, packet.data, length);
+    queue.head = (queue.head + 1) % EMULATOR_QUEUE;
+    queue.count--;
+    return length;
+}
+
+/**
+ * Like receive, but only hands out a packet that is already due.
+ */
+size_t DexcomEmulator::poll(Queue &queue, uint8_t* pData, size_t max_length)
+{
+    if (!connected || queue.count == 0 || (int32_t)(queue.packets[queue.head].due - DexcomPlatform::millis()) > 0)
+        return 0;
+    return receive(queue, pData, max_length);
+}
+
+void DexcomEmulator::handleAuth(const uint8_t* pData, size_t length)
+{
+    if (exchangePhase >= 0 && length == JPAKE_EXCHANGE_CHUNK)                                                           // Chunk of the client's J-PAKE packet.
+    {
+        memcpy(&exchange[exchangePhase == 1 ? 1 : 0][exchangeReceived], pData, length);
+        exchangeReceived += length;
+        if (exchangeReceived == JPAKE_PACKET_SIZE)
+            handleExchange();
+    }
+    else if (length == 2 && pData[0] == JPAKE_EXCHANGE_OPCODE && pData[1] < 3 && id.isG7())
+    {
+        exchangePhase = pData[1];
+        exchangeReceived = 0;
+    }
+    else if (length == 10 && pData[0] == 0x01 && key != NULL)                                                           // AuthRequestTxMessage, a G7 ignores it before the exchange.
+    {
+        uint64_t token;
+        memcpy(&token, &pData[1], 8);
+        uint64_t tokenHash = DexcomAuth::calculateHash(token, key);
+        challenge = ((uint64_t)next() << 32) | next();
+        uint8_t authChallenge[17] = {0x03};
+        memcpy(&authChallenge[1], &tokenHash, 8);
+        memcpy(&authChallenge[9], &challenge, 8);
+        reply(auth, authChallenge, sizeof(authChallenge));
+    }
+    else if (length == 9 && pData[0] == 0x04 && key != NULL)                                                           // AuthChallengeTxMessage
+    {
+        uint64_t hash;
+        memcpy(&hash, &pData[1], 8);
+        bool authenticated = hash == DexcomAuth::calculateHash(challenge, key);
+        uint8_t authStatus[3] = {0x05, (uint8_t)(authenticated ? 0x01 : 0x02), (uint8_t)(config.requestBond ? 0x02 : 0x01)};
+        reply(auth, authStatus, sizeof(authStatus));
+    }
+    else if (length == 1 && pData[0] == 0x07)                                                                           // BondRequestTxMessage, the keep alive needs no answer.
+        bonded = !chance(config.lossPermille);
+}
+
+/**
+ * Phase 0 answers with our first round one packet, phase 1 checks the client's round one and answers with the second,
+ * phase 2 answers with round two and agrees on the key. A failed proof is never answered, like a wrong ID on the G6.
+ */
+void DexcomEmulator::handleExchange()
+{
+    int phase = exchangePhase;
+    exchangePhase = -1;
+    if (phase == 0)
+        replyExchange(jpake.roundOnePacket(0));
+    else if (phase == 1 && jpake.readRoundOne(exchange[0], exchange[1]))
+        replyExchange(jpake.roundOnePacket(1));
+    else if (phase == 2)
+    {
+        uint8_t packet[JPAKE_PACKET_SIZE];
+        if (jpake.writeRoundTwo(packet, jpakeRandom, this) && jpake.readRoundTwo(exchange[0]))
+        {
+            key = jpake.sessionKey();
+            replyExchange(packet);
+        }
+    }
+}
+
+void DexcomEmulator::replyExchange(const uint8_t* packet)
+{
+    for (size_t offset = 0; offset < JPAKE_PACKET_SIZE; offset += JPAKE_EXCHANGE_CHUNK)
+        reply(auth, &packet[offset], JPAKE_EXCHANGE_CHUNK);
+}
+
+/**
+ * The server secrets come from the emulator's own generator, a fixed seed repeats the whole handshake.
+ */
+int DexcomEmulator::jpakeRandom(void* context, unsigned char* output, size_t length)
+{
+    DexcomEmulator* emulator = (DexcomEmulator*)context;
+    for (size_t i = 0; i < length; i++)
+        output[i] = (uint8_t)emulator->next();
+    return 0;
+}
+
+void DexcomEmulator::handleControl(const uint8_t* pData, size_t length)
+{
+    if (length == 0)
+        return;
+    const Reading &latest = history[(historyCount - 1) % EMULATOR_HISTORY];
+    uint32_t currentTime = activationTime + 30;                                                                         // The client connects shortly after the reading.
+    uint8_t message[20];
+    memset(message, 0, sizeof(message));
+    message[0] = pData[0] + 1;                                                                                          // Every response opcode is the request + 1.
+
+    switch (pData[0])
+    {
+        case 0x24:                                                                                                      // Time
+        {
+            uint32_t sessionStart = activationTime - 2*24*60*60;
+            memcpy(&message[2], &currentTime, 4);
+            memcpy(&message[6], &sessionStart, 4);
+            memset(&message[10], 0xff, 4);
+            replyWithCrc(message, 16);
+            break;
+        }
+        case 0x22:                                                                                                      // Battery, G6 layout
+        {
+            uint16_t voltageA = 310, voltageB = 298, resistance = 1200;
+            memcpy(&message[2], &voltageA, 2);
+            memcpy(&message[4], &voltageB, 2);
+            memcpy(&message[6], &resistance, 2);
+            message[8] = 40;
+            message[9] = 34;
+            replyWithCrc(message, 12);
+            break;
+        }
+        case 0x30:                                                                                                      // Glucose, G5 opcode
+        case 0x4e:                                                                                                      // Glucose, G6 opcode
+        {
+            memcpy(&message[2], &sequence, 4);
+            memcpy(&message[6], &latest.dextime, 4);
+            memcpy(&message[10], &latest.glucose, 2);
+            message[12] = config.sessionState;
+            message[13] = (uint8_t)latest.trend;
+            replyWithCrc(message, 16);
+            break;
+        }
+        case 0x2e:                                                                                                      // Sensor raw data
+        {
+            uint32_t unfiltered = latest.glucose * 1000u, filtered = latest.glucose * 990u;
+            memcpy(&message[2], &latest.dextime, 4);
+            memcpy(&message[6], &unfiltered, 4);
+            memcpy(&message[10], &filtered, 4);
+            replyWithCrc(message, 16);
+            break;
+        }
+        case 0x32:                                                                                                      // Last calibration
+        {
+            uint16_t glucose = 110;
+            uint32_t timestamp = activationTime - 12*60*60;
+            memcpy(&message[11], &glucose, 2);
+            memcpy(&message[13], &timestamp, 4);
+            replyWithCrc(message, 19);
+            break;
+        }
+        case 0x50:                                                                                                      // Backfill request
+        {
+            uint32_t start, end;
+            if (length < 12)
+                return;
+            memcpy(&start, &pData[4], 4);
+            memcpy(&end, &pData[8], 4);
+            streamBackfill(start, end);
+            backfillRequests++;
+            message[2] = 1;                                                                                             // Backfill status
+            message[3] = (uint8_t)backfillRequests;                                                                     // Identifier
+            memcpy(&message[4], &start, 4);
+            memcpy(&message[8], &end, 4);
+            replyWithCrc(message, 20);
+            break;
+        }
+        case 0x09:                                                                                                      // Disconnect, handled by the caller.
+            break;
+        default:
+            SerialPrintf(ERROR, "Emulator - unknown control opcode 0x%02x\n", pData[0]);
+            break;
+    }
+}
+
+/**
+ * Sends the 8 byte records of all readings in [start, end] on the backfill characteristic,
+ * packed like the transmitter: sequence, identifier and on the first packet a 4 byte header.
+ */
+void DexcomEmulator::streamBackfill(uint32_t start, uint32_t end)
+{
+    uint8_t packet[EMULATOR_PACKET] = {0};
+    size_t fill = 0;
+    uint8_t sequenceNumber = 1;
+    size_t first = historyCount > EMULATOR_HISTORY ? historyCount - EMULATOR_HISTORY : 0;
+
+    packet[fill++] = sequenceNumber;
+    packet[fill++] = (uint8_t)(backfillRequests + 1);
+    memcpy(&packet[fill], &backfillRequests, 2);
+    fill += 4;
+    for (size_t i = first; i < historyCount; i++)
+    {
+        const Reading &reading = history[i % EMULATOR_HISTORY];
+        if (reading.dextime < start || reading.dextime > end)
+            continue;
+        uint8_t record[8];
+        memcpy(&record[0], &reading.dextime, 4);
+        memcpy(&record[4], &reading.glucose, 2);
+        record[6] = config.sessionState;
+        record[7] = (uint8_t)reading.trend;
+        for (size_t j = 0; j < sizeof(record); j++)                                                                     // Records span packet boundaries.
+        {
+            if (fill == EMULATOR_PACKET)
+            {
+                reply(backfill, packet, fill);
+                fill = 0;
+                packet[fill++] = ++sequenceNumber;
+                packet[fill++] = (uint8_t)(backfillRequests + 1);
+            }
+            packet[fill++] = record[j];
+        }
+    }
+    if (fill > 2)
+        reply(backfill, packet, fill);
+}
+
+void DexcomEmulator::replyWithCrc(uint8_t* message, size_t length)
+{
+    uint16_t crc = DexcomPlatform::crc16Xmodem(message, length - 2);
+    memcpy(&message[length - 2], &crc, 2);
+    reply(control, message, length);
+}
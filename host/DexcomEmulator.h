@@ -0,0 +1,120 @@
+/**
+ * Header File with the software G6 transmitter used for soak and latency testing
+ * Implements the GATT behavior the client sees as an in-process DexcomTransport:
+ * the AES challenge / response, the bond request, the control opcodes and the backfill stream.
+ * With a pairing code it is a G7 / ONE+ and plays the server side of the EC J-PAKE exchange before the challenge.
+ * Latency, jitter, packet loss and disconnects in the middle of a session are configurable.
+ */
+
+#ifndef DEXCOMEMULATOR_H
+#define DEXCOMEMULATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../DexcomTransport.h"
+#include "../DexcomTransmitterId.h"
+#include "../DexcomJpake.h"
+
+#define EMULATOR_HISTORY        288                                                                                     // 24 h of readings available for backfill.
+#define EMULATOR_QUEUE          192                                                                                     // Pending packets per characteristic, a whole 24 h backfill stream fits.
+#define EMULATOR_PACKET         20                                                                                      // Payload of one notification / indication.
+
+typedef struct
+{
+    uint32_t latencyMs;             // Delay of every response.
+    uint32_t jitterMs;              // Uniform extra delay 0..jitterMs.
+    uint16_t lossPermille;          // Chance that a response packet is never delivered.
+    uint16_t disconnectPermille;    // Chance per request that the transmitter drops the link.
+    uint32_t supervisionMs;         // The transmitter drops a silent link after this long, like the real one does.
+    bool requestBond;               // Ask for a bond in the auth status.
+    uint8_t sessionState;           // Glucose state byte, 0x06 is ok.
+    uint32_t seed;
+    const char* pairingCode;        // G7 / ONE+ when set, may differ from the client's to test a wrong code.
+} DexcomEmulatorConfig;
+
+class DexcomEmulator : public DexcomTransport
+{
+    struct Packet
+    {
+        uint32_t due;                                                                                                   // Platform millis when the packet is delivered.
+        uint8_t length;
+        uint8_t data[EMULATOR_PACKET];
+    };
+    struct Queue
+    {
+        Packet packets[EMULATOR_QUEUE];
+        size_t head;
+        size_t count;
+    };
+    struct Reading
+    {
+        uint32_t dextime;
+        uint16_t glucose;
+        int8_t trend;
+    };
+
+    DexcomEmulatorConfig config;
+    DexcomTransmitterId id;
+    uint32_t random;
+    bool connected;
+    bool bonded;
+    bool errorConnection;
+    bool errorLastConnection;
+    uint64_t challenge;
+    uint32_t activationTime;                                                                                           // dextime of the newest reading.
+    uint32_t sequence;
+    uint16_t backfillRequests;
+    Reading history[EMULATOR_HISTORY];
+    size_t historyCount;
+    Queue auth, control, backfill;
+    DexcomJpake jpake;                                                                                                  // Server side of the G7 exchange.
+    uint8_t exchange[2][JPAKE_PACKET_SIZE];                                                                             // Client packets of the current phase.
+    int exchangePhase;                                                                                                  // -1 outside of the exchange.
+    size_t exchangeReceived;
+    const uint8_t* key;                                                                                                 // Challenge key, the ID key or the J-PAKE key once agreed.
+
+    public:
+        uint32_t sessions;                                                                                              // Counters for the soak report.
+        uint32_t dropped;
+        uint32_t disconnects;
+
+        DexcomEmulator(const char* transmitterID, const DexcomEmulatorConfig &config);
+        void advance();                                                                                                 // Moves the transmitter to its next 5 minute reading.
+
+        bool connect();
+        bool isConnected();
+        bool disconnect();
+        void fault(const char* message);
+        bool lastConnectionWasError();
+
+        bool readDeviceInformations();
+        void prepareBond();
+        bool waitForBond();
+
+        bool authSend(uint8_t* pData, size_t length);
+        size_t authReceive(uint8_t* pData, size_t max_length);
+        bool controlRegister();
+        bool controlSend(uint8_t* pData, size_t length);
+        size_t controlReceive(uint8_t* pData, size_t max_length);
+        size_t controlPoll(uint8_t* pData, size_t max_length);
+        bool backfillRegister();
+        size_t backfillReceive(uint8_t* pData, size_t max_length);
+        size_t backfillPoll(uint8_t* pData, size_t max_length);
+
+    private:
+        uint32_t next();
+        bool chance(uint16_t permille);
+        void drop();
+        void reply(Queue &queue, const uint8_t* pData, size_t length);
+        size_t receive(Queue &queue, uint8_t* pData, size_t max_length);
+        size_t poll(Queue &queue, uint8_t* pData, size_t max_length);
+        void handleAuth(const uint8_t* pData, size_t length);
+        void handleExchange();
+        void replyExchange(const uint8_t* packet);
+        static int jpakeRandom(void* context, unsigned char* output, size_t length);
+        void handleControl(const uint8_t* pData, size_t length);
+        void streamBackfill(uint32_t start, uint32_t end);
+        void replyWithCrc(uint8_t* message, size_t length);
+};
+
+#endif /* DEXCOMEMULATOR_H */
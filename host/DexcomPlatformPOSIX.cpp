@@ -0,0 +1,249 @@
+/*
+ * DexcomPlatformPOSIX
+ *
+ * Linux implementation of the platform layer for the host build.
+ * Storage is a small "key=value" text file, its path can be set with FLYING_CGM_STORAGE.
+ * The history region is a file of HISTORY_FILE_SIZE bytes, its path can be set with FLYING_CGM_HISTORY.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include "../DexcomPlatform.h"
+
+
+#define STORAGE_MAX_KEYS 32
+#define STORAGE_KEY_LEN  16
+#define HISTORY_FILE_SIZE (64 * HISTORY_SECTOR_SIZE)
+
+struct StorageEntry
+{
+    char key[STORAGE_KEY_LEN];
+    int value;
+};
+
+static StorageEntry storage[STORAGE_MAX_KEYS];
+static int storageCount = -1;                                                                                           // -1 until the file was loaded.
+
+static const char* storagePath()
+{
+    const char* path = getenv("FLYING_CGM_STORAGE");
+    return path != NULL ? path : "flying-cgm.nvs";
+}
+
+static void storageLoad()
+{
+    if (storageCount >= 0)
+        return;
+    storageCount = 0;
+    FILE* file = fopen(storagePath(), "r");
+    if (file == NULL)
+        return;
+    char line[64];
+    while (storageCount < STORAGE_MAX_KEYS && fgets(line, sizeof(line), file) != NULL)
+    {
+        char* separator = strchr(line, '=');
+        if (separator == NULL || separator - line >= STORAGE_KEY_LEN)
+            continue;
+        *separator = 0;
+        strcpy(storage[storageCount].key, line);
+        storage[storageCount].value = atoi(separator + 1);
+        storageCount++;
+    }
+    fclose(file);
+}
+
+static void storageSave()
+{
+    FILE* file = fopen(storagePath(), "w");
+    if (file == NULL)
+        return;
+    for (int i = 0; i < storageCount; i++)
+        fprintf(file, "%s=%d\n", storage[i].key, storage[i].value);
+    fclose(file);
+}
+
+static StorageEntry* storageFind(const char* key)
+{
+    storageLoad();
+    for (int i = 0; i < storageCount; i++)
+    {
+        if (strcmp(storage[i].key, key) == 0)
+            return &storage[i];
+    }
+    return NULL;
+}
+
+uint32_t DexcomPlatform::millis() { return (uint32_t)(micros() / 1000); }
+
+uint64_t DexcomPlatform::micros()
+{
+    static uint64_t start = 0;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if (start == 0)
+        start = us;
+    return us - start;
+}
+
+uint32_t DexcomPlatform::epochSeconds() { return (uint32_t)time(NULL); }
+
+void DexcomPlatform::delay(uint32_t ms)
+{
+    timespec wait = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+    while (nanosleep(&wait, &wait) != 0);                                                                               // Continue after a signal interrupted the sleep.
+}
+
+/**
+ * No portable cycle counter, nanoseconds of the thread CPU clock stand in for it.
+ */
+uint32_t DexcomPlatform::cycleCount()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+
+void DexcomPlatform::log(const char* text)
+{
+    fputs(text, stdout);
+}
+
+bool DexcomPlatform::storageHasKey(const char* key)
+{
+    return storageFind(key) != NULL;
+}
+
+int DexcomPlatform::storageGetInt(const char* key, int defaultValue)
+{
+    StorageEntry* entry = storageFind(key);
+    return entry != NULL ? entry->value : defaultValue;
+}
+
+void DexcomPlatform::storagePutInt(const char* key, int value)
+{
+    StorageEntry* entry = storageFind(key);
+    if (entry == NULL)
+    {
+        if (storageCount >= STORAGE_MAX_KEYS || strlen(key) >= STORAGE_KEY_LEN)
+            return;
+        entry = &storage[storageCount++];
+        strcpy(entry->key, key);
+    }
+    entry->value = value;
+    storageSave();
+}
+
+/**
+ * Opens the history file, a new file is created erased (all 0xff) like a fresh partition.
+ */
+static FILE* historyFile()
+{
+    static FILE* file = NULL;
+    if (file != NULL)
+        return file;
+    const char* path = getenv("FLYING_CGM_HISTORY");
+    if (path == NULL) path = "flying-cgm.history";
+    file = fopen(path, "r+b");
+    if (file == NULL && (file = fopen(path, "w+b")) != NULL)
+    {
+        uint8_t erased[HISTORY_SECTOR_SIZE];
+        memset(erased, 0xff, sizeof(erased));
+        for (size_t i = 0; i < HISTORY_FILE_SIZE / HISTORY_SECTOR_SIZE; i++)
+            fwrite(erased, 1, sizeof(erased), file);
+        fflush(file);
+    }
+    return file;
+}
+
+size_t DexcomPlatform::historySize() { return historyFile() != NULL ? HISTORY_FILE_SIZE : 0; }
+
+bool DexcomPlatform::historyRead(size_t offset, void* buffer, size_t length)
+{
+    FILE* file = historyFile();
+    return file != NULL && offset + length <= HISTORY_FILE_SIZE &&
+           fseek(file, offset, SEEK_SET) == 0 && fread(buffer, 1, length, file) == length;
+}
+
+bool DexcomPlatform::historyWrite(size_t offset, const void* data, size_t length)
+{
+    uint8_t merged[HISTORY_SECTOR_SIZE];
+    if (length > sizeof(merged) || !historyRead(offset, merged, length))
+        return false;
+    for (size_t i = 0; i < length; i++)
+        merged[i] &= ((const uint8_t*)data)[i];                                                                         // Writes can only clear bits.
+    FILE* file = historyFile();
+    return fseek(file, offset, SEEK_SET) == 0 && fwrite(merged, 1, length, file) == length && fflush(file) == 0;
+}
+
+bool DexcomPlatform::historyErase(size_t offset, size_t length)
+{
+    FILE* file = historyFile();
+    if (file == NULL || offset % HISTORY_SECTOR_SIZE != 0 || length % HISTORY_SECTOR_SIZE != 0 || offset + length > HISTORY_FILE_SIZE)
+        return false;
+    uint8_t erased[HISTORY_SECTOR_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    if (fseek(file, offset, SEEK_SET) != 0)
+        return false;
+    for (size_t done = 0; done < length; done += HISTORY_SECTOR_SIZE)
+    {
+        if (fwrite(erased, 1, sizeof(erased), file) != sizeof(erased))
+            return false;
+    }
+    return fflush(file) == 0;
+}
+
+/**
+ * Shared mapping of the file, writes go through the same page cache and show up in the view after the fflush.
+ */
+const uint8_t* DexcomPlatform::historyMap()
+{
+    static void* mapped = MAP_FAILED;
+    FILE* file = historyFile();
+    if (mapped == MAP_FAILED && file != NULL)
+        mapped = mmap(NULL, HISTORY_FILE_SIZE, PROT_READ, MAP_SHARED, fileno(file), 0);
+    return mapped != MAP_FAILED ? (const uint8_t*)mapped : NULL;
+}
+
+/**
+ * glibc has no largest free block, the free space inside the arena stands in for it.
+ */
+void DexcomPlatform::heapInfo(DexcomHeapInfo* info)
+{
+    static uint32_t minFree = UINT32_MAX;
+    struct mallinfo2 heap = mallinfo2();
+    info->freeBytes = (uint32_t)heap.fordblks;
+    info->largestBlock = (uint32_t)heap.fordblks;
+    if (info->freeBytes < minFree) minFree = info->freeBytes;
+    info->minFreeBytes = minFree;
+}
+
+void DexcomPlatform::randomBytes(uint8_t* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t read = getrandom(buffer, length, 0);
+        if (read <= 0)
+            continue;
+        buffer += read;
+        length -= read;
+    }
+}
+
+uint16_t DexcomPlatform::crc16Xmodem(const uint8_t* data, size_t length)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
@@ -0,0 +1,201 @@
+/*
+ * DexcomSocketTransport
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "DexcomSocketTransport.h"
+#include "../DebugHelper.h"
+#include "../DexcomPlatform.h"
+
+
+DexcomSocketTransport::DexcomSocketTransport(const char* host, uint16_t port)
+    : host(host), port(port), fd(-1), errorConnection(false), errorLastConnection(false), bonded(false)
+{
+}
+
+DexcomSocketTransport::~DexcomSocketTransport()
+{
+    close();
+}
+
+bool DexcomSocketTransport::connect()
+{
+    errorConnection = false;
+    bonded = false;
+    for (int channel = 0; channel <= SOCKET_CH_BACKFILL; channel++)
+        rings[channel].clear();
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    if (getaddrinfo(host, service, &hints, &result) != 0)
+        return false;
+    for (addrinfo* entry = result; entry != NULL && fd < 0; entry = entry->ai_next)
+    {
+        fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+        if (fd >= 0 && ::connect(fd, entry->ai_addr, entry->ai_addrlen) != 0)
+            close();
+    }
+    freeaddrinfo(result);
+    SerialPrintf(DEBUG, "Socket transport %s to %s:%u\n", fd >= 0 ? "connected" : "failed to connect", host, port);
+    return fd >= 0;
+}
+
+bool DexcomSocketTransport::isConnected() { return fd >= 0; }
+bool DexcomSocketTransport::lastConnectionWasError() { return errorLastConnection; }
+
+bool DexcomSocketTransport::disconnect()
+{
+    SerialPrintln(DEBUG, "Initiating a disconnect.");
+    uint8_t disconnectTxMessage[1] = {0x09};
+    controlSend(disconnectTxMessage, 1);
+    while (isConnected() && pump(SOCKET_RECEIVE_TIMEOUT_MS));                                                           // Wait until the peer closed the link.
+    close();
+    return true;
+}
+
+void DexcomSocketTransport::fault(const char* message)
+{
+    errorConnection = true;
+    SerialPrintln(ERROR, message);
+    close();
+}
+
+/**
+ * The bridge has no device information service, only the protocol characteristics.
+ */
+bool DexcomSocketTransport::readDeviceInformations() { return true; }
+
+void DexcomSocketTransport::prepareBond() {}
+
+bool DexcomSocketTransport::waitForBond()
+{
+    while (!bonded && isConnected() && pump(SOCKET_RECEIVE_TIMEOUT_MS));
+    return bonded;
+}
+
+bool DexcomSocketTransport::authSend(uint8_t* pData, size_t length)
+{
+    rings[SOCKET_CH_AUTH].clear();
+    return send(SOCKET_CH_AUTH, pData, length);
+}
+
+size_t DexcomSocketTransport::authReceive(uint8_t* pData, size_t max_length) { return receive(SOCKET_CH_AUTH, pData, max_length); }
+bool DexcomSocketTransport::controlRegister() { return isConnected(); }
+
+bool DexcomSocketTransport::controlSend(uint8_t* pData, size_t length)
+{
+    rings[SOCKET_CH_CONTROL].clear();
+    return send(SOCKET_CH_CONTROL, pData, length);
+}
+
+size_t DexcomSocketTransport::controlReceive(uint8_t* pData, size_t max_length) { return receive(SOCKET_CH_CONTROL, pData, max_length); }
+bool DexcomSocketTransport::backfillRegister() { return isConnected(); }
+size_t DexcomSocketTransport::backfillReceive(uint8_t* pData, size_t max_length) { return receive(SOCKET_CH_BACKFILL, pData, max_length); }
+
+size_t DexcomSocketTransport::backfillPoll(uint8_t* pData, size_t max_length) { return poll(SOCKET_CH_BACKFILL, pData, max_length); }
+size_t DexcomSocketTransport::controlPoll(uint8_t* pData, size_t max_length) { return poll(SOCKET_CH_CONTROL, pData, max_length); }
+
+
+/////////////////////////////////////
+//
+//      PRIVATE
+//
+/////////////////////////////////////
+
+
+bool DexcomSocketTransport::send(uint8_t channel, const uint8_t* pData, size_t length)
+{
+    if (fd < 0 || length > SOCKET_MAX_PAYLOAD)
+        return false;
+    uint8_t frame[2 + SOCKET_MAX_PAYLOAD];
+    frame[0] = channel;
+    frame[1] = (uint8_t)length;
+    memcpy(&frame[2], pData, length);
+    return ::send(fd, frame, length + 2, MSG_NOSIGNAL) == (ssize_t)(length + 2);
+}
+
+/**
+ * Reads one frame into its channel ring. Returns false on timeout or when the link closed.
+ */
+bool DexcomSocketTransport::pump(uint32_t timeoutMs)
+{
+    pollfd waitFd = { fd, POLLIN, 0 };
+    if (fd < 0 || ::poll(&waitFd, 1, timeoutMs) <= 0)
+        return false;
+
+    uint8_t header[2];
+    if (recv(fd, header, 2, MSG_WAITALL) != 2 || header[0] > SOCKET_CH_BACKFILL)
+    {
+        close();
+        return false;
+    }
+    uint8_t buffer[SOCKET_MAX_PAYLOAD];
+    if (header[1] > 0 && recv(fd, buffer, header[1], MSG_WAITALL) != header[1])
+    {
+        close();
+        return false;
+    }
+
+    if (header[0] == SOCKET_CH_LINK)
+    {
+        if (header[1] > 0 && buffer[0] == SOCKET_LINK_BONDED) bonded = true;
+        if (header[1] > 0 && buffer[0] == SOCKET_LINK_DISCONNECTED) close();
+    }
+    else if (!rings[header[0]].push(buffer, header[1], DexcomPlatform::millis()))
+        SerialPrintf(ERROR, "Socket transport - channel %u ring full, value dropped\n", header[0]);
+    return true;
+}
+
+/**
+ * Barrier to wait until a new value arrived on the channel, like the notify callbacks on the board.
+ */
+size_t DexcomSocketTransport::receive(uint8_t channel, uint8_t* pData, size_t max_length)
+{
+    DexcomPacket packet;
+    while (isConnected())
+    {
+        if (rings[channel].pop(&packet))
+        {
+            size_t returnSize = packet.length > max_length ? max_length : packet.length;
+            memcpy(pData, packet.data, returnSize);
+            return returnSize;
+        }
+        if (!pump(SOCKET_RECEIVE_TIMEOUT_MS))
+            break;
+    }
+    fault("Error timeout in socket receive");
+    return 0;
+}
+
+/**
+ * Reads what the socket already holds, then hands out the oldest value of the channel without waiting.
+ */
+size_t DexcomSocketTransport::poll(uint8_t channel, uint8_t* pData, size_t max_length)
+{
+    while (isConnected() && pump(0));
+    DexcomPacket packet;
+    if (!rings[channel].pop(&packet))
+        return 0;
+    size_t returnSize = packet.length > max_length ? max_length : packet.length;
+    memcpy(pData, packet.data, returnSize);
+    return returnSize;
+}
+
+void DexcomSocketTransport::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+        errorLastConnection = errorConnection;
+    }
+}
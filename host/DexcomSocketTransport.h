@@ -0,0 +1,68 @@
+/**
+ * Header File with the TCP transport of the host build
+ * Carries the three GATT characteristics over one TCP stream to a bridge or an emulator.
+ * Each frame is: channel (1 byte), payload length (1 byte), payload.
+ */
+
+#ifndef DEXCOMSOCKETTRANSPORT_H
+#define DEXCOMSOCKETTRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../DexcomTransport.h"
+#include "../DexcomPacketRing.h"
+
+#define SOCKET_CH_LINK      0                                                                                           // Link events from the peer, payload is one of the SOCKET_LINK_ codes.
+#define SOCKET_CH_AUTH      1
+#define SOCKET_CH_CONTROL   2
+#define SOCKET_CH_BACKFILL  3
+
+#define SOCKET_LINK_BONDED        1
+#define SOCKET_LINK_DISCONNECTED  2
+
+#define SOCKET_RECEIVE_TIMEOUT_MS 10000                                                                                 // A silent peer is treated like a dropped link.
+#define SOCKET_MAX_PAYLOAD        255
+
+class DexcomSocketTransport : public DexcomTransport
+{
+    const char* host;
+    uint16_t port;
+    int fd;
+    bool errorConnection;
+    bool errorLastConnection;
+    bool bonded;
+    DexcomPacketRing rings[4];                                                                                          // Values per channel in arrival order, like the characteristic rings on the board.
+
+    public:
+        DexcomSocketTransport(const char* host, uint16_t port);
+        ~DexcomSocketTransport();
+
+        bool connect();
+        bool isConnected();
+        bool disconnect();
+        void fault(const char* message);
+        bool lastConnectionWasError();
+
+        bool readDeviceInformations();
+        void prepareBond();
+        bool waitForBond();
+
+        bool authSend(uint8_t* pData, size_t length);
+        size_t authReceive(uint8_t* pData, size_t max_length);
+        bool controlRegister();
+        bool controlSend(uint8_t* pData, size_t length);
+        size_t controlReceive(uint8_t* pData, size_t max_length);
+        size_t controlPoll(uint8_t* pData, size_t max_length);
+        bool backfillRegister();
+        size_t backfillReceive(uint8_t* pData, size_t max_length);
+        size_t backfillPoll(uint8_t* pData, size_t max_length);
+
+    private:
+        bool send(uint8_t channel, const uint8_t* pData, size_t length);
+        bool pump(uint32_t timeoutMs);
+        size_t receive(uint8_t channel, uint8_t* pData, size_t max_length);
+        size_t poll(uint8_t channel, uint8_t* pData, size_t max_length);
+        void close();
+};
+
+#endif /* DEXCOMSOCKETTRANSPORT_H */
@@ -0,0 +1,103 @@
+/*
+ * DexcomSocketUplink
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "DexcomSocketUplink.h"
+#include "../DexcomPlatform.h"
+
+
+DexcomSocketUplink::DexcomSocketUplink(const char* host, uint16_t port, uint32_t joinMs)
+    : host(host), port(port), joinMs(joinMs), fd(-1), radio(false), reachable(true), connections(0)
+{
+}
+
+DexcomSocketUplink::~DexcomSocketUplink()
+{
+    close();
+}
+
+bool DexcomSocketUplink::radioOn()
+{
+    DexcomPlatform::delay(joinMs);
+    radio = reachable;
+    return radio;
+}
+
+void DexcomSocketUplink::radioOff()
+{
+    close();
+    radio = false;
+}
+
+bool DexcomSocketUplink::open()
+{
+    if (fd >= 0)
+        return true;
+    if (!radio)
+        return false;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    if (getaddrinfo(host, service, &hints, &result) != 0)
+        return false;
+    for (addrinfo* entry = result; entry != NULL && fd < 0; entry = entry->ai_next)
+    {
+        fd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+        if (fd >= 0 && ::connect(fd, entry->ai_addr, entry->ai_addrlen) != 0)
+            close();
+    }
+    freeaddrinfo(result);
+    if (fd >= 0)
+        connections++;
+    return fd >= 0;
+}
+
+bool DexcomSocketUplink::isOpen() { return fd >= 0; }
+
+void DexcomSocketUplink::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool DexcomSocketUplink::write(const uint8_t* data, size_t length)
+{
+    while (fd >= 0 && length > 0)
+    {
+        ssize_t sent = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0)
+            close();
+        else
+        {
+            data += sent;
+            length -= sent;
+        }
+    }
+    return length == 0;
+}
+
+size_t DexcomSocketUplink::read(uint8_t* buffer, size_t max_length, uint32_t timeoutMs)
+{
+    pollfd waitFd = { fd, POLLIN, 0 };
+    if (fd < 0 || ::poll(&waitFd, 1, timeoutMs) <= 0)
+        return 0;
+    ssize_t received = recv(fd, buffer, max_length, 0);
+    if (received <= 0)
+    {
+        close();
+        return 0;
+    }
+    return (size_t)received;
+}
@@ -0,0 +1,40 @@
+/**
+ * Header File with the TCP uplink of the host build
+ * Plain HTTP to a local server, the radio is simulated: switching it on takes joinMs,
+ * setReachable(false) plays a window without network.
+ */
+
+#ifndef DEXCOMSOCKETUPLINK_H
+#define DEXCOMSOCKETUPLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../DexcomUplink.h"
+
+class DexcomSocketUplink : public DexcomUplink
+{
+    const char* host;
+    uint16_t port;
+    uint32_t joinMs;
+    int fd;
+    bool radio;
+    bool reachable;
+
+    public:
+        uint32_t connections;       // TCP connections opened, the kept alive ones only count once.
+
+        DexcomSocketUplink(const char* host, uint16_t port, uint32_t joinMs);
+        ~DexcomSocketUplink();
+
+        void setReachable(bool network) { reachable = network; }
+
+        bool radioOn();
+        void radioOff();
+        bool open();
+        bool isOpen();
+        void close();
+        bool write(const uint8_t* data, size_t length);
+        size_t read(uint8_t* buffer, size_t max_length, uint32_t timeoutMs);
+};
+
+#endif /* DEXCOMSOCKETUPLINK_H */
@@ -0,0 +1,834 @@
+/*
+ * Host micro-benchmarks
+ *
+ * Times the protocol hot paths on Linux, one benchmark per function, in the style of Google Benchmark:
+ * each case loops while state.keepRunning() and the iteration count grows until the run is long enough.
+ * Results go to a JSON file in the Google Benchmark schema, with the operator new calls per iteration,
+ * a summary table goes to stderr and the session log to stdout:
+ *
+ *   flying-cgm-bench [json path] [name filter] > /dev/null
+ *
+ * The codec cases also run on a recorded trace, a CSV written by flying-cgm-export, and the advertisement filter on a
+ * captured stream, hex advertisements one per line. FLYING_CGM_TRACE and FLYING_CGM_ADV_CAPTURE name the files,
+ * without them the fixtures in host/fixtures are used.
+ * The DexcomMFD draw routines run against the fake Arduino_GFX surface of host/fake and report the pixels they send.
+ * The packet ring flood runs a producer thread against the consumer and exits with 1 when a packet comes out changed or out of order.
+ * BM_backlightPolicy exits with 1 when the brightness policy leaves its age / alert / user state ladder.
+ * The G7 J-PAKE cases time each handshake step, BM_jpakeVectors exits with 1 when a seeded handshake does not
+ * reproduce the vectors of an independent P-256 implementation.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include "DexcomEmulator.h"
+#include "../DexcomAdvFilter.h"
+#include "../DexcomCodec.h"
+#include "../DexcomJpake.h"
+#include "../DexcomPacketRing.h"
+#include "../DexcomPlatform.h"
+#include "../DexcomTransmitterId.h"
+#include "../G6DexcomAuth.h"
+#include "../G6DexcomBacklight.h"
+#include "../G6DexcomBattery.h"
+#include "../G6DexcomClient.h"
+#include "../G6DexcomMFD.h"
+#include "../G6DexcomSession.h"
+
+#define BENCH_MIN_TIME_NS       200000000ull                                                                            // Grow the iteration count until a run takes this long.
+#define BENCH_MAX_ITERATIONS    1000000000ull
+#define BENCH_MAX_CASES         32
+#define BENCH_TRACE_READINGS    (4*7*288)                                                                               // Four weeks of 5 minute readings.
+#define BENCH_ADV_STREAM        4096                                                                                    // Advertisements in one replayed stream.
+#define BENCH_ADV_LENGTH        62                                                                                      // Advertisement and scan response.
+#ifndef BENCH_FIXTURES
+#define BENCH_FIXTURES          "host/fixtures"                                                                         // Set by host/CMakeLists.txt, relative to the sketch folder otherwise.
+#endif
+
+
+static uint64_t allocations = 0;                                                                                        // Calls to operator new, only the flood producer runs on a second thread and it never allocates.
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+/**
+ * The file named by the variable, or the fixture of that name.
+ */
+static FILE* openInput(const char* variable, const char* fixture)
+{
+    const char* path = getenv(variable);
+    if (path != NULL)
+        return fopen(path, "r");
+    char fixturePath[256];
+    snprintf(fixturePath, sizeof(fixturePath), "%s/%s", BENCH_FIXTURES, fixture);
+    FILE* file = fopen(fixturePath, "r");
+    if (file == NULL)
+        fprintf(stderr, "no %s and no fixture %s\n", variable, fixturePath);
+    return file;
+}
+
+static uint64_t nanos(clockid_t clock)
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+/**
+ * Loop state handed to each benchmark, counts down the iterations of one run.
+ */
+class BenchState
+{
+    uint64_t remaining;
+
+    public:
+        uint64_t iterations;
+        const char* counterName;                                                                                        // Optional result reported next to the times.
+        double counter;
+
+        BenchState(uint64_t iterations) : remaining(iterations), iterations(iterations), counterName(NULL), counter(0) {}
+        inline bool keepRunning() { return remaining-- > 0; }
+};
+
+/**
+ * Keeps a result alive so the optimizer can not drop the call that produced it.
+ */
+template <class T> inline void doNotOptimize(const T &value) { asm volatile("" : : "r,m"(value) : "memory"); }
+
+typedef void (*BenchFunction)(BenchState &state);
+
+static struct { const char* name; BenchFunction function; } cases[BENCH_MAX_CASES];
+static int caseCount = 0;
+
+static int registerBenchmark(const char* name, BenchFunction function)
+{
+    if (caseCount < BENCH_MAX_CASES)
+    {
+        cases[caseCount].name = name;
+        cases[caseCount].function = function;
+        caseCount++;
+    }
+    return caseCount;
+}
+
+#define BENCHMARK(function) static int function##Registered = registerBenchmark(#function, function)
+
+
+/**
+ * ----------------------------------------------------------------------------------------------------------------
+ * CASES
+ * ----------------------------------------------------------------------------------------------------------------
+ */
+
+static uint8_t backfillRequest[18] = {0x50, 0x05, 0x02, 0x00, 0x10, 0x0e, 0x04, 0x00, 0xbc, 0x10, 0x04, 0x00};
+
+static void BM_crc16Xmodem(BenchState &state)
+{
+    while (state.keepRunning())
+        doNotOptimize(DexcomPlatform::crc16Xmodem(backfillRequest, sizeof(backfillRequest)));
+}
+BENCHMARK(BM_crc16Xmodem);
+
+static void BM_CRC_16_XMODEM(BenchState &state)                                                                        // Includes the debug dump of every byte.
+{
+    while (state.keepRunning())
+        DexcomClient::CRC_16_XMODEM(backfillRequest, sizeof(backfillRequest));
+}
+BENCHMARK(BM_CRC_16_XMODEM);
+
+static void BM_calculateHash(BenchState &state)
+{
+    DexcomTransmitterId id("8G1234");
+    uint64_t challenge = 0x1122334455667788ull;
+    while (state.keepRunning())
+        challenge = DexcomAuth::calculateHash(challenge, id.key);
+}
+BENCHMARK(BM_calculateHash);
+
+static void BM_encrypt(BenchState &state)
+{
+    DexcomTransmitterId id("8G1234");
+    uint8_t block[16] = {0}, output[16];
+    while (state.keepRunning())
+    {
+        DexcomAuth::encrypt(block, id.key, output);
+        block[0] = output[0];
+    }
+}
+BENCHMARK(BM_encrypt);
+
+static void BM_matchesName(BenchState &state)                                                                           // Once per advertisement seen by the scan.
+{
+    DexcomTransmitterId id("8G1234");
+    const char* names[3] = {"Dexcom34", "8G1234", "Galaxy Buds"};
+    int i = 0;
+    while (state.keepRunning())
+    {
+        doNotOptimize(id.matchesName(names[i]));
+        i = i < 2 ? i + 1 : 0;
+    }
+}
+BENCHMARK(BM_matchesName);
+
+/**
+ * Full backfill packets, the sequence restarts whenever the client rejects one.
+ */
+static void BM_saveBackfill(BenchState &state)
+{
+    uint8_t packet[20];
+    memset(packet, 0x01, sizeof(packet));
+    uint8_t sequence = 0;
+    while (state.keepRunning())
+    {
+        packet[0] = sequence;
+        sequence = DexcomClient::saveBackfill(packet, sizeof(packet)) ? sequence + 1 : 0;
+    }
+}
+BENCHMARK(BM_saveBackfill);
+
+static void BM_parseBackfill(BenchState &state)                                                                        // One record, inserted into the glucose history.
+{
+    static const uint8_t record[8] = {0x10, 0x0e, 0x04, 0x00, 0x78, 0x00, 0x06, 0x01};
+    while (state.keepRunning())
+        DexcomClient::parseBackfill(record);
+}
+BENCHMARK(BM_parseBackfill);
+
+/**
+ * Glucose request and response through the emulator without latency, then the history shift.
+ */
+static void BM_readGlucose(BenchState &state)
+{
+    DexcomEmulatorConfig config = {};
+    config.sessionState = 0x06;
+    config.seed = 1;
+    DexcomEmulator emulator(DexcomSession::getTransmitterID(), config);
+    DexcomSession::setTransport(&emulator);
+    emulator.connect();
+    while (state.keepRunning())
+        DexcomClient::readGlucose();
+    DexcomSession::setTransport(NULL);
+}
+BENCHMARK(BM_readGlucose);
+
+static void BM_batteryBuildTable(BenchState &state)
+{
+    static uint8_t table[BATT_TABLE_SIZE];
+    while (state.keepRunning())
+    {
+        DexcomBattery::buildTable(table, BAT_VOLT_D);
+        doNotOptimize(table);
+    }
+}
+BENCHMARK(BM_batteryBuildTable);
+
+static void BM_batteryLookup(BenchState &state)
+{
+    static uint8_t table[BATT_TABLE_SIZE];
+    DexcomBattery::buildTable(table, BAT_VOLT_D);
+    int millivolts = 3000;
+    while (state.keepRunning())
+    {
+        doNotOptimize(DexcomBattery::lookup(table, millivolts));
+        millivolts = millivolts < 4400 ? millivolts + 7 : 3000;
+    }
+}
+BENCHMARK(BM_batteryLookup);
+
+/**
+ * The brightness ladder of DexcomBacklight::policy, checked before the timing: data age in seconds, alert level,
+ * user state and the expected duty. Exits with 1 on the first step that differs.
+ */
+static const struct { int dataAge; int alertLevel; int userState; uint8_t duty; } backlightLadder[] = {
+    {0,    BACKLIGHT_ALERT_WARNING, 0, BACKLIGHT_DUTY_OFF},                                                             // Switched off wins over everything.
+    {5,    BACKLIGHT_ALERT_NONE,    1, BACKLIGHT_DUTY_FULL},
+    {14,   BACKLIGHT_ALERT_WARNING, 1, BACKLIGHT_DUTY_FULL},                                                            // New data first.
+    {15,   BACKLIGHT_ALERT_NONE,    1, BACKLIGHT_DUTY_DIM},
+    {15,   BACKLIGHT_ALERT_CAUTION, 1, BACKLIGHT_DUTY_CAUTION},
+    {59,   BACKLIGHT_ALERT_CAUTION, 1, BACKLIGHT_DUTY_CAUTION},
+    {60,   BACKLIGHT_ALERT_CAUTION, 1, BACKLIGHT_DUTY_DIM},
+    {15,   BACKLIGHT_ALERT_WARNING, 1, BACKLIGHT_DUTY_WARNING},
+    {600,  BACKLIGHT_ALERT_NONE,    1, BACKLIGHT_DUTY_DIM},
+    {601,  BACKLIGHT_ALERT_NONE,    1, BACKLIGHT_DUTY_WARNING},                                                         // Old data.
+    {601,  BACKLIGHT_ALERT_CAUTION, 1, BACKLIGHT_DUTY_WARNING},
+    {3600, BACKLIGHT_ALERT_NONE,   -1, BACKLIGHT_DUTY_OFF},
+};
+
+static void BM_backlightPolicy(BenchState &state)
+{
+    for (size_t i = 0; i < sizeof(backlightLadder) / sizeof(backlightLadder[0]); i++)
+    {
+        uint8_t duty = DexcomBacklight::policy(backlightLadder[i].dataAge, backlightLadder[i].alertLevel, backlightLadder[i].userState);
+        if (duty != backlightLadder[i].duty)
+        {
+            fprintf(stderr, "BM_backlightPolicy: age %d alert %d user %d gave %u, expected %u\n", backlightLadder[i].dataAge,
+                    backlightLadder[i].alertLevel, backlightLadder[i].userState, duty, backlightLadder[i].duty);
+            exit(1);
+        }
+    }
+    int dataAge = 0;
+    while (state.keepRunning())
+    {
+        doNotOptimize(DexcomBacklight::policy(dataAge, dataAge & 3, 1));
+        dataAge = dataAge < 700 ? dataAge + 1 : 0;
+    }
+}
+BENCHMARK(BM_backlightPolicy);
+
+/**
+ * The draw routines of the UI tick on the fake GFX surface, the counter is the pixels one call sends to the panel.
+ * The glucose value and the data age step through their ranges so every color and text width is drawn.
+ */
+static void mfdCounters(BenchState &state, uint64_t pixels)
+{
+    doNotOptimize(Arduino_GFX::counters.checksum);
+    state.counterName = "panel_pixels";
+    state.counter = state.iterations > 0 ? (double)pixels / state.iterations : 0;
+}
+
+static void BM_mfdDrawScreen(BenchState &state)
+{
+    uint64_t pixels = Arduino_GFX::counters.pixels;
+    int glucose = 40;
+    while (state.keepRunning())
+    {
+        DexcomMFD::set_glucoseValue(glucose);
+        DexcomMFD::drawScreen();
+        glucose = glucose < 400 ? glucose + 3 : 0;
+    }
+    mfdCounters(state, Arduino_GFX::counters.pixels - pixels);
+}
+BENCHMARK(BM_mfdDrawScreen);
+
+static void BM_mfdDrawTime(BenchState &state)
+{
+    uint64_t pixels = Arduino_GFX::counters.pixels;
+    uint32_t age = 0;
+    while (state.keepRunning())
+    {
+        DexcomMFD::drawTime(age);
+        age = age < 700 ? age + 1 : 0;
+    }
+    mfdCounters(state, Arduino_GFX::counters.pixels - pixels);
+}
+BENCHMARK(BM_mfdDrawTime);
+
+static void BM_mfdDrawVBat(BenchState &state)
+{
+    uint64_t pixels = Arduino_GFX::counters.pixels;
+    int millivolts = 3000;
+    while (state.keepRunning())
+    {
+        DexcomMFD::drawVBat(millivolts);
+        millivolts = millivolts < 4400 ? millivolts + 7 : 3000;
+    }
+    mfdCounters(state, Arduino_GFX::counters.pixels - pixels);
+}
+BENCHMARK(BM_mfdDrawVBat);
+
+static void BM_mfdDrawPBat(BenchState &state)
+{
+    uint64_t pixels = Arduino_GFX::counters.pixels;
+    int percent = 0;
+    while (state.keepRunning())
+    {
+        DexcomMFD::drawPBat(percent);
+        percent = percent < 100 ? percent + 1 : 0;
+    }
+    mfdCounters(state, Arduino_GFX::counters.pixels - pixels);
+}
+BENCHMARK(BM_mfdDrawPBat);
+
+/**
+ * A trace of BENCH_TRACE_READINGS readings. The synthetic one is a slow random walk with a sensor warmup gap
+ * and a few seconds of clock jitter, the recorded one is read from FLYING_CGM_TRACE or the trace fixture.
+ */
+static size_t syntheticTrace(DexcomReading* trace)
+{
+    uint32_t seed = 12345, dextime = 7200;
+    int glucose = 120, slope = 0;
+    for (size_t i = 0; i < BENCH_TRACE_READINGS; i++)
+    {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        slope += (int)(seed % 5) - 2;
+        slope = slope > 6 ? 6 : (slope < -6 ? -6 : slope);
+        glucose += slope / 2;
+        glucose = glucose > 350 ? 350 : (glucose < 50 ? 50 : glucose);
+        dextime += i % 2880 == 2879 ? 2*60*60 : 300 + (seed >> 8) % 3 - 1;                                              // Sensor change every 10 days.
+        trace[i] = { dextime, (uint16_t)glucose, (int8_t)(slope / 2), (uint8_t)(i % 2880 < 24 ? 0x02 : 0x06) };
+    }
+    return BENCH_TRACE_READINGS;
+}
+
+static size_t recordedTrace(DexcomReading* trace)
+{
+    FILE* file = openInput("FLYING_CGM_TRACE", "trace.csv");
+    if (file == NULL)
+        return 0;
+    char line[128];
+    size_t count = 0;
+    while (count < BENCH_TRACE_READINGS && fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned dextime, glucose, status;
+        int trend;
+        if (sscanf(line, "%u,%u,%d,%u", &dextime, &glucose, &trend, &status) == 4)
+            trace[count++] = { dextime, (uint16_t)glucose, (int8_t)trend, (uint8_t)status };
+    }
+    fclose(file);
+    return count;
+}
+
+/**
+ * Encodes the whole trace into history sized blocks, reports the stored bytes per reading.
+ */
+static void codecEncode(BenchState &state, const DexcomReading* trace, size_t count)
+{
+    static uint8_t blocks[BENCH_TRACE_READINGS * sizeof(DexcomReading) + 4080];
+    size_t bytes = 0;
+    while (state.keepRunning())
+    {
+        bytes = 0;
+        for (size_t done = 0, encoded; done < count; done += encoded)
+            bytes += DexcomCodec::encodeBlock(&trace[done], count - done, &blocks[bytes], 4080, &encoded);              // A history sector without its header.
+        doNotOptimize(blocks);
+    }
+    state.counterName = "bytes_per_reading";
+    state.counter = count > 0 ? (double)bytes / count : 0;
+}
+
+static void codecDecode(BenchState &state, const DexcomReading* trace, size_t count)
+{
+    static uint8_t block[BENCH_TRACE_READINGS * sizeof(DexcomReading)];
+    static DexcomReading decoded[BENCH_TRACE_READINGS];
+    size_t encoded, length = DexcomCodec::encodeBlock(trace, count, block, sizeof(block), &encoded);
+    while (state.keepRunning())
+        doNotOptimize(DexcomCodec::decodeBlock(block, length, decoded, encoded));
+    state.counterName = "bytes_per_reading";
+    state.counter = encoded > 0 ? (double)length / encoded : 0;
+}
+
+static void BM_codecEncodeSynthetic(BenchState &state)
+{
+    static DexcomReading trace[BENCH_TRACE_READINGS];
+    codecEncode(state, trace, syntheticTrace(trace));
+}
+BENCHMARK(BM_codecEncodeSynthetic);
+
+static void BM_codecDecodeSynthetic(BenchState &state)
+{
+    static DexcomReading trace[BENCH_TRACE_READINGS];
+    codecDecode(state, trace, syntheticTrace(trace));
+}
+BENCHMARK(BM_codecDecodeSynthetic);
+
+static void BM_codecEncodeRecorded(BenchState &state)
+{
+    static DexcomReading trace[BENCH_TRACE_READINGS];
+    codecEncode(state, trace, recordedTrace(trace));
+}
+BENCHMARK(BM_codecEncodeRecorded);
+
+static void BM_codecDecodeRecorded(BenchState &state)
+{
+    static DexcomReading trace[BENCH_TRACE_READINGS];
+    codecDecode(state, trace, recordedTrace(trace));
+}
+BENCHMARK(BM_codecDecodeRecorded);
+
+/**
+ * A dense advertisement stream: phones, beacons, trackers and wearables with our transmitter in every 500th slot.
+ * The synthetic stream is built from typical payloads, the captured one is read from FLYING_CGM_ADV_CAPTURE
+ * or the advertisement fixture.
+ */
+typedef struct
+{
+    uint8_t data[BENCH_ADV_LENGTH];
+    uint8_t length;
+} BenchAdvertisement;
+
+static size_t syntheticAdvertisements(BenchAdvertisement* stream)
+{
+    static const uint8_t payloads[][BENCH_ADV_LENGTH] = {
+        {0x02, 0x01, 0x1a, 0x0a, 0xff, 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x3d, 0x2a, 0x9c},                       // Phone, manufacturer data only
+        {0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0xe2, 0xc5, 0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2, 0xb0,
+         0x60, 0xd0, 0xf5, 0xa7, 0x10, 0x96, 0xe0, 0x00, 0x01, 0x00, 0x02, 0xc5},                                     // iBeacon
+        {0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe, 0x10, 0x00, 0x03, 'e', 'x', 'a', 'm', 'p',
+         'l', 'e', 0x07},                                                                                              // Eddystone URL
+        {0x02, 0x01, 0x06, 0x05, 0x03, 0x0d, 0x18, 0x0f, 0x18, 0x09, 0x09, 'H', 'R', 'M', ' ', '1', '2', '3', '4'},      // Heart rate strap
+        {0x02, 0x01, 0x06, 0x03, 0x03, 0xbc, 0xfe, 0x09, 0x09, 'D', 'e', 'x', 'c', 'o', 'm', '9', '9'},               // Somebody else's transmitter
+        {0x02, 0x01, 0x06, 0x03, 0x03, 0xbc, 0xfe, 0x09, 0x09, 'D', 'e', 'x', 'c', 'o', 'm', '3', '4'},               // Ours, ID 8G1234
+    };
+    static const uint8_t lengths[] = {14, 30, 22, 19, 17, 17};
+    for (size_t i = 0; i < BENCH_ADV_STREAM; i++)
+    {
+        int kind = i % 500 == 499 ? 5 : (int)(i * 2654435761u % 997) % 5;
+        memcpy(stream[i].data, payloads[kind], BENCH_ADV_LENGTH);
+        stream[i].length = lengths[kind];
+    }
+    return BENCH_ADV_STREAM;
+}
+
+static size_t capturedAdvertisements(BenchAdvertisement* stream)
+{
+    FILE* file = openInput("FLYING_CGM_ADV_CAPTURE", "advertisements.txt");
+    if (file == NULL)
+        return 0;
+    char line[2 * BENCH_ADV_LENGTH + 8];
+    size_t count = 0;
+    while (count < BENCH_ADV_STREAM && fgets(line, sizeof(line), file) != NULL)
+    {
+        size_t length = 0;
+        unsigned value;
+        for (const char* hex = line; length < BENCH_ADV_LENGTH && sscanf(hex, "%2x", &value) == 1; hex += 2)
+            stream[count].data[length++] = (uint8_t)value;
+        stream[count].length = (uint8_t)length;
+        if (length > 0)
+            count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static void advFilter(BenchState &state, const BenchAdvertisement* stream, size_t count)
+{
+    DexcomTransmitterId id("8G1234");
+    size_t matches = 0, i = 0;
+    while (state.keepRunning() && count > 0)
+    {
+        matches += DexcomAdvFilter::match(stream[i].data, stream[i].length, id);
+        i = i + 1 < count ? i + 1 : 0;
+    }
+    doNotOptimize(matches);
+    state.counterName = "match_ratio";
+    state.counter = state.iterations > 0 ? (double)matches / state.iterations : 0;
+}
+
+static void BM_advFilterSynthetic(BenchState &state)                                                                    // Per advertisement.
+{
+    static BenchAdvertisement stream[BENCH_ADV_STREAM];
+    advFilter(state, stream, syntheticAdvertisements(stream));
+}
+BENCHMARK(BM_advFilterSynthetic);
+
+static void BM_advFilterCaptured(BenchState &state)
+{
+    static BenchAdvertisement stream[BENCH_ADV_STREAM];
+    advFilter(state, stream, capturedAdvertisements(stream));
+}
+BENCHMARK(BM_advFilterCaptured);
+
+
+/**
+ * Packet n carries n in its first four bytes and bytes derived from n after it,
+ * the length cycles past PACKET_RING_PAYLOAD so truncation is exercised too.
+ */
+static size_t ringPacket(uint32_t sequence, uint8_t* data)
+{
+    size_t length = 4 + sequence % (PACKET_RING_PAYLOAD + 4);
+    memcpy(data, &sequence, 4);
+    for (size_t i = 4; i < length; i++)
+        data[i] = (uint8_t)(sequence * 31 + i);
+    return length;
+}
+
+static bool ringPacketValid(const DexcomPacket &packet, uint32_t* sequence)
+{
+    uint8_t expected[PACKET_RING_PAYLOAD + 8];
+    if (packet.length < 4)
+        return false;
+    memcpy(sequence, packet.data, 4);
+    size_t length = ringPacket(*sequence, expected);
+    size_t stored = length > PACKET_RING_PAYLOAD ? PACKET_RING_PAYLOAD : length;
+    return packet.received == length && packet.length == stored && memcmp(packet.data, expected, stored) == 0 && packet.time == *sequence;
+}
+
+static void BM_packetRingPushPop(BenchState &state)                                                                     // Callback and consumer side of one packet, one thread.
+{
+    static DexcomPacketRing ring;
+    uint8_t data[PACKET_RING_PAYLOAD + 8];
+    DexcomPacket packet;
+    uint32_t sequence = 0, popped = 0;
+    while (state.keepRunning())
+    {
+        ring.push(data, ringPacket(sequence, data), sequence);
+        sequence++;
+        if (ring.pop(&packet) && ringPacketValid(packet, &popped))
+            doNotOptimize(popped);
+    }
+}
+BENCHMARK(BM_packetRingPushPop);
+
+/**
+ * The producer pushes as fast as it can, like a backfill burst into a stalled protocol task.
+ * Every packet that comes out must be intact and newer than the one before, and after the drain
+ * consumed plus dropped must equal pushed: nothing is lost without being counted.
+ */
+static void BM_packetRingFlood(BenchState &state)                                                                       // Per consumed packet.
+{
+    DexcomPacketRing* ring = new DexcomPacketRing();
+    std::atomic<bool> stop(false);
+    std::atomic<uint32_t> pushed(0);
+    std::thread producer([ring, &stop, &pushed]() {
+        uint8_t data[PACKET_RING_PAYLOAD + 8];
+        uint32_t sequence = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            if (!ring->push(data, ringPacket(sequence, data), sequence))
+                std::this_thread::yield();                                                                              // Dropped and counted, give the consumer the core.
+            sequence++;
+        }
+        pushed.store(sequence);
+    });
+
+    DexcomPacket packet;
+    uint32_t consumed = 0, sequence = 0, last = 0;
+    bool bad = false;
+    while (state.keepRunning())
+    {
+        while (!ring->pop(&packet))
+            std::this_thread::yield();                                                                                  // Like the delay(1) in the BLE wait, matters on a single core host.
+        bad |= !ringPacketValid(packet, &sequence) || (consumed > 0 && sequence <= last);
+        last = sequence;
+        consumed++;
+    }
+    stop.store(true);
+    producer.join();
+    while (ring->pop(&packet))
+    {
+        bad |= !ringPacketValid(packet, &sequence) || (consumed > 0 && sequence <= last);
+        last = sequence;
+        consumed++;
+    }
+    if (bad || consumed + ring->get_overflows() != pushed.load())
+    {
+        fprintf(stderr, "BM_packetRingFlood: pushed %u consumed %u dropped %u%s\n", (unsigned)pushed.load(), (unsigned)consumed,
+                (unsigned)ring->get_overflows(), bad ? ", packet changed or out of order" : "");
+        exit(1);
+    }
+    state.counterName = "drop_ratio";
+    state.counter = pushed.load() > 0 ? (double)ring->get_overflows() / pushed.load() : 0;
+    delete ring;
+}
+BENCHMARK(BM_packetRingFlood);
+
+
+/**
+ * Seeded J-PAKE, the same linear congruential bytes as the reference: c = c * 1103515245 + 12345, byte = c >> 16.
+ * Client seed 1, server seed 2, pairing code "1234". The vectors are the first bytes of the client's X1 packet
+ * and round two packet and the agreed key.
+ */
+static const uint8_t jpakeVectorRoundOne[16] = {0xd3, 0x55, 0x14, 0xc5, 0x47, 0x5c, 0xb5, 0xdb, 0x5b, 0xa5, 0xf7, 0x3f, 0x6a, 0xf8, 0x98, 0x3c};
+static const uint8_t jpakeVectorRoundTwo[16] = {0x8d, 0x8b, 0xea, 0x4f, 0x7f, 0x5b, 0xe9, 0x10, 0xda, 0xe7, 0xad, 0x44, 0x59, 0xa2, 0x8e, 0x5a};
+static const uint8_t jpakeVectorKey[16]      = {0x55, 0x0f, 0x1e, 0x1a, 0x31, 0xd9, 0x04, 0x42, 0xea, 0xcf, 0x78, 0xa4, 0x08, 0xaf, 0x94, 0x81};
+
+static int jpakeSeeded(void* context, unsigned char* output, size_t length)
+{
+    uint32_t* state = (uint32_t*)context;
+    for (size_t i = 0; i < length; i++)
+    {
+        *state = *state * 1103515245u + 12345u;
+        output[i] = (uint8_t)(*state >> 16);
+    }
+    return 0;
+}
+
+/**
+ * Both sides up to the given step, false when a step fails.
+ */
+static bool jpakeHandshake(DexcomJpake &client, DexcomJpake &server, uint32_t* clientSeed, uint32_t* serverSeed,
+                           uint8_t* clientTwo, uint8_t* serverTwo, int steps)
+{
+    bool ok = client.prepare(jpakeSeeded, clientSeed) && server.prepare(jpakeSeeded, serverSeed);
+    if (steps > 1)
+        ok = ok && client.readRoundOne(server.roundOnePacket(0), server.roundOnePacket(1)) &&
+             server.readRoundOne(client.roundOnePacket(0), client.roundOnePacket(1));
+    if (steps > 2)
+        ok = ok && client.writeRoundTwo(clientTwo, jpakeSeeded, clientSeed) && server.writeRoundTwo(serverTwo, jpakeSeeded, serverSeed);
+    if (steps > 3)
+        ok = ok && client.readRoundTwo(serverTwo) && server.readRoundTwo(clientTwo);
+    return ok;
+}
+
+static void BM_jpakeVectors(BenchState &state)                                                                          // Whole exchange, both sides.
+{
+    static DexcomJpake client(JPAKE_ROLE_CLIENT), server(JPAKE_ROLE_SERVER);
+    uint8_t clientTwo[JPAKE_PACKET_SIZE], serverTwo[JPAKE_PACKET_SIZE];
+    const char* failed = NULL;
+
+    server.setPassword((const uint8_t*)"4321", 4);                                                                     // A wrong code still passes the proofs but must not agree.
+    client.setPassword((const uint8_t*)"1234", 4);
+    uint32_t clientSeed = 1, serverSeed = 2;
+    if (!jpakeHandshake(client, server, &clientSeed, &serverSeed, clientTwo, serverTwo, 4) ||
+        memcmp(client.sessionKey(), server.sessionKey(), JPAKE_KEY_SIZE) == 0)
+        failed = "wrong pairing code agreed";
+    server.setPassword((const uint8_t*)"1234", 4);
+    uint8_t forged[JPAKE_PACKET_SIZE];
+    memcpy(forged, server.roundOnePacket(1), JPAKE_PACKET_SIZE);
+    forged[JPAKE_PACKET_SIZE - 1] ^= 0x01;                                                                              // A changed proof response must be refused.
+    if (client.readRoundOne(server.roundOnePacket(0), forged))
+        failed = "forged proof accepted";
+
+    while (state.keepRunning() && failed == NULL)
+    {
+        clientSeed = 1;
+        serverSeed = 2;
+        if (!jpakeHandshake(client, server, &clientSeed, &serverSeed, clientTwo, serverTwo, 4))
+            failed = "step failed";
+        else if (memcmp(client.roundOnePacket(0), jpakeVectorRoundOne, 16) != 0 || memcmp(clientTwo, jpakeVectorRoundTwo, 16) != 0)
+            failed = "packet differs";
+        else if (memcmp(client.sessionKey(), jpakeVectorKey, JPAKE_KEY_SIZE) != 0 || memcmp(server.sessionKey(), jpakeVectorKey, JPAKE_KEY_SIZE) != 0)
+            failed = "key differs";
+    }
+    if (failed != NULL)
+    {
+        fprintf(stderr, "BM_jpakeVectors: %s\n", failed);
+        exit(1);
+    }
+}
+BENCHMARK(BM_jpakeVectors);
+
+static void BM_jpakePrepare(BenchState &state)                                                                          // Round one, before the connection.
+{
+    static DexcomJpake client(JPAKE_ROLE_CLIENT);
+    uint32_t seed = 1;
+    client.setPassword((const uint8_t*)"1234", 4);
+    while (state.keepRunning())
+        client.prepare(jpakeSeeded, &seed);
+}
+BENCHMARK(BM_jpakePrepare);
+
+/**
+ * The steps inside the connection window, each repeated on the state the steps before left.
+ */
+static void jpakeStep(BenchState &state, int step)
+{
+    static DexcomJpake client(JPAKE_ROLE_CLIENT), server(JPAKE_ROLE_SERVER);
+    uint8_t clientTwo[JPAKE_PACKET_SIZE], serverTwo[JPAKE_PACKET_SIZE];
+    uint32_t clientSeed = 1, serverSeed = 2;
+    client.setPassword((const uint8_t*)"1234", 4);
+    server.setPassword((const uint8_t*)"1234", 4);
+    jpakeHandshake(client, server, &clientSeed, &serverSeed, clientTwo, serverTwo, 4);
+    while (state.keepRunning())
+    {
+        if (step == 2)
+            doNotOptimize(client.readRoundOne(server.roundOnePacket(0), server.roundOnePacket(1)));
+        else if (step == 3)
+            doNotOptimize(client.writeRoundTwo(clientTwo, jpakeSeeded, &clientSeed));
+        else
+            doNotOptimize(client.readRoundTwo(serverTwo));
+    }
+}
+
+static void BM_jpakeReadRoundOne(BenchState &state) { jpakeStep(state, 2); }
+BENCHMARK(BM_jpakeReadRoundOne);
+static void BM_jpakeWriteRoundTwo(BenchState &state) { jpakeStep(state, 3); }
+BENCHMARK(BM_jpakeWriteRoundTwo);
+static void BM_jpakeReadRoundTwo(BenchState &state) { jpakeStep(state, 4); }
+BENCHMARK(BM_jpakeReadRoundTwo);
+
+/**
+ * DexcomAuth::authenticate of a G7 against the emulator, chunked exchange and challenge included.
+ * The emulator computes the transmitter side in the same thread, so this is about twice the client's share.
+ */
+static void BM_authenticateG7(BenchState &state)
+{
+    DexcomEmulatorConfig config = {};
+    config.sessionState = 0x06;
+    config.seed = 1;
+    config.pairingCode = "1234";
+    DexcomTransmitterId id("8G1234");
+    id.setPairingCode("1234");
+    static DexcomEmulator* emulator = new DexcomEmulator(id.id, config);
+    while (state.keepRunning())
+    {
+        DexcomAuth::prepare(id);
+        emulator->connect();
+        if (!DexcomAuth::authenticate(emulator, id, false))
+        {
+            fprintf(stderr, "BM_authenticateG7: handshake failed\n");
+            exit(1);
+        }
+    }
+}
+BENCHMARK(BM_authenticateG7);
+
+
+int main(int argc, char** argv)
+{
+    const char* jsonPath = argc > 1 ? argv[1] : "flying-cgm-bench.json";
+    const char* filter = argc > 2 ? argv[2] : NULL;
+    FILE* json = fopen(jsonPath, "w");
+    if (json == NULL)
+    {
+        fprintf(stderr, "can not write %s\n", jsonPath);
+        return 2;
+    }
+
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    fprintf(json, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"%s\"\n  },\n  \"benchmarks\": [", date, argv[0]);
+    fprintf(stderr, "%-24s %14s %14s %12s %12s %12s\n", "Benchmark", "Time ns", "CPU ns", "Iterations", "Allocs/iter", "Counter");
+
+    bool first = true;
+    for (int i = 0; i < caseCount; i++)
+    {
+        if (filter != NULL && strstr(cases[i].name, filter) == NULL)
+            continue;
+
+        uint64_t iterations = 1, real = 0, cpu = 0, allocated = 0;
+        const char* counterName = NULL;
+        double counter = 0;
+        for (;;)
+        {
+            BenchState state(iterations);
+            uint64_t allocationsStart = allocations;
+            uint64_t realStart = nanos(CLOCK_MONOTONIC), cpuStart = nanos(CLOCK_PROCESS_CPUTIME_ID);
+            cases[i].function(state);
+            real = nanos(CLOCK_MONOTONIC) - realStart;
+            cpu = nanos(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+            allocated = allocations - allocationsStart;
+            counterName = state.counterName;
+            counter = state.counter;
+            if (real >= BENCH_MIN_TIME_NS || iterations >= BENCH_MAX_ITERATIONS)
+                break;
+            uint64_t scale = real > 0 ? BENCH_MIN_TIME_NS * 14 / 10 / real : 10;                                         // Aim past the minimum like Google Benchmark does.
+            iterations *= scale < 2 ? 2 : (scale > 10 ? 10 : scale);
+        }
+
+        double realPerIteration = (double)real / iterations;
+        double cpuPerIteration = (double)cpu / iterations;
+        double allocsPerIteration = (double)allocated / iterations;
+        fprintf(json, "%s\n    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n      \"iterations\": %llu,\n"
+                      "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n      \"allocs_per_iter\": %.3f",
+                first ? "" : ",", cases[i].name, (unsigned long long)iterations, realPerIteration, cpuPerIteration, allocsPerIteration);
+        if (counterName != NULL)
+            fprintf(json, ",\n      \"%s\": %.3f", counterName, counter);
+        fprintf(json, "\n    }");
+        fprintf(stderr, "%-24s %14.1f %14.1f %12llu %12.2f", cases[i].name, realPerIteration, cpuPerIteration,
+                (unsigned long long)iterations, allocsPerIteration);
+        if (counterName != NULL)
+            fprintf(stderr, " %12.3f", counter);
+        fprintf(stderr, "\n");
+        first = false;
+    }
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+    return 0;
+}
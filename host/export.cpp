@@ -0,0 +1,127 @@
+/*
+ * Host history export
+ *
+ * Pulls the glucose history from the board over the USB CDC serial port with the framed binary export
+ * and writes it as CSV (one typed column per field, ready for a Parquet conversion).
+ * Debug text on the port is skipped by the frame parser.
+ *
+ *   flying-cgm-export <serial device> [since dextime] [live]
+ *
+ * The last dextime written is the "since" of the next incremental sync.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../DexcomExport.h"
+
+
+#define EXPORT_TIMEOUT_MS 5000                                                                                          // No frame for this long ends the export with an error.
+
+static int openPort(const char* device)
+{
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        return -1;
+    termios settings;
+    if (tcgetattr(fd, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        cfsetspeed(&settings, B115200);                                                                                 // Ignored by USB CDC, set for real UART bridges.
+        tcsetattr(fd, TCSANOW, &settings);
+    }
+    return fd;
+}
+
+static void command(int fd, const char* text)
+{
+    if (write(fd, text, strlen(text)) < 0)
+        perror("write");
+}
+
+static void printReading(const DexcomReading &reading)
+{
+    printf("%u,%u,%d,%u\n", reading.dextime, reading.glucose, reading.trend, reading.status);
+}
+
+static void printBlock(const uint8_t* payload, uint16_t length)
+{
+    static DexcomReading readings[EXPORT_MAX_PAYLOAD * 8];                                                              // At least one bit per reading.
+    size_t count = DexcomCodec::decodeBlock(payload, length, readings, sizeof(readings) / sizeof(readings[0]));
+    for (size_t i = 0; i < count; i++)
+        printReading(readings[i]);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <serial device> [since dextime] [live]\n", argv[0]);
+        return 2;
+    }
+    unsigned long since = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    bool live = argc > 3 && strcmp(argv[3], "live") == 0;
+    int fd = openPort(argv[1]);
+    if (fd < 0)
+    {
+        perror(argv[1]);
+        return 2;
+    }
+
+    char request[32];
+    snprintf(request, sizeof(request), "\nexport %lu\n", since);                                                       // Leading newline ends any partial console line.
+    command(fd, request);
+    printf("dextime,glucose,trend,status\n");
+
+    static DexcomFrameParser parser;
+    uint8_t buffer[512];
+    bool finished = false;
+    while (!finished || live)
+    {
+        pollfd descriptor = { fd, POLLIN, 0 };
+        if (poll(&descriptor, 1, live && finished ? -1 : EXPORT_TIMEOUT_MS) <= 0)
+        {
+            fprintf(stderr, "timeout waiting for the board\n");
+            return 1;
+        }
+        ssize_t received = read(fd, buffer, sizeof(buffer));
+        if (received <= 0)
+            return 1;
+        for (ssize_t i = 0; i < received; i++)
+        {
+            if (!parser.push(buffer[i]))
+                continue;
+            if (parser.type == EXPORT_FRAME_BLOCK)
+                printBlock(parser.payload, parser.length);
+            else if (parser.type == EXPORT_FRAME_LIVE && parser.length == sizeof(DexcomReading))
+            {
+                DexcomReading reading;
+                memcpy(&reading, parser.payload, sizeof(reading));
+                printReading(reading);
+            }
+            else if (parser.type == EXPORT_FRAME_BEGIN && parser.length == 8)
+            {
+                uint32_t stored;
+                memcpy(&stored, parser.payload + 4, 4);
+                fprintf(stderr, "board holds %u readings\n", stored);
+            }
+            else if (parser.type == EXPORT_FRAME_END && parser.length == 4 && !finished)
+            {
+                uint32_t sent;
+                memcpy(&sent, parser.payload, 4);
+                fprintf(stderr, "exported %u readings\n", sent);
+                finished = true;
+                if (live)
+                    command(fd, "live on\n");
+            }
+        }
+        fflush(stdout);
+    }
+    close(fd);
+    return 0;
+}
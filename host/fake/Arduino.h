@@ -0,0 +1,39 @@
+/**
+ * Header File with the part of the Arduino core the board modules the host bench compiles use
+ * Pins, the LEDC and the serial port do nothing, the clocks come from DexcomPlatform. Only on the bench include path.
+ */
+
+#ifndef FAKE_ARDUINO_H
+#define FAKE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "../../DexcomPlatform.h"
+
+#define RTC_NOINIT_ATTR
+#define OUTPUT  0x03
+#define HIGH    0x1
+#define LOW     0x0
+#define F(text) (text)
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void delay(uint32_t) {}
+inline uint32_t millis() { return DexcomPlatform::millis(); }
+inline int64_t esp_timer_get_time() { return (int64_t)DexcomPlatform::micros(); }
+
+inline bool ledcAttach(uint8_t, uint32_t, uint8_t) { return true; }
+inline bool ledcWrite(uint8_t, uint32_t) { return true; }
+inline uint32_t ledcRead(uint8_t) { return 0; }
+inline bool ledcFade(uint8_t, uint32_t, uint32_t, int) { return true; }
+
+class FakeSerial
+{
+    public:
+        void println(const char*) {}
+};
+
+inline FakeSerial Serial;
+
+#endif /* FAKE_ARDUINO_H */
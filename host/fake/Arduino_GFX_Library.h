@@ -0,0 +1,112 @@
+/**
+ * Header File with a fake Arduino_GFX surface for the host bench
+ * Implements only the calls G6DexcomMFD makes. Nothing is drawn, each call is counted with the pixels it would
+ * send to the panel (the area of fills and lines, a glyph box per character) and folded into a checksum of its
+ * arguments, so a benchmark can report the panel traffic of a draw routine and the calls can not be optimized away.
+ */
+
+#ifndef FAKE_ARDUINO_GFX_LIBRARY_H
+#define FAKE_ARDUINO_GFX_LIBRARY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLACK       0x0000
+#define DARKGREEN   0x03E0
+#define DARKGREY    0x7BEF
+#define RED         0xF800
+#define GREEN       0x07E0
+#define YELLOW      0xFFE0
+#define WHITE       0xFFFF
+
+typedef struct
+{
+    uint64_t calls;
+    uint64_t pixels;
+    uint32_t checksum;
+} FakeGFXCounters;
+
+class Arduino_DataBus
+{
+    public:
+        virtual ~Arduino_DataBus() {}
+};
+
+class Arduino_ESP32PAR8Q : public Arduino_DataBus
+{
+    public:
+        Arduino_ESP32PAR8Q(int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t, int8_t) {}
+};
+
+class Arduino_GFX
+{
+    int16_t width, height;
+    int16_t cursorX = 0, cursorY = 0;
+    uint8_t fontSize = 6;
+
+    inline void record(uint64_t pixels, int32_t a, int32_t b = 0, int32_t c = 0, int32_t d = 0)
+    {
+        counters.calls++;
+        counters.pixels += pixels;
+        counters.checksum = (counters.checksum ^ (uint32_t)a) * 16777619u;                                              // FNV-1a over the arguments.
+        counters.checksum = (counters.checksum ^ (uint32_t)b) * 16777619u;
+        counters.checksum = (counters.checksum ^ (uint32_t)c) * 16777619u;
+        counters.checksum = (counters.checksum ^ (uint32_t)d) * 16777619u;
+    }
+    inline uint16_t advance() const { return fontSize * 2 / 3 + 1; }
+    inline void text(const char* str)
+    {
+        size_t length = strlen(str);
+        record((uint64_t)length * advance() * fontSize, cursorX, cursorY, (int32_t)length, str[0]);
+        cursorX += length * advance();
+    }
+
+    public:
+        static inline FakeGFXCounters counters = {};
+
+        Arduino_GFX(int16_t w, int16_t h) : width(w), height(h) {}
+
+        bool begin() { record(0, 0); return true; }
+        void setRotation(uint8_t r) { record(0, r); if (r & 1) { int16_t w = width; width = height; height = w; } }
+        void fillScreen(uint16_t color) { record((uint64_t)width * height, color); }
+        void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) { record(w > 0 ? w : 0, x, y, w, color); }
+        void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) { record(h > 0 ? h : 0, x, y, h, color); }
+        void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) { record(2 * (w + h), x, y, w ^ (h << 16), color); }
+        void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) { record(w > 0 && h > 0 ? w * h : 0, x, y, w ^ (h << 16), color); }
+        void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t, uint16_t color) { record(2 * (w + h), x, y, w ^ (h << 16), color); }
+        void fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t, uint16_t color) { record(w > 0 && h > 0 ? w * h : 0, x, y, w ^ (h << 16), color); }
+        void drawTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color)
+        {
+            record((x1 > x0 ? x1 - x0 : x0 - x1) + (y2 > y0 ? y2 - y0 : y0 - y2) * 2, x0 ^ (y0 << 16), x1 ^ (y1 << 16), x2 ^ (y2 << 16), color);
+        }
+        void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t color)
+        {
+            record((uint64_t)(x1 > x0 ? x1 - x0 : x0 - x1) * (y2 > y0 ? y2 - y0 : y0 - y2) / 2, x0 ^ (y0 << 16), x1 ^ (y1 << 16), x2 ^ (y2 << 16), color);
+        }
+
+        void setTextColor(uint16_t color) { record(0, color); }
+        void setFont(const uint8_t* font) { fontSize = font[0]; record(0, font[0]); }
+        void setCursor(int16_t x, int16_t y) { cursorX = x; cursorY = y; record(0, x, y); }
+        void print(char c) { char str[2] = {c, 0}; text(str); }
+        void print(const char* str) { text(str); }
+        void println(const char* str) { text(str); cursorX = 0; cursorY += fontSize + 2; }
+        void println(int value) { char str[12]; snprintf(str, sizeof(str), "%d", value); println(str); }
+        void getTextBounds(const char* str, int16_t x, int16_t y, int16_t* x1, int16_t* y1, uint16_t* w, uint16_t* h)
+        {
+            record(0, x, y);
+            *x1 = x;
+            *y1 = y - fontSize;
+            *w = strlen(str) * advance();
+            *h = fontSize;
+        }
+};
+
+class Arduino_ST7789 : public Arduino_GFX
+{
+    public:
+        Arduino_ST7789(Arduino_DataBus*, int8_t, uint8_t, bool, int16_t w, int16_t h, uint8_t, uint8_t, uint8_t, uint8_t)
+            : Arduino_GFX(w, h) {}
+};
+
+#endif /* FAKE_ARDUINO_GFX_LIBRARY_H */
@@ -0,0 +1,15 @@
+/**
+ * Header File with the U8g2 fonts G6DexcomMFD draws with, the fake GFX surface only looks at their address.
+ */
+
+#ifndef FAKE_U8G2LIB_H
+#define FAKE_U8G2LIB_H
+
+#include <stdint.h>
+
+static const uint8_t u8g2_font_helvB10_te[1] = {10};
+static const uint8_t u8g2_font_helvB14_te[1] = {14};
+static const uint8_t u8g2_font_helvR08_tr[1] = {8};
+static const uint8_t u8g2_font_inb21_mr[1] = {21};
+
+#endif /* FAKE_U8G2LIB_H */
@@ -0,0 +1 @@
+// Empty, the controller status call of G6DexcomEnergy is compiled out without CONFIG_BT_ENABLED.
@@ -0,0 +1 @@
+// Empty, the power management calls of G6DexcomEnergy are compiled out without CONFIG_PM_ENABLE.
@@ -0,0 +1,85 @@
+/*
+ * Host history check
+ *
+ * Fills a fresh history file with the readings of one transmitter, then swaps in a new transmitter whose clock starts
+ * over far below the old one, and checks that DexcomHistory::seek lands where the export, the server and the uploader
+ * expect it: in the only epoch before the swap, in the new transmitter's epoch after it, also once the history is
+ * set up again from the file. Exits with 1 on the first seek that is off:
+ *
+ *   flying-cgm-history [old readings] [new readings] > /dev/null
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../DexcomHistory.h"
+
+
+#define OLD_START       7000000
+#define NEW_START       7200
+#define INTERVAL_SEC    300
+
+static int failures = 0;
+
+static DexcomReading readingAt(uint32_t dextime, int i) { return { dextime, (uint16_t)(80 + i % 200), 0, 0x06 }; }
+
+/**
+ * Seeks past since and reads to the end, the first reading and the count have to match.
+ */
+static void check(const char* name, uint32_t since, uint32_t first, uint32_t count)
+{
+    DexcomHistoryCursor cursor;
+    DexcomReading reading;
+    uint32_t seen = 0, start = 0, last = 0;
+    if (DexcomHistory::seek(&cursor, since))
+    {
+        while (DexcomHistory::next(&cursor, &reading))
+        {
+            if (seen == 0) start = reading.dextime;
+            else if (reading.dextime <= last) break;
+            last = reading.dextime;
+            seen++;
+        }
+    }
+    bool ok = seen == count && (count == 0 || start == first);
+    fprintf(stderr, "%-4s %-36s since %8u: first %8u, %5u readings, expected %8u and %5u\n", ok ? "ok" : "FAIL", name, since,
+            start, seen, first, count);
+    if (!ok) failures++;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t oldCount = argc > 1 ? atoi(argv[1]) : 3000;
+    uint32_t newCount = argc > 2 ? atoi(argv[2]) : 50;
+
+    remove("flying-cgm-history.history");
+    setenv("FLYING_CGM_HISTORY", "flying-cgm-history.history", 1);
+    DexcomHistory::setup();
+
+    for (uint32_t i = 0; i < oldCount; i++)
+        DexcomHistory::append(readingAt(OLD_START + i * INTERVAL_SEC, i));
+    uint32_t oldEpoch = DexcomHistory::get_epoch();
+    check("one transmitter, all", 1, OLD_START, oldCount);
+    check("one transmitter, since middle", OLD_START + oldCount / 2 * INTERVAL_SEC, OLD_START + (oldCount / 2 + 1) * INTERVAL_SEC,
+          oldCount - oldCount / 2 - 1);
+    check("one transmitter, since newest", OLD_START + (oldCount - 1) * INTERVAL_SEC, 0, 0);
+
+    for (uint32_t i = 0; i < newCount; i++)
+        DexcomHistory::append(readingAt(NEW_START + i * INTERVAL_SEC, i));
+    if (DexcomHistory::get_epoch() == oldEpoch)
+    {
+        fprintf(stderr, "FAIL the swap did not start a new epoch\n");
+        failures++;
+    }
+    for (int pass = 0; pass < 2; pass++)
+    {
+        check(pass == 0 ? "swapped, all" : "set up again, all", 1, NEW_START, newCount);
+        check(pass == 0 ? "swapped, since second" : "set up again, since second", NEW_START + INTERVAL_SEC,
+              NEW_START + 2 * INTERVAL_SEC, newCount - 2);
+        check(pass == 0 ? "swapped, since the old newest" : "set up again, since the old newest",
+              OLD_START + (oldCount - 1) * INTERVAL_SEC, 0, 0);
+        DexcomHistory::setup();
+    }
+    fprintf(stderr, "%u stored readings, %d failed checks\n", DexcomHistory::count(), failures);
+    return failures == 0 ? 0 : 1;
+}
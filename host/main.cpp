@@ -0,0 +1,66 @@
+/*
+ * Host entry point
+ *
+ * Runs the same session flow as run() in Flying-CGM.ino as a Linux binary,
+ * against a transmitter bridge or emulator listening on a TCP port.
+ *
+ *   flying-cgm-host <host> <port> [transmitter id] [cycles] [interval seconds]
+ *
+ * FLYING_CGM_PAIRING_CODE selects a G7 / ONE+ with that pairing code.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "DexcomSocketTransport.h"
+#include "../DebugHelper.h"
+#include "../DexcomHistory.h"
+#include "../DexcomPlatform.h"
+#include "../G6DexcomClient.h"
+#include "../G6DexcomSession.h"
+
+
+static bool appendBackfill(const DexcomReading &reading, int) { DexcomHistory::append(reading); return true; }
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <host> <port> [transmitter id] [cycles] [interval seconds]\n", argv[0]);
+        return 2;
+    }
+    if (argc > 3 && !DexcomSession::setTransmitterID(argv[3]))
+    {
+        fprintf(stderr, "invalid transmitter id %s\n", argv[3]);
+        return 2;
+    }
+    const char* pairingCode = getenv("FLYING_CGM_PAIRING_CODE");
+    if (pairingCode != NULL && !DexcomSession::setPairingCode(pairingCode))
+    {
+        fprintf(stderr, "invalid pairing code %s\n", pairingCode);
+        return 2;
+    }
+    int cycles = argc > 4 ? atoi(argv[4]) : 1;
+    int interval = argc > 5 ? atoi(argv[5]) : 0;
+
+    static DexcomSocketTransport transport(argv[1], (uint16_t)atoi(argv[2]));
+    DexcomSession::setTransport(&transport);
+    DexcomHistory::setup();                                                                                             // Backfill is planned from the history file, like from the partition on the board.
+    DexcomClient::setBackfillSink(appendBackfill);
+
+    int failures = 0;
+    for (int cycle = 0; cycles <= 0 || cycle < cycles; cycle++)                                                        // 0 cycles runs until killed.
+    {
+        DexcomClient::restart();
+        DexcomSession::prepare();
+        uint32_t start = DexcomPlatform::millis();
+        bool readComplete = DexcomSession::run();
+        if (readComplete && !DexcomClient::backfillPending()) DexcomHistory::append(DexcomClient::get_lastReading());
+        if (!readComplete) failures++;
+        SerialPrintf(GLUCOSE, "Cycle %d: %s, glucose %d, %u ms\n", cycle, readComplete ? "ok" : "failed",
+                     DexcomClient::get_glucose(), DexcomPlatform::millis() - start);
+        if (interval > 0)
+            DexcomPlatform::delay(interval * 1000);
+    }
+    return failures == 0 ? 0 : 1;
+}
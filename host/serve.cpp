@@ -0,0 +1,257 @@
+/*
+ * Host server runner
+ *
+ * Runs DexcomServer on a local port with WebSocket clients on /live and HTTP pollers on /reading and /history,
+ * and publishes readings into it at a fixed interval like the history owner does after each session. Every live
+ * client checks the handshake, the order of the frames and that the last reading reaches it, and times each frame
+ * from the publish. The server log goes to stdout, the report to stderr:
+ *
+ *   flying-cgm-serve [readings] [interval ms] [live clients] [pollers] > /dev/null
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../DexcomHistory.h"
+#include "../DexcomPerf.h"
+#include "../DexcomPlatform.h"
+#include "../DexcomServer.h"
+
+
+#define WINDOW_SEC      300
+#define FIRST_DEXTIME   1000000
+#define WEBSOCKET_KEY   "dGhlIHNhbXBsZSBub25jZQ=="                                                                      // The sample key of RFC 6455 and its answer.
+#define WEBSOCKET_ACCEPT "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+static uint16_t port = 0;
+static int readings = 0;
+static std::atomic<bool> running(true);
+static std::atomic<bool> polling(true);
+static std::vector<uint64_t> publishedUs;                                                                               // Publish time per reading, 0 until published.
+static std::mutex resultLock;
+static std::vector<uint32_t> latenciesUs;
+static uint32_t framesReceived = 0, framesCoalesced = 0, orderErrors = 0, handshakeErrors = 0, clientsMissedLast = 0;
+static std::atomic<uint32_t> pollResponses(0), pollBytes(0), pollErrors(0), pollRefused(0);
+
+static int connectLocal()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) == 0)
+        return fd;
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static bool receiveAll(int fd, uint8_t* buffer, size_t length)
+{
+    for (size_t got = 0; got < length; )
+    {
+        ssize_t received = recv(fd, buffer + got, length - got, 0);
+        if (received <= 0)
+            return false;
+        got += received;
+    }
+    return true;
+}
+
+/**
+ * One WebSocket client for the whole run, frames are matched to their reading by the dextime in them.
+ */
+static void liveClient()
+{
+    int fd = connectLocal();
+    char request[256];
+    snprintf(request, sizeof(request), "GET /live HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+             "Sec-WebSocket-Key: " WEBSOCKET_KEY "\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    char response[512];
+    size_t filled = 0;
+    response[0] = 0;
+    if (fd >= 0 && send(fd, request, strlen(request), MSG_NOSIGNAL) <= 0)
+        filled = sizeof(response);
+    while (fd >= 0 && filled < sizeof(response) - 1 && strstr(response, "\r\n\r\n") == NULL)
+    {
+        ssize_t received = recv(fd, response + filled, 1, 0);                                                           // Byte by byte, a frame may follow right away.
+        if (received <= 0)
+            break;
+        filled += received;
+        response[filled] = 0;
+    }
+    if (fd < 0 || strncmp(response, "HTTP/1.1 101", 12) != 0 || strstr(response, "Sec-WebSocket-Accept: " WEBSOCKET_ACCEPT "\r\n") == NULL)
+    {
+        std::lock_guard<std::mutex> lock(resultLock);
+        handshakeErrors++;
+        clientsMissedLast++;
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    std::vector<uint32_t> latencies;
+    uint32_t frames = 0, coalesced = 0, disorder = 0;
+    long last = -1;
+    uint8_t frame[SERVER_FRAME_SIZE];
+    while (last < readings - 1)
+    {
+        if (!receiveAll(fd, frame, 2))
+            break;
+        size_t length = frame[1] & 0x7f;
+        if (length == 126)
+        {
+            if (!receiveAll(fd, frame + 2, 2))
+                break;
+            length = (frame[2] << 8) | frame[3];
+        }
+        if (frame[0] != 0x81 || length >= sizeof(frame) || !receiveAll(fd, frame, length))
+            break;
+        uint64_t now = DexcomPlatform::micros();
+        frame[length] = 0;
+        const char* dextime = strstr((const char*)frame, "\"dextime\":");
+        long index = dextime != NULL ? ((long)strtoul(dextime + 10, NULL, 10) - FIRST_DEXTIME) / WINDOW_SEC : -1;
+        if (index <= last || index >= readings)
+        {
+            disorder++;
+            continue;
+        }
+        coalesced += index - last - 1;
+        last = index;
+        frames++;
+        latencies.push_back((uint32_t)(now - publishedUs[index]));
+    }
+    uint8_t closeFrame[6] = { 0x88, 0x80, 0, 0, 0, 0 };                                                                // Masked and empty, as a browser closes.
+    send(fd, closeFrame, sizeof(closeFrame), MSG_NOSIGNAL);
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(resultLock);
+    latenciesUs.insert(latenciesUs.end(), latencies.begin(), latencies.end());
+    framesReceived += frames;
+    framesCoalesced += coalesced;
+    orderErrors += disorder;
+    if (last != readings - 1) clientsMissedLast++;
+}
+
+/**
+ * Polls /reading and /history one connection after the other, every response must be complete.
+ */
+static void poller(int id)
+{
+    static thread_local char response[SERVER_HISTORY_SIZE + 1];
+    for (uint32_t round = 0; polling.load(); round++)
+    {
+        int fd = connectLocal();
+        if (fd < 0)
+        {
+            pollRefused++;
+            continue;
+        }
+        const char* request = (round + id) % 4 == 0 ? "GET /history HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                                    : "GET /reading HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        send(fd, request, strlen(request), MSG_NOSIGNAL);
+        size_t filled = 0;
+        ssize_t received;
+        while (filled < sizeof(response) - 1 && (received = recv(fd, response + filled, sizeof(response) - 1 - filled, 0)) > 0)
+            filled += received;
+        close(fd);
+        response[filled] = 0;
+        if (filled == 0)
+        {
+            pollRefused++;                                                                                              // Closed at once, every client slot was taken.
+            continue;
+        }
+        const char* body = strstr(response, "\r\n\r\n");
+        const char* length = strstr(response, "Content-Length: ");
+        bool complete = body != NULL && length != NULL && strtoul(length + 16, NULL, 10) == (size_t)(response + filled - body - 4);
+        if (!complete || (strncmp(response, "HTTP/1.1 200", 12) != 0 && strncmp(response, "HTTP/1.1 503", 12) != 0))
+            pollErrors++;
+        pollResponses++;
+        pollBytes += filled;
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, int percent)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+int main(int argc, char** argv)
+{
+    readings = argc > 1 ? atoi(argv[1]) : 300;
+    int intervalMs = argc > 2 ? atoi(argv[2]) : 20;
+    int liveClients = argc > 3 ? atoi(argv[3]) : 4;
+    int pollerCount = argc > 4 ? atoi(argv[4]) : 3;
+
+    remove("flying-cgm-serve.history");
+    setenv("FLYING_CGM_HISTORY", "flying-cgm-serve.history", 1);
+    DexcomHistory::setup();
+    if (!DexcomServer::setup(0))
+        return 2;
+    port = DexcomServer::get_port();
+    publishedUs.assign(readings, 0);
+    std::thread server([] { while (running.load()) DexcomServer::service(50); });
+
+    std::vector<std::thread> clients;
+    for (int i = 0; i < liveClients; i++)
+        clients.emplace_back(liveClient);
+    std::vector<std::thread> pollers;
+    for (int i = 0; i < pollerCount; i++)
+        pollers.emplace_back(poller, i);
+    while (DexcomServer::clientCount() < liveClients)                                                                  // Live before the first reading, so none is missed.
+        usleep(1000);
+
+    uint64_t start = DexcomPlatform::micros();
+    int skipped = 0;
+    for (int i = 0; i < readings; i++)
+    {
+        DexcomReading reading = { FIRST_DEXTIME + (uint32_t)i * WINDOW_SEC, (uint16_t)(100 + (i * 7) % 150), (int8_t)(i % 40 - 20), 0x06 };
+        DexcomHistory::append(reading);
+        publishedUs[i] = DexcomPlatform::micros();
+        while (!DexcomServer::publish(reading, reading.dextime + 2))                                                   // The last reading must go out, the others may be skipped.
+        {
+            if (i < readings - 1) { skipped++; break; }
+            usleep(1000);
+        }
+        usleep(intervalMs * 1000);
+    }
+    for (std::thread &client : clients)
+        client.join();
+    double seconds = (DexcomPlatform::micros() - start) / 1e6;
+    polling.store(false);                                                                                               // The server keeps serving until the last poll is answered.
+    for (std::thread &poll : pollers)
+        poll.join();
+    running.store(false);
+    server.join();
+
+    std::sort(latenciesUs.begin(), latenciesUs.end());
+    const DexcomServerStats &stats = DexcomServer::get_stats();
+    fprintf(stderr, "readings %d every %d ms, %d live clients, %d pollers, %.2f s\n", readings, intervalMs, liveClients, pollerCount, seconds);
+    fprintf(stderr, "server - %u accepted, %u rejected, %u responses, %u pushes, %u dropped, %u snapshots, %u skipped\n",
+            stats.accepted, stats.rejected, stats.responses, stats.pushes, stats.dropped, stats.snapshots, stats.skipped);
+    fprintf(stderr, "pollers - %u responses, %.0f per second, %.0f bytes per response, %u incomplete, %u refused\n",
+            pollResponses.load(), pollResponses.load() / seconds, pollResponses.load() ? (double)pollBytes.load() / pollResponses.load() : 0.0,
+            pollErrors.load(), pollRefused.load());
+    fprintf(stderr, "live - %u frames, %u coalesced, %u out of order, %u bad handshakes, %u clients missed the last reading\n",
+            framesReceived, framesCoalesced, orderErrors, handshakeErrors, clientsMissedLast);
+    fprintf(stderr, "push latency us - p50 %u, p90 %u, p99 %u, max %u\n", percentile(latenciesUs, 50), percentile(latenciesUs, 90),
+            percentile(latenciesUs, 99), latenciesUs.empty() ? 0 : latenciesUs.back());
+
+    char line[96];
+    fprintf(stderr, "%-16s %8s %10s %10s %10s %12s\n", "phase", "count", "avg_us", "max_us", "last_us", "avg_cycles");
+    for (int i = PERF_SERVER_SNAPSHOT; i <= PERF_SERVER_PUSH; i++)
+    {
+        DexcomPerf::format((DexcomPerfCounter)i, line, sizeof(line));
+        fputs(line, stderr);
+    }
+    return clientsMissedLast == 0 && orderErrors == 0 && pollErrors.load() == 0 && skipped == 0 ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/*
+ * Host soak runner
+ *
+ * Drives DexcomSession::run against the in-process transmitter emulator as fast as it answers,
+ * and reports hung cycles, heap growth and the slow tail of the cycle time.
+ * After the warm up cycles no operator new call is allowed, any one fails the run.
+ * A backfill decision that costs more bytes or time than the fixed window the legacy rule asked for fails it too.
+ * Set FLYING_CGM_ALLOC_ABORT to abort at the first one, so a debugger or core dump shows who allocated.
+ * Readings and backfilled readings go to a fresh history file like on the board, so backfill is only asked for after a gap.
+ * FLYING_CGM_PAIRING_CODE makes both sides a G7 / ONE+, every cycle then runs the EC J-PAKE handshake.
+ * The session log goes to stdout, the report to stderr:
+ *
+ *   flying-cgm-soak [cycles] [latency ms] [jitter ms] [loss permille] [disconnect permille] [hang seconds] > /dev/null
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "DexcomEmulator.h"
+#include "../DexcomHistory.h"
+#include "../DexcomPerf.h"
+#include "../DexcomPlatform.h"
+#include "../G6DexcomClient.h"
+#include "../G6DexcomSession.h"
+
+
+#define WARMUP_CYCLES   16
+
+static std::atomic<uint32_t> cycleStart(0);                                                                            // Platform millis of the running cycle, 0 between cycles.
+static std::atomic<int> cycleNumber(0);
+static std::atomic<uint64_t> steadyAllocations(0);                                                                      // operator new calls after the warm up.
+static std::atomic<bool> steadyState(false);
+static bool abortOnAllocation = false;
+
+void* operator new(size_t size)
+{
+    if (steadyState.load(std::memory_order_relaxed))
+    {
+        steadyAllocations++;
+        if (abortOnAllocation)
+        {
+            fprintf(stderr, "ALLOCATION - %zu bytes in cycle %d\n", size, cycleNumber.load());
+            abort();
+        }
+    }
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+/**
+ * A cycle that does not finish within the hang limit aborts the process, so a debugger or core dump shows where it is stuck.
+ */
+static void watchdog(uint32_t hangMs)
+{
+    for (;;)
+    {
+        DexcomPlatform::delay(100);
+        uint32_t start = cycleStart.load();
+        if (start != 0 && (int32_t)(DexcomPlatform::millis() - start) > (int32_t)hangMs)
+        {
+            fprintf(stderr, "HANG - cycle %d has been running for %u ms\n", cycleNumber.load(), DexcomPlatform::millis() - start);
+            abort();
+        }
+    }
+}
+
+static bool appendBackfill(const DexcomReading &reading, int) { DexcomHistory::append(reading); return true; }
+
+static size_t heapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks;
+}
+
+int main(int argc, char** argv)
+{
+    int cycles = argc > 1 ? atoi(argv[1]) : 1000;
+    DexcomEmulatorConfig config = {};
+    config.latencyMs = argc > 2 ? atoi(argv[2]) : 0;
+    config.jitterMs = argc > 3 ? atoi(argv[3]) : 0;
+    config.lossPermille = argc > 4 ? atoi(argv[4]) : 0;
+    config.disconnectPermille = argc > 5 ? atoi(argv[5]) : 0;
+    uint32_t hangMs = (argc > 6 ? atoi(argv[6]) : 30) * 1000;
+    config.supervisionMs = 50;                                                                                          // Scaled down from the transmitter's seconds so lost packets do not dominate the run.
+    config.requestBond = true;
+    config.sessionState = 0x06;
+    config.seed = 0x6D5A;
+    config.pairingCode = getenv("FLYING_CGM_PAIRING_CODE");
+    if (config.pairingCode != NULL && !DexcomSession::setPairingCode(config.pairingCode))
+    {
+        fprintf(stderr, "pairing code must be 4 digits\n");
+        return 2;
+    }
+    abortOnAllocation = getenv("FLYING_CGM_ALLOC_ABORT") != NULL;
+
+    if (getenv("FLYING_CGM_HISTORY") == NULL)
+    {
+        remove("flying-cgm-soak.history");                                                                             // Every run starts like a board after a power loss.
+        setenv("FLYING_CGM_HISTORY", "flying-cgm-soak.history", 1);
+    }
+    DexcomHistory::setup();
+    DexcomClient::setBackfillSink(appendBackfill);
+
+    static DexcomEmulator emulator(DexcomSession::getTransmitterID(), config);
+    DexcomSession::setTransport(&emulator);
+    std::thread(watchdog, hangMs).detach();
+
+    std::vector<uint32_t> durations;
+    durations.reserve(cycles);
+    int failures = 0, slowest = 0, negativeSavings = 0;
+    uint32_t backfillSessions = 0;
+    size_t heapStart = 0;
+    uint32_t runStart = DexcomPlatform::millis();
+
+    for (int cycle = 0; cycle < cycles; cycle++)
+    {
+        emulator.advance();
+        cycleNumber = cycle;
+        DexcomClient::restart();
+        DexcomSession::prepare();                                                                                       // Before the scan on the board, not part of the cycle.
+        uint64_t start = DexcomPlatform::micros();
+        cycleStart = DexcomPlatform::millis() | 1;
+        bool readComplete = DexcomSession::run();
+        cycleStart = 0;
+        uint32_t duration = (uint32_t)(DexcomPlatform::micros() - start);
+
+        if (readComplete && !DexcomClient::backfillPending()) DexcomHistory::append(DexcomClient::get_lastReading());
+        if (!readComplete) failures++;
+        if (DexcomClient::get_backfillTotal().sessions != backfillSessions)                                             // A session that got to the backfill decision.
+        {
+            backfillSessions = DexcomClient::get_backfillTotal().sessions;
+            const DexcomBackfillStats &session = DexcomClient::get_backfillSession();
+            if (session.bytesSaved < 0 || session.msSaved < 0) negativeSavings++;
+        }
+        DexcomPerf::heapSample();
+        if (cycle == WARMUP_CYCLES)                                                                                     // Static buffers and the initial backfill are set up by now.
+        {
+            heapStart = heapInUse();
+            steadyState = true;
+        }
+        if (durations.empty() || duration > durations[slowest]) slowest = cycle;
+        durations.push_back(duration);
+    }
+
+    steadyState = false;
+    uint32_t runMs = DexcomPlatform::millis() - runStart;
+    size_t count = durations.size();
+    long heapGrowth = count > WARMUP_CYCLES ? (long)heapInUse() - (long)heapStart : 0;
+    std::sort(durations.begin(), durations.end());
+
+    fprintf(stderr, "cycles %zu, failures %d, sessions %u, dropped packets %u, link drops %u\n",
+            count, failures, emulator.sessions, emulator.dropped, emulator.disconnects);
+    if (count > 0)
+        fprintf(stderr, "cycle us - p50 %u, p90 %u, p99 %u, max %u (cycle %d)\n",
+                durations[count / 2], durations[count * 9 / 10], durations[count * 99 / 100], durations[count - 1], slowest);
+    fprintf(stderr, "rate %.0f cycles / minute, heap growth %ld bytes, steady state allocations %llu\n",
+            runMs ? count * 60000.0 / runMs : 0.0, heapGrowth, (unsigned long long)steadyAllocations.load());
+
+    const DexcomBackfillStats &backfill = DexcomClient::get_backfillTotal();
+    fprintf(stderr, "backfill - %u requests in %u sessions, %u records, %u bytes, %u cold starts with %u bytes, saved %d bytes and %d ms, %d sessions cost more than the fixed window, history %u readings\n",
+            backfill.requests, backfill.sessions, backfill.records, backfill.bytes, backfill.coldStarts, backfill.coldStartBytes,
+            backfill.bytesSaved, backfill.msSaved, negativeSavings, DexcomHistory::count());
+
+    char line[96];
+    DexcomPerf::formatHeap(line, sizeof(line));
+    fputs(line, stderr);
+    fprintf(stderr, "%-16s %8s %10s %10s %10s %12s\n", "phase", "count", "avg_us", "max_us", "last_us", "avg_cycles");
+    for (int i = PERF_RUN; i < PERF_COUNTERS; i++)
+    {
+        if (i > PERF_SESSION_FAIL && (i < PERF_AUTH_PREPARE || DexcomPerf::get((DexcomPerfCounter)i)->count == 0))
+            continue;
+        DexcomPerf::format((DexcomPerfCounter)i, line, sizeof(line));
+        fputs(line, stderr);
+    }
+    return failures == 0 && heapGrowth <= 0 && steadyAllocations == 0 && negativeSavings == 0 ? 0 : 1;
+}
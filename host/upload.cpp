@@ -0,0 +1,258 @@
+/*
+ * Host upload runner
+ *
+ * Plays transmitter windows against a stand-in Nightscout server on a local port: every window stores one reading
+ * and runs a DexcomUploader burst like the board does after the session. A range of windows has no network and the
+ * server answers a share of the requests with 503, so the offline queue, the backoff and the catch up batches run.
+ * The server checks the api-secret, counts connections, requests and entries and looks for lost or doubled readings.
+ * From the swap window on a new transmitter's clock starts over at 2 hours, its readings have to reach the server too.
+ * The uploader log goes to stdout, the report to stderr:
+ *
+ *   flying-cgm-upload [windows] [outage start] [outage windows] [error permille] [join ms] [swap window] > /dev/null
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DexcomSocketUplink.h"
+#include "../DexcomHistory.h"
+#include "../DexcomPerf.h"
+#include "../DexcomPlatform.h"
+#include "../DexcomUploader.h"
+
+
+#define WINDOW_SEC      300
+#define FIRST_START     1000000                                                                                         // Clock of the first transmitter in window 0.
+#define SWAP_START      7200                                                                                            // Clock of the new transmitter in the swap window.
+#define DRAIN_WINDOWS   64                                                                                              // Windows without new readings to empty the queue at the end.
+#define API_SECRET      "flying-cgm-secret"
+#define API_SECRET_SHA1 "b19a1057443816fcd9ee2f0e4bd522d91231d75b"
+
+static std::mutex serverLock;
+static std::vector<int> received;                                                                                       // Entries per window slot.
+static uint32_t serverRequests = 0, serverErrors = 0, serverEntries = 0, serverRejected = 0;
+static uint32_t errorPermille = 0;
+static uint32_t firstEpoch = 0;                                                                                         // Wall clock of window 0.
+static uint32_t seed = 0x2545F491;
+static int swapWindow = -1;
+
+static uint32_t next()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint16_t glucoseOf(int window) { return (uint16_t)(100 + (window * 7) % 150); }
+
+/**
+ * Clock at the start of window of the transmitter that is on in transmitterWindow, the clocks run with the windows.
+ */
+static uint32_t clockAt(int transmitterWindow, int window)
+{
+    if (swapWindow >= 0 && transmitterWindow >= swapWindow)
+        return SWAP_START + (uint32_t)(window - swapWindow) * WINDOW_SEC;
+    return FIRST_START + (uint32_t)window * WINDOW_SEC;
+}
+
+/**
+ * Files each entry under the window its date falls into, checks the value.
+ */
+static void account(const char* body)
+{
+    for (const char* entry = strstr(body, "\"date\":"); entry != NULL; entry = strstr(entry + 1, "\"date\":"))
+    {
+        unsigned long long date = strtoull(entry + 7, NULL, 10);
+        const char* sgv = strstr(entry, "\"sgv\":");
+        long slot = ((long)(date / 1000) - (long)firstEpoch + WINDOW_SEC / 2) / WINDOW_SEC;
+        serverEntries++;
+        if (sgv == NULL || slot < 0 || slot >= (long)received.size() || atoi(sgv + 6) != glucoseOf((int)slot))
+            serverRejected++;
+        else
+            received[slot]++;
+    }
+}
+
+/**
+ * One kept alive connection: requests until the client closes, some answered with 503.
+ */
+static void serve(int fd)
+{
+    static thread_local char buffer[16384];
+    size_t filled = 0;
+    for (;;)
+    {
+        char* headersEnd = NULL;
+        while ((headersEnd = (char*)memmem(buffer, filled, "\r\n\r\n", 4)) == NULL)
+        {
+            ssize_t got = filled < sizeof(buffer) - 1 ? recv(fd, buffer + filled, sizeof(buffer) - 1 - filled, 0) : 0;
+            if (got <= 0)
+            {
+                close(fd);
+                return;
+            }
+            filled += got;
+        }
+        *headersEnd = 0;
+        const char* length = strcasestr(buffer, "\r\nContent-Length:");
+        const char* secret = strcasestr(buffer, "\r\napi-secret:");
+        size_t bodyLength = length != NULL ? strtoul(length + 17, NULL, 10) : 0;
+        size_t headerLength = headersEnd + 4 - buffer;
+        bool authorized = secret != NULL && strncmp(secret + 13 + strspn(secret + 13, " "), API_SECRET_SHA1, 40) == 0;
+        while (filled < headerLength + bodyLength)
+        {
+            ssize_t got = filled < sizeof(buffer) - 1 ? recv(fd, buffer + filled, sizeof(buffer) - 1 - filled, 0) : 0;
+            if (got <= 0)
+            {
+                close(fd);
+                return;
+            }
+            filled += got;
+        }
+        char saved = buffer[headerLength + bodyLength];
+        buffer[headerLength + bodyLength] = 0;
+
+        const char* answer;
+        {
+            std::lock_guard<std::mutex> lock(serverLock);
+            serverRequests++;
+            if (!authorized)
+                answer = "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n";
+            else if (next() % 1000 < errorPermille)
+            {
+                serverErrors++;
+                answer = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            }
+            else
+            {
+                account(buffer + headerLength);
+                answer = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 2\r\n\r\n[]";
+            }
+        }
+        buffer[headerLength + bodyLength] = saved;
+        send(fd, answer, strlen(answer), MSG_NOSIGNAL);
+        if (strstr(answer, "close") != NULL)
+        {
+            close(fd);
+            return;
+        }
+        memmove(buffer, buffer + headerLength + bodyLength, filled - headerLength - bodyLength);
+        filled -= headerLength + bodyLength;
+    }
+}
+
+static int listenLocal(uint16_t* port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 4) != 0 ||
+        getsockname(fd, (sockaddr*)&address, &size) != 0)
+        return -1;
+    *port = ntohs(address.sin_port);
+    return fd;
+}
+
+static void acceptLoop(int listenFd)
+{
+    for (;;)
+    {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd >= 0)
+            std::thread(serve, fd).detach();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int windows = argc > 1 ? atoi(argv[1]) : 288;
+    int outageStart = argc > 2 ? atoi(argv[2]) : 100;
+    int outageWindows = argc > 3 ? atoi(argv[3]) : 24;
+    errorPermille = argc > 4 ? atoi(argv[4]) : 20;
+    uint32_t joinMs = argc > 5 ? atoi(argv[5]) : 0;
+    swapWindow = argc > 6 ? atoi(argv[6]) : -1;
+
+    remove("flying-cgm-upload.history");                                                                               // Fresh queue and history every run.
+    remove("flying-cgm-upload.nvs");
+    setenv("FLYING_CGM_HISTORY", "flying-cgm-upload.history", 1);
+    setenv("FLYING_CGM_STORAGE", "flying-cgm-upload.nvs", 1);
+    DexcomHistory::setup();
+
+    uint16_t port = 0;
+    int listenFd = listenLocal(&port);
+    if (listenFd < 0)
+    {
+        fprintf(stderr, "could not listen on a local port\n");
+        return 2;
+    }
+    std::thread(acceptLoop, listenFd).detach();
+    static DexcomSocketUplink uplink("127.0.0.1", port, joinMs);
+    DexcomUploader::setup(&uplink, "127.0.0.1", API_SECRET);
+
+    // The windows lie in the past of the wall clock, so the transmitter clock can run in real time and
+    // each reading is dated the same in every burst that carries it.
+    uint32_t runEpoch = DexcomPlatform::epochSeconds();
+    firstEpoch = runEpoch - (uint32_t)(windows + DRAIN_WINDOWS) * WINDOW_SEC;
+    received.assign(windows, 0);
+    int stagedBursts = 0;
+    uint32_t burstMaxMs = 0;
+
+    for (int window = 0; window < windows + DRAIN_WINDOWS; window++)
+    {
+        if (window < windows)
+        {
+            DexcomReading reading = { clockAt(window, window), glucoseOf(window), (int8_t)(window % 40 - 20), 0x06 };
+            DexcomHistory::append(reading);
+        }
+        else if (DexcomUploader::get_sentDextime() >= clockAt(windows - 1, windows - 1))
+            break;
+        uplink.setReachable(window < outageStart || window >= outageStart + outageWindows);
+        uint32_t transmitterNow = clockAt(window, windows + DRAIN_WINDOWS) + (DexcomPlatform::epochSeconds() - runEpoch);
+        if (DexcomUploader::stage(transmitterNow) == 0)
+            continue;
+        uint32_t radioMs = DexcomUploader::get_stats().radioMs;
+        DexcomUploader::upload();
+        stagedBursts++;
+        if (DexcomUploader::get_stats().radioMs - radioMs > burstMaxMs) burstMaxMs = DexcomUploader::get_stats().radioMs - radioMs;
+    }
+
+    std::lock_guard<std::mutex> lock(serverLock);
+    int missing = 0, doubled = 0;
+    for (int count : received)
+    {
+        if (count == 0) missing++;
+        if (count > 1) doubled += count - 1;
+    }
+    const DexcomUploadStats &stats = DexcomUploader::get_stats();
+    fprintf(stderr, "windows %d, outage %d-%d, error permille %u, join ms %u, swap %d\n",
+            windows, outageStart, outageStart + outageWindows - 1, errorPermille, joinMs, swapWindow);
+    fprintf(stderr, "server - %u requests on %u connections, %u answered 503, %u entries, %u rejected\n",
+            serverRequests, uplink.connections, serverErrors, serverEntries, serverRejected);
+    fprintf(stderr, "readings - %d stored, %d missing, %d sent again\n", windows, missing, doubled);
+    fprintf(stderr, "uploader - %u bursts, %u failed, %u requests, %.3f requests per reading, %u bytes, %.0f bytes per reading\n",
+            stats.bursts, stats.failures, stats.requests, stats.readings ? (double)stats.requests / stats.readings : 0.0,
+            stats.bytes, stats.readings ? (double)stats.bytes / stats.readings : 0.0);
+    fprintf(stderr, "radio - %u ms on, %.1f ms per burst, max %u ms, %.1f ms per reading\n",
+            stats.radioMs, stagedBursts ? (double)stats.radioMs / stagedBursts : 0.0, burstMaxMs,
+            windows ? (double)stats.radioMs / windows : 0.0);
+
+    char line[96];
+    fprintf(stderr, "%-16s %8s %10s %10s %10s %12s\n", "phase", "count", "avg_us", "max_us", "last_us", "avg_cycles");
+    for (int i = PERF_UPLOAD_RADIO; i <= PERF_UPLOAD_POST; i++)
+    {
+        DexcomPerf::format((DexcomPerfCounter)i, line, sizeof(line));
+        fputs(line, stderr);
+    }
+    return missing == 0 && serverRejected == 0 ? 0 : 1;
+}